@@ -0,0 +1,216 @@
+#define TFLAC_IMPLEMENTATION
+#define TFLAC_MT_IMPLEMENTATION
+#include "tflac_mt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+/* headerless wav can be created via ffmpeg like:
+ *     ffmpeg -i your-audio.mp3 -ar 44100 -ac 2 -f s16le your-audio.raw
+ */
+
+#define FRAME_SIZE   1152
+#define SAMPLERATE  44100
+#define BITDEPTH       16
+#define CHANNELS        2
+
+/* how many frames each thread gets per run */
+#define RUN_FRAMES     32
+
+/* example that reads in a headerless WAV file and writes out a FLAC
+ * file, encoding frames on a pool of threads. assumes WAV has the
+ * defined parameters above */
+
+static tflac_u16 unpack_u16le(const tflac_u8* d) {
+    return (tflac_u16)((((tflac_u16)d[0])    ) |
+                       (((tflac_u16)d[1])<< 8));
+}
+
+static tflac_s16 unpack_s16le(const tflac_u8* d) {
+    return (tflac_s16)unpack_u16le(d);
+}
+
+static void
+repack_samples(tflac_s16 *s, tflac_u32 channels, tflac_u32 num) {
+    tflac_u32 i = 0;
+    while(i < (channels*num)) {
+        s[i] = unpack_s16le( (tflac_u8*) (&s[i]) );
+        i++;
+    }
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1000000000.0);
+}
+
+static void setup(tflac_mt* m, tflac_u32 threads, void** mem) {
+    tflac_u32 mem_len = tflac_mt_size_memory(threads, FRAME_SIZE);
+
+    tflac_mt_init(m);
+    m->t.samplerate = SAMPLERATE;
+    m->t.channels = CHANNELS;
+    m->t.bitdepth = BITDEPTH;
+    m->t.blocksize = FRAME_SIZE;
+    m->t.max_partition_order = 3;
+    m->t.enable_md5 = 1;
+    m->threads = threads;
+
+    *mem = malloc(mem_len);
+    if(*mem == NULL) abort();
+
+    if(tflac_mt_validate(m, *mem, mem_len) != 0) abort();
+}
+
+/* encodes a whole in-memory file, returns the number of bytes written */
+static size_t encode_all(tflac_mt* m, tflac_s16* samples, tflac_u32 total, tflac_u8* buffer, tflac_u32 bufferlen, FILE* output) {
+    tflac_u32 pos = 0;
+    tflac_u32 run = m->threads * RUN_FRAMES * FRAME_SIZE;
+    tflac_u32 used = 0;
+    size_t bytes = 0;
+
+    while(pos < total) {
+        if(run > total - pos) run = total - pos;
+        if(tflac_mt_encode_s16i(m, run, &samples[pos * CHANNELS], buffer, bufferlen, &used) != 0) abort();
+        if(output != NULL) fwrite(buffer,1,used,output);
+        bytes += used;
+        pos += run;
+    }
+
+    tflac_mt_finalize(m);
+    return bytes;
+}
+
+/* reads the whole input into memory */
+static tflac_s16* read_all(FILE* input, tflac_u32* total) {
+    tflac_s16* samples = NULL;
+    size_t len = 0;
+    size_t cap = 0;
+    size_t r;
+
+    for(;;) {
+        if(len == cap) {
+            cap = cap ? cap * 2 : (size_t)FRAME_SIZE * 1024;
+            samples = (tflac_s16*)realloc(samples, sizeof(tflac_s16) * CHANNELS * cap);
+            if(samples == NULL) abort();
+        }
+        r = fread(&samples[len * CHANNELS], sizeof(tflac_s16) * CHANNELS, cap - len, input);
+        if(r == 0) break;
+        len += r;
+    }
+
+    repack_samples(samples, CHANNELS, (tflac_u32)len);
+    *total = (tflac_u32)len;
+    return samples;
+}
+
+int main(int argc, const char *argv[]) {
+    FILE *input = NULL;
+    FILE *output = NULL;
+    tflac_s16 *samples = NULL;
+    tflac_u8 *buffer = NULL;
+    tflac_u32 bufferlen = 0;
+    tflac_u32 bufferused = 0;
+    tflac_u32 total = 0;
+    tflac_u32 threads = 4;
+    tflac_u32 bench = 0;
+    tflac_u32 i = 0;
+    void *mem = NULL;
+    double start = 0.0;
+    double elapsed = 0.0;
+    double single = 0.0;
+    double raw_mb = 0.0;
+    size_t bytes = 0;
+    tflac_mt m;
+    int argi = 1;
+
+    while(argi < argc && argv[argi][0] == '-' && argv[argi][1] != '\0') {
+        if(strcmp(argv[argi],"-b") == 0) {
+            bench = 1;
+        } else if(strcmp(argv[argi],"-t") == 0 && argi + 1 < argc) {
+            threads = (tflac_u32)strtoul(argv[++argi], NULL, 10);
+        } else {
+            break;
+        }
+        argi++;
+    }
+
+    if(argc - argi < 2 || threads == 0) {
+        printf("Usage: %s [-t threads] [-b] /path/to/raw /path/to/flac\n",argv[0]);
+        return 1;
+    }
+
+    tflac_detect_cpu();
+
+    if(strcmp(argv[argi],"-") == 0) {
+        input = stdin;
+    } else {
+        input = fopen(argv[argi],"rb");
+    }
+
+    if(input == NULL) return 1;
+
+    samples = read_all(input, &total);
+    if(input != stdin) fclose(input);
+
+    bufferlen = tflac_mt_size_buffer(threads * RUN_FRAMES * FRAME_SIZE, FRAME_SIZE, CHANNELS, BITDEPTH);
+    if(bufferlen < TFLAC_SIZE_STREAMINFO) bufferlen = TFLAC_SIZE_STREAMINFO;
+    buffer = malloc(bufferlen);
+    if(buffer == NULL) abort();
+
+    raw_mb = ((double)total * CHANNELS * sizeof(tflac_s16)) / (1024.0 * 1024.0);
+
+    if(bench) {
+        /* encode everything with 1 thread, then double the threads until we
+         * hit the requested count, to see how well things scale */
+        printf("threads  seconds      MB/s  speedup\n");
+        for(i=1;;i *= 2) {
+            if(i > threads) i = threads;
+
+            setup(&m, i, &mem);
+            start = now();
+            encode_all(&m, samples, total, buffer, bufferlen, NULL);
+            elapsed = now() - start;
+            tflac_mt_destroy(&m);
+            free(mem);
+
+            if(i == 1) single = elapsed;
+            printf("%7u  %7.3f  %8.2f  %6.2fx\n", i, elapsed, raw_mb / elapsed, single / elapsed);
+
+            if(i == threads) break;
+        }
+    }
+
+    output = fopen(argv[argi+1],"wb");
+    if(output == NULL) return 1;
+
+    setup(&m, threads, &mem);
+
+    fwrite("fLaC",1,4,output);
+
+    /* we'll write out an empty STREAMINFO block and overwrite later to get MD5 checksum
+     * and sample count */
+    tflac_encode_streaminfo(&m.t, 1, buffer, bufferlen, &bufferused);
+    fwrite(buffer,1,bufferused,output);
+
+    bytes = encode_all(&m, samples, total, buffer, bufferlen, output);
+
+    /* now we overwrite our original STREAMINFO with an updated one */
+    fseek(output,4,SEEK_SET);
+    tflac_encode_streaminfo(&m.t, 1, buffer, bufferlen, &bufferused);
+    fwrite(buffer,1,bufferused,output);
+    fclose(output);
+
+    printf("encoded %u frames, %lu bytes\n", m.t.frameno, (unsigned long)bytes);
+
+    tflac_mt_destroy(&m);
+    free(mem);
+    free(buffer);
+    free(samples);
+
+    return 0;
+}
@@ -0,0 +1,69 @@
+/* encodes the same audio with TFlac and TFlacPool, reports how long
+ * each took and checks they produced the exact same file. */
+const BLOCK_SIZE = 4096;
+const CHANNELS = 2;
+const BITDEPTH = 16;
+const SAMPLE_RATE = 44100;
+
+const LENGTH = 300; // in seconds
+
+import { readFile } from 'node:fs/promises';
+import { availableParallelism } from 'node:os';
+import { TFlac } from './tflac.mjs';
+import { TFlacPool } from './tflac-pool.mjs';
+
+const THREADS = availableParallelism();
+
+await TFlac.load(await readFile('tflac.wasm'), await readFile('tflac-simd.wasm'));
+await TFlacPool.load(await readFile('tflac-threads.wasm'), await readFile('tflac-threads-simd.wasm'));
+
+/* same signal as bench.mjs */
+const total = SAMPLE_RATE * LENGTH;
+const audio = new Int32Array(total * CHANNELS);
+let seed = 12345;
+for(let i = 0; i < total; i++) {
+    for(let j = 0; j < CHANNELS; j++) {
+        seed = (Math.imul(seed, 1103515245) + 12345) >>> 0;
+        const noise = ((seed >>> 8) & 0xFFFF) / 0x8000 - 1;
+        const v =
+          0.4 * Math.sin(i * (0.03 + j * 0.011)) +
+          0.3 * Math.sin(i * 0.0041 + j) +
+          0.01 * noise;
+        audio[(i * CHANNELS) + j] = Math.round(v * 0x7FFF);
+    }
+}
+
+const step = BLOCK_SIZE * CHANNELS;
+
+let start = performance.now();
+const tflac = new TFlac(BLOCK_SIZE, CHANNELS, BITDEPTH, SAMPLE_RATE);
+for(let i = 0; i < audio.length; i += step) {
+    const block = audio.subarray(i, i + step);
+    tflac.encode_s32i(block.length / CHANNELS, block);
+}
+tflac.finalize();
+const single = performance.now() - start;
+
+/* don't count starting the workers */
+const pool = await TFlacPool.create(BLOCK_SIZE, CHANNELS, BITDEPTH, SAMPLE_RATE, THREADS);
+start = performance.now();
+for(let i = 0; i < audio.length; i += step) {
+    const block = audio.subarray(i, i + step);
+    await pool.encode_s32i(block.length / CHANNELS, block);
+}
+await pool.finalize();
+const pooled = performance.now() - start;
+pool.destroy();
+
+console.log(`simd128  ${TFlac.simd ? 'yes' : 'no'}`);
+console.log(`single   ${single.toFixed(1).padStart(8)} ms`);
+console.log(`pool     ${pooled.toFixed(1).padStart(8)} ms (${THREADS} threads)`);
+console.log(`speedup  ${(single / pooled).toFixed(2)}x`);
+
+const a = Buffer.concat(tflac.chunks);
+const b = Buffer.concat(pool.chunks);
+if(!a.equals(b)) {
+    console.log('outputs differ!');
+    process.exit(1);
+}
+console.log('outputs match');
@@ -0,0 +1,106 @@
+/* encodes the same audio with tflac.wasm and tflac-simd.wasm,
+ * reports how long each took and checks they produced the
+ * exact same file. Then encodes it again as 16-bit and float
+ * samples with both and checks those match too. */
+const BLOCK_SIZE = 4096;
+const CHANNELS = 2;
+const BITDEPTH = 16;
+const SAMPLE_RATE = 44100;
+
+const LENGTH = 60; // in seconds
+const RUNS = 5;    // we report the best run
+
+import { readFile } from 'node:fs/promises';
+import { TFlac } from './tflac.mjs';
+
+if(!TFlac.simd_supported()) {
+    console.log('this runtime does not support WASM SIMD128');
+    process.exit(1);
+}
+
+/* we load each module ourselves and hand it to the constructor */
+const scalar = await WebAssembly.instantiate(await readFile('tflac.wasm'));
+const simd = await WebAssembly.instantiate(await readFile('tflac-simd.wasm'));
+
+/* a couple of tones plus a little noise so the predictors
+ * and rice coder have some real work to do */
+const total = SAMPLE_RATE * LENGTH;
+const audio = new Int32Array(total * CHANNELS);
+let seed = 12345;
+for(let i = 0; i < total; i++) {
+    for(let j = 0; j < CHANNELS; j++) {
+        seed = (Math.imul(seed, 1103515245) + 12345) >>> 0;
+        const noise = ((seed >>> 8) & 0xFFFF) / 0x8000 - 1;
+        const v =
+          0.4 * Math.sin(i * (0.03 + j * 0.011)) +
+          0.3 * Math.sin(i * 0.0041 + j) +
+          0.01 * noise;
+        audio[(i * CHANNELS) + j] = Math.round(v * 0x7FFF);
+    }
+}
+
+/* the same audio as 16-bit and float samples, these should encode
+ * to the exact same file (16-bit values come back out of float exactly) */
+const audio_s16 = Int16Array.from(audio);
+const audio_f32 = Float32Array.from(audio, (v) => v / 32768);
+const planes_f32 = [];
+for(let j = 0; j < CHANNELS; j++) {
+    planes_f32.push(Float32Array.from({ length: total }, (_, i) => audio_f32[(i * CHANNELS) + j]));
+}
+
+function encode(module, format = 's32i') {
+    const tflac = new TFlac(BLOCK_SIZE, CHANNELS, BITDEPTH, SAMPLE_RATE, module);
+    const step = BLOCK_SIZE * CHANNELS;
+
+    for(let i = 0; i < audio.length; i += step) {
+        const len = Math.min(step, audio.length - i) / CHANNELS;
+        switch(format) {
+            case 's16i': tflac.encode_s16i(len, audio_s16.subarray(i, i + step)); break;
+            case 'f32i': tflac.encode_f32i(len, audio_f32.subarray(i, i + step)); break;
+            case 'f32p': tflac.encode_f32p(len, planes_f32.map((p) => p.subarray(i / CHANNELS))); break;
+            default: tflac.encode_s32i(len, audio.subarray(i, i + step)); break;
+        }
+    }
+    tflac.finalize();
+
+    return Buffer.concat(tflac.chunks);
+}
+
+function bench(module) {
+    let best = Infinity;
+    let out = null;
+    for(let i = 0; i < RUNS; i++) {
+        const start = performance.now();
+        out = encode(module);
+        best = Math.min(best, performance.now() - start);
+    }
+    return { best, out };
+}
+
+const a = bench(scalar);
+const b = bench(simd);
+
+for(const [name, r] of [['scalar', a], ['simd128', b]]) {
+    console.log(`${name.padEnd(8)} ${r.best.toFixed(1).padStart(8)} ms ` +
+      `${(LENGTH * 1000 / r.best).toFixed(0).padStart(5)}x realtime ` +
+      `${r.out.length} bytes`);
+}
+console.log(`speedup  ${(a.best / b.best).toFixed(2)}x`);
+
+if(!a.out.equals(b.out)) {
+    console.log('outputs differ!');
+    process.exit(1);
+}
+console.log('outputs match');
+
+/* the float formats go through the quantizers in tflac.c, which have
+ * their own SIMD128 versions */
+for(const [name, module] of [['scalar', scalar], ['simd128', simd]]) {
+    for(const format of ['s16i', 'f32i', 'f32p']) {
+        if(!encode(module, format).equals(a.out)) {
+            console.log(`${name} ${format} output differs!`);
+            process.exit(1);
+        }
+    }
+}
+console.log('16-bit and float outputs match');
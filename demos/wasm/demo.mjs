@@ -15,7 +15,7 @@ import { TFlac } from './tflac.mjs';
 
 /* load up the WASM module */
 const wasmBuffer = await readFile('tflac.wasm');
-await TFlac.load(wasmBuffer);
+await TFlac.load(wasmBuffer, await readFile('tflac-simd.wasm'));
 
 /* create our encoder */
 const tflac = new TFlac(BLOCK_SIZE, CHANNELS, BITDEPTH, SAMPLE_RATE);
@@ -0,0 +1,50 @@
+/* same sine wave as demo.mjs, but 10 minutes of it and using
+ * TFlacStream - samples get written straight into the encoder's
+ * ring 10ms at a time, and frames go straight to the file */
+const BLOCK_SIZE = 4096;
+const CHANNELS = 2;
+const BITDEPTH = 16;
+const SAMPLE_RATE = 44100;
+
+const LENGTH = 600; // in seconds
+const CHUNK = SAMPLE_RATE / 100; // samples per write, 10ms
+const FREQ = 440;
+const AMP  = Math.ceil(0x7FFF * .5);
+const STEP = FREQ * 2 * Math.PI/SAMPLE_RATE;
+
+import { open, readFile } from 'node:fs/promises';
+import { writeSync } from 'node:fs';
+import { TFlac, TFlacStream } from './tflac.mjs';
+
+await TFlac.load(await readFile('tflac.wasm'), await readFile('tflac-simd.wasm'));
+
+const file = await open('stream.flac', 'w');
+
+/* frames are only good until on_frame returns, so write them out right away */
+const stream = new TFlacStream(BLOCK_SIZE, CHANNELS, BITDEPTH, SAMPLE_RATE, {
+    on_frame: (frame) => writeSync(file.fd, frame),
+});
+
+let p = 0;
+let i = 0;
+while(i < SAMPLE_RATE * LENGTH) {
+    const view = stream.buffer();
+    const frames = Math.min(CHUNK, view.length / CHANNELS, SAMPLE_RATE * LENGTH - i);
+
+    for(let o = 0; o < frames; o++) {
+        for(let j = 0; j < CHANNELS; j++) {
+            view[(o * CHANNELS) + j] = AMP * Math.sin(p);
+        }
+        p += STEP;
+    }
+
+    stream.commit(frames);
+    i += frames;
+}
+
+/* the real STREAMINFO goes right after the "fLaC" marker */
+const streaminfo = stream.finalize();
+await file.write(streaminfo, 0, streaminfo.length, 4);
+await file.close();
+
+console.log('successfully wrote stream.flac');
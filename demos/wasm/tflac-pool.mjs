@@ -0,0 +1,319 @@
+/* A multi-threaded version of TFlac.
+ *
+ * FLAC frames don't depend on each other, so we can hand blocks out
+ * to a pool of workers round-robin, each with its own tflac instance.
+ * This is the same idea as tflac_mt.h, just with Web Workers (or Node's
+ * worker_threads) instead of pthreads.
+ *
+ * Everything lives in one shared WebAssembly.Memory: a "master" tflac
+ * that tracks what goes in the STREAMINFO block, a tflac struct,
+ * residual memory and stack for each worker, and a set of slots that
+ * hold a block of samples and the encoded frame. Sending a block to
+ * a worker is just sending it a slot number.
+ *
+ * Frames come back in whatever order the workers finish them, they're
+ * put back in order before being added to chunks. MD5 has to see every
+ * sample in order so it gets its own worker, which hashes each slot
+ * in order into the master tflac.
+ *
+ * This needs the tflac-threads.wasm build (shared memory and atomics),
+ * and in a browser the page needs to be cross-origin isolated to use
+ * shared memory. */
+
+import { TFlac } from './tflac.mjs';
+
+/* these need to match --initial-memory and --max-memory in the Makefile */
+const INITIAL_PAGES = 16;
+const MAXIMUM_PAGES = 16384;
+
+/* same as wasm-ld's default stack size */
+const STACK_SIZE = 65536;
+
+let pool_mod = null;
+
+function align(offset) {
+    return (offset + 15) & ~15;
+}
+
+/* wraps a Web Worker or a Node worker_threads Worker */
+async function spawn() {
+    const url = new URL('./tflac-worker.mjs', import.meta.url);
+
+    if(typeof Worker !== 'undefined') {
+        const w = new Worker(url, { type: 'module' });
+        return {
+            post: (msg) => w.postMessage(msg),
+            on: (fn) => { w.onmessage = (e) => fn(e.data); },
+            terminate: () => w.terminate(),
+        };
+    }
+
+    const { Worker: NodeWorker } = await import('node:worker_threads');
+    const w = new NodeWorker(url);
+    return {
+        post: (msg) => w.postMessage(msg),
+        on: (fn) => w.on('message', fn),
+        terminate: () => w.terminate(),
+    };
+}
+
+class TFlacPool {
+
+    /* same as TFlac.load, but with the tflac-threads builds. Returns the
+     * compiled module, the pool needs a WebAssembly.Module to send to
+     * its workers */
+    static async load(buf, simd_buf) {
+        TFlacPool.simd = simd_buf !== undefined && TFlac.simd_supported();
+        pool_mod = await WebAssembly.compile(TFlacPool.simd ? simd_buf : buf);
+        return pool_mod;
+    }
+
+    /* creating the pool is async since we have to wait for the workers
+     * to start, so use this instead of new. threads is the number of
+     * encoding workers, there's one more for MD5 */
+    static async create(block_size, channels, bitdepth, samplerate, threads, module = pool_mod) {
+        if(module === null) throw new Error("WASM module not loaded");
+        const pool = new TFlacPool();
+        await pool.start(block_size, channels, bitdepth, samplerate, threads, module);
+        return pool;
+    }
+
+    async start(block_size, channels, bitdepth, samplerate, threads, module) {
+        this.chunks = [];
+        this.block_size = block_size;
+        this.channels = channels;
+        this.threads = threads;
+        this.next_frame = 0;  // frame number of the next block we're given
+        this.next_chunk = 0;  // frame number we're waiting on to add to chunks
+        this.done = new Map(); // finished frames that are waiting on an earlier one
+        this.error = null;
+
+        this.memory = new WebAssembly.Memory({ initial: INITIAL_PAGES, maximum: MAXIMUM_PAGES, shared: true });
+        this.wasm = (await WebAssembly.instantiate(module, { env: { memory: this.memory }})).exports;
+
+        const {
+            __heap_base,
+            tflac_size,
+            tflac_size_memory,
+            tflac_size_frame,
+            tflac_init,
+            tflac_validate,
+            tflac_set_blocksize,
+            tflac_set_channels,
+            tflac_set_bitdepth,
+            tflac_set_samplerate,
+            tflac_set_enable_md5,
+            tflac_get_enable_md5,
+            tflac_encode_streaminfo,
+        } = this.wasm;
+
+        /* section off memory the same way TFlac does, except now
+         * we're just tracking "pointers" and views come later */
+        let offset = align(__heap_base.value);
+
+        this.tflac_ptr = offset;
+        offset = align(offset + tflac_size());
+
+        const hashing = this.threads; // index of the MD5 worker
+        const memory_len = tflac_size_memory(block_size);
+        const workers = [];
+        for(let i = 0; i <= this.threads; i++) {
+            const w = {};
+            if(i == hashing) {
+                w.tflac_ptr = this.tflac_ptr;
+            } else {
+                w.tflac_ptr = offset;
+                offset = align(offset + tflac_size());
+                w.memory_ptr = offset;
+                offset = align(offset + memory_len);
+            }
+
+            /* the stack grows down */
+            offset += STACK_SIZE;
+            w.stack_ptr = offset;
+            workers.push(w);
+        }
+
+        /* two slots per worker, so each has a block queued up while
+         * we're putting the previous one back in order */
+        const frame_len = tflac_size_frame(block_size, channels, bitdepth);
+        this.slots = [];
+        for(let i = 0; i < this.threads * 2; i++) {
+            const slot = { index: i, jobs: 0, frame: 0, block_size: 0 };
+            slot.samples_ptr = offset;
+            offset = align(offset + (Int32Array.BYTES_PER_ELEMENT * block_size * channels));
+            slot.frame_ptr = offset;
+            slot.frame_len = frame_len;
+            offset = align(offset + frame_len);
+            slot.used_ptr = offset;
+            offset = align(offset + Uint32Array.BYTES_PER_ELEMENT);
+            this.slots.push(slot);
+        }
+
+        const needed_pages = Math.ceil(offset / 65536);
+        const have_pages = this.memory.buffer.byteLength / 65536;
+        if(needed_pages > have_pages) {
+            this.memory.grow(needed_pages - have_pages);
+        }
+
+        /* we don't grow again so these views stay good */
+        const buffer = this.memory.buffer;
+        for(const slot of this.slots) {
+            slot.samples = new Int32Array(buffer, slot.samples_ptr, block_size * channels);
+            slot.frame_data = new Uint8Array(buffer, slot.frame_ptr, frame_len);
+            slot.used = new Uint32Array(buffer, slot.used_ptr, 1);
+        }
+        this.free = this.slots.slice();
+        this.waiting = [];
+
+        /* set up the master, then every worker gets a copy of its settings,
+         * minus MD5 (this is what tflac_mt_validate does) */
+        tflac_init(this.tflac_ptr);
+        tflac_set_blocksize(this.tflac_ptr, block_size);
+        tflac_set_channels(this.tflac_ptr, channels);
+        tflac_set_bitdepth(this.tflac_ptr, bitdepth);
+        tflac_set_samplerate(this.tflac_ptr, samplerate);
+        this.md5 = tflac_get_enable_md5(this.tflac_ptr) != 0;
+
+        const bytes = new Uint8Array(buffer);
+        for(let i = 0; i < this.threads; i++) {
+            const w = workers[i];
+            bytes.copyWithin(w.tflac_ptr, this.tflac_ptr, this.tflac_ptr + tflac_size());
+            tflac_set_enable_md5(w.tflac_ptr, 0);
+            if(tflac_validate(w.tflac_ptr, w.memory_ptr, memory_len)) {
+                throw new Error("Error validating tflac");
+            }
+        }
+        if(!this.md5) workers.pop();
+
+        /* start the workers and wait for them to instantiate the module */
+        this.workers = [];
+        const ready = [];
+        for(const w of workers) {
+            const worker = await spawn();
+            ready.push(new Promise((resolve) => {
+                worker.on((msg) => {
+                    if(msg.type === 'ready') resolve();
+                    else this.message(msg);
+                });
+            }));
+            worker.post({
+                type: 'init',
+                module,
+                memory: this.memory,
+                stack_ptr: w.stack_ptr,
+                tflac_ptr: w.tflac_ptr,
+            });
+            this.workers.push(worker);
+        }
+        await Promise.all(ready);
+        this.hasher = this.md5 ? this.workers[hashing] : null;
+
+        /* "fLaC" stream marker and a placeholder STREAMINFO block, same as TFlac */
+        this.chunks.push(new Uint8Array([0x66, 0x4c, 0x61, 0x43]));
+
+        const slot = this.slots[0];
+        tflac_encode_streaminfo(this.tflac_ptr, 1, slot.frame_ptr, slot.frame_len, slot.used_ptr);
+        this.chunks.push(slot.frame_data.slice(0, slot.used[0]));
+    }
+
+    /* waits for a free slot */
+    acquire() {
+        if(this.free.length > 0) return this.free.shift();
+        return new Promise((resolve) => this.waiting.push(resolve));
+    }
+
+    /* a slot is free once it's been encoded and hashed */
+    release(slot) {
+        if(--slot.jobs > 0) return;
+        if(this.waiting.length > 0) this.waiting.shift()(slot);
+        else this.free.push(slot);
+    }
+
+    message(msg) {
+        const slot = this.slots[msg.slot];
+
+        if(msg.type === 'encode') {
+            if(msg.result) {
+                this.error = new Error("Error encoding frame");
+            } else {
+                this.done.set(slot.frame, {
+                    block_size: slot.block_size,
+                    data: slot.frame_data.slice(0, msg.used),
+                });
+            }
+
+            /* add every frame we can to chunks, in order */
+            while(this.done.has(this.next_chunk)) {
+                const frame = this.done.get(this.next_chunk);
+                this.done.delete(this.next_chunk);
+                this.wasm.tflac_add_frame(this.tflac_ptr, frame.block_size, frame.data.byteLength);
+                this.chunks.push(frame.data);
+                this.next_chunk++;
+            }
+        }
+
+        this.release(slot);
+    }
+
+    /* same rules as TFlac.encode_s32i, but this returns a Promise - await
+     * it before reusing samples. It resolves as soon as the samples are
+     * copied in, not when the frame is done. */
+    async encode_s32i(block_size, samples) {
+        if(this.error) throw this.error;
+        if(block_size > this.block_size) throw new Error("Block is larger than the pool's block size");
+        if(samples.length < block_size * this.channels) throw new Error("Not enough samples for the block");
+
+        const slot = await this.acquire();
+        slot.samples.set(samples.subarray(0, block_size * this.channels));
+        slot.block_size = block_size;
+        slot.frame = this.next_frame++;
+        slot.jobs = this.md5 ? 2 : 1;
+
+        this.workers[slot.frame % this.threads].post({
+            type: 'encode',
+            slot: slot.index,
+            frameno: slot.frame & 0x7FFFFFFF,
+            block_size,
+            samples_ptr: slot.samples_ptr,
+            frame_ptr: slot.frame_ptr,
+            frame_len: slot.frame_len,
+            used_ptr: slot.used_ptr,
+        });
+
+        if(this.md5) {
+            this.hasher.post({
+                type: 'md5',
+                slot: slot.index,
+                block_size,
+                samples_ptr: slot.samples_ptr,
+            });
+        }
+    }
+
+    /* waits for every frame, then finalizes the master and updates
+     * the STREAMINFO block */
+    async finalize() {
+        /* once we have every slot, everything's done */
+        const slots = [];
+        while(slots.length < this.slots.length) {
+            slots.push(await this.acquire());
+        }
+        for(const slot of slots) this.free.push(slot);
+
+        if(this.error) throw this.error;
+
+        const slot = this.slots[0];
+        this.wasm.tflac_finalize(this.tflac_ptr);
+        this.wasm.tflac_encode_streaminfo(this.tflac_ptr, 1, slot.frame_ptr, slot.frame_len, slot.used_ptr);
+        this.chunks[1] = slot.frame_data.slice(0, slot.used[0]);
+    }
+
+    /* stops the workers */
+    destroy() {
+        for(const worker of this.workers) worker.terminate();
+        this.workers = [];
+    }
+}
+
+export { TFlacPool };
@@ -0,0 +1,66 @@
+/* worker side of TFlacPool (see tflac-pool.mjs).
+ *
+ * Every worker gets its own instance of the module, but they all share
+ * one WebAssembly.Memory - the pool has already set up our tflac struct,
+ * residual memory, and the sample/frame slots in it, so jobs are just
+ * a handful of pointers. */
+
+let port = null;
+if(typeof self !== 'undefined') {
+    port = {
+        post: (msg) => self.postMessage(msg),
+        on: (fn) => { self.onmessage = (e) => fn(e.data); },
+    };
+} else {
+    const { parentPort } = await import('node:worker_threads');
+    port = {
+        post: (msg) => parentPort.postMessage(msg),
+        on: (fn) => parentPort.on('message', fn),
+    };
+}
+
+let wasm = null;
+let memory = null;
+let tflac_ptr = 0;
+
+port.on((msg) => {
+    switch(msg.type) {
+        case 'init': {
+            memory = msg.memory;
+            wasm = new WebAssembly.Instance(msg.module, { env: { memory }}).exports;
+
+            /* the shadow stack lives in the shared memory too, every
+             * instance starts with the same stack pointer so move ours
+             * to the stack the pool set aside for us */
+            wasm.__stack_pointer.value = msg.stack_ptr;
+            tflac_ptr = msg.tflac_ptr;
+
+            port.post({ type: 'ready' });
+            break;
+        }
+
+        case 'encode': {
+            wasm.tflac_set_frameno(tflac_ptr, msg.frameno);
+            const r = wasm.tflac_encode_s32i(
+              tflac_ptr,
+              msg.block_size,
+              msg.samples_ptr,
+              msg.frame_ptr,
+              msg.frame_len,
+              msg.used_ptr);
+            const used = new Uint32Array(memory.buffer, msg.used_ptr, 1)[0];
+            port.post({ type: 'encode', slot: msg.slot, result: r, used });
+            break;
+        }
+
+        /* only sent to the hashing worker, tflac_ptr is the pool's
+         * master tflac and messages come in order */
+        case 'md5': {
+            wasm.tflac_update_md5_s32i(tflac_ptr, msg.block_size, msg.samples_ptr);
+            port.post({ type: 'md5', slot: msg.slot });
+            break;
+        }
+
+        default: break;
+    }
+});
@@ -1,3 +1,106 @@
 #define TFLAC_IMPLEMENTATION
 #include "../../tflac.h"
 
+/* Float32 ingest for tflac.mjs - Web Audio (and most decoders) hand out
+ * float samples in -1.0 .. 1.0, these quantize them to integers here
+ * instead of in a JS loop.
+ *
+ * Samples are scaled by 2^(bitdepth-1), clamped, and rounded to nearest
+ * (ties to even), so 16-bit audio that was converted to float by dividing
+ * by 32768 comes back out exactly. NaN becomes 0. out can be the same
+ * buffer as in, tflac.mjs converts in place.
+ *
+ * Returns 0 on success, -1 if the bitdepth isn't supported (floats only
+ * have 24 bits of precision so anything past that is pointless) */
+
+TFLAC_PRIVATE
+float tflac_quantize_round(float v) {
+    /* clang turns this into f32.nearest */
+    return __builtin_rintf(v);
+}
+
+TFLAC_PUBLIC
+int tflac_quantize_f32_s16(const float* in, tflac_s16* out, tflac_u32 len, tflac_u32 bitdepth) {
+    tflac_u32 i = 0;
+    float scale;
+    float hi;
+    float lo;
+    float v;
+
+    if(bitdepth == 0 || bitdepth > 16) return -1;
+
+    scale = (float)(UINT32_C(1) << (bitdepth - 1));
+    hi = scale - 1.0f;
+    lo = -scale;
+
+#ifdef TFLAC_ENABLE_SIMD128
+    {
+        const v128_t vscale = wasm_f32x4_splat(scale);
+        const v128_t vhi = wasm_f32x4_splat(hi);
+        const v128_t vlo = wasm_f32x4_splat(lo);
+        v128_t a;
+        v128_t b;
+
+        for(;i+8<=len;i+=8) {
+            a = wasm_f32x4_mul(wasm_v128_load(&in[i]), vscale);
+            b = wasm_f32x4_mul(wasm_v128_load(&in[i+4]), vscale);
+            a = wasm_f32x4_max(wasm_f32x4_min(a, vhi), vlo);
+            b = wasm_f32x4_max(wasm_f32x4_min(b, vhi), vlo);
+            a = wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_nearest(a));
+            b = wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_nearest(b));
+            wasm_v128_store(&out[i], wasm_i16x8_narrow_i32x4(a, b));
+        }
+    }
+#endif
+
+    for(;i<len;i++) {
+        v = in[i] * scale;
+        if(v != v) v = 0.0f;
+        else if(v > hi) v = hi;
+        else if(v < lo) v = lo;
+        out[i] = (tflac_s16)tflac_quantize_round(v);
+    }
+
+    return 0;
+}
+
+TFLAC_PUBLIC
+int tflac_quantize_f32_s32(const float* in, tflac_s32* out, tflac_u32 len, tflac_u32 bitdepth) {
+    tflac_u32 i = 0;
+    float scale;
+    float hi;
+    float lo;
+    float v;
+
+    if(bitdepth == 0 || bitdepth > 24) return -1;
+
+    scale = (float)(UINT32_C(1) << (bitdepth - 1));
+    hi = scale - 1.0f;
+    lo = -scale;
+
+#ifdef TFLAC_ENABLE_SIMD128
+    {
+        const v128_t vscale = wasm_f32x4_splat(scale);
+        const v128_t vhi = wasm_f32x4_splat(hi);
+        const v128_t vlo = wasm_f32x4_splat(lo);
+        v128_t a;
+
+        for(;i+4<=len;i+=4) {
+            a = wasm_f32x4_mul(wasm_v128_load(&in[i]), vscale);
+            a = wasm_f32x4_max(wasm_f32x4_min(a, vhi), vlo);
+            a = wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_nearest(a));
+            wasm_v128_store(&out[i], a);
+        }
+    }
+#endif
+
+    for(;i<len;i++) {
+        v = in[i] * scale;
+        if(v != v) v = 0.0f;
+        else if(v > hi) v = hi;
+        else if(v < lo) v = lo;
+        out[i] = (tflac_s32)tflac_quantize_round(v);
+    }
+
+    return 0;
+}
@@ -6,7 +6,26 @@
  * then grow the memory of the loaded instance. */
 let mod = null;
 
-function calc_needed_pages(block_size,channels,bitdepth) {
+/* a tiny module that uses a v128 instruction (i8x16.splat, i8x16.popcnt),
+ * it only validates if the runtime supports WASM SIMD128. There's no
+ * other way to check - a module built with SIMD just fails to compile
+ * without it. */
+const simd_test = new Uint8Array([
+  0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, // header
+  0x01, 0x05, 0x01, 0x60, 0x00, 0x01, 0x7b,       // type: () -> v128
+  0x03, 0x02, 0x01, 0x00,                         // function
+  0x0a, 0x0a, 0x01, 0x08, 0x00,                   // code
+  0x41, 0x00,                                     // i32.const 0
+  0xfd, 0x0f,                                     // i8x16.splat
+  0xfd, 0x62,                                     // i8x16.popcnt
+  0x0b,                                           // end
+]);
+
+function simd_supported() {
+    return WebAssembly.validate(simd_test);
+}
+
+function calc_needed_pages(mod,block_size,channels,bitdepth,sample_blocks) {
 
     /* WASM uses flat memory - just one big buffer of data. So
      * we need to calculate the total amount of memory, then request
@@ -15,7 +34,7 @@ function calc_needed_pages(block_size,channels,bitdepth) {
     const struct_size = mod.instance.exports.tflac_size();
     const memory_size = mod.instance.exports.tflac_size_memory(block_size);
     const frame_size = mod.instance.exports.tflac_size_frame(block_size, channels, bitdepth);
-    const samples_size = Int32Array.BYTES_PER_ELEMENT * block_size * channels;
+    const samples_size = Int32Array.BYTES_PER_ELEMENT * block_size * channels * sample_blocks;
     const total_size =
       struct_size + // storage for the tflac struct
       memory_size + // storage for tflac internal memory (residuals)
@@ -23,6 +42,7 @@ function calc_needed_pages(block_size,channels,bitdepth) {
       Int32Array.BYTES_PER_ELEMENT + // to ensure we align Int32Array on 4-byte boundary
       samples_size + // storage for our incoming audio samples
       (1 * Uint32Array.BYTES_PER_ELEMENT) + // single-element Uint32Array for used ptr
+      (channels * Uint32Array.BYTES_PER_ELEMENT) + // channel pointers for planar samples
       mod.instance.exports.__heap_base.value; // base offset of where heap memory starts:w
 
     const pages = Math.ceil(total_size / 65536); // convert to pages, each page is 64k
@@ -32,13 +52,26 @@ function calc_needed_pages(block_size,channels,bitdepth) {
 class TFlac {
 
     /* static method to load the global module from a buffer, this needs to be called
-     * before creating any instances of the class. */
-    static async load(buf) {
-        mod = await WebAssembly.instantiate(buf);
+     * before creating any instances of the class.
+     *
+     * simd_buf is optional, it's the tflac-simd.wasm build and gets used
+     * instead of buf when the runtime supports SIMD128. TFlac.simd says
+     * which one was picked. Returns the loaded module, in case you want to
+     * pass it to the constructor yourself. */
+    static async load(buf, simd_buf) {
+        TFlac.simd = simd_buf !== undefined && simd_supported();
+        mod = await WebAssembly.instantiate(TFlac.simd ? simd_buf : buf);
+        return mod;
+    }
+
+    static simd_supported() {
+        return simd_supported();
     }
 
-    constructor(block_size, channels, bitdepth, samplerate) {
-        if(mod === null) throw new Error("WASM module not loaded");
+    /* sample_blocks is how many blocks of samples to make room for,
+     * TFlacStream uses this for its ring */
+    constructor(block_size, channels, bitdepth, samplerate, module = mod, sample_blocks = 1) {
+        if(module === null) throw new Error("WASM module not loaded");
 
         this.chunks = []; // we'll store things like the fLaC stream marker, STREAMINFO block and audio frames
                           // as an array of Uint8Array
@@ -46,12 +79,18 @@ class TFlac {
         /* Note: In a "real" version of this I wouldn't store chunks, but instead
          * emit them as needed, or return them from calls to encode, etc.
          * The main point of this demo was to figure out how memory management works with WASM
-         * so I'm just going to collect them all and let the caller get them at the end. */
+         * so I'm just going to collect them all and let the caller get them at the end.
+         *
+         * TFlacStream (below) is that "real" version. */
+
+        /* create a new instance, then grow its memory to fit everything */
+        this.wasm = new WebAssembly.Instance(module.module, {});
 
-        /* calculate how much memory we'll need, request it, create a new instance */
-        const needed_pages = calc_needed_pages(block_size, channels, bitdepth);
-        const memory = new WebAssembly.Memory({ initial: needed_pages });
-        this.wasm = new WebAssembly.Instance(mod.module, { env: { memory: this.memory }});
+        const needed_pages = calc_needed_pages(module, block_size, channels, bitdepth, sample_blocks);
+        const have_pages = this.wasm.exports.memory.buffer.byteLength / 65536;
+        if(needed_pages > have_pages) {
+            this.wasm.exports.memory.grow(needed_pages - have_pages);
+        }
 
         /* grab a bunch of needed functions and values */
         const {
@@ -99,15 +138,30 @@ class TFlac {
         }
 
         /* our incoming samples and pointer */
-        this.samples = new Int32Array(buffer, offset, block_size * channels);
+        this.samples = new Int32Array(buffer, offset, block_size * channels * sample_blocks);
         this.samples_ptr = this.samples.byteOffset;
 
+        /* the same memory as 16-bit and float samples, so we never
+         * have to widen anything on the JS side */
+        this.samples_s16 = new Int16Array(buffer, offset, this.samples.length * 2);
+        this.samples_f32 = new Float32Array(buffer, offset, this.samples.length);
+
         offset += this.samples.byteLength;
 
         /* a single Uint32Array and pointer for getting out bytes-used outvar */
         this.used = new Uint32Array(buffer, offset, 1);
         this.used_ptr = this.used.byteOffset;
 
+        offset += this.used.byteLength;
+
+        /* the planar encode functions take an array of pointers, one per channel */
+        this.planes = new Uint32Array(buffer, offset, channels);
+        this.planes_ptr = this.planes.byteOffset;
+
+        this.block_size = block_size;
+        this.channels = channels;
+        this.bitdepth = bitdepth;
+
         /* Let's get it all set up! */
         tflac_init(this.tflac_ptr);
 
@@ -138,19 +192,78 @@ class TFlac {
      * samples, every block should be the same size except the final block. */
 
     encode_s32i(block_size, samples) {
-        this.samples.set(samples); // copy caller-provided samples to our internal buffer
+        this.samples.set(samples.subarray(0, block_size * this.channels)); // copy caller-provided samples to our internal buffer
+        this.chunks.push(this.encode_frame(block_size, this.samples_ptr).slice());
+    }
+
+    /* same thing for an Int16Array, these go straight to tflac_encode_s16i */
+    encode_s16i(block_size, samples) {
+        this.samples_s16.set(samples.subarray(0, block_size * this.channels));
+        this.chunks.push(this.encode_frame(block_size, this.samples_ptr, this.wasm.exports.tflac_encode_s16i).slice());
+    }
+
+    /* samples is an array with an Int16Array per channel */
+    encode_s16p(block_size, samples) {
+        this.load_planes(this.samples_s16, block_size, samples);
+        this.chunks.push(this.encode_frame(block_size, this.planes_ptr, this.wasm.exports.tflac_encode_s16p).slice());
+    }
 
-        // tflac_encode_s32i returns non-zero on error so just throw an error if that happens.
-        if(this.wasm.exports.tflac_encode_s32i(
+    /* Float32 samples in -1.0 .. 1.0, like Web Audio's. They get quantized
+     * to our bitdepth in place by tflac_quantize_f32_* (in tflac.c), then
+     * encoded as 16-bit samples if they fit, 32-bit otherwise */
+    encode_f32i(block_size, samples) {
+        this.samples_f32.set(samples.subarray(0, block_size * this.channels));
+        this.quantize(this.samples_ptr, block_size * this.channels);
+
+        const encode = this.bitdepth <= 16 ? this.wasm.exports.tflac_encode_s16i : this.wasm.exports.tflac_encode_s32i;
+        this.chunks.push(this.encode_frame(block_size, this.samples_ptr, encode).slice());
+    }
+
+    /* samples is an array with a Float32Array per channel, like what
+     * AudioBuffer.getChannelData gives you */
+    encode_f32p(block_size, samples) {
+        this.load_planes(this.samples_f32, block_size, samples);
+        for(let c = 0; c < this.channels; c++) {
+            this.quantize(this.planes[c], block_size);
+        }
+
+        const encode = this.bitdepth <= 16 ? this.wasm.exports.tflac_encode_s16p : this.wasm.exports.tflac_encode_s32p;
+        this.chunks.push(this.encode_frame(block_size, this.planes_ptr, encode).slice());
+    }
+
+    /* copies one channel after another into our buffer (as whatever view
+     * is, 16-bit or float) and points this.planes at each of them */
+    load_planes(view, block_size, samples) {
+        for(let c = 0; c < this.channels; c++) {
+            view.set(samples[c].subarray(0, block_size), c * block_size);
+            this.planes[c] = this.samples_ptr + (c * block_size * view.BYTES_PER_ELEMENT);
+        }
+    }
+
+    /* converts len floats at ptr to integers, in place */
+    quantize(ptr, len) {
+        const quantize = this.bitdepth <= 16 ? this.wasm.exports.tflac_quantize_f32_s16 : this.wasm.exports.tflac_quantize_f32_s32;
+        if(quantize(ptr, ptr, len, this.bitdepth)) {
+            throw new Error("Unsupported bitdepth for float samples");
+        }
+    }
+
+    /* encodes a block that's already in WASM memory, returns a view of the
+     * frame - this gets overwritten by the next frame. samples_ptr is
+     * whatever the encode function takes (samples, or channel pointers
+     * for the planar ones) */
+    encode_frame(block_size, samples_ptr, encode = this.wasm.exports.tflac_encode_s32i) {
+        // the tflac_encode functions return non-zero on error so just throw an error if that happens.
+        if(encode(
           this.tflac_ptr,
           block_size,
-          this.samples_ptr,
+          samples_ptr,
           this.tflac_frame_ptr,
           this.tflac_frame.byteLength,
           this.used_ptr)) {
             throw new Error("Error encoding frame");
         }
-        this.chunks.push(this.tflac_frame.slice(0,this.used[0]));
+        return this.tflac_frame.subarray(0,this.used[0]);
     }
 
     /* tflac_finalize that also updates the STREAMINFO block in memory */
@@ -162,4 +275,130 @@ class TFlac {
 
 }
 
-export { TFlac };
+/* A streaming version of TFlac. Instead of handing over whole blocks,
+ * callers write any number of samples into a ring buffer that lives in
+ * WASM memory, whole blocks get encoded as soon as they fill up and each
+ * frame goes straight out - so memory use doesn't depend on how long
+ * the recording is.
+ *
+ * The fastest way to get samples in is to write them straight into
+ * the ring:
+ *
+ *   const view = stream.buffer();  // Int32Array, interleaved
+ *   const frames = fill(view);     // however many samples per channel fit
+ *   stream.commit(frames);         // encodes any blocks that filled up
+ *
+ * write() does the same thing for samples you already have in an
+ * Int32Array, and takes any length.
+ *
+ * Frames go to options.on_frame if you give one, otherwise they're
+ * queued on this.readable, a ReadableStream of Uint8Arrays (which holds
+ * on to them until they're read, so keep reading). on_frame
+ * gets a view into WASM memory that's only good until it returns (copy
+ * it if you need it later), the stream gets copies. Either way the
+ * first things out are the "fLaC" marker and a placeholder STREAMINFO
+ * block.
+ *
+ * finalize() encodes whatever's left and returns the real STREAMINFO
+ * block, if you're writing to something seekable like a file write it
+ * over the placeholder at byte offset 4.
+ *
+ * options.ring_blocks is the size of the ring in blocks, a bigger ring
+ * means buffer() can hand out more room at once. */
+class TFlacStream extends TFlac {
+
+    constructor(block_size, channels, bitdepth, samplerate, options = {}, module = mod) {
+        const ring_blocks = options.ring_blocks ?? 4;
+        super(block_size, channels, bitdepth, samplerate, module, ring_blocks);
+
+        this.ring_len = block_size * ring_blocks; // in samples per channel
+        this.write_pos = 0;  // where the next sample goes
+        this.encode_pos = 0; // start of the block we're filling
+
+        if(options.on_frame) {
+            this.on_frame = options.on_frame;
+            this.readable = null;
+        } else {
+            let controller = null;
+            this.readable = new ReadableStream({
+                start: (c) => { controller = c; },
+            });
+            this.controller = controller;
+            this.on_frame = (frame) => this.controller.enqueue(frame.slice());
+        }
+
+        /* the base class put the marker and STREAMINFO in chunks,
+         * send them out and stop collecting */
+        for(const chunk of this.chunks) this.on_frame(chunk);
+        this.chunks = null;
+    }
+
+    /* returns a view of the ring from the write position up to the end,
+     * the most you can commit at once */
+    buffer() {
+        return this.samples.subarray(this.write_pos * this.channels, this.ring_len * this.channels);
+    }
+
+    /* marks frames samples per channel as written and encodes every
+     * block that filled up */
+    commit(frames) {
+        if(frames > this.ring_len - this.write_pos) throw new Error("Committed past the end of the ring");
+        this.write_pos += frames;
+
+        while(this.write_pos - this.encode_pos >= this.block_size) {
+            const ptr = this.samples_ptr + (this.encode_pos * this.channels * Int32Array.BYTES_PER_ELEMENT);
+            this.on_frame(this.encode_frame(this.block_size, ptr));
+            this.encode_pos += this.block_size;
+        }
+
+        /* the ring is a whole number of blocks, so the last block always
+         * ends right at the end and we never split one */
+        if(this.write_pos == this.ring_len) {
+            this.write_pos = 0;
+            this.encode_pos = 0;
+        }
+    }
+
+    /* copies samples (interleaved, any length) into the ring */
+    write(samples) {
+        if(samples.length % this.channels) throw new Error("Partial sample frame");
+
+        let offset = 0;
+        while(offset < samples.length) {
+            const view = this.buffer();
+            const len = Math.min(view.length, samples.length - offset);
+            view.set(samples.subarray(offset, offset + len));
+            this.commit(len / this.channels);
+            offset += len;
+        }
+    }
+
+    /* the block-at-a-time methods would write over the ring */
+    encode_s32i() { TFlacStream.not_supported(); }
+    encode_s16i() { TFlacStream.not_supported(); }
+    encode_s16p() { TFlacStream.not_supported(); }
+    encode_f32i() { TFlacStream.not_supported(); }
+    encode_f32p() { TFlacStream.not_supported(); }
+
+    static not_supported() {
+        throw new Error("TFlacStream takes samples with write() or buffer()/commit()");
+    }
+
+    /* encodes the last partial block, finalizes MD5 and returns the
+     * updated STREAMINFO block. This closes the ReadableStream */
+    finalize() {
+        if(this.write_pos > this.encode_pos) {
+            const ptr = this.samples_ptr + (this.encode_pos * this.channels * Int32Array.BYTES_PER_ELEMENT);
+            this.on_frame(this.encode_frame(this.write_pos - this.encode_pos, ptr));
+            this.encode_pos = this.write_pos;
+        }
+
+        this.wasm.exports.tflac_finalize(this.tflac_ptr);
+        this.wasm.exports.tflac_encode_streaminfo(this.tflac_ptr, 1, this.tflac_frame_ptr, this.tflac_frame.byteLength, this.used_ptr);
+
+        if(this.readable) this.controller.close();
+        return this.tflac_frame.slice(0,this.used[0]);
+    }
+}
+
+export { TFlac, TFlacStream };
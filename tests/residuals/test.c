@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* makes sure the residual-calculating functions get expected results */
 
@@ -14,8 +15,13 @@ static tflac_s32* residuals_unaligned = NULL;
 
 static tflac_s32* samples = NULL;
 static tflac_s32* residuals = NULL;
+static tflac_s32* stereo_residuals_unaligned = NULL;
+static tflac_s32* stereo_residuals = NULL;
 static tflac_u64 result;
 
+/* used by the fused tests */
+static tflac_u64 fused_results[5];
+
 #ifdef TFLAC_32BIT_ONLY
 static void print_result(void) {
     printf("%u",result.lo);
@@ -419,17 +425,1413 @@ STANDARD_TEST_DEF(3,sse4_1)
 STANDARD_TEST_DEF(4,sse4_1)
 #endif
 
+#ifdef TFLAC_ENABLE_AVX2
+STANDARD_TEST_DEF(0,avx2)
+STANDARD_TEST_DEF(1,avx2)
+STANDARD_TEST_DEF(2,avx2)
+STANDARD_TEST_DEF(3,avx2)
+STANDARD_TEST_DEF(4,avx2)
+#endif
+
+#ifdef TFLAC_ENABLE_AVX512
+STANDARD_TEST_DEF(0,avx512)
+STANDARD_TEST_DEF(1,avx512)
+STANDARD_TEST_DEF(2,avx512)
+STANDARD_TEST_DEF(3,avx512)
+STANDARD_TEST_DEF(4,avx512)
+#endif
+
+#ifdef TFLAC_ENABLE_SSE4_1
+STANDARD_TEST_DEF(1,wide_sse4_1)
+STANDARD_TEST_DEF(2,wide_sse4_1)
+STANDARD_TEST_DEF(3,wide_sse4_1)
+STANDARD_TEST_DEF(4,wide_sse4_1)
+#endif
+
+#ifdef TFLAC_ENABLE_AVX2
+STANDARD_TEST_DEF(1,wide_avx2)
+STANDARD_TEST_DEF(2,wide_avx2)
+STANDARD_TEST_DEF(3,wide_avx2)
+STANDARD_TEST_DEF(4,wide_avx2)
+#endif
+
+#ifdef TFLAC_ENABLE_NEON
+STANDARD_TEST_DEF(0,neon)
+STANDARD_TEST_DEF(1,neon)
+STANDARD_TEST_DEF(2,neon)
+STANDARD_TEST_DEF(3,neon)
+STANDARD_TEST_DEF(4,neon)
+STANDARD_TEST_DEF(1,wide_neon)
+STANDARD_TEST_DEF(2,wide_neon)
+STANDARD_TEST_DEF(3,wide_neon)
+STANDARD_TEST_DEF(4,wide_neon)
+#endif
+
+#ifdef TFLAC_ENABLE_SIMD128
+STANDARD_TEST_DEF(0,simd128)
+STANDARD_TEST_DEF(1,simd128)
+STANDARD_TEST_DEF(2,simd128)
+STANDARD_TEST_DEF(3,simd128)
+STANDARD_TEST_DEF(4,simd128)
+#endif
+
+typedef void (*test_cfr_func)(tflac_u32, const tflac_s32* TFLAC_RESTRICT, tflac_s32* TFLAC_RESTRICT, tflac_u64* TFLAC_RESTRICT);
+
+#if defined(TFLAC_ENABLE_SSE4_1) || defined(TFLAC_ENABLE_AVX2) || defined(TFLAC_ENABLE_NEON)
+/* the SIMD wide calculators against the _std ones with 32-bit samples,
+ * first small enough that nothing overflows, then with a single pair of
+ * extremes dropped in at the start, in the vector loop, and in the tail */
+static int test_cfr_wide(const char* name, const test_cfr_func* funcs) {
+    static const test_cfr_func std_funcs[4] = {
+        tflac_cfr_order1_wide_std,
+        tflac_cfr_order2_wide_std,
+        tflac_cfr_order3_wide_std,
+        tflac_cfr_order4_wide_std
+    };
+    static tflac_s32 in[1027];
+    static tflac_s32 expected[1027];
+    static tflac_s32 got[1027];
+    const tflac_u32 spikes[4] = { 0, 2, 517, 1025 };
+    tflac_u64 expected_err;
+    tflac_u64 got_err;
+    tflac_u32 i = 0;
+    tflac_u32 k = 0;
+    tflac_u32 o = 0;
+    int r = 0;
+
+    printf("test_cfr_wide_%s:\n", name);
+    for(k=0;k<5;k++) {
+        for(i=0;i<1027;i++) {
+            in[i] = (tflac_s32)(((tflac_u32)rand() << 16) ^ (tflac_u32)rand()) >> 4;
+        }
+        if(k < 4) {
+            in[spikes[k]] = INT32_MAX;
+            in[spikes[k] + 1] = INT32_MIN;
+        }
+
+        for(o=0;o<4;o++) {
+            std_funcs[o](1027, in, expected, &expected_err);
+            funcs[o](1027, in, got, &got_err);
+            if(!TFLAC_U64_EQ(expected_err, got_err)) {
+                printf("  order %u spike %u: error sum mismatch\n", o + 1, k < 4 ? spikes[k] : 0);
+                r = 1;
+            }
+            if(TFLAC_U64_EQ(expected_err, TFLAC_U64_MAX)) continue;
+            if(k < 4) {
+                printf("  order %u spike %u: overflow not found\n", o + 1, spikes[k]);
+                r = 1;
+            }
+            if(memcmp(expected, got, sizeof(expected)) != 0) {
+                printf("  order %u: residuals mismatch\n", o + 1);
+                r = 1;
+            }
+        }
+    }
+
+    printf("  %s\n", passfail[r]);
+    return r;
+}
+#endif
+
+#if defined(TFLAC_ENABLE_AVX512) || defined(TFLAC_ENABLE_SIMD128)
+/* the SIMD calculators against the _std ones at every blocksize from
+ * 5 to 70, so each length of tail gets hit. The residuals past the end
+ * of the block have to be left alone. */
+static int test_cfr_lengths(const char* name, const test_cfr_func* funcs,
+  void (*fused)(tflac_u32, const tflac_s32* TFLAC_RESTRICT, tflac_u64* TFLAC_RESTRICT)) {
+    static const test_cfr_func std_funcs[5] = {
+        tflac_cfr_order0_std,
+        tflac_cfr_order1_std,
+        tflac_cfr_order2_std,
+        tflac_cfr_order3_std,
+        tflac_cfr_order4_std
+    };
+    static tflac_s32 in[80];
+    static tflac_s32 expected[80];
+    static tflac_s32 got[80];
+    tflac_u64 expected_err[5];
+    tflac_u64 got_err[5];
+    tflac_u32 i = 0;
+    tflac_u32 n = 0;
+    tflac_u32 o = 0;
+    int r = 0;
+
+    printf("test_cfr_lengths_%s:\n", name);
+    for(n=5;n<=70;n++) {
+        for(i=0;i<80;i++) {
+            in[i] = (tflac_s32)(((tflac_u32)rand() << 16) ^ (tflac_u32)rand()) >> 8;
+        }
+
+        for(o=0;o<5;o++) {
+            for(i=0;i<80;i++) {
+                expected[i] = -1;
+                got[i] = -1;
+            }
+            std_funcs[o](n, in, expected, &expected_err[o]);
+            funcs[o](n, in, got, &got_err[o]);
+            if(!TFLAC_U64_EQ(expected_err[o], got_err[o])) {
+                printf("  order %u blocksize %u: error sum mismatch\n", o, n);
+                r = 1;
+            }
+            if(o > 0 && memcmp(expected, got, sizeof(expected)) != 0) {
+                printf("  order %u blocksize %u: residuals mismatch\n", o, n);
+                r = 1;
+            }
+        }
+
+        if(fused != NULL) {
+            fused(n, in, got_err);
+            for(o=0;o<5;o++) {
+                if(!TFLAC_U64_EQ(expected_err[o], got_err[o])) {
+                    printf("  fused order %u blocksize %u: error sum mismatch\n", o, n);
+                    r = 1;
+                }
+            }
+        }
+    }
+
+    printf("  %s\n", passfail[r]);
+    return r;
+}
+#endif
+
+#define FUSED_TEST(v) test_fused_ ## v
+
+/* checks a single error sum, the fused calculators
+ * don't store any residuals */
+static int test_fused_result(tflac_u32 order, tflac_u32 expected) {
+    int t = !TFLAC_U64_EQ_WORD(fused_results[order], expected);
+    if(t) {
+        result = fused_results[order];
+        printf("  order %u error: expected %u got ", order, expected);
+        print_result();
+        printf("\n");
+    }
+    return t;
+}
+
+#define FUSED_TEST_DEF(v) \
+static int test_fused_ ## v (void) { \
+    int r = 0; \
+    test_reset(); \
+    test_set_samples(); \
+    tflac_cfr_fused_ ## v (BLOCKSIZE,samples,fused_results); \
+    printf("test_fused_%s:\n", #v); \
+    r |= test_fused_result(0, 166894); \
+    r |= test_fused_result(1, 227169); \
+    r |= test_fused_result(2, 368699); \
+    r |= test_fused_result(3, 644582); \
+    r |= test_fused_result(4, 1239351); \
+    printf("  %s\n", passfail[r]); \
+    return r; \
+}
+
+FUSED_TEST_DEF(std)
+
+#if defined(TFLAC_ENABLE_SSE2) || defined(TFLAC_ENABLE_SSSE3) || defined(TFLAC_ENABLE_SSE4_1)
+FUSED_TEST_DEF(sse2)
+#endif
+
+#ifdef TFLAC_ENABLE_AVX2
+FUSED_TEST_DEF(avx2)
+#endif
+
+#ifdef TFLAC_ENABLE_AVX512
+FUSED_TEST_DEF(avx512)
+#endif
+
+#ifdef TFLAC_ENABLE_NEON
+FUSED_TEST_DEF(neon)
+#endif
+
+#ifdef TFLAC_ENABLE_SIMD128
+FUSED_TEST_DEF(simd128)
+#endif
+
+/* the decorrelation tests use the samples as left and the same
+ * samples in reverse as right, shifted up so there's wasted bits,
+ * over 15 samples so the SIMD versions have a leftover to handle */
+static tflac_s16 stereo_s16[BLOCKSIZE * 2];
+static tflac_s32 stereo_s32[BLOCKSIZE * 2];
+
+static void test_set_stereo(void) {
+    tflac_u32 i = 0;
+    test_set_samples();
+    for(i=0;i<BLOCKSIZE;i++) {
+        stereo_s32[i*2]     = samples[i] * 4;
+        stereo_s32[(i*2)+1] = samples[BLOCKSIZE - 1 - i] * 4;
+        stereo_s16[i*2]     = (tflac_s16)(samples[i] / 2);
+        stereo_s16[(i*2)+1] = (tflac_s16)(samples[BLOCKSIZE - 1 - i] / 2);
+    }
+}
+
+static int test_decorrelate_results(tflac_u32 op, tflac_u32 blocksize, const tflac_s32* out, const tflac_s32* left, const tflac_s32* right, tflac_u32 stride, const tflac_u32* info) {
+    tflac_u32 i = 0;
+    tflac_u32 bits = 0;
+    tflac_u32 non_constant = 0;
+    tflac_s32 v = 0;
+
+    for(i=0;i<blocksize;i++) {
+        switch(op) {
+            case TFLAC_DECORRELATE_LEFT: v = left[i*stride]; break;
+            case TFLAC_DECORRELATE_RIGHT: v = right[i*stride]; break;
+            case TFLAC_DECORRELATE_SIDE: v = left[i*stride] - right[i*stride]; break;
+            default: v = (left[i*stride] + right[i*stride]) >> 1; break;
+        }
+        if(out[i] != v) {
+            printf("  op %u error: residual %u expected %d got %d\n", op, i, v, out[i]);
+            return 1;
+        }
+        bits |= (tflac_u32)v;
+        non_constant |= (tflac_u32)v ^ (tflac_u32)out[0];
+    }
+
+    if(info[0] != bits || info[1] != non_constant || info[2] != 0) {
+        printf("  op %u error: expected info %08x %08x 0 got %08x %08x %u\n",
+          op, bits, non_constant, info[0], info[1], info[2]);
+        return 1;
+    }
+    return 0;
+}
+
+#define DECORRELATE_TEST(v) test_decorrelate_ ## v
+
+#define DECORRELATE_TEST_DEF(v) \
+static int test_decorrelate_ ## v (void) { \
+    int r = 0; \
+    tflac_u32 op = 0; \
+    tflac_u32 i = 0; \
+    tflac_u32 info[6]; \
+    tflac_s32 wide[BLOCKSIZE * 2]; \
+    test_reset(); \
+    test_set_stereo(); \
+    for(i=0;i<BLOCKSIZE*2;i++) wide[i] = stereo_s16[i]; \
+    printf("test_decorrelate_%s:\n", #v); \
+    for(op=0;op<4;op++) { \
+        tflac_decorrelate_s32i_ ## v (BLOCKSIZE - 1, op, 3 - op, stereo_s32, residuals, stereo_residuals, info); \
+        r |= test_decorrelate_results(op, BLOCKSIZE - 1, residuals, &stereo_s32[0], &stereo_s32[1], 2, &info[0]); \
+        r |= test_decorrelate_results(3 - op, BLOCKSIZE - 1, stereo_residuals, &stereo_s32[0], &stereo_s32[1], 2, &info[3]); \
+        tflac_decorrelate_s32p_ ## v (BLOCKSIZE - 1, op, &stereo_s32[0], &stereo_s32[BLOCKSIZE], residuals, info); \
+        r |= test_decorrelate_results(op, BLOCKSIZE - 1, residuals, &stereo_s32[0], &stereo_s32[BLOCKSIZE], 1, info); \
+        tflac_decorrelate_s16i_ ## v (BLOCKSIZE - 1, op, 3 - op, stereo_s16, residuals, stereo_residuals, info); \
+        r |= test_decorrelate_results(op, BLOCKSIZE - 1, residuals, &wide[0], &wide[1], 2, &info[0]); \
+        r |= test_decorrelate_results(3 - op, BLOCKSIZE - 1, stereo_residuals, &wide[0], &wide[1], 2, &info[3]); \
+        tflac_decorrelate_s16p_ ## v (BLOCKSIZE - 1, op, &stereo_s16[0], &stereo_s16[BLOCKSIZE], residuals, info); \
+        r |= test_decorrelate_results(op, BLOCKSIZE - 1, residuals, &wide[0], &wide[BLOCKSIZE], 1, info); \
+    } \
+    printf("  %s\n", passfail[r]); \
+    return r; \
+}
+
+DECORRELATE_TEST_DEF(std)
+
+#if defined(TFLAC_ENABLE_SSE2) || defined(TFLAC_ENABLE_SSSE3) || defined(TFLAC_ENABLE_SSE4_1)
+DECORRELATE_TEST_DEF(sse2)
+#endif
+
+#ifdef TFLAC_ENABLE_AVX2
+DECORRELATE_TEST_DEF(avx2)
+#endif
+
+#ifdef TFLAC_ENABLE_NEON
+DECORRELATE_TEST_DEF(neon)
+#endif
+
+#ifdef TFLAC_ENABLE_SIMD128
+DECORRELATE_TEST_DEF(simd128)
+#endif
+
+/* CRC-16 over a generated buffer, lengths picked to land on either
+ * side of the 64-byte folding cutoff, also checks continuing a CRC */
+static tflac_u8 crc_data[1000];
+
+static const tflac_u32 crc_lengths[7] = { 9, 63, 64, 65, 127, 200, 1000 };
+static const tflac_u16 crc_expected[7] = { 0xdbd5, 0x0c48, 0xc9b5, 0x3533, 0xf3ad, 0x90d1, 0xcf64 };
+
+static void test_set_crc_data(void) {
+    tflac_u32 i = 0;
+    for(i=0;i<sizeof(crc_data);i++) {
+        crc_data[i] = (tflac_u8)((i * i * 7) + (i * 3) + 1);
+    }
+}
+
+#define CRC_TEST(v) test_crc16_ ## v
+
+#define CRC_TEST_DEF(v) \
+static int test_crc16_ ## v (void) { \
+    int r = 0; \
+    tflac_u32 i = 0; \
+    tflac_u16 crc = 0; \
+    test_set_crc_data(); \
+    printf("test_crc16_%s:\n", #v); \
+    for(i=0;i<7;i++) { \
+        crc = tflac_crc16_ ## v (crc_data, crc_lengths[i], 0); \
+        if(crc != crc_expected[i]) { \
+            printf("  length %u error: expected %04x got %04x\n", crc_lengths[i], crc_expected[i], crc); \
+            r = 1; \
+        } \
+        crc = tflac_crc16_ ## v (&crc_data[5], crc_lengths[i] - 5, tflac_crc16_ ## v (crc_data, 5, 0)); \
+        if(crc != crc_expected[i]) { \
+            printf("  length %u continued error: expected %04x got %04x\n", crc_lengths[i], crc_expected[i], crc); \
+            r = 1; \
+        } \
+    } \
+    printf("  %s\n", passfail[r]); \
+    return r; \
+}
+
+CRC_TEST_DEF(std)
+
+#ifdef TFLAC_ENABLE_PCLMUL
+CRC_TEST_DEF(pclmul)
+#endif
+
+/* the frame CRC-16 is caught up in chunks while the frame is being
+ * written, the footer should match a CRC over the whole frame. Loud
+ * frames with lots of partitions cross the chunk size many times, and
+ * short ones never reach it */
+static int test_crc16_frame(void) {
+    static tflac_s32 in[2 * 4608];
+    static tflac_u8 buffer[TFLAC_SIZE_FRAME(4608, 2, 24)];
+    const tflac_u32 blocksizes[3] = { 4608, 4608, 16 };
+    const tflac_u32 amps[3] = { 24, 12, 12 };
+    void* memory = NULL;
+    tflac t;
+    tflac_u32 used = 0;
+    tflac_u32 i = 0;
+    tflac_u32 k = 0;
+    tflac_u16 crc = 0;
+    int r = 0;
+
+    printf("test_crc16_frame:\n");
+    memory = malloc(tflac_size_memory(4608));
+    if(memory == NULL) abort();
+
+    for(k=0;k<3;k++) {
+        tflac_init(&t);
+        t.blocksize = 4608;
+        t.samplerate = 44100;
+        t.channels = 2;
+        t.bitdepth = 24;
+        t.max_partition_order = 8;
+        t.enable_exact_rice = 1;
+        if(tflac_validate(&t, memory, tflac_size_memory(4608)) != 0) {
+            printf("  validate error\n");
+            r = 1;
+            break;
+        }
+        for(i=0;i<2 * blocksizes[k];i++) {
+            in[i] = (tflac_s32)((((tflac_u32)rand() << 16) ^ (tflac_u32)rand()) & ((UINT32_C(1) << amps[k]) - 1)) - (tflac_s32)(UINT32_C(1) << (amps[k] - 1));
+            if(i & 0x100) in[i] >>= 8;
+        }
+        if(tflac_encode_s32i(&t, blocksizes[k], in, buffer, sizeof(buffer), &used) != 0) {
+            printf("  blocksize %u amp %u: encode error\n", blocksizes[k], amps[k]);
+            r = 1;
+            continue;
+        }
+        crc = tflac_crc16_std(buffer, used - 2, 0);
+        if( ((tflac_u32)buffer[used - 2] << 8 | buffer[used - 1]) != crc) {
+            printf("  blocksize %u amp %u (%u bytes): expected %04x got %02x%02x\n",
+              blocksizes[k], amps[k], used, crc, buffer[used - 2], buffer[used - 1]);
+            r = 1;
+        }
+    }
+    free(memory);
+
+    printf("  %s\n", passfail[r]);
+    return r;
+}
+
+/* the multi-buffer MD5 transforms against the scalar one, with all
+ * 8 lanes in use and with 5 (the rest are only scratch) */
+static tflac_md5 md5_lanes[TFLAC_MD5_LANES];
+static tflac_md5 md5_expected[TFLAC_MD5_LANES];
+
+static void test_set_md5_lanes(void) {
+    tflac_u32 i = 0;
+    tflac_u32 j = 0;
+    for(i=0;i<TFLAC_MD5_LANES;i++) {
+        tflac_md5_init(&md5_lanes[i]);
+        md5_lanes[i].a += i;
+        for(j=0;j<sizeof(md5_lanes[i].buffer);j++) {
+            md5_lanes[i].buffer[j] = (tflac_u8)rand();
+        }
+        md5_expected[i] = md5_lanes[i];
+    }
+}
+
+static int test_md5_results(const char* name, tflac_u32 n) {
+    tflac_u32 i = 0;
+    int r = 0;
+    for(i=0;i<n;i++) {
+        tflac_md5_transform(&md5_expected[i]);
+        if(md5_lanes[i].a != md5_expected[i].a || md5_lanes[i].b != md5_expected[i].b ||
+           md5_lanes[i].c != md5_expected[i].c || md5_lanes[i].d != md5_expected[i].d) {
+            printf("  %s: lane %u error: expected %08x %08x %08x %08x got %08x %08x %08x %08x\n", name, i,
+              md5_expected[i].a, md5_expected[i].b, md5_expected[i].c, md5_expected[i].d,
+              md5_lanes[i].a, md5_lanes[i].b, md5_lanes[i].c, md5_lanes[i].d);
+            r = 1;
+        }
+    }
+    return r;
+}
+
+#define MD5_TEST(v) test_md5_multi_ ## v
+
+#define MD5_TEST_DEF(v) \
+static int test_md5_multi_ ## v (void) { \
+    int r = 0; \
+    tflac_u32 i = 0; \
+    tflac_md5 scratch; \
+    tflac_md5* m[TFLAC_MD5_LANES]; \
+    printf("test_md5_multi_%s:\n", #v); \
+    test_set_md5_lanes(); \
+    for(i=0;i<TFLAC_MD5_LANES;i++) m[i] = &md5_lanes[i]; \
+    tflac_md5_transform_multi_ ## v (m, TFLAC_MD5_LANES); \
+    r |= test_md5_results("8 lanes", TFLAC_MD5_LANES); \
+    test_set_md5_lanes(); \
+    scratch = md5_lanes[0]; \
+    for(i=5;i<TFLAC_MD5_LANES;i++) m[i] = &scratch; \
+    tflac_md5_transform_multi_ ## v (m, 5); \
+    r |= test_md5_results("5 lanes", 5); \
+    printf("  %s\n", passfail[r]); \
+    return r; \
+}
+
+MD5_TEST_DEF(std)
+
+#if defined(TFLAC_ENABLE_SSE2) || defined(TFLAC_ENABLE_SSSE3) || defined(TFLAC_ENABLE_SSE4_1)
+MD5_TEST_DEF(sse2)
+#endif
+
+#ifdef TFLAC_ENABLE_AVX2
+MD5_TEST_DEF(avx2)
+#endif
+
+/* the partition Rice writer against writing each residual with the
+ * regular bitwriter calls, starting at different bit offsets and with
+ * residuals big enough for long unary runs */
+static int test_bitwriter_rice(void) {
+    tflac_s32 res[300];
+    tflac_u32 folded[300];
+    static tflac_u8 expected[131072];
+    static tflac_u8 got[131072];
+    tflac_bitwriter a;
+    tflac_bitwriter b;
+    const tflac_u32 rices[6] = { 0, 1, 4, 14, 17, 30 };
+    tflac_u32 i = 0;
+    tflac_u32 k = 0;
+    tflac_u32 offset = 0;
+    tflac_u32 v = 0;
+    int r = 0;
+
+    printf("test_bitwriter_rice:\n");
+    for(i=0;i<300;i++) {
+        res[i] = (tflac_s32)(rand() % 2001) - 1000;
+        if(i % 37 == 0) res[i] *= 20;
+    }
+    res[299] = INT32_C(-0x7FFFFFFF);
+    for(i=0;i<300;i++) {
+        folded[i] = ((tflac_u32)tflac_s32_abs(res[i]) << 1) - ((tflac_u32)res[i] >> 31);
+    }
+
+    for(k=0;k<6;k++) {
+        for(offset=0;offset<30;offset+=7) {
+            memset(expected, 0, sizeof(expected));
+            memset(got, 0, sizeof(got));
+            tflac_bitwriter_init(&a);
+            a.buffer = expected;
+            a.len = sizeof(expected) - 8;
+            tflac_bitwriter_add(&a, offset + 1, 1);
+            b = a;
+            b.buffer = got;
+
+            /* only the last residual is too big for the small rice values */
+            for(i=0;i<300 - (rices[k] < 17);i++) {
+                v = folded[i];
+                if(v >> rices[k]) tflac_bitwriter_zeroes(&a, v >> rices[k]);
+                tflac_bitwriter_add(&a, rices[k] + 1, (UINT32_C(1) << rices[k]) | (v & ((UINT32_C(1) << rices[k]) - 1)));
+            }
+            tflac_bitwriter_flush(&a);
+
+            tflac_bitwriter_rice(&b, folded, i, rices[k]);
+            tflac_bitwriter_flush(&b);
+
+            if(a.pos != b.pos || a.tot != b.tot || memcmp(expected, got, a.pos + 1) != 0) {
+                printf("  rice %u offset %u error\n", rices[k], offset);
+                r = 1;
+            }
+        }
+    }
+
+    printf("  %s\n", passfail[r]);
+    return r;
+}
+
+/* the residual folders against a plain zig-zag, with blocksizes and
+ * predictor orders that leave the partitions unaligned and with tails,
+ * and a few residuals big enough to carry into the upper sum words */
+static int test_fold_residuals(const char* name, tflac_residual_folder fold) {
+    static tflac_s32 res[4096];
+    static tflac_u32 folded[4096];
+    tflac_u64 sums[16];
+    tflac_u64 sum;
+    const tflac_u32 blocksizes[3] = { 4096, 4088, 1155 };
+    const tflac_u32 orders[4] = { 0, 1, 4, 13 };
+    tflac_u32 partition_length = 0;
+    tflac_u32 partition_order = 0;
+    tflac_u32 offset = 0;
+    tflac_u32 i = 0;
+    tflac_u32 j = 0;
+    tflac_u32 k = 0;
+    tflac_u32 v = 0;
+    int r = 0;
+
+    printf("test_fold_residuals_%s:\n", name);
+    for(i=0;i<4096;i++) {
+        res[i] = (tflac_s32)(rand() % 20001) - 10000;
+        if(i % 101 == 0) res[i] = (tflac_s32)(((tflac_u32)rand() << 16) ^ (tflac_u32)rand());
+    }
+    res[4095] = INT32_C(-0x7FFFFFFF);
+    res[4094] = INT32_C(0x7FFFFFFF);
+
+    for(i=0;i<3;i++) {
+        for(j=0;j<4;j++) {
+            for(partition_order=0;partition_order<=4;partition_order++) {
+                if(blocksizes[i] & ((UINT32_C(1) << partition_order) - 1)) break;
+                partition_length = blocksizes[i] >> partition_order;
+                memset(folded, 0, sizeof(folded));
+                fold(blocksizes[i], orders[j], partition_order, res, folded, sums);
+
+                offset = orders[j];
+                for(k=0;k<(UINT32_C(1) << partition_order);k++) {
+                    sum = TFLAC_U64_ZERO;
+                    for(;offset<(k + 1) * partition_length;offset++) {
+                        v = ((tflac_u32)tflac_s32_abs(res[offset]) << 1) - ((tflac_u32)res[offset] >> 31);
+                        if(folded[offset] != v) {
+                            printf("  blocksize %u order %u partition order %u: folded[%u] expected %u, got %u\n",
+                              blocksizes[i], orders[j], partition_order, offset, v, folded[offset]);
+                            r = 1;
+                        }
+                        TFLAC_U64_ADD_WORD(sum, (tflac_u32)tflac_s32_abs(res[offset]));
+                    }
+                    if(!TFLAC_U64_EQ(sum, sums[k])) {
+                        printf("  blocksize %u order %u partition order %u: partition %u sum error\n",
+                          blocksizes[i], orders[j], partition_order, k);
+                        r = 1;
+                    }
+                }
+            }
+        }
+    }
+
+    printf("  %s\n", passfail[r]);
+    return r;
+}
+
+/* the MD5 packers against plain little-endian bytes, with random
+ * samples that don't fit the byte width so the truncation gets checked,
+ * and lengths that leave a tail for the scalar loop */
+static int test_md5_pack(const char* name, tflac_md5_packer_int16 pack16, tflac_md5_packer_int32 pack32) {
+    tflac_s16 in16[203];
+    tflac_s32 in32[203];
+    tflac_u8 out[(203 * 4) + 16];
+    tflac_u8 expected[203 * 4];
+    const tflac_u32 lengths[3] = { 7, 48, 203 };
+    tflac_u32 bytes = 0;
+    tflac_u32 i = 0;
+    tflac_u32 j = 0;
+    tflac_u32 k = 0;
+    int r = 0;
+
+    printf("test_md5_pack_%s:\n", name);
+    for(i=0;i<203;i++) {
+        in32[i] = (tflac_s32)(((tflac_u32)rand() << 16) ^ (tflac_u32)rand());
+        in16[i] = (tflac_s16)in32[i];
+    }
+
+    for(bytes=1;bytes<=4;bytes++) {
+        for(k=0;k<3;k++) {
+            for(i=0;i<lengths[k];i++) {
+                for(j=0;j<bytes;j++) {
+                    expected[(i * bytes) + j] = (tflac_u8)(((tflac_u32)in32[i]) >> (j * 8));
+                }
+            }
+            pack32(out, in32, lengths[k], bytes);
+            if(memcmp(out, expected, lengths[k] * bytes) != 0) {
+                printf("  int32 %u bytes length %u error\n", bytes, lengths[k]);
+                r = 1;
+            }
+            if(bytes > 2 || pack16 == NULL) continue;
+            pack16(out, in16, lengths[k], bytes);
+            if(memcmp(out, expected, lengths[k] * bytes) != 0) {
+                printf("  int16 %u bytes length %u error\n", bytes, lengths[k]);
+                r = 1;
+            }
+        }
+    }
+
+    printf("  %s\n", passfail[r]);
+    return r;
+}
+
+/* the LPC quantizer should keep every coefficient within the precision
+ * and the shift within 0-15, including coefficients that round up past
+ * the largest value, and refuse coefficients it can't shift down to */
+static int test_lpc_quantize(void) {
+    double lpc[TFLAC_MAX_LPC_ORDER];
+    tflac_s32 coefficients[TFLAC_MAX_LPC_ORDER];
+    const double edge[2] = { 1.99999, -1.99999 };
+    const double scales[4] = { 0.001, 0.7, 1.5, 40.0 };
+    tflac_s32 qmax = 0;
+    tflac_u32 shift = 0;
+    tflac_u32 precision = 0;
+    tflac_u32 order = 0;
+    tflac_u32 i = 0;
+    tflac_u32 k = 0;
+    tflac_u32 log2cmax = 0;
+    double cmax = 0.0;
+    int q = 0;
+    int r = 0;
+
+    printf("test_lpc_quantize:\n");
+    for(precision=5;precision<=15;precision++) {
+        qmax = (tflac_s32)((UINT32_C(1) << (precision - 1)) - 1);
+        for(k=0;k<4;k++) {
+            for(order=1;order<=TFLAC_MAX_LPC_ORDER;order+=order < 4 ? 1 : 7) {
+                cmax = 0.0;
+                for(i=0;i<order;i++) {
+                    lpc[i] = scales[k] * ((double)(rand() % 2001) - 1000.0) / 1000.0;
+                    if(lpc[i] > cmax) cmax = lpc[i];
+                    else if(-lpc[i] > cmax) cmax = -lpc[i];
+                }
+                for(log2cmax=0;cmax >= 2.0;log2cmax++) cmax /= 2.0;
+
+                q = tflac_lpc_quantize(lpc, order, precision, coefficients, &shift);
+                if(cmax == 0.0) continue;
+                if(q != (log2cmax + 2 > precision ? -1 : 0)) {
+                    printf("  precision %u order %u scale %g: unexpected result %d\n", precision, order, scales[k], q);
+                    r = 1;
+                    continue;
+                }
+                if(q != 0) continue;
+                if(shift > 15) {
+                    printf("  precision %u order %u scale %g: shift %u\n", precision, order, scales[k], shift);
+                    r = 1;
+                }
+                for(i=0;i<order;i++) {
+                    if(coefficients[i] > qmax || coefficients[i] < -qmax - 1) {
+                        printf("  precision %u order %u scale %g: coefficient %u is %d\n", precision, order, scales[k], i, coefficients[i]);
+                        r = 1;
+                    }
+                }
+            }
+        }
+
+        /* these round to 2^(precision-1) and -2^(precision-1) */
+        if(tflac_lpc_quantize(&edge[0], 1, precision, coefficients, &shift) != 0 ||
+          shift != precision - 2 || coefficients[0] != qmax) {
+            printf("  precision %u: positive edge coefficient error\n", precision);
+            r = 1;
+        }
+        if(tflac_lpc_quantize(&edge[1], 1, precision, coefficients, &shift) != 0 ||
+          shift != precision - 2 || coefficients[0] != -qmax - 1) {
+            printf("  precision %u: negative edge coefficient error\n", precision);
+            r = 1;
+        }
+    }
+
+    lpc[0] = 0.0;
+    lpc[1] = 0.0;
+    if(tflac_lpc_quantize(lpc, 2, 12, coefficients, &shift) != -1) {
+        printf("  all-zero coefficients should be refused\n");
+        r = 1;
+    }
+
+    printf("  %s\n", passfail[r]);
+    return r;
+}
+
+#ifndef TFLAC_32BIT_ONLY
+/* the 32-bit LPC residual against the 64-bit one, at the limit where
+ * bitdepth + precision + ceil(log2(order)) is still 32, using full-scale
+ * samples and coefficients so the narrow sums come close to overflowing */
+static int test_lpc_residual(void) {
+    static tflac_s32 in[1024];
+    static tflac_s32 narrow[1024];
+    static tflac_s32 wide[1024];
+    tflac_s32 coefficients[TFLAC_MAX_LPC_ORDER];
+    tflac_u64 narrow_error;
+    tflac_u64 wide_error;
+    const tflac_u32 bitdepths[5] = { 8, 16, 20, 24, 27 };
+    const tflac_u32 precisions[5] = { 15, 12, 9, 5, 5 };
+    const tflac_u32 orders[5] = { 32, 16, 8, 8, 1 };
+    tflac_s32 smax = 0;
+    tflac_s32 qmax = 0;
+    tflac_u32 shift = 0;
+    tflac_u32 i = 0;
+    tflac_u32 k = 0;
+    tflac_u32 pass = 0;
+    int r = 0;
+
+    printf("test_lpc_residual:\n");
+    for(k=0;k<5;k++) {
+        smax = (tflac_s32)((UINT32_C(1) << (bitdepths[k] - 1)) - 1);
+        qmax = (tflac_s32)((UINT32_C(1) << (precisions[k] - 1)) - 1);
+        for(pass=0;pass<3;pass++) {
+            for(i=0;i<1024;i++) {
+                switch(pass) {
+                    case 0: in[i] = (tflac_s32)(((tflac_u32)rand() << 16) ^ (tflac_u32)rand()) % (smax + 1); break;
+                    case 1: in[i] = i & 1 ? smax : -smax - 1; break;
+                    default: in[i] = -smax - 1; break;
+                }
+            }
+            for(i=0;i<orders[k];i++) {
+                switch(pass) {
+                    case 0: coefficients[i] = (tflac_s32)(rand() % (2 * qmax + 2)) - qmax - 1; break;
+                    case 1: coefficients[i] = i & 1 ? -qmax - 1 : qmax; break;
+                    default: coefficients[i] = -qmax - 1; break;
+                }
+            }
+            for(shift=0;shift<=15;shift+=5) {
+                tflac_lpc_residual_narrow(1024, in, narrow, &narrow_error, coefficients, orders[k], shift);
+                tflac_lpc_residual_wide(1024, in, wide, &wide_error, coefficients, orders[k], shift);
+                if(memcmp(narrow, wide, sizeof(narrow)) != 0 || !TFLAC_U64_EQ(narrow_error, wide_error)) {
+                    printf("  bitdepth %u precision %u order %u pass %u shift %u: residuals differ\n",
+                      bitdepths[k], precisions[k], orders[k], pass, shift);
+                    r = 1;
+                }
+            }
+        }
+    }
+
+    printf("  %s\n", passfail[r]);
+    return r;
+}
+#endif
+
+/* the automatic stereo mode estimators against summing each channel's
+ * order 2 residuals separately, in every sample format, then a frame
+ * encoded with TFLAC_CHANNEL_AUTO should say mid/side in its header
+ * when the channels are mostly opposite each other */
+static tflac_u32 test_stereo_reference(tflac_u32 blocksize, const tflac_s32* in, tflac_u32 max_rice_value) {
+    tflac_u64 errors[4];
+    double bits[4];
+    double cost[4];
+    tflac_s32 v[4][3];
+    tflac_u32 best = TFLAC_CHANNEL_INDEPENDENT;
+    tflac_u32 i = 0;
+    tflac_u32 k = 0;
+
+    for(k=0;k<4;k++) errors[k] = TFLAC_U64_ZERO;
+    for(i=0;i<blocksize;i++) {
+        for(k=0;k<4;k++) {
+            v[k][2] = v[k][1];
+            v[k][1] = v[k][0];
+        }
+        v[0][0] = in[i*2];
+        v[1][0] = in[(i*2)+1];
+        v[2][0] = (v[0][0] + v[1][0]) >> 1;
+        v[3][0] = v[0][0] - v[1][0];
+        if(i < 2) continue;
+        for(k=0;k<4;k++) {
+            TFLAC_U64_ADD_WORD(errors[k], (tflac_u32)tflac_s32_abs(v[k][0] - (2 * v[k][1]) + v[k][2]));
+        }
+    }
+    for(k=0;k<4;k++) {
+        bits[k] = tflac_estimate_residual_bits(errors[k], blocksize - 2, max_rice_value);
+    }
+    cost[TFLAC_CHANNEL_INDEPENDENT] = bits[0] + bits[1];
+    cost[TFLAC_CHANNEL_LEFT_SIDE]   = bits[0] + bits[3];
+    cost[TFLAC_CHANNEL_SIDE_RIGHT]  = bits[3] + bits[1];
+    cost[TFLAC_CHANNEL_MID_SIDE]    = bits[2] + bits[3];
+    for(k=1;k<4;k++) {
+        if(cost[k] < cost[best]) best = k;
+    }
+    return best;
+}
+
+static int test_stereo_estimate(void) {
+    static tflac_s32 in32[2 * 1024];
+    static tflac_s16 in16[2 * 1024];
+    static tflac_s32 planar32[2][1024];
+    static tflac_s16 planar16[2][1024];
+    static tflac_u8 buffer[TFLAC_SIZE_FRAME(1024, 2, 16)];
+    const tflac_s32* p32[2];
+    const tflac_s16* p16[2];
+    void* memory = NULL;
+    tflac t;
+    tflac_s32 x = 0;
+    tflac_s32 n = 0;
+    tflac_u32 expected = 0;
+    tflac_u32 used = 0;
+    tflac_u32 pass = 0;
+    tflac_u32 i = 0;
+    int r = 0;
+
+    printf("test_stereo_estimate:\n");
+    tflac_init(&t);
+    t.channels = 2;
+    t.bitdepth = 16;
+    t.max_rice_value = 30;
+    t.cur_blocksize = 1024;
+    p32[0] = planar32[0];
+    p32[1] = planar32[1];
+    p16[0] = planar16[0];
+    p16[1] = planar16[1];
+
+    for(pass=0;pass<8;pass++) {
+        for(i=0;i<1024;i++) {
+            x = (tflac_s32)(rand() % 20001) - 10000;
+            n = (tflac_s32)(rand() % 201) - 100;
+            switch(pass) {
+                /* the same on both sides */
+                case 0: in32[i*2] = x; in32[(i*2)+1] = x; break;
+                /* mostly opposite, mid/side */
+                case 1: in32[i*2] = x + n; in32[(i*2)+1] = n - x; break;
+                /* one side nearly follows the other */
+                case 2: in32[i*2] = x; in32[(i*2)+1] = x + n; break;
+                case 3: in32[i*2] = x + n; in32[(i*2)+1] = x; break;
+                /* unrelated, with the loudness moving around */
+                default: {
+                    in32[i*2] = x >> (rand() % 8);
+                    in32[(i*2)+1] = ((tflac_s32)(rand() % 20001) - 10000) >> (rand() % 8);
+                    break;
+                }
+            }
+            in16[i*2] = (tflac_s16)in32[i*2];
+            in16[(i*2)+1] = (tflac_s16)in32[(i*2)+1];
+            planar32[0][i] = in32[i*2];
+            planar32[1][i] = in32[(i*2)+1];
+            planar16[0][i] = in16[i*2];
+            planar16[1][i] = in16[(i*2)+1];
+        }
+
+        expected = test_stereo_reference(1024, in32, t.max_rice_value);
+        if( (pass == 0 && expected != TFLAC_CHANNEL_LEFT_SIDE) || (pass == 1 && expected != TFLAC_CHANNEL_MID_SIDE) ) {
+            printf("  pass %u: reference picked mode %u\n", pass, expected);
+            r = 1;
+        }
+
+        t.cur_channel_mode = 0xFF;
+        tflac_stereo_estimate_int32_interleaved(&t, in32);
+        if(t.cur_channel_mode != expected) {
+            printf("  pass %u: int32 interleaved expected mode %u got %u\n", pass, expected, t.cur_channel_mode);
+            r = 1;
+        }
+        t.cur_channel_mode = 0xFF;
+        tflac_stereo_estimate_int32_planar(&t, p32);
+        if(t.cur_channel_mode != expected) {
+            printf("  pass %u: int32 planar expected mode %u got %u\n", pass, expected, t.cur_channel_mode);
+            r = 1;
+        }
+        t.cur_channel_mode = 0xFF;
+        tflac_stereo_estimate_int16_interleaved(&t, in16);
+        if(t.cur_channel_mode != expected) {
+            printf("  pass %u: int16 interleaved expected mode %u got %u\n", pass, expected, t.cur_channel_mode);
+            r = 1;
+        }
+        t.cur_channel_mode = 0xFF;
+        tflac_stereo_estimate_int16_planar(&t, p16);
+        if(t.cur_channel_mode != expected) {
+            printf("  pass %u: int16 planar expected mode %u got %u\n", pass, expected, t.cur_channel_mode);
+            r = 1;
+        }
+    }
+
+    /* in32 is still unrelated channels, redo the mid/side signal and
+     * the next frame should switch to it */
+    tflac_init(&t);
+    t.blocksize = 1024;
+    t.samplerate = 44100;
+    t.channels = 2;
+    t.bitdepth = 16;
+    t.channel_mode = TFLAC_CHANNEL_AUTO;
+    memory = malloc(tflac_size_memory(1024));
+    if(memory == NULL) abort();
+    if(tflac_validate(&t, memory, tflac_size_memory(1024)) != 0) {
+        printf("  validate error\n");
+        r = 1;
+    } else {
+        if(tflac_encode_s32i(&t, 1024, in32, buffer, sizeof(buffer), &used) != 0) {
+            printf("  encode error\n");
+            r = 1;
+        }
+        expected = test_stereo_reference(1024, in32, t.max_rice_value);
+        if(t.cur_channel_mode != expected || (buffer[3] >> 4) != (expected == 0 ? 1 : 7 + expected)) {
+            printf("  unrelated frame: expected mode %u got %u, header %02x\n", expected, t.cur_channel_mode, buffer[3]);
+            r = 1;
+        }
+        for(i=0;i<1024;i++) {
+            x = (tflac_s32)(rand() % 20001) - 10000;
+            n = (tflac_s32)(rand() % 201) - 100;
+            in32[i*2] = x + n;
+            in32[(i*2)+1] = n - x;
+        }
+        if(tflac_encode_s32i(&t, 1024, in32, buffer, sizeof(buffer), &used) != 0) {
+            printf("  encode error\n");
+            r = 1;
+        }
+        if(t.cur_channel_mode != TFLAC_CHANNEL_MID_SIDE || (buffer[3] >> 4) != 10) {
+            printf("  mid/side frame: got mode %u, header %02x\n", t.cur_channel_mode, buffer[3]);
+            r = 1;
+        }
+    }
+    free(memory);
+
+    printf("  %s\n", passfail[r]);
+    return r;
+}
+
+/* the exact Rice parameter check against costing the neighboring
+ * parameters one residual at a time, starting from the estimate and
+ * from parameters at either end of the range */
+static double test_rice_cost(const tflac_u32* folded, tflac_u32 len, tflac_u32 rice) {
+    double cost = (double)len * (double)(rice + 1);
+    tflac_u32 i = 0;
+    for(i=0;i<len;i++) cost += (double)(folded[i] >> rice);
+    return cost;
+}
+
+static int test_rice_parameter_exact(void) {
+    static tflac_u32 folded[1000];
+    const tflac_u32 lengths[4] = { 1, 7, 250, 1000 };
+    const tflac_u32 max_rice[2] = { 14, 30 };
+    tflac_u64 sum;
+    tflac_u32 amp = 0;
+    tflac_u32 start = 0;
+    tflac_u32 got = 0;
+    tflac_u32 expected = 0;
+    tflac_u32 k = 0;
+    tflac_u32 lo = 0;
+    tflac_u32 hi = 0;
+    tflac_u32 i = 0;
+    tflac_u32 j = 0;
+    tflac_u32 m = 0;
+    tflac_u32 s = 0;
+    int r = 0;
+
+    printf("test_rice_parameter_exact:\n");
+    for(amp=0;amp<31;amp+=3) {
+        for(i=0;i<1000;i++) {
+            folded[i] = (((tflac_u32)rand() << 16) ^ (tflac_u32)rand()) & ((UINT32_C(2) << amp) - 1);
+            if(i % 17 == 0) folded[i] >>= amp / 2;
+        }
+        for(j=0;j<4;j++) {
+            sum = TFLAC_U64_ZERO;
+            for(i=0;i<lengths[j];i++) TFLAC_U64_ADD_WORD(sum, (folded[i] >> 1) + (folded[i] & 1));
+            for(m=0;m<2;m++) {
+                for(s=0;s<4;s++) {
+                    switch(s) {
+                        case 0: start = tflac_rice_parameter(sum, lengths[j], max_rice[m]); break;
+                        case 1: start = 0; break;
+                        case 2: start = max_rice[m]; break;
+                        default: start = amp > max_rice[m] ? max_rice[m] : amp; break;
+                    }
+                    got = tflac_rice_parameter_exact(folded, lengths[j], start, max_rice[m]);
+
+                    lo = start ? start - 1 : 0;
+                    hi = start < max_rice[m] ? start + 1 : start;
+                    expected = lo;
+                    for(k=lo+1;k<=hi;k++) {
+                        if(test_rice_cost(folded, lengths[j], k) < test_rice_cost(folded, lengths[j], expected)) expected = k;
+                    }
+                    if(got != expected) {
+                        printf("  amp %u length %u max %u start %u: expected %u got %u\n",
+                          amp, lengths[j], max_rice[m], start, expected, got);
+                        r = 1;
+                    }
+                }
+            }
+        }
+    }
+
+    printf("  %s\n", passfail[r]);
+    return r;
+}
+
+/* the partition order has to divide the block even when the minimum
+ * order doesn't, like a short last block */
+static int test_pick_partition_order(void) {
+    static tflac_s32 in[2 * 2048];
+    static tflac_u8 buffer[TFLAC_SIZE_FRAME(2048, 2, 24)];
+    void* memory = NULL;
+    tflac t;
+    tflac_u32 blocksize = 0;
+    tflac_u32 used = 0;
+    tflac_u8 min_order = 0;
+    tflac_u8 max_order = 0;
+    tflac_u8 order = 0;
+    tflac_u32 i = 0;
+    int r = 0;
+
+    printf("test_pick_partition_order:\n");
+    tflac_init(&t);
+    for(min_order=0;min_order<=8;min_order++) {
+        for(max_order=min_order;max_order<=8;max_order++) {
+            t.min_partition_order = min_order;
+            t.max_partition_order = max_order;
+            for(blocksize=2;blocksize<=4608;blocksize++) {
+                order = tflac_pick_partition_order(&t, blocksize);
+                if(order > max_order || blocksize % (UINT32_C(1) << order) != 0 || (blocksize >> order) < 2 ||
+                  (blocksize % (UINT32_C(1) << min_order) == 0 && (blocksize >> min_order) >= 2 && order < min_order) ||
+                  (order < max_order && blocksize % (UINT32_C(2) << order) == 0 && (blocksize >> (order + 1)) >= 2)) {
+                    printf("  min %u max %u blocksize %u: got order %u\n", min_order, max_order, blocksize, order);
+                    r = 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    /* 8114 samples at 2048 leaves a 1970 sample frame */
+    tflac_init(&t);
+    t.blocksize = 2048;
+    t.samplerate = 44100;
+    t.channels = 2;
+    t.bitdepth = 24;
+    t.min_partition_order = 2;
+    t.max_partition_order = 4;
+    t.enable_partition_search = 1;
+    memory = malloc(tflac_size_memory(2048));
+    if(memory == NULL) abort();
+    if(tflac_validate(&t, memory, tflac_size_memory(2048)) != 0) {
+        printf("  validate error\n");
+        r = 1;
+    } else {
+        for(i=0;i<2048;i++) {
+            in[i*2] = (tflac_s32)((i * i * 3) & 0xFFFFF) - 0x80000 + (rand() % 64);
+            in[(i*2)+1] = in[i*2] / 2;
+        }
+        for(i=0;i<4;i++) {
+            blocksize = i == 3 ? 1970 : 2048;
+            if(tflac_encode_s32i(&t, blocksize, in, buffer, sizeof(buffer), &used) != 0) {
+                printf("  frame %u encode error\n", i);
+                r = 1;
+            }
+        }
+        if(t.partition_order != 1) {
+            printf("  last frame: expected partition order 1 got %u\n", t.partition_order);
+            r = 1;
+        }
+    }
+    free(memory);
+
+    printf("  %s\n", passfail[r]);
+    return r;
+}
+
+/* the partition order search against estimating every order from
+ * scratch, over residuals with quiet and loud stretches so the best
+ * order moves around */
+static int test_search_partition_order(void) {
+    static tflac_s32 res[4096];
+    static tflac_u32 folded[4096];
+    tflac_u64 sums[2 << 8];
+    tflac_u64 sum;
+    tflac t;
+    const tflac_u32 blocksizes[4] = { 4096, 4064, 1152, 1970 };
+    const tflac_u32 predictor_orders[4] = { 0, 2, 4, 32 };
+    tflac_u32 rice_bits = 0;
+    tflac_u32 partitions = 0;
+    tflac_u32 partition_length = 0;
+    tflac_u32 blocksize = 0;
+    tflac_u32 amp = 0;
+    tflac_u32 offset = 0;
+    tflac_u32 pass = 0;
+    tflac_u32 i = 0;
+    tflac_u32 j = 0;
+    tflac_u32 k = 0;
+    tflac_u32 p = 0;
+    tflac_u8 order = 0;
+    tflac_u8 start = 0;
+    tflac_u8 expected = 0;
+    tflac_u8 got = 0;
+    double bits = 0.0;
+    double best_bits = 0.0;
+    int r = 0;
+
+    printf("test_search_partition_order:\n");
+    tflac_init(&t);
+    t.partition_sums = sums;
+    t.max_partition_order = 8;
+    for(pass=0;pass<6;pass++) {
+        t.max_rice_value = pass & 1 ? 14 : 30;
+        rice_bits = pass & 1 ? 4 : 5;
+        for(i=0;i<4096;i++) {
+            if(i % (UINT32_C(8) << pass) == 0) amp = UINT32_C(1) << (rand() % (pass < 2 ? 3 : 14));
+            res[i] = (tflac_s32)(rand() % (2 * amp + 1)) - (tflac_s32)amp;
+        }
+        for(k=0;k<4;k++) {
+            blocksize = blocksizes[k];
+            t.cur_blocksize = blocksize;
+            for(t.min_partition_order=0;t.min_partition_order<=3;t.min_partition_order++) {
+                start = tflac_pick_partition_order(&t, blocksize);
+                for(j=0;j<4;j++) {
+                    if(predictor_orders[j] >= blocksize >> start) continue;
+                    tflac_fold_residuals_std(blocksize, predictor_orders[j], start, res, folded, &sums[UINT32_C(1) << start]);
+                    got = start > t.min_partition_order ?
+                      tflac_search_partition_order(&t, predictor_orders[j], start) : start;
+
+                    expected = start;
+                    for(order=start;;order--) {
+                        partitions = UINT32_C(1) << order;
+                        partition_length = blocksize >> order;
+                        bits = (double)(partitions * rice_bits);
+                        offset = predictor_orders[j];
+                        for(p=0;p<partitions;p++) {
+                            sum = TFLAC_U64_ZERO;
+                            for(;offset<(p + 1) * partition_length;offset++) {
+                                TFLAC_U64_ADD_WORD(sum, (tflac_u32)tflac_s32_abs(res[offset]));
+                            }
+                            bits += tflac_estimate_residual_bits(sum, p == 0 ? partition_length - predictor_orders[j] : partition_length, t.max_rice_value);
+                        }
+                        if(order == start || bits < best_bits) {
+                            best_bits = bits;
+                            expected = order;
+                        }
+                        if(order <= t.min_partition_order) break;
+                    }
+
+                    if(got != expected) {
+                        printf("  pass %u blocksize %u min %u predictor order %u: expected order %u got %u\n",
+                          pass, blocksize, t.min_partition_order, predictor_orders[j], expected, got);
+                        r = 1;
+                    }
+                }
+            }
+        }
+    }
+
+    printf("  %s\n", passfail[r]);
+    return r;
+}
+
+/* the maximum LPC order reads back as 8 before tflac_validate, and
+ * out of range values get clamped instead of failing */
+static int test_max_lpc_order(void) {
+    const tflac_u32 set[4] = { 8, 0, 12, 200 };
+    const tflac_u32 expected[4] = { 8, 1, 12, 32 };
+    void* memory = NULL;
+    tflac t;
+    tflac_u32 k = 0;
+    int r = 0;
+
+    printf("test_max_lpc_order:\n");
+    memory = malloc(tflac_size_memory(1024));
+    if(memory == NULL) abort();
+
+    for(k=0;k<4;k++) {
+        tflac_init(&t);
+        if(tflac_get_max_lpc_order(&t) != 8) {
+            printf("  default: expected 8 got %u\n", tflac_get_max_lpc_order(&t));
+            r = 1;
+        }
+        t.blocksize = 1024;
+        t.samplerate = 44100;
+        t.channels = 1;
+        t.bitdepth = 16;
+        tflac_set_max_lpc_order(&t, set[k]);
+        if(tflac_validate(&t, memory, tflac_size_memory(1024)) != 0) {
+            printf("  order %u: validate error\n", set[k]);
+            r = 1;
+        } else if(tflac_get_max_lpc_order(&t) != expected[k]) {
+            printf("  order %u: expected %u got %u\n", set[k], expected[k], tflac_get_max_lpc_order(&t));
+            r = 1;
+        }
+    }
+    free(memory);
+
+    printf("  %s\n", passfail[r]);
+    return r;
+}
+
+/* frame and sample numbers against the UTF-8-like coding written out
+ * one byte at a time, at both ends of every length up to 36 bits */
+static tflac_u32 test_coded_shift(tflac_u32 hi, tflac_u32 lo, tflac_u32 shift) {
+    if(shift == 0) return lo;
+    if(shift >= 32) return hi >> (shift - 32);
+    return (lo >> shift) | (hi << (32 - shift));
+}
+
+static int test_coded_number(void) {
+    tflac_u8 expected[8];
+    tflac_u8 got[16];
+    tflac_bitwriter bw;
+    tflac_u32 values[74][2];
+    tflac_u32 count = 0;
+    tflac_u32 bits = 0;
+    tflac_u32 len = 0;
+    tflac_u32 hi = 0;
+    tflac_u32 lo = 0;
+    tflac_u32 i = 0;
+    tflac_u32 k = 0;
+    int r = 0;
+
+    printf("test_coded_number:\n");
+    values[count][0] = 0;
+    values[count][1] = 0;
+    count++;
+    for(bits=1;bits<=36;bits++) {
+        /* the smallest and largest numbers with this many bits */
+        values[count][0] = bits > 32 ? UINT32_C(1) << (bits - 33) : 0;
+        values[count][1] = bits > 32 ? 0 : UINT32_C(1) << (bits - 1);
+        count++;
+        values[count][0] = bits > 32 ? (UINT32_C(1) << (bits - 32)) - 1 : 0;
+        values[count][1] = bits >= 32 ? UINT32_C(0xFFFFFFFF) : (UINT32_C(1) << bits) - 1;
+        count++;
+    }
+    values[count][0] = 0x0A;
+    values[count][1] = UINT32_C(0x5A5A5A5A);
+    count++;
+
+    for(i=0;i<count;i++) {
+        hi = values[i][0];
+        lo = values[i][1];
+        for(bits=36;bits>0 && (test_coded_shift(hi, lo, bits - 1) & 1) == 0;bits--) { }
+        if(bits <= 7) len = 1;
+        else if(bits <= 11) len = 2;
+        else if(bits <= 16) len = 3;
+        else if(bits <= 21) len = 4;
+        else if(bits <= 26) len = 5;
+        else if(bits <= 31) len = 6;
+        else len = 7;
+
+        if(len == 1) {
+            expected[0] = (tflac_u8)lo;
+        } else {
+            expected[0] = (tflac_u8)((0xFF00 >> len) | test_coded_shift(hi, lo, 6 * (len - 1)));
+            for(k=1;k<len;k++) {
+                expected[k] = (tflac_u8)(0x80 | (test_coded_shift(hi, lo, 6 * (len - 1 - k)) & 0x3F));
+            }
+        }
+
+        memset(got, 0, sizeof(got));
+        tflac_bitwriter_init(&bw);
+        bw.buffer = got;
+        bw.len = sizeof(got);
+        if(tflac_encode_coded_number(&bw, hi, lo) != 0 || tflac_bitwriter_flush(&bw) != 0) {
+            printf("  %x%08x: encode error\n", hi, lo);
+            r = 1;
+            continue;
+        }
+        if(bw.pos != len || memcmp(expected, got, len) != 0) {
+            printf("  %x%08x: expected %u bytes got %u\n", hi, lo, len, bw.pos);
+            r = 1;
+        }
+    }
+
+    printf("  %s\n", passfail[r]);
+    return r;
+}
+
+/* a variable blocksize stream that's a single short frame still has to
+ * report a minimum blocksize of at least 16 in STREAMINFO, and LPC
+ * subframes turn variable blocksizes off */
+static int test_variable_streaminfo(void) {
+    static tflac_s32 in[2 * 4096];
+    static tflac_u8 buffer[TFLAC_SIZE_FRAME(4096, 2, 16)];
+    void* memory = NULL;
+    tflac t;
+    tflac_u32 used = 0;
+    tflac_u32 min = 0;
+    tflac_u32 max = 0;
+    tflac_u32 i = 0;
+    int r = 0;
+
+    printf("test_variable_streaminfo:\n");
+    memory = malloc(tflac_size_memory(4096));
+    if(memory == NULL) abort();
+
+    tflac_init(&t);
+    t.blocksize = 4096;
+    t.samplerate = 44100;
+    t.channels = 2;
+    t.bitdepth = 16;
+    tflac_set_variable_blocksize(&t, 1);
+    if(tflac_validate(&t, memory, tflac_size_memory(4096)) != 0) {
+        printf("  validate error\n");
+        r = 1;
+    } else {
+        for(i=0;i<2 * 4096;i++) in[i] = (tflac_s32)(rand() % 2001) - 1000;
+        if(tflac_encode_s32i(&t, 10, in, buffer, sizeof(buffer), &used) != 0 ||
+           tflac_encode_streaminfo(&t, 1, buffer, sizeof(buffer), &used) != 0) {
+            printf("  encode error\n");
+            r = 1;
+        } else {
+            min = ((tflac_u32)buffer[4] << 8) | buffer[5];
+            max = ((tflac_u32)buffer[6] << 8) | buffer[7];
+            if(min != 4096 || max != 4096) {
+                printf("  one frame: expected 4096/4096 got %u/%u\n", min, max);
+                r = 1;
+            }
+        }
+
+    }
+
+    /* a block only counts towards the minimum once another frame
+     * follows it */
+    tflac_init(&t);
+    t.blocksize = 4096;
+    t.samplerate = 44100;
+    t.channels = 2;
+    t.bitdepth = 16;
+    tflac_set_variable_blocksize(&t, 1);
+    if(tflac_validate(&t, memory, tflac_size_memory(4096)) != 0) {
+        printf("  validate error\n");
+        r = 1;
+    } else {
+        if(tflac_encode_s32i(&t, 2048, in, buffer, sizeof(buffer), &used) != 0 ||
+           tflac_encode_s32i(&t, 12, in, buffer, sizeof(buffer), &used) != 0 ||
+           tflac_encode_streaminfo(&t, 1, buffer, sizeof(buffer), &used) != 0) {
+            printf("  encode error\n");
+            r = 1;
+        } else {
+            min = ((tflac_u32)buffer[4] << 8) | buffer[5];
+            max = ((tflac_u32)buffer[6] << 8) | buffer[7];
+            if(min != 2048 || max != 2048) {
+                printf("  two frames: expected 2048/2048 got %u/%u\n", min, max);
+                r = 1;
+            }
+        }
+    }
+
+    /* the split estimate doesn't know about LPC, tflac_validate turns
+     * variable blocksizes off with it */
+    tflac_init(&t);
+    t.blocksize = 4096;
+    t.samplerate = 44100;
+    t.channels = 2;
+    t.bitdepth = 16;
+    tflac_set_variable_blocksize(&t, 1);
+    tflac_set_lpc_subframe(&t, 1);
+    if(tflac_validate(&t, memory, tflac_size_memory(4096)) != 0) {
+        printf("  validate error\n");
+        r = 1;
+    } else if(tflac_get_variable_blocksize(&t) != 0) {
+        printf("  LPC: variable blocksize still enabled\n");
+        r = 1;
+    }
+    free(memory);
+
+    printf("  %s\n", passfail[r]);
+    return r;
+}
+
 int main(void) {
     int r = 0;
     samples_unaligned = (tflac_s32*)malloc(15 + (sizeof(tflac_s32) * 16));
     if(samples_unaligned == NULL) abort();
     residuals_unaligned = (tflac_s32*)malloc(15 + (sizeof(tflac_s32) * 16));
     if(residuals_unaligned == NULL) abort();
+    stereo_residuals_unaligned = (tflac_s32*)malloc(15 + (sizeof(tflac_s32) * 16));
+    if(stereo_residuals_unaligned == NULL) abort();
 
     printf("sizeof(tflac_uint): %u\n",(tflac_u32)sizeof(tflac_uint));
 
     samples = align_ptr(samples_unaligned);
     residuals = align_ptr(residuals_unaligned);
+    stereo_residuals = align_ptr(stereo_residuals_unaligned);
 
     r |= test_order1_wide_std_zero();
     r |= test_order2_wide_std_zero();
@@ -477,7 +1879,225 @@ int main(void) {
     r |= STANDARD_TEST(4,sse4_1)();
 #endif
 
+#ifdef TFLAC_ENABLE_AVX2
+    r |= STANDARD_TEST(0,avx2)();
+    r |= STANDARD_TEST(1,avx2)();
+    r |= STANDARD_TEST(2,avx2)();
+    r |= STANDARD_TEST(3,avx2)();
+    r |= STANDARD_TEST(4,avx2)();
+#endif
+
+#ifdef TFLAC_ENABLE_AVX512
+    r |= STANDARD_TEST(0,avx512)();
+    r |= STANDARD_TEST(1,avx512)();
+    r |= STANDARD_TEST(2,avx512)();
+    r |= STANDARD_TEST(3,avx512)();
+    r |= STANDARD_TEST(4,avx512)();
+#endif
+
+#ifdef TFLAC_ENABLE_SSE4_1
+    r |= STANDARD_TEST(1,wide_sse4_1)();
+    r |= STANDARD_TEST(2,wide_sse4_1)();
+    r |= STANDARD_TEST(3,wide_sse4_1)();
+    r |= STANDARD_TEST(4,wide_sse4_1)();
+#endif
+
+#ifdef TFLAC_ENABLE_AVX2
+    r |= STANDARD_TEST(1,wide_avx2)();
+    r |= STANDARD_TEST(2,wide_avx2)();
+    r |= STANDARD_TEST(3,wide_avx2)();
+    r |= STANDARD_TEST(4,wide_avx2)();
+#endif
+
+#ifdef TFLAC_ENABLE_NEON
+    r |= STANDARD_TEST(0,neon)();
+    r |= STANDARD_TEST(1,neon)();
+    r |= STANDARD_TEST(2,neon)();
+    r |= STANDARD_TEST(3,neon)();
+    r |= STANDARD_TEST(4,neon)();
+    r |= STANDARD_TEST(1,wide_neon)();
+    r |= STANDARD_TEST(2,wide_neon)();
+    r |= STANDARD_TEST(3,wide_neon)();
+    r |= STANDARD_TEST(4,wide_neon)();
+#endif
+
+#ifdef TFLAC_ENABLE_SIMD128
+    r |= STANDARD_TEST(0,simd128)();
+    r |= STANDARD_TEST(1,simd128)();
+    r |= STANDARD_TEST(2,simd128)();
+    r |= STANDARD_TEST(3,simd128)();
+    r |= STANDARD_TEST(4,simd128)();
+#endif
+
+    r |= FUSED_TEST(std)();
+
+#if defined(TFLAC_ENABLE_SSE2) || defined(TFLAC_ENABLE_SSSE3) || defined(TFLAC_ENABLE_SSE4_1)
+    r |= FUSED_TEST(sse2)();
+#endif
+
+#ifdef TFLAC_ENABLE_AVX2
+    r |= FUSED_TEST(avx2)();
+#endif
+
+#ifdef TFLAC_ENABLE_AVX512
+    r |= FUSED_TEST(avx512)();
+#endif
+
+#ifdef TFLAC_ENABLE_NEON
+    r |= FUSED_TEST(neon)();
+#endif
+
+#ifdef TFLAC_ENABLE_SIMD128
+    r |= FUSED_TEST(simd128)();
+#endif
+
+    r |= DECORRELATE_TEST(std)();
+
+#if defined(TFLAC_ENABLE_SSE2) || defined(TFLAC_ENABLE_SSSE3) || defined(TFLAC_ENABLE_SSE4_1)
+    r |= DECORRELATE_TEST(sse2)();
+#endif
+
+#ifdef TFLAC_ENABLE_AVX2
+    r |= DECORRELATE_TEST(avx2)();
+#endif
+
+#ifdef TFLAC_ENABLE_NEON
+    r |= DECORRELATE_TEST(neon)();
+#endif
+
+#ifdef TFLAC_ENABLE_SIMD128
+    r |= DECORRELATE_TEST(simd128)();
+#endif
+
+    r |= CRC_TEST(std)();
+
+#ifdef TFLAC_ENABLE_PCLMUL
+    r |= CRC_TEST(pclmul)();
+#endif
+
+    r |= test_crc16_frame();
+
+    r |= MD5_TEST(std)();
+
+#if defined(TFLAC_ENABLE_SSE2) || defined(TFLAC_ENABLE_SSSE3) || defined(TFLAC_ENABLE_SSE4_1)
+    r |= MD5_TEST(sse2)();
+#endif
+
+#ifdef TFLAC_ENABLE_AVX2
+    r |= MD5_TEST(avx2)();
+#endif
+
+    r |= test_bitwriter_rice();
+
+#ifdef TFLAC_ENABLE_SSE4_1
+    {
+        const test_cfr_func funcs[4] = {
+            tflac_cfr_order1_wide_sse4_1,
+            tflac_cfr_order2_wide_sse4_1,
+            tflac_cfr_order3_wide_sse4_1,
+            tflac_cfr_order4_wide_sse4_1
+        };
+        r |= test_cfr_wide("sse4_1", funcs);
+    }
+#endif
+
+#ifdef TFLAC_ENABLE_AVX2
+    {
+        const test_cfr_func funcs[4] = {
+            tflac_cfr_order1_wide_avx2,
+            tflac_cfr_order2_wide_avx2,
+            tflac_cfr_order3_wide_avx2,
+            tflac_cfr_order4_wide_avx2
+        };
+        r |= test_cfr_wide("avx2", funcs);
+    }
+#endif
+
+#ifdef TFLAC_ENABLE_NEON
+    {
+        const test_cfr_func funcs[4] = {
+            tflac_cfr_order1_wide_neon,
+            tflac_cfr_order2_wide_neon,
+            tflac_cfr_order3_wide_neon,
+            tflac_cfr_order4_wide_neon
+        };
+        r |= test_cfr_wide("neon", funcs);
+    }
+#endif
+
+#ifdef TFLAC_ENABLE_AVX512
+    {
+        const test_cfr_func funcs[5] = {
+            tflac_cfr_order0_avx512,
+            tflac_cfr_order1_avx512,
+            tflac_cfr_order2_avx512,
+            tflac_cfr_order3_avx512,
+            tflac_cfr_order4_avx512
+        };
+        r |= test_cfr_lengths("avx512", funcs, tflac_cfr_fused_avx512);
+    }
+#endif
+
+#ifdef TFLAC_ENABLE_SIMD128
+    {
+        const test_cfr_func funcs[5] = {
+            tflac_cfr_order0_simd128,
+            tflac_cfr_order1_simd128,
+            tflac_cfr_order2_simd128,
+            tflac_cfr_order3_simd128,
+            tflac_cfr_order4_simd128
+        };
+        r |= test_cfr_lengths("simd128", funcs, tflac_cfr_fused_simd128);
+    }
+#endif
+
+    r |= test_fold_residuals("std", tflac_fold_residuals_std);
+
+#if defined(TFLAC_ENABLE_SSE2) || defined(TFLAC_ENABLE_SSSE3) || defined(TFLAC_ENABLE_SSE4_1)
+    r |= test_fold_residuals("sse2", tflac_fold_residuals_sse2);
+#endif
+
+#ifdef TFLAC_ENABLE_AVX2
+    r |= test_fold_residuals("avx2", tflac_fold_residuals_avx2);
+#endif
+
+#ifdef TFLAC_ENABLE_NEON
+    r |= test_fold_residuals("neon", tflac_fold_residuals_neon);
+#endif
+
+    r |= test_md5_pack("std", tflac_md5_pack_s16_std, tflac_md5_pack_s32_std);
+
+#if defined(TFLAC_ENABLE_SSE2) || defined(TFLAC_ENABLE_SSSE3) || defined(TFLAC_ENABLE_SSE4_1)
+    r |= test_md5_pack("sse2", tflac_md5_pack_s16_sse2, tflac_md5_pack_s32_sse2);
+#endif
+
+#ifdef TFLAC_ENABLE_SSSE3
+    r |= test_md5_pack("ssse3", NULL, tflac_md5_pack_s32_ssse3);
+#endif
+
+#ifdef TFLAC_ENABLE_NEON
+    r |= test_md5_pack("neon", tflac_md5_pack_s16_neon, tflac_md5_pack_s32_neon);
+#endif
+
+    r |= test_stereo_estimate();
+
+    r |= test_rice_parameter_exact();
+
+    r |= test_pick_partition_order();
+    r |= test_search_partition_order();
+
+    r |= test_coded_number();
+    r |= test_variable_streaminfo();
+
+    r |= test_lpc_quantize();
+    r |= test_max_lpc_order();
+
+#ifndef TFLAC_32BIT_ONLY
+    r |= test_lpc_residual();
+#endif
+
     free(samples_unaligned);
     free(residuals_unaligned);
+    free(stereo_residuals_unaligned);
     return r;
 }
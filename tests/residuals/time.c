@@ -30,6 +30,33 @@ static LARGE_INTEGER frequency;
 #endif
 static tflac_u64 result;
 
+/* the fused calculators only produce the 5 error sums, we time
+ * them through a wrapper with the same signature as the others */
+static tflac_u64 fused_results[5];
+static void (*fused_cfr)(tflac_u32, const tflac_s32* TFLAC_RESTRICT,
+  tflac_u64* TFLAC_RESTRICT) = NULL;
+
+static void run_fused(tflac_u32 blocksize, const tflac_s32* TFLAC_RESTRICT s, tflac_s32* TFLAC_RESTRICT r, tflac_u64* TFLAC_RESTRICT res) {
+    fused_cfr(blocksize, s, fused_results);
+    (void)r;
+    (void)res;
+}
+
+/* same idea for the CRC-16 functions, they run over the samples
+ * buffer as bytes, about the size of a large 32-bit frame */
+static tflac_u16 crc_result;
+static tflac_u16 (*crc16)(const tflac_u8*, tflac_u32, tflac_u16) = NULL;
+
+static void run_crc16(tflac_u32 blocksize, const tflac_s32* TFLAC_RESTRICT s, tflac_s32* TFLAC_RESTRICT r, tflac_u64* TFLAC_RESTRICT res) {
+    crc_result = crc16((const tflac_u8*)s, blocksize * sizeof(tflac_s32), 0);
+    (void)r;
+    (void)res;
+}
+
+static tflac_u32 sum_times(const tflac_u32* times) {
+    return times[0] + times[1] + times[2] + times[3] + times[4];
+}
+
 static void test_reset(void) {
     tflac_u32 i = 0;
     for(i=0;i<BLOCKSIZE;i++) {
@@ -135,6 +162,19 @@ int main(void) {
 #endif
 #ifdef TFLAC_ENABLE_SSE4_1
     tflac_u32 sse4_1_times[5];
+#endif
+#ifdef TFLAC_ENABLE_AVX2
+    tflac_u32 avx2_times[5];
+#endif
+#ifdef TFLAC_ENABLE_AVX512
+    tflac_u32 avx512_times[5];
+#endif
+#ifdef TFLAC_ENABLE_NEON
+    tflac_u32 neon_times[5];
+    tflac_u32 wneon_times[5];
+#endif
+#ifdef TFLAC_ENABLE_SIMD128
+    tflac_u32 simd128_times[5];
 #endif
     samples_unaligned = (tflac_s32*)malloc(15 + (sizeof(tflac_s32) * BLOCKSIZE));
     if(samples_unaligned == NULL) abort();
@@ -205,10 +245,116 @@ int main(void) {
     printf("|%6s|%13u|%13u|%13u|%14u|%14u|\n",
       "sse4_1", sse4_1_times[0], sse4_1_times[1], sse4_1_times[2], sse4_1_times[3], sse4_1_times[4]);
 
+#endif
+
+#ifdef TFLAC_ENABLE_AVX2
+
+    avx2_times[0] = time_cfr(tflac_cfr_order0_avx2);
+    avx2_times[1] = time_cfr(tflac_cfr_order1_avx2);
+    avx2_times[2] = time_cfr(tflac_cfr_order2_avx2);
+    avx2_times[3] = time_cfr(tflac_cfr_order3_avx2);
+    avx2_times[4] = time_cfr(tflac_cfr_order4_avx2);
+    printf("|%6s|%13u|%13u|%13u|%14u|%14u|\n",
+      "avx2", avx2_times[0], avx2_times[1], avx2_times[2], avx2_times[3], avx2_times[4]);
+
+#endif
+
+#ifdef TFLAC_ENABLE_AVX512
+
+    avx512_times[0] = time_cfr(tflac_cfr_order0_avx512);
+    avx512_times[1] = time_cfr(tflac_cfr_order1_avx512);
+    avx512_times[2] = time_cfr(tflac_cfr_order2_avx512);
+    avx512_times[3] = time_cfr(tflac_cfr_order3_avx512);
+    avx512_times[4] = time_cfr(tflac_cfr_order4_avx512);
+    printf("|%6s|%13u|%13u|%13u|%14u|%14u|\n",
+      "avx512", avx512_times[0], avx512_times[1], avx512_times[2], avx512_times[3], avx512_times[4]);
+
+#endif
+
+#ifdef TFLAC_ENABLE_NEON
+
+    neon_times[0] = time_cfr(tflac_cfr_order0_neon);
+    neon_times[1] = time_cfr(tflac_cfr_order1_neon);
+    neon_times[2] = time_cfr(tflac_cfr_order2_neon);
+    neon_times[3] = time_cfr(tflac_cfr_order3_neon);
+    neon_times[4] = time_cfr(tflac_cfr_order4_neon);
+    printf("|%6s|%13u|%13u|%13u|%14u|%14u|\n",
+      "neon", neon_times[0], neon_times[1], neon_times[2], neon_times[3], neon_times[4]);
+
+    wneon_times[0] = neon_times[0];
+    wneon_times[1] = time_cfr(tflac_cfr_order1_wide_neon);
+    wneon_times[2] = time_cfr(tflac_cfr_order2_wide_neon);
+    wneon_times[3] = time_cfr(tflac_cfr_order3_wide_neon);
+    wneon_times[4] = time_cfr(tflac_cfr_order4_wide_neon);
+    printf("|%6s|%13u|%13u|%13u|%14u|%14u|\n",
+      "wneon", wneon_times[0], wneon_times[1], wneon_times[2], wneon_times[3], wneon_times[4]);
+
+#endif
+
+#ifdef TFLAC_ENABLE_SIMD128
+
+    simd128_times[0] = time_cfr(tflac_cfr_order0_simd128);
+    simd128_times[1] = time_cfr(tflac_cfr_order1_simd128);
+    simd128_times[2] = time_cfr(tflac_cfr_order2_simd128);
+    simd128_times[3] = time_cfr(tflac_cfr_order3_simd128);
+    simd128_times[4] = time_cfr(tflac_cfr_order4_simd128);
+    printf("|%6s|%13u|%13u|%13u|%14u|%14u|\n",
+      "simd", simd128_times[0], simd128_times[1], simd128_times[2], simd128_times[3], simd128_times[4]);
+
 #endif
 
     printf("|______________________________________________________________________________|\n");
 
+    /* compare running each order separately against the fused calculators */
+    printf(".______________________________.\n");
+    printf("|%6s|%11s|%11s|\n","","separate","fused");
+    printf("|------|-----------|-----------|\n");
+
+    fused_cfr = tflac_cfr_fused_std;
+    printf("|%6s|%11u|%11u|\n", "std", sum_times(std_times), time_cfr(run_fused));
+
+#if defined(TFLAC_ENABLE_SSE2)
+    fused_cfr = tflac_cfr_fused_sse2;
+    printf("|%6s|%11u|%11u|\n", "sse2", sum_times(sse2_times), time_cfr(run_fused));
+#endif
+
+#ifdef TFLAC_ENABLE_AVX2
+    fused_cfr = tflac_cfr_fused_avx2;
+    printf("|%6s|%11u|%11u|\n", "avx2", sum_times(avx2_times), time_cfr(run_fused));
+#endif
+
+#ifdef TFLAC_ENABLE_AVX512
+    fused_cfr = tflac_cfr_fused_avx512;
+    printf("|%6s|%11u|%11u|\n", "avx512", sum_times(avx512_times), time_cfr(run_fused));
+#endif
+
+#ifdef TFLAC_ENABLE_NEON
+    fused_cfr = tflac_cfr_fused_neon;
+    printf("|%6s|%11u|%11u|\n", "neon", sum_times(neon_times), time_cfr(run_fused));
+#endif
+
+#ifdef TFLAC_ENABLE_SIMD128
+    fused_cfr = tflac_cfr_fused_simd128;
+    printf("|%6s|%11u|%11u|\n", "simd", sum_times(simd128_times), time_cfr(run_fused));
+#endif
+
+    printf("|______________________________|\n");
+
+    /* compare the slicing-by-8 table CRC against carry-less multiply */
+    printf(".__________________.\n");
+    printf("|%6s|%11s|\n","","crc16");
+    printf("|------|-----------|\n");
+
+    crc16 = tflac_crc16_std;
+    printf("|%6s|%11u|\n", "std", time_cfr(run_crc16));
+
+#ifdef TFLAC_ENABLE_PCLMUL
+    crc16 = tflac_crc16_pclmul;
+    printf("|%6s|%11u|\n", "pclmul", time_cfr(run_crc16));
+#endif
+
+    printf("|__________________|\n");
+
 
     free(samples_unaligned);
     free(residuals_unaligned);
@@ -85,6 +85,16 @@ use the same block size), a buffer to encode data to, and your buffer's length.
 
 You can now write out used bytes of buffer.
 
+Calling tflac_set_variable_blocksize(&t, 1) before tflac_validate makes a
+variable blocksize stream instead. Frame headers carry sample numbers,
+blocks can be any size up to the blocksize, and each block may be
+split into halves or quarters when a quick estimate says that's smaller
+(used covers every frame written). Blocks are only ever split, never
+merged, so the blocksize you encode with is the longest block you'll get.
+The estimate only looks at fixed predictors, so with LPC subframes
+enabled tflac_validate turns variable blocksizes back off, check
+tflac_get_variable_blocksize afterwards to see which one you got.
+
 The library also has a convenience function for creating a STREAMINFO block:
 
     tflac_streaminfo(&t, 1,  buffer, bufferlen, &used);
@@ -136,6 +146,7 @@ Other metadata blocks are out-of-scope, as is writing the "fLaC" stream marker.
 #define TFLAC_SIZE_STREAMINFO 38UL
 #define TFLAC_SIZE_FRAME(blocksize, channels, bitdepth) \
     (UINT32_C(18) + UINT32_C(8) + UINT32_C(channels) + \
+      (UINT32_C(3) * (UINT32_C(18) + UINT32_C(channels))) + UINT32_C(4) + \
       (( \
         (UINT32_C(blocksize) * UINT32_C(bitdepth) * (UINT32_C(channels) * (UINT32_C(channels) != (UINT32_C(2))))) + \
         (UINT32_C(blocksize) * UINT32_C(bitdepth) * (UINT32_C(channels) == UINT32_C(2))) + \
@@ -143,7 +154,10 @@ Other metadata blocks are out-of-scope, as is writing the "fLaC" stream marker.
         7 \
       ) / 8) )
 
-#define TFLAC_SIZE_MEMORY(blocksize) (15UL + (5UL * ((15UL + (UINT32_C(blocksize) * 4UL)) & UINT32_C(0xFFFFFFF0))))
+#define TFLAC_SIZE_MEMORY(blocksize) (15UL + (4UL * ((15UL + (UINT32_C(blocksize) * 4UL)) & UINT32_C(0xFFFFFFF0))) + \
+  ((15UL + (UINT32_C(blocksize) * 8UL)) & UINT32_C(0xFFFFFFF0)))
+
+#define TFLAC_MAX_LPC_ORDER 32
 
 
 #ifdef __cplusplus
@@ -339,10 +353,21 @@ enum TFLAC_CHANNEL_MODE {
     TFLAC_CHANNEL_SIDE_RIGHT   = 2,
     TFLAC_CHANNEL_MID_SIDE     = 3,
     TFLAC_CHANNEL_MODE_COUNT   = 4,
+    TFLAC_CHANNEL_AUTO         = 0xFF, /* estimate the best mode for every frame */
 };
 
 typedef enum TFLAC_CHANNEL_MODE TFLAC_CHANNEL_MODE;
 
+/* how samples were passed in, given to md5_push */
+enum TFLAC_SAMPLE_FORMAT {
+    TFLAC_SAMPLES_S16P = 0,
+    TFLAC_SAMPLES_S16I = 1,
+    TFLAC_SAMPLES_S32P = 2,
+    TFLAC_SAMPLES_S32I = 3
+};
+
+typedef enum TFLAC_SAMPLE_FORMAT TFLAC_SAMPLE_FORMAT;
+
 struct tflac_bitwriter {
     tflac_uint val;
     tflac_u32  bits;
@@ -350,6 +375,11 @@ struct tflac_bitwriter {
     tflac_u32  len;
     tflac_u32  tot;
     tflac_u8*  buffer;
+    /* when set, committed bytes get folded into crc16 as the
+     * frame is written, everything before crc_pos is done */
+    tflac_u16 (*calculate_crc16)(const tflac_u8*, tflac_u32 len, tflac_u16 crc16);
+    tflac_u32  crc_pos;
+    tflac_u16  crc16;
 };
 
 typedef struct tflac_bitwriter tflac_bitwriter;
@@ -375,15 +405,24 @@ struct tflac {
     tflac_u32 bitdepth;
 
     tflac_u8 channel_mode;
+    tflac_u8 cur_channel_mode; /* the mode used for the current frame */
     tflac_u8 max_rice_value; /* defaults to 14 if bitdepth < 16; 30 otherwise */
     tflac_u8 min_partition_order; /* defaults to 0 */
     tflac_u8 max_partition_order; /* defaults to 0, should be <=8 to be in streamable subset */
     tflac_u8 partition_order;
+    tflac_u8 enable_partition_search; /* defaults to 0, search between min and max partition order */
+    tflac_u8 enable_exact_rice; /* defaults to 0, check the actual cost of nearby rice parameters */
+    tflac_u8 enable_variable_blocksize; /* defaults to 0, split blocks into halves or quarters when it looks cheaper,
+    blocks are never merged. tflac_validate turns it off when LPC subframes are enabled */
 
     tflac_u8 enable_constant_subframe;
     tflac_u8 enable_fixed_subframe;
+    tflac_u8 enable_lpc_subframe; /* defaults to 0 */
     tflac_u8 enable_md5;
 
+    tflac_u8 max_lpc_order; /* defaults to 8, clamped to 1-32, should be <=12 to be in streamable subset */
+    tflac_u8 lpc_precision; /* quantized coefficient precision, 0 = pick based on blocksize and bitdepth */
+
     tflac_u32 frame_header;
 
     tflac_u64 samplecount;
@@ -395,12 +434,24 @@ struct tflac {
     tflac_u32 min_frame_size;
     tflac_u32 max_frame_size;
 
+    tflac_u32 min_blocksize; /* not counting the last frame */
+    tflac_u32 max_blocksize;
+    tflac_u32 last_blocksize;
+
     tflac_u32 wasted_bits;
     tflac_u32 subframe_bitdepth;
     tflac_u8 constant;
 
     tflac_u8 md5_digest[16];
 
+    /* lets something else compute the MD5 (like the helper thread in
+     * tflac_mt.h). When set, samples get handed to md5_push instead of
+     * being hashed, and tflac_finalize calls md5_wait first, which has
+     * to leave the hashed state in md5_ctx */
+    void (*md5_push)(struct tflac*, tflac_u32 format, tflac_u32 blocksize, const void* samples);
+    void (*md5_wait)(struct tflac*);
+    void* md5_userdata;
+
     void (*calculate_order[5])(
       tflac_u32 blocksize,
       const tflac_s32* TFLAC_RESTRICT,
@@ -408,8 +459,89 @@ struct tflac {
       tflac_u64* TFLAC_RESTRICT
     );
 
+    /* calculates all 5 orders at once, NULL if any order needs
+     * the wide calculators */
+    void (*calculate_fused)(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT,
+      tflac_u64* TFLAC_RESTRICT
+    );
+
+    /* stereo decorrelation kernels, these also gather what's
+     * needed to detect wasted bits and constant subframes */
+    void (*decorrelate_s16i)(
+      tflac_u32 blocksize,
+      tflac_u32 op0,
+      tflac_u32 op1,
+      const tflac_s16*,
+      tflac_s32* TFLAC_RESTRICT,
+      tflac_s32* TFLAC_RESTRICT,
+      tflac_u32*
+    );
+    void (*decorrelate_s16p)(
+      tflac_u32 blocksize,
+      tflac_u32 op,
+      const tflac_s16*,
+      const tflac_s16*,
+      tflac_s32* TFLAC_RESTRICT,
+      tflac_u32*
+    );
+    void (*decorrelate_s32i)(
+      tflac_u32 blocksize,
+      tflac_u32 op0,
+      tflac_u32 op1,
+      const tflac_s32*,
+      tflac_s32* TFLAC_RESTRICT,
+      tflac_s32* TFLAC_RESTRICT,
+      tflac_u32*
+    );
+    void (*decorrelate_s32p)(
+      tflac_u32 blocksize,
+      tflac_u32 op,
+      const tflac_s32*,
+      const tflac_s32*,
+      tflac_s32* TFLAC_RESTRICT,
+      tflac_u32*
+    );
+
+    /* frame footer CRC-16 */
+    tflac_u16 (*calculate_crc16)(
+      const tflac_u8*,
+      tflac_u32 len,
+      tflac_u16 crc16
+    );
+
+    /* zig-zag folds residuals for the Rice writer and sums up
+     * each partition at the highest partition order */
+    void (*fold_residuals)(
+      tflac_u32 blocksize,
+      tflac_u32 predictor_order,
+      tflac_u32 partition_order,
+      const tflac_s32* TFLAC_RESTRICT,
+      tflac_u32* TFLAC_RESTRICT,
+      tflac_u64* TFLAC_RESTRICT
+    );
+
     tflac_u64 residual_errors[5];
-    tflac_s32* residuals[5]; /* orders 0, 1, 2, 3, 4 */
+    tflac_u8 residual_errors_ready; /* the whole block's sums were already
+    put together while scoring a split, so tflac_cfr can be skipped */
+    tflac_s32* stereo_residuals; /* interleaved stereo decorrelates the
+    second channel here while doing the first */
+    tflac_u32 stereo_info[6];
+    tflac_s32* residuals[5]; /* orders 0, 1, 2, 3, 4 - orders 1-4 share
+    a single buffer with lpc_residuals, only the chosen one gets stored */
+
+    /* the current LPC subframe candidate */
+    tflac_u8 lpc_order;
+    tflac_u8 lpc_shift;
+    tflac_u8 lpc_coefficient_precision;
+    tflac_s32 lpc_coefficients[TFLAC_MAX_LPC_ORDER];
+    tflac_u64 lpc_residual_error;
+    tflac_s32* lpc_residuals;
+
+    tflac_u64* partition_sums;
+    tflac_u32* folded_residuals; /* the residuals being Rice-coded,
+    already zig-zagged */
 
 #ifndef TFLAC_DISABLE_COUNTERS
     tflac_u64 subframe_type_counts[8][TFLAC_SUBFRAME_TYPE_COUNT]; /* stores stats on what
@@ -435,6 +567,26 @@ int tflac_default_ssse3(int enable);
 TFLAC_PUBLIC
 int tflac_default_sse4_1(int enable);
 
+TFLAC_PUBLIC
+int tflac_default_avx2(int enable);
+
+/* AVX-512 fixed-order calculators, everything else stays on AVX2 */
+TFLAC_PUBLIC
+int tflac_default_avx512(int enable);
+
+/* carry-less multiply CRC-16 (PCLMULQDQ + SSSE3) */
+TFLAC_PUBLIC
+int tflac_default_pclmul(int enable);
+
+/* NEON on AArch64, this is already the default when it's compiled in */
+TFLAC_PUBLIC
+int tflac_default_neon(int enable);
+
+/* WebAssembly SIMD128 (fixed-order calculators and stereo decorrelation),
+ * also the default when it's compiled in */
+TFLAC_PUBLIC
+int tflac_default_simd128(int enable);
+
 /* you can also enable sse2 on the individual encoder, down below */
 
 /* returns the maximum number of bytes to store a whole FLAC frame */
@@ -477,10 +629,48 @@ int tflac_encode_s32p(tflac *, tflac_u32 blocksize, tflac_s32** samples, void* b
 TFLAC_PUBLIC
 int tflac_encode_s32i(tflac *, tflac_u32 blocksize, tflac_s32* samples, void* buffer, tflac_u32 len, tflac_u32* used);
 
-/* computes the final MD5 digest, if it was enabled */
+/* computes the final MD5 digest, if it was enabled. If md5_push is set
+ * this waits for md5_wait first */
 TFLAC_PUBLIC
 void tflac_finalize(tflac *);
 
+/* adds samples to the MD5 checksum without encoding them, for when
+ * frames are encoded by other tflac instances (like in tflac_mt.h).
+ * does nothing if MD5 is disabled */
+TFLAC_PUBLIC
+void tflac_update_md5_s16p(tflac *, tflac_u32 blocksize, tflac_s16** samples);
+
+TFLAC_PUBLIC
+void tflac_update_md5_s16i(tflac *, tflac_u32 blocksize, tflac_s16* samples);
+
+TFLAC_PUBLIC
+void tflac_update_md5_s32p(tflac *, tflac_u32 blocksize, tflac_s32** samples);
+
+TFLAC_PUBLIC
+void tflac_update_md5_s32i(tflac *, tflac_u32 blocksize, tflac_s32* samples);
+
+/* same as above for several encoders in one call, count encoders each
+ * with their own blocksize and samples. MD5 can't be split up within one
+ * stream, but separate streams get hashed side by side, up to 8 at once
+ * with SSE2/AVX2 (whatever tflac_detect_cpu or tflac_default_* picked).
+ * Encoders with MD5 disabled are skipped */
+TFLAC_PUBLIC
+void tflac_update_md5_multi_s16p(tflac** t, tflac_u32 count, const tflac_u32* blocksizes, tflac_s16*** samples);
+
+TFLAC_PUBLIC
+void tflac_update_md5_multi_s16i(tflac** t, tflac_u32 count, const tflac_u32* blocksizes, tflac_s16** samples);
+
+TFLAC_PUBLIC
+void tflac_update_md5_multi_s32p(tflac** t, tflac_u32 count, const tflac_u32* blocksizes, tflac_s32*** samples);
+
+TFLAC_PUBLIC
+void tflac_update_md5_multi_s32i(tflac** t, tflac_u32 count, const tflac_u32* blocksizes, tflac_s32** samples);
+
+/* records a frame that was encoded by another tflac instance, updates
+ * the frame number, sample count, and min/max frame sizes */
+TFLAC_PUBLIC
+void tflac_add_frame(tflac *, tflac_u32 blocksize, tflac_u32 frame_size);
+
 /* encode a STREAMINFO block */
 TFLAC_PUBLIC
 int tflac_encode_streaminfo(const tflac *, tflac_u32 lastflag, void* buffer, tflac_u32 len, tflac_u32* used);
@@ -516,9 +706,32 @@ void tflac_set_constant_subframe(tflac* t, tflac_u32 enable);
 TFLAC_PUBLIC
 void tflac_set_fixed_subframe(tflac* t, tflac_u32 enable);
 
+TFLAC_PUBLIC
+void tflac_set_partition_search(tflac* t, tflac_u32 enable);
+
+TFLAC_PUBLIC
+void tflac_set_exact_rice(tflac* t, tflac_u32 enable);
+
+TFLAC_PUBLIC
+void tflac_set_variable_blocksize(tflac* t, tflac_u32 enable);
+
+TFLAC_PUBLIC
+void tflac_set_lpc_subframe(tflac* t, tflac_u32 enable);
+
+TFLAC_PUBLIC
+void tflac_set_max_lpc_order(tflac* t, tflac_u32 max_lpc_order);
+
+TFLAC_PUBLIC
+void tflac_set_lpc_precision(tflac* t, tflac_u32 lpc_precision);
+
 TFLAC_PUBLIC
 void tflac_set_enable_md5(tflac* t, tflac_u32 enable);
 
+/* sets the frame number used in the next frame header, for when
+ * frames are handed out to several tflac instances */
+TFLAC_PUBLIC
+void tflac_set_frameno(tflac* t, tflac_u32 frameno);
+
 /* one of the few setters that can return an error, try
  * to set the default to use sse2. returns 0 on success,
  * 1 on error (because SSE2 support was not compiled */
@@ -531,6 +744,21 @@ tflac_u32 tflac_enable_ssse3(tflac* t, tflac_u32 enable);
 TFLAC_PUBLIC
 tflac_u32 tflac_enable_sse4_1(tflac* t, tflac_u32 enable);
 
+TFLAC_PUBLIC
+tflac_u32 tflac_enable_avx2(tflac* t, tflac_u32 enable);
+
+TFLAC_PUBLIC
+tflac_u32 tflac_enable_avx512(tflac* t, tflac_u32 enable);
+
+TFLAC_PUBLIC
+tflac_u32 tflac_enable_pclmul(tflac* t, tflac_u32 enable);
+
+TFLAC_PUBLIC
+tflac_u32 tflac_enable_neon(tflac* t, tflac_u32 enable);
+
+TFLAC_PUBLIC
+tflac_u32 tflac_enable_simd128(tflac* t, tflac_u32 enable);
+
 
 /* getters for various fields */
 TFLAC_PURE
@@ -573,10 +801,38 @@ TFLAC_PURE
 TFLAC_PUBLIC
 tflac_u32 tflac_get_fixed_subframe(const tflac* t);
 
+TFLAC_PURE
+TFLAC_PUBLIC
+tflac_u32 tflac_get_partition_search(const tflac* t);
+
+TFLAC_PURE
+TFLAC_PUBLIC
+tflac_u32 tflac_get_exact_rice(const tflac* t);
+
+TFLAC_PURE
+TFLAC_PUBLIC
+tflac_u32 tflac_get_variable_blocksize(const tflac* t);
+
+TFLAC_PURE
+TFLAC_PUBLIC
+tflac_u32 tflac_get_lpc_subframe(const tflac* t);
+
+TFLAC_PURE
+TFLAC_PUBLIC
+tflac_u32 tflac_get_max_lpc_order(const tflac* t);
+
+TFLAC_PURE
+TFLAC_PUBLIC
+tflac_u32 tflac_get_lpc_precision(const tflac* t);
+
 TFLAC_PURE
 TFLAC_PUBLIC
 tflac_u32 tflac_get_enable_md5(const tflac* t);
 
+TFLAC_PURE
+TFLAC_PUBLIC
+tflac_u32 tflac_get_frameno(const tflac* t);
+
 TFLAC_PURE
 TFLAC_PUBLIC
 tflac_u32 tflac_get_enable_sse2(const tflac* t);
@@ -589,6 +845,26 @@ TFLAC_PURE
 TFLAC_PUBLIC
 tflac_u32 tflac_get_enable_sse4_1(const tflac* t);
 
+TFLAC_PURE
+TFLAC_PUBLIC
+tflac_u32 tflac_get_enable_avx2(const tflac* t);
+
+TFLAC_PURE
+TFLAC_PUBLIC
+tflac_u32 tflac_get_enable_avx512(const tflac* t);
+
+TFLAC_PURE
+TFLAC_PUBLIC
+tflac_u32 tflac_get_enable_pclmul(const tflac* t);
+
+TFLAC_PURE
+TFLAC_PUBLIC
+tflac_u32 tflac_get_enable_neon(const tflac* t);
+
+TFLAC_PURE
+TFLAC_PUBLIC
+tflac_u32 tflac_get_enable_simd128(const tflac* t);
+
 
 #ifdef __cplusplus
 }
@@ -670,6 +946,7 @@ tflac_u32 tflac_get_enable_sse4_1(const tflac* t);
 #if defined(_MSC_VER) && _MSC_VER >= 1400
 #include <intrin.h>
 #pragma intrinsic(_BitScanForward)
+#pragma intrinsic(_BitScanReverse)
 #ifdef TFLAC_X64
 #pragma intrinsic(_BitScanForward64)
 #endif
@@ -720,6 +997,67 @@ tflac_u32 tflac_get_enable_sse4_1(const tflac* t);
 
 #endif
 
+
+#ifndef TFLAC_DISABLE_AVX2
+
+#ifdef __AVX2__
+#define TFLAC_ENABLE_AVX2
+#endif
+
+#if defined(_MSC_VER) && _MSC_VER >= 1700 && (defined(TFLAC_X86) || defined(TFLAC_X64))
+#define TFLAC_ENABLE_AVX2
+#endif
+
+#endif
+
+
+#ifndef TFLAC_DISABLE_AVX512
+
+/* the AVX-512 kernels reduce their sums with the AVX2 helpers */
+#if defined(__AVX512F__) && defined(TFLAC_ENABLE_AVX2)
+#define TFLAC_ENABLE_AVX512
+#endif
+
+#if defined(_MSC_VER) && _MSC_VER >= 1920 && defined(TFLAC_ENABLE_AVX2)
+#define TFLAC_ENABLE_AVX512
+#endif
+
+#endif
+
+
+#ifndef TFLAC_DISABLE_PCLMUL
+
+/* the CRC folding also needs pshufb for byte-swapping */
+#if defined(__PCLMUL__) && defined(__SSSE3__)
+#define TFLAC_ENABLE_PCLMUL
+#endif
+
+#if defined(_MSC_VER) && _MSC_VER >= 1500 && (defined(TFLAC_X86) || defined(TFLAC_X64))
+#define TFLAC_ENABLE_PCLMUL
+#endif
+
+#endif
+
+#ifndef TFLAC_DISABLE_NEON
+
+/* NEON is part of the AArch64 baseline, so there's nothing to detect */
+#if (defined(__aarch64__) || defined(_M_ARM64)) && !defined(__ARM_BIG_ENDIAN)
+#define TFLAC_ENABLE_NEON
+#endif
+
+#endif
+
+#ifndef TFLAC_DISABLE_SIMD128
+
+/* WebAssembly SIMD, set by -msimd128. A module using it won't even
+ * load without SIMD support, so this can't be detected at runtime,
+ * you need to build a second module instead */
+#ifdef __wasm_simd128__
+#define TFLAC_ENABLE_SIMD128
+#endif
+
+#endif
+
 #ifdef TFLAC_ENABLE_SSE2
 #include <emmintrin.h>
 #endif
@@ -732,6 +1070,23 @@ tflac_u32 tflac_get_enable_sse4_1(const tflac* t);
 #include <smmintrin.h>
 #endif
 
+#ifdef TFLAC_ENABLE_AVX2
+#include <immintrin.h>
+#endif
+
+#ifdef TFLAC_ENABLE_PCLMUL
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#ifdef TFLAC_ENABLE_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef TFLAC_ENABLE_SIMD128
+#include <wasm_simd128.h>
+#endif
+
 #ifdef TFLAC_32BIT_ONLY
 
 TFLAC_PRIVATE TFLAC_INLINE
@@ -955,15 +1310,23 @@ void tflac_pack_u64be(tflac_u8* d, tflac_u64 n) {
 
 typedef void (*tflac_md5_calculator)(tflac*, void* samples);
 typedef void (*tflac_stereo_decorrelator)(tflac*, tflac_u32 channel, void* samples);
+typedef void (*tflac_stereo_estimator)(tflac*, void* samples);
+
+typedef void (*tflac_decorrelator_int16)(tflac_u32 blocksize, tflac_u32 op, const tflac_s16* left, const tflac_s16* right, tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* info);
+typedef void (*tflac_decorrelator_int32)(tflac_u32 blocksize, tflac_u32 op, const tflac_s32* left, const tflac_s32* right, tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* info);
+typedef void (*tflac_stereo_decorrelator_int16)(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s16* samples, tflac_s32* TFLAC_RESTRICT out0, tflac_s32* TFLAC_RESTRICT out1, tflac_u32* info);
+typedef void (*tflac_stereo_decorrelator_int32)(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s32* samples, tflac_s32* TFLAC_RESTRICT out0, tflac_s32* TFLAC_RESTRICT out1, tflac_u32* info);
 
 struct tflac_encode_params {
     tflac_u32 blocksize;
     tflac_u32 buffer_len;
     void* buffer;
     void* samples;
+    tflac_u32 format;
     tflac_u32 *used;
     tflac_md5_calculator calculate_md5;
     tflac_stereo_decorrelator decorrelate;
+    tflac_stereo_estimator estimate;
 };
 typedef struct tflac_encode_params tflac_encode_params;
 
@@ -984,7 +1347,7 @@ tflac_u32 tflac_max_size_frame(tflac_u32 blocksize, tflac_u32 channels, tflac_u3
      *   2 for frame sync + blocking strategy
      *   1 for block size + sample rate
      *   1 for channel assignment and sample size
-     *   7 for maximum sample number (we use frame number so it's really 6)
+     *   7 for maximum sample number (frame numbers only need 6)
      *   2 for optional 16-bit blocksize
      *   2 for optional 16-bit samplerate
      *   1 for crc8
@@ -1009,8 +1372,10 @@ tflac_u32 tflac_max_size_frame(tflac_u32 blocksize, tflac_u32 channels, tflac_u3
 TFLAC_PUBLIC
 TFLAC_CONST
 tflac_u32 tflac_size_frame(tflac_u32 blocksize, tflac_u32 channels, tflac_u32 bitdepth) {
-    /* pad the max frame size with an extra 8 bytes for bitwriter to overflow into */
-    return 8 + tflac_max_size_frame(blocksize, channels, bitdepth);
+    /* pad the max frame size with an extra 8 bytes for bitwriter to overflow into,
+     * and leave room for 3 more frame headers (and their rounding) in case
+     * variable blocksize mode splits the block into quarters */
+    return 8 + (3 * (18 + channels) + 4) + tflac_max_size_frame(blocksize, channels, bitdepth);
 }
 
 TFLAC_PUBLIC
@@ -1018,7 +1383,9 @@ TFLAC_CONST
 tflac_u32 tflac_size_memory(tflac_u32 blocksize) {
     /* assuming we need everything on a 16-byte alignment */
     return
-      (tflac_u32) UINT32_C(15) + (UINT32_C(5) * ( (UINT32_C(15) + (blocksize * UINT32_C(4))) & UINT32_C(0xFFFFFFF0)));
+      (tflac_u32) UINT32_C(15) + (UINT32_C(4) * ( (UINT32_C(15) + (blocksize * UINT32_C(4))) & UINT32_C(0xFFFFFFF0))) +
+      /* and the per-partition sums */
+      ( (UINT32_C(15) + (blocksize * UINT32_C(8))) & UINT32_C(0xFFFFFFF0));
 }
 
 TFLAC_PRIVATE
@@ -1029,6 +1396,10 @@ TFLAC_PRIVATE
 TFLAC_INLINE
 int tflac_bitwriter_flush(tflac_bitwriter*);
 
+TFLAC_PRIVATE
+TFLAC_INLINE
+tflac_u16 tflac_bitwriter_crc16(tflac_bitwriter*);
+
 TFLAC_PRIVATE
 TFLAC_INLINE
 int tflac_bitwriter_align(tflac_bitwriter*);
@@ -1041,6 +1412,13 @@ TFLAC_PRIVATE
 TFLAC_INLINE
 int tflac_bitwriter_add(tflac_bitwriter*, tflac_u32 bits, tflac_uint val);
 
+TFLAC_PRIVATE
+TFLAC_INLINE
+int tflac_bitwriter_rice_fits(const tflac_bitwriter*, tflac_u64 sum, tflac_u32 len, tflac_u32 rice);
+
+TFLAC_PRIVATE
+void tflac_bitwriter_rice(tflac_bitwriter*, const tflac_u32* folded, tflac_u32 len, tflac_u32 rice);
+
 TFLAC_PRIVATE
 TFLAC_INLINE
 void tflac_md5_init(tflac_md5* m);
@@ -1049,6 +1427,13 @@ TFLAC_PRIVATE
 TFLAC_INLINE
 void tflac_md5_transform(tflac_md5* m);
 
+TFLAC_PRIVATE
+void tflac_md5_transform_block(tflac_md5* m, const tflac_u8* block);
+
+/* hashes len bytes, whole blocks get transformed straight from data */
+TFLAC_PRIVATE
+void tflac_md5_update(tflac_md5* m, const tflac_u8* data, tflac_u32 len);
+
 TFLAC_PRIVATE
 TFLAC_INLINE
 void tflac_md5_addsample(tflac_md5* m, tflac_u32 bits, tflac_uint val);
@@ -1057,23 +1442,132 @@ TFLAC_PRIVATE
 TFLAC_INLINE
 void tflac_md5_finalize(tflac_md5* m);
 
+/* multi-buffer MD5, independent contexts get a block transformed at
+ * once, one per SIMD lane. The transforms take TFLAC_MD5_LANES contexts
+ * with the first n having a full block, the rest are scratch */
+#define TFLAC_MD5_LANES 8
+
+typedef void (*tflac_md5_multi_transform)(tflac_md5** m, tflac_u32 n);
+
+TFLAC_PRIVATE void tflac_md5_transform_multi_std(tflac_md5** m, tflac_u32 n);
+
+#if defined(TFLAC_ENABLE_SSE2) || defined(TFLAC_ENABLE_SSSE3) || defined(TFLAC_ENABLE_SSE4_1)
+TFLAC_PRIVATE void tflac_md5_transform_multi_sse2(tflac_md5** m, tflac_u32 n);
+#endif
+
+#ifdef TFLAC_ENABLE_AVX2
+TFLAC_PRIVATE void tflac_md5_transform_multi_avx2(tflac_md5** m, tflac_u32 n);
+#endif
+
+TFLAC_PRIVATE tflac_md5_multi_transform tflac_md5_transform_multi;
+
+/* block packers, these convert len interleaved samples into their MD5
+ * bytes (bytes per sample, 1-2 for int16 and 1-4 for int32). The SIMD
+ * versions may write up to 16 bytes past the end of out */
+#define TFLAC_MD5_CHUNK 384 /* whole number of 1-4 byte samples and 64-byte blocks */
+
+typedef void (*tflac_md5_packer_int16)(tflac_u8* TFLAC_RESTRICT out, const tflac_s16* TFLAC_RESTRICT in, tflac_u32 len, tflac_u32 bytes);
+typedef void (*tflac_md5_packer_int32)(tflac_u8* TFLAC_RESTRICT out, const tflac_s32* TFLAC_RESTRICT in, tflac_u32 len, tflac_u32 bytes);
+
+TFLAC_PRIVATE void tflac_md5_pack_s16_std(tflac_u8* TFLAC_RESTRICT out, const tflac_s16* TFLAC_RESTRICT in, tflac_u32 len, tflac_u32 bytes);
+TFLAC_PRIVATE void tflac_md5_pack_s32_std(tflac_u8* TFLAC_RESTRICT out, const tflac_s32* TFLAC_RESTRICT in, tflac_u32 len, tflac_u32 bytes);
+
+#if defined(TFLAC_ENABLE_SSE2) || defined(TFLAC_ENABLE_SSSE3) || defined(TFLAC_ENABLE_SSE4_1)
+TFLAC_PRIVATE void tflac_md5_pack_s16_sse2(tflac_u8* TFLAC_RESTRICT out, const tflac_s16* TFLAC_RESTRICT in, tflac_u32 len, tflac_u32 bytes);
+TFLAC_PRIVATE void tflac_md5_pack_s32_sse2(tflac_u8* TFLAC_RESTRICT out, const tflac_s32* TFLAC_RESTRICT in, tflac_u32 len, tflac_u32 bytes);
+#endif
+
+#ifdef TFLAC_ENABLE_SSSE3
+TFLAC_PRIVATE void tflac_md5_pack_s32_ssse3(tflac_u8* TFLAC_RESTRICT out, const tflac_s32* TFLAC_RESTRICT in, tflac_u32 len, tflac_u32 bytes);
+#endif
+
+#ifdef TFLAC_ENABLE_NEON
+TFLAC_PRIVATE void tflac_md5_pack_s16_neon(tflac_u8* TFLAC_RESTRICT out, const tflac_s16* TFLAC_RESTRICT in, tflac_u32 len, tflac_u32 bytes);
+TFLAC_PRIVATE void tflac_md5_pack_s32_neon(tflac_u8* TFLAC_RESTRICT out, const tflac_s32* TFLAC_RESTRICT in, tflac_u32 len, tflac_u32 bytes);
+#endif
+
+TFLAC_PRIVATE tflac_md5_packer_int16 tflac_md5_pack_s16;
+TFLAC_PRIVATE tflac_md5_packer_int32 tflac_md5_pack_s32;
+
+TFLAC_PRIVATE void tflac_md5_update_int16(tflac_md5* m, const tflac_s16* samples, tflac_u32 len, tflac_u32 bytes);
+TFLAC_PRIVATE void tflac_md5_update_int32(tflac_md5* m, const tflac_s32* samples, tflac_u32 len, tflac_u32 bytes);
+
+/* where a multi-buffer update is in one encoder's samples */
+struct tflac_md5_lane {
+    tflac_md5* m;
+    const void* samples;
+    tflac_u32 planar;
+    tflac_u32 wide;
+    tflac_u32 bits;
+    tflac_u32 channels;
+    tflac_u32 total;
+    tflac_u32 i;
+    tflac_u32 c;
+    tflac_u32 f;
+};
+
+typedef struct tflac_md5_lane tflac_md5_lane;
+
+TFLAC_PRIVATE void tflac_update_md5_multi(tflac** t, tflac_u32 count, const tflac_u32* blocksizes, const void* const* samples, tflac_u32 planar, tflac_u32 wide);
+
 TFLAC_PRIVATE int tflac_encode(tflac* t, const tflac_encode_params* p);
+TFLAC_PRIVATE int tflac_encode_frame(tflac* t, const tflac_encode_params* p, double* split_cost);
 TFLAC_PRIVATE int tflac_encode_frame_header(tflac *);
 
 TFLAC_CONST TFLAC_PRIVATE TFLAC_INLINE
 tflac_u32 tflac_wasted_bits(tflac_s32 sample, tflac_u32 bits);
 
-TFLAC_PRIVATE void tflac_stereo_decorrelate_independent_int16(tflac*, tflac_u32 channel, tflac_u32 stride, const tflac_s16* samples, void*);
-TFLAC_PRIVATE void tflac_stereo_decorrelate_independent_int32(tflac*, tflac_u32 channel, tflac_u32 stride, const tflac_s32* samples, void*);
+/* what a decorrelation kernel puts into residuals[0] */
+enum TFLAC_DECORRELATE_OP {
+    TFLAC_DECORRELATE_LEFT  = 0,
+    TFLAC_DECORRELATE_RIGHT = 1,
+    TFLAC_DECORRELATE_SIDE  = 2,
+    TFLAC_DECORRELATE_MID   = 3
+};
+
+/* generic versions that handle any stride */
+TFLAC_PRIVATE void tflac_decorrelate_int16_std(tflac_u32 blocksize, tflac_u32 stride, tflac_u32 op, const tflac_s16* left, const tflac_s16* right, tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* info);
+TFLAC_PRIVATE void tflac_decorrelate_int32_std(tflac_u32 blocksize, tflac_u32 stride, tflac_u32 op, const tflac_s32* left, const tflac_s32* right, tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* info);
+
+/* stereo kernels, "i" versions take interleaved samples and fill both
+ * channels at once, "p" versions take separate buffers and fill one */
+TFLAC_PRIVATE void tflac_decorrelate_s16i_std(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s16* samples, tflac_s32* TFLAC_RESTRICT out0, tflac_s32* TFLAC_RESTRICT out1, tflac_u32* info);
+TFLAC_PRIVATE void tflac_decorrelate_s16p_std(tflac_u32 blocksize, tflac_u32 op, const tflac_s16* left, const tflac_s16* right, tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* info);
+TFLAC_PRIVATE void tflac_decorrelate_s32i_std(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s32* samples, tflac_s32* TFLAC_RESTRICT out0, tflac_s32* TFLAC_RESTRICT out1, tflac_u32* info);
+TFLAC_PRIVATE void tflac_decorrelate_s32p_std(tflac_u32 blocksize, tflac_u32 op, const tflac_s32* left, const tflac_s32* right, tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* info);
+
+#if defined(TFLAC_ENABLE_SSE2) || defined(TFLAC_ENABLE_SSSE3) || defined(TFLAC_ENABLE_SSE4_1)
+TFLAC_PRIVATE void tflac_decorrelate_s16i_sse2(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s16* samples, tflac_s32* TFLAC_RESTRICT out0, tflac_s32* TFLAC_RESTRICT out1, tflac_u32* info);
+TFLAC_PRIVATE void tflac_decorrelate_s16p_sse2(tflac_u32 blocksize, tflac_u32 op, const tflac_s16* left, const tflac_s16* right, tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* info);
+TFLAC_PRIVATE void tflac_decorrelate_s32i_sse2(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s32* samples, tflac_s32* TFLAC_RESTRICT out0, tflac_s32* TFLAC_RESTRICT out1, tflac_u32* info);
+TFLAC_PRIVATE void tflac_decorrelate_s32p_sse2(tflac_u32 blocksize, tflac_u32 op, const tflac_s32* left, const tflac_s32* right, tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* info);
+#endif
+
+#ifdef TFLAC_ENABLE_AVX2
+TFLAC_PRIVATE void tflac_decorrelate_s16i_avx2(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s16* samples, tflac_s32* TFLAC_RESTRICT out0, tflac_s32* TFLAC_RESTRICT out1, tflac_u32* info);
+TFLAC_PRIVATE void tflac_decorrelate_s16p_avx2(tflac_u32 blocksize, tflac_u32 op, const tflac_s16* left, const tflac_s16* right, tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* info);
+TFLAC_PRIVATE void tflac_decorrelate_s32i_avx2(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s32* samples, tflac_s32* TFLAC_RESTRICT out0, tflac_s32* TFLAC_RESTRICT out1, tflac_u32* info);
+TFLAC_PRIVATE void tflac_decorrelate_s32p_avx2(tflac_u32 blocksize, tflac_u32 op, const tflac_s32* left, const tflac_s32* right, tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* info);
+#endif
 
-TFLAC_PRIVATE void tflac_stereo_decorrelate_left_side_int16(tflac*, tflac_u32 channel, tflac_u32 stride, const tflac_s16* left, const tflac_s16* right);
-TFLAC_PRIVATE void tflac_stereo_decorrelate_left_side_int32(tflac*, tflac_u32 channel, tflac_u32 stride, const tflac_s32* left, const tflac_s32* right);
+#ifdef TFLAC_ENABLE_NEON
+TFLAC_PRIVATE void tflac_decorrelate_s16i_neon(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s16* samples, tflac_s32* TFLAC_RESTRICT out0, tflac_s32* TFLAC_RESTRICT out1, tflac_u32* info);
+TFLAC_PRIVATE void tflac_decorrelate_s16p_neon(tflac_u32 blocksize, tflac_u32 op, const tflac_s16* left, const tflac_s16* right, tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* info);
+TFLAC_PRIVATE void tflac_decorrelate_s32i_neon(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s32* samples, tflac_s32* TFLAC_RESTRICT out0, tflac_s32* TFLAC_RESTRICT out1, tflac_u32* info);
+TFLAC_PRIVATE void tflac_decorrelate_s32p_neon(tflac_u32 blocksize, tflac_u32 op, const tflac_s32* left, const tflac_s32* right, tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* info);
+#endif
 
-TFLAC_PRIVATE void tflac_stereo_decorrelate_side_right_int16(tflac*, tflac_u32 channel, tflac_u32 stride, const tflac_s16* left, const tflac_s16* right);
-TFLAC_PRIVATE void tflac_stereo_decorrelate_side_right_int32(tflac*, tflac_u32 channel, tflac_u32 stride, const tflac_s32* left, const tflac_s32* right);
+#ifdef TFLAC_ENABLE_SIMD128
+TFLAC_PRIVATE void tflac_decorrelate_s16i_simd128(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s16* samples, tflac_s32* TFLAC_RESTRICT out0, tflac_s32* TFLAC_RESTRICT out1, tflac_u32* info);
+TFLAC_PRIVATE void tflac_decorrelate_s16p_simd128(tflac_u32 blocksize, tflac_u32 op, const tflac_s16* left, const tflac_s16* right, tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* info);
+TFLAC_PRIVATE void tflac_decorrelate_s32i_simd128(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s32* samples, tflac_s32* TFLAC_RESTRICT out0, tflac_s32* TFLAC_RESTRICT out1, tflac_u32* info);
+TFLAC_PRIVATE void tflac_decorrelate_s32p_simd128(tflac_u32 blocksize, tflac_u32 op, const tflac_s32* left, const tflac_s32* right, tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* info);
+#endif
 
-TFLAC_PRIVATE void tflac_stereo_decorrelate_mid_side_int16(tflac*, tflac_u32 channel, tflac_u32 stride, const tflac_s16* left, const tflac_s16* right);
-TFLAC_PRIVATE void tflac_stereo_decorrelate_mid_side_int32(tflac*, tflac_u32 channel, tflac_u32 stride, const tflac_s32* left, const tflac_s32* right);
+TFLAC_PRIVATE tflac_stereo_decorrelator_int16 tflac_decorrelate_s16i;
+TFLAC_PRIVATE tflac_decorrelator_int16 tflac_decorrelate_s16p;
+TFLAC_PRIVATE tflac_stereo_decorrelator_int32 tflac_decorrelate_s32i;
+TFLAC_PRIVATE tflac_decorrelator_int32 tflac_decorrelate_s32p;
 
 TFLAC_PRIVATE void tflac_stereo_decorrelate_int16_planar(tflac*, tflac_u32 channel, const tflac_s16** samples);
 TFLAC_PRIVATE void tflac_stereo_decorrelate_int16_interleaved(tflac*, tflac_u32 channel, const tflac_s16* samples);
@@ -1081,6 +1575,17 @@ TFLAC_PRIVATE void tflac_stereo_decorrelate_int16_interleaved(tflac*, tflac_u32
 TFLAC_PRIVATE void tflac_stereo_decorrelate_int32_planar(tflac*, tflac_u32 channel, const tflac_s32** samples);
 TFLAC_PRIVATE void tflac_stereo_decorrelate_int32_interleaved(tflac*, tflac_u32 channel, const tflac_s32* samples);
 
+TFLAC_PRIVATE void tflac_stereo_estimate_int16(tflac*, tflac_u32 stride, const tflac_s16* left, const tflac_s16* right);
+TFLAC_PRIVATE void tflac_stereo_estimate_int32(tflac*, tflac_u32 stride, const tflac_s32* left, const tflac_s32* right);
+
+TFLAC_PRIVATE void tflac_stereo_estimate_int16_planar(tflac*, const tflac_s16** samples);
+TFLAC_PRIVATE void tflac_stereo_estimate_int16_interleaved(tflac*, const tflac_s16* samples);
+
+TFLAC_PRIVATE void tflac_stereo_estimate_int32_planar(tflac*, const tflac_s32** samples);
+TFLAC_PRIVATE void tflac_stereo_estimate_int32_interleaved(tflac*, const tflac_s32* samples);
+
+TFLAC_PRIVATE void tflac_stereo_pick_mode(tflac*, const tflac_u64* errors);
+
 
 TFLAC_PRIVATE void (*tflac_cfr_order0)(
     tflac_u32 blocksize,
@@ -1112,6 +1617,11 @@ TFLAC_PRIVATE void (*tflac_cfr_order4)(
     tflac_s32* TFLAC_RESTRICT residuals,
     tflac_u64* TFLAC_RESTRICT residual_error
 );
+TFLAC_PRIVATE void (*tflac_cfr_fused)(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_u64* TFLAC_RESTRICT residual_errors
+);
 
 
 TFLAC_PRIVATE void (*tflac_cfr_order1_wide)(
@@ -1272,58 +1782,357 @@ TFLAC_PRIVATE void tflac_cfr_order4_sse4_1(
 );
 #endif
 
-/* variant functions that convert samples to 64-bit then calculates,
- * used when bps >= 32, 31, 30, 29 */
-
-/* note, there is no order0 wide_std, we just default to
- * the default order0 function since checking for
- * INT32_MIN was already handled in sample analysis */
-
-TFLAC_PRIVATE void tflac_cfr_order1_wide_std(
+#ifdef TFLAC_ENABLE_AVX2
+TFLAC_PRIVATE void tflac_cfr_order0_avx2(
     tflac_u32 blocksize,
     const tflac_s32* TFLAC_RESTRICT samples,
     tflac_s32* TFLAC_RESTRICT residuals,
     tflac_u64* TFLAC_RESTRICT residual_error
 );
-TFLAC_PRIVATE void tflac_cfr_order2_wide_std(
+TFLAC_PRIVATE void tflac_cfr_order1_avx2(
     tflac_u32 blocksize,
     const tflac_s32* TFLAC_RESTRICT samples,
     tflac_s32* TFLAC_RESTRICT residuals,
     tflac_u64* TFLAC_RESTRICT residual_error
 );
-TFLAC_PRIVATE void tflac_cfr_order3_wide_std(
+TFLAC_PRIVATE void tflac_cfr_order2_avx2(
     tflac_u32 blocksize,
     const tflac_s32* TFLAC_RESTRICT samples,
     tflac_s32* TFLAC_RESTRICT residuals,
     tflac_u64* TFLAC_RESTRICT residual_error
 );
-TFLAC_PRIVATE void tflac_cfr_order4_wide_std(
+TFLAC_PRIVATE void tflac_cfr_order3_avx2(
     tflac_u32 blocksize,
     const tflac_s32* TFLAC_RESTRICT samples,
     tflac_s32* TFLAC_RESTRICT residuals,
     tflac_u64* TFLAC_RESTRICT residual_error
 );
+TFLAC_PRIVATE void tflac_cfr_order4_avx2(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+#endif
 
-TFLAC_PRIVATE void tflac_cfr(tflac*);
-
-/* encodes a constant subframe iff value is constant, this should always be tried first */
-TFLAC_PRIVATE int tflac_encode_subframe_constant(tflac*);
-
-/* encodes a fixed subframe only if the length < verbatim */
-TFLAC_PRIVATE int tflac_encode_subframe_fixed(tflac*);
-
-/* encodes a subframe verbatim, only fails if the buffer runs out of room */
-TFLAC_PRIVATE int tflac_encode_subframe_verbatim(tflac*);
-
-/* encodes a subframe, tries constant, fixed, then verbatim */
-TFLAC_PRIVATE int tflac_encode_subframe(tflac*, tflac_u8 channel);
-
-TFLAC_PRIVATE int tflac_encode_residuals(tflac*, tflac_u8 predictor_order, tflac_u8 partition_order);
-
-/* various tables to define at the end of the file */
-TFLAC_PRIVATE const tflac_u16 tflac_crc16_tables[8][256];
+#ifdef TFLAC_ENABLE_AVX512
+TFLAC_PRIVATE void tflac_cfr_order0_avx512(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order1_avx512(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order2_avx512(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order3_avx512(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order4_avx512(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+#endif
+
+#ifdef TFLAC_ENABLE_NEON
+TFLAC_PRIVATE void tflac_cfr_order0_neon(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order1_neon(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order2_neon(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order3_neon(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order4_neon(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+#endif
+
+#ifdef TFLAC_ENABLE_SIMD128
+TFLAC_PRIVATE void tflac_cfr_order0_simd128(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order1_simd128(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order2_simd128(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order3_simd128(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order4_simd128(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+#endif
+
+/* fused variants, calculates the error sums of all 5 orders in one pass */
+TFLAC_PRIVATE void tflac_cfr_fused_std(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_u64* TFLAC_RESTRICT residual_errors
+);
+
+#if defined(TFLAC_ENABLE_SSE2) || defined(TFLAC_ENABLE_SSSE3) || defined(TFLAC_ENABLE_SSE4_1)
+TFLAC_PRIVATE void tflac_cfr_fused_sse2(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_u64* TFLAC_RESTRICT residual_errors
+);
+#endif
+
+#ifdef TFLAC_ENABLE_AVX2
+TFLAC_PRIVATE void tflac_cfr_fused_avx2(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_u64* TFLAC_RESTRICT residual_errors
+);
+#endif
+
+#ifdef TFLAC_ENABLE_AVX512
+TFLAC_PRIVATE void tflac_cfr_fused_avx512(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_u64* TFLAC_RESTRICT residual_errors
+);
+#endif
+
+#ifdef TFLAC_ENABLE_NEON
+TFLAC_PRIVATE void tflac_cfr_fused_neon(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_u64* TFLAC_RESTRICT residual_errors
+);
+#endif
+
+#ifdef TFLAC_ENABLE_SIMD128
+TFLAC_PRIVATE void tflac_cfr_fused_simd128(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_u64* TFLAC_RESTRICT residual_errors
+);
+#endif
+
+/* variant functions that convert samples to 64-bit then calculates,
+ * used when bps >= 32, 31, 30, 29 */
+
+/* note, there is no order0 wide_std, we just default to
+ * the default order0 function since checking for
+ * INT32_MIN was already handled in sample analysis */
+
+TFLAC_PRIVATE void tflac_cfr_order1_wide_std(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order2_wide_std(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order3_wide_std(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order4_wide_std(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+
+#if defined(TFLAC_ENABLE_SSE4_1) || defined(TFLAC_ENABLE_AVX2) || defined(TFLAC_ENABLE_NEON)
+TFLAC_PRIVATE void tflac_cfr_wide_range(
+    tflac_u32 order,
+    tflac_u32 start,
+    tflac_u32 end,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_err,
+    tflac_u32* TFLAC_RESTRICT max_found
+);
+#endif
+
+#ifdef TFLAC_ENABLE_SSE4_1
+TFLAC_PRIVATE void tflac_cfr_order1_wide_sse4_1(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order2_wide_sse4_1(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order3_wide_sse4_1(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order4_wide_sse4_1(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+#endif
+
+#ifdef TFLAC_ENABLE_AVX2
+TFLAC_PRIVATE void tflac_cfr_order1_wide_avx2(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order2_wide_avx2(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order3_wide_avx2(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order4_wide_avx2(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+#endif
+
+#ifdef TFLAC_ENABLE_NEON
+TFLAC_PRIVATE void tflac_cfr_order1_wide_neon(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order2_wide_neon(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order3_wide_neon(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+TFLAC_PRIVATE void tflac_cfr_order4_wide_neon(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT samples,
+    tflac_s32* TFLAC_RESTRICT residuals,
+    tflac_u64* TFLAC_RESTRICT residual_error
+);
+#endif
+
+TFLAC_PRIVATE void tflac_cfr(tflac*);
+
+/* encodes a constant subframe iff value is constant, this should always be tried first */
+TFLAC_PRIVATE int tflac_encode_subframe_constant(tflac*);
+
+/* encodes a fixed subframe only if the length < verbatim */
+TFLAC_PRIVATE int tflac_encode_subframe_fixed(tflac*, tflac_u8 order);
+
+/* encodes the LPC subframe found by tflac_analyze_lpc only if the length < verbatim */
+TFLAC_PRIVATE int tflac_encode_subframe_lpc(tflac*);
+
+/* encodes a subframe verbatim, only fails if the buffer runs out of room */
+TFLAC_PRIVATE int tflac_encode_subframe_verbatim(tflac*);
+
+/* encodes a subframe, tries constant, then whichever of fixed and LPC
+ * looks smaller, then verbatim */
+TFLAC_PRIVATE int tflac_encode_subframe(tflac*, tflac_u8 channel);
+
+TFLAC_PRIVATE int tflac_encode_residuals(tflac*, const tflac_s32* residuals, tflac_u32 predictor_order, tflac_u8 partition_order);
+
+/* zig-zag folds residuals[predictor_order] through residuals[blocksize - 1]
+ * into the same spots in folded, and sums up the absolute values of each
+ * partition at partition_order, sums gets one entry per partition */
+typedef void (*tflac_residual_folder)(tflac_u32 blocksize, tflac_u32 predictor_order, tflac_u32 partition_order, const tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* TFLAC_RESTRICT folded, tflac_u64* TFLAC_RESTRICT sums);
+
+TFLAC_PRIVATE void tflac_fold_residuals_std(tflac_u32 blocksize, tflac_u32 predictor_order, tflac_u32 partition_order, const tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* TFLAC_RESTRICT folded, tflac_u64* TFLAC_RESTRICT sums);
+#if defined(TFLAC_ENABLE_SSE2) || defined(TFLAC_ENABLE_SSSE3) || defined(TFLAC_ENABLE_SSE4_1)
+TFLAC_PRIVATE void tflac_fold_residuals_sse2(tflac_u32 blocksize, tflac_u32 predictor_order, tflac_u32 partition_order, const tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* TFLAC_RESTRICT folded, tflac_u64* TFLAC_RESTRICT sums);
+#endif
+#ifdef TFLAC_ENABLE_AVX2
+TFLAC_PRIVATE void tflac_fold_residuals_avx2(tflac_u32 blocksize, tflac_u32 predictor_order, tflac_u32 partition_order, const tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* TFLAC_RESTRICT folded, tflac_u64* TFLAC_RESTRICT sums);
+#endif
+#ifdef TFLAC_ENABLE_NEON
+TFLAC_PRIVATE void tflac_fold_residuals_neon(tflac_u32 blocksize, tflac_u32 predictor_order, tflac_u32 partition_order, const tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* TFLAC_RESTRICT folded, tflac_u64* TFLAC_RESTRICT sums);
+#endif
+TFLAC_PRIVATE tflac_residual_folder tflac_fold_residuals;
+
+/* various tables to define at the end of the file */
+TFLAC_PRIVATE const tflac_u16 tflac_crc16_tables[8][256];
 TFLAC_PRIVATE const tflac_u8 tflac_crc8_table[256];
 
+TFLAC_PRIVATE tflac_u16 tflac_crc16_std(const tflac_u8* d, tflac_u32 len, tflac_u16 crc16);
+#ifdef TFLAC_ENABLE_PCLMUL
+TFLAC_PRIVATE tflac_u16 tflac_crc16_pclmul(const tflac_u8* d, tflac_u32 len, tflac_u16 crc16);
+#endif
+TFLAC_PRIVATE tflac_u16 (*tflac_crc16)(const tflac_u8*, tflac_u32, tflac_u16);
+
 
 TFLAC_PRIVATE TFLAC_INLINE tflac_u8 tflac_crc8(const tflac_u8* d, tflac_u32 len, tflac_u8 crc8) {
     tflac_u32 i = 0;
@@ -1336,7 +2145,7 @@ TFLAC_PRIVATE TFLAC_INLINE tflac_u8 tflac_crc8(const tflac_u8* d, tflac_u32 len,
 /*
  * https://freac.org/developer-blog-mainmenu-9/14-freac/277-fastcrc
  */
-TFLAC_PRIVATE TFLAC_INLINE tflac_u16 tflac_crc16(const tflac_u8* d, tflac_u32 len, tflac_u16 crc16) {
+TFLAC_PRIVATE tflac_u16 tflac_crc16_std(const tflac_u8* d, tflac_u32 len, tflac_u16 crc16) {
     while(len >= 8) {
         crc16 ^= d[0] << 8 | d[1];
         crc16 =
@@ -1355,6 +2164,67 @@ TFLAC_PRIVATE TFLAC_INLINE tflac_u16 tflac_crc16(const tflac_u8* d, tflac_u32 le
     return crc16;
 }
 
+#ifdef TFLAC_ENABLE_PCLMUL
+/*
+ * folds 16-byte blocks with carry-less multiplies, see Intel's
+ * "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ".
+ * Blocks are byte-swapped so each register is a big-endian polynomial,
+ * four of them get folded forward by 512 bits at a time (x^576 and
+ * x^512 mod P), then down to one by 128 bits (x^192 and x^128 mod P).
+ * Rather than a Barrett reduction the remaining 16 bytes and whatever
+ * tail is left go through the table version.
+ */
+#define TFLAC_PCLMUL_FOLD(x, k) \
+    _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11), _mm_clmulepi64_si128(x, k, 0x00))
+
+TFLAC_PRIVATE tflac_u16 tflac_crc16_pclmul(const tflac_u8* d, tflac_u32 len, tflac_u16 crc16) {
+    const __m128i bswap = _mm_set_epi8(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15);
+    const __m128i k4 = _mm_set_epi32(0, 0x1446, 0, 0x8107);
+    const __m128i k1 = _mm_set_epi32(0, 0x1666, 0, 0x0106);
+    __m128i x0, x1, x2, x3;
+    tflac_u8 buf[16];
+
+    if(len < 64) return tflac_crc16_std(d, len, crc16);
+
+    x0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&d[0]), bswap);
+    x1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&d[16]), bswap);
+    x2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&d[32]), bswap);
+    x3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&d[48]), bswap);
+    x0 = _mm_xor_si128(x0, _mm_slli_si128(_mm_cvtsi32_si128((int)crc16), 14));
+    d   += 64;
+    len -= 64;
+
+    while(len >= 64) {
+        x0 = _mm_xor_si128(TFLAC_PCLMUL_FOLD(x0, k4),
+          _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&d[0]), bswap));
+        x1 = _mm_xor_si128(TFLAC_PCLMUL_FOLD(x1, k4),
+          _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&d[16]), bswap));
+        x2 = _mm_xor_si128(TFLAC_PCLMUL_FOLD(x2, k4),
+          _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&d[32]), bswap));
+        x3 = _mm_xor_si128(TFLAC_PCLMUL_FOLD(x3, k4),
+          _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&d[48]), bswap));
+        d   += 64;
+        len -= 64;
+    }
+
+    x0 = _mm_xor_si128(TFLAC_PCLMUL_FOLD(x0, k1), x1);
+    x0 = _mm_xor_si128(TFLAC_PCLMUL_FOLD(x0, k1), x2);
+    x0 = _mm_xor_si128(TFLAC_PCLMUL_FOLD(x0, k1), x3);
+
+    while(len >= 16) {
+        x0 = _mm_xor_si128(TFLAC_PCLMUL_FOLD(x0, k1),
+          _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)d), bswap));
+        d   += 16;
+        len -= 16;
+    }
+
+    _mm_storeu_si128((__m128i*)buf, _mm_shuffle_epi8(x0, bswap));
+    return tflac_crc16_std(d, len, tflac_crc16_std(buf, 16, 0));
+}
+
+#undef TFLAC_PCLMUL_FOLD
+#endif
+
 TFLAC_CONST TFLAC_PRIVATE TFLAC_INLINE
 tflac_u32 tflac_wasted_bits(tflac_s32 sample, tflac_u32 bits) {
 #if defined(_MSC_VER) && _MSC_VER >= 1400
@@ -1383,17 +2253,72 @@ tflac_u32 tflac_wasted_bits(tflac_s32 sample, tflac_u32 bits) {
 #endif
 }
 
-#define TFLAC_MD5_LEFTROTATE(x, s) (x << s | x >> (32-s))
-
-TFLAC_PRIVATE
-TFLAC_INLINE
-void tflac_bitwriter_init(tflac_bitwriter* bw) {
-    bw->val = 0;
+/* returns the number of bits needed to store v, 0 if v is 0 */
+TFLAC_CONST TFLAC_PRIVATE TFLAC_INLINE
+tflac_u32 tflac_u32_bitlen(tflac_u32 v) {
+#if defined(_MSC_VER) && _MSC_VER >= 1400
+    unsigned long index;
+    if(v == 0) return 0;
+    _BitScanReverse(&index, (unsigned long) v);
+    return (tflac_u32)index + 1;
+#elif __GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4)
+    if(v == 0) return 0;
+    return 32 - (tflac_u32)__builtin_clz(v);
+#else
+    tflac_u32 i = 0;
+    while(v) {
+        v >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+TFLAC_PRIVATE TFLAC_INLINE
+tflac_u32 tflac_u64_bitlen(tflac_u64 v) {
+#ifdef TFLAC_32BIT_ONLY
+    return v.hi ? 32 + tflac_u32_bitlen(v.hi) : tflac_u32_bitlen(v.lo);
+#else
+    return (v >> 32) ? 32 + tflac_u32_bitlen((tflac_u32)(v >> 32)) : tflac_u32_bitlen((tflac_u32)v);
+#endif
+}
+
+#define TFLAC_MD5_LEFTROTATE(x, s) (x << s | x >> (32-s))
+
+TFLAC_PRIVATE
+TFLAC_INLINE
+void tflac_bitwriter_init(tflac_bitwriter* bw) {
+    bw->val = 0;
     bw->bits = 0;
     bw->pos = 0;
     bw->len = 0;
     bw->tot = 0;
     bw->buffer = NULL;
+    bw->calculate_crc16 = NULL;
+    bw->crc_pos = 0;
+    bw->crc16 = 0;
+}
+
+/* committed bytes are handed to the CRC in chunks, small enough that
+ * they're still in cache, large enough for the CRC functions to get going.
+ * This is checked between residual partitions and subframes rather than
+ * on every flush, which would put a branch in the middle of the Rice
+ * coding loop */
+#define TFLAC_BW_CRC_CHUNK 1024
+
+#define TFLAC_BW_UPDATE_CRC(bw) \
+    do { \
+        if((bw)->calculate_crc16 != NULL && (bw)->pos - (bw)->crc_pos >= TFLAC_BW_CRC_CHUNK) \
+            tflac_bitwriter_crc16(bw); \
+    } while(0)
+
+/* catches up the CRC to the current byte position and returns it */
+TFLAC_PRIVATE
+TFLAC_INLINE
+tflac_u16 tflac_bitwriter_crc16(tflac_bitwriter* bw) {
+    bw->crc16 = bw->calculate_crc16(&bw->buffer[bw->crc_pos], bw->pos - bw->crc_pos, bw->crc16);
+    bw->crc_pos = bw->pos;
+    return bw->crc16;
 }
 
 TFLAC_PRIVATE
@@ -1491,1866 +2416,5521 @@ int tflac_bitwriter_align(tflac_bitwriter *bw) {
     return 0;
 }
 
-TFLAC_PRIVATE
-TFLAC_INLINE
-void tflac_md5_init(tflac_md5* m) {
-    m->a = 0x67452301;
-    m->b = 0xefcdab89;
-    m->c = 0x98badcfe;
-    m->d = 0x10325476;
-    m->total = TFLAC_U64_ZERO;
-    m->pos = 0;
-}
+/* checks if a Rice-coded partition is sure to fit. Every residual takes
+ * rice + 1 bits plus its unary part, and with sum being the sum of the
+ * absolute values, the unary parts add up to at most
+ * ((sum >> rice) * 2) + 1 */
+TFLAC_PRIVATE
+TFLAC_INLINE
+int tflac_bitwriter_rice_fits(const tflac_bitwriter* bw, tflac_u64 sum, tflac_u32 len, tflac_u32 rice) {
+    tflac_u32 unary;
+
+#ifdef TFLAC_32BIT_ONLY
+    if(sum.hi != 0) return 0;
+    unary = sum.lo >> rice;
+#else
+    if( (sum >> rice) > UINT64_C(0x0FFFFFFF)) return 0;
+    unary = (tflac_u32)(sum >> rice);
+#endif
+
+    /* len is at most 65535 and rice at most 30, none of this overflows */
+    return (bw->bits + (len * (rice + 1)) + (unary * 2) + 1) / CHAR_BIT <= bw->len - bw->pos;
+}
+
+/* writes a Rice-coded partition of zig-zagged residuals with the bits
+ * kept in a local accumulator, storing half a word at a time. The unary
+ * part, stop bit and low bits usually go in with a single shift and OR.
+ * Nothing is bounds-checked, check with tflac_bitwriter_rice_fits first */
+#define TFLAC_RICE_HALF ((tflac_u32)(TFLAC_BW_BITS / 2))
+
+#ifdef TFLAC_32BIT_ONLY
+#define TFLAC_RICE_STORE(out, acc) \
+    (out)[0] = (tflac_u8)((acc) >> 24); \
+    (out)[1] = (tflac_u8)((acc) >> 16);
+#else
+#define TFLAC_RICE_STORE(out, acc) \
+    tflac_pack_u32be((out), (tflac_u32)((acc) >> 32));
+#endif
+
+#define TFLAC_RICE_FLUSH() \
+    while(bits >= TFLAC_RICE_HALF) { \
+        TFLAC_RICE_STORE(out, acc) \
+        out += TFLAC_RICE_HALF / CHAR_BIT; \
+        acc <<= TFLAC_RICE_HALF; \
+        bits -= TFLAC_RICE_HALF; \
+    }
+
+/* n is at most TFLAC_RICE_HALF and bits is less than that going in */
+#define TFLAC_RICE_PUT(v, n) \
+    acc |= ((tflac_uint)(v)) << (TFLAC_BW_BITS - bits - (n)); \
+    bits += (n); \
+    if(bits >= TFLAC_RICE_HALF) { \
+        TFLAC_RICE_STORE(out, acc) \
+        out += TFLAC_RICE_HALF / CHAR_BIT; \
+        acc <<= TFLAC_RICE_HALF; \
+        bits -= TFLAC_RICE_HALF; \
+    }
+
+TFLAC_PRIVATE
+void tflac_bitwriter_rice(tflac_bitwriter* bw, const tflac_u32* folded, tflac_u32 len, tflac_u32 rice) {
+    tflac_u8* const start = &bw->buffer[bw->pos];
+    tflac_u8* out = start;
+    tflac_uint acc = bw->val;
+    tflac_u32 bits = bw->bits;
+    const tflac_u32 start_bits = bw->bits;
+    const tflac_u32 stop = UINT32_C(1) << rice;
+    const tflac_u32 fast = rice < TFLAC_RICE_HALF ? TFLAC_RICE_HALF - rice : 0;
+    tflac_u32 i = 0;
+    tflac_u32 v = 0;
+    tflac_u32 msb = 0;
+    tflac_u32 code = 0;
+
+    TFLAC_RICE_FLUSH()
+
+    for(i=0;i<len;i++) {
+        v = folded[i];
+        msb = v >> rice;
+        code = stop | (v & (stop - 1));
+
+        if(msb < fast) {
+            /* unary zeros are just the leading bits of the shifted code */
+            TFLAC_RICE_PUT(code, msb + rice + 1)
+        } else {
+            bits += msb;
+            TFLAC_RICE_FLUSH()
+            if(rice + 1 > TFLAC_RICE_HALF) {
+                TFLAC_RICE_PUT(((tflac_uint)code) >> TFLAC_RICE_HALF, rice + 1 - TFLAC_RICE_HALF)
+                TFLAC_RICE_PUT(code & (TFLAC_UINT_MAX >> TFLAC_RICE_HALF), TFLAC_RICE_HALF)
+            } else {
+                TFLAC_RICE_PUT(code, rice + 1)
+            }
+        }
+    }
+
+    bw->tot += (((tflac_u32)(out - start)) * CHAR_BIT) + bits - start_bits;
+    bw->pos += (tflac_u32)(out - start);
+    bw->val = acc;
+    bw->bits = bits;
+}
+
+#undef TFLAC_RICE_STORE
+#undef TFLAC_RICE_FLUSH
+#undef TFLAC_RICE_PUT
+
+TFLAC_PRIVATE
+TFLAC_INLINE
+void tflac_md5_init(tflac_md5* m) {
+    m->a = 0x67452301;
+    m->b = 0xefcdab89;
+    m->c = 0x98badcfe;
+    m->d = 0x10325476;
+    m->total = TFLAC_U64_ZERO;
+    m->pos = 0;
+}
+
+/* the 64 MD5 steps as (round, message word, shift, constant), shared
+ * by the scalar and SIMD transforms */
+#define TFLAC_MD5_STEPS(R1,R2,R3,R4) \
+    R1( 0,  7, UINT32_C(0x0d76aa478)) \
+    R1( 1, 12, UINT32_C(0x0e8c7b756)) \
+    R1( 2, 17, UINT32_C(0x0242070db)) \
+    R1( 3, 22, UINT32_C(0x0c1bdceee)) \
+    R1( 4,  7, UINT32_C(0x0f57c0faf)) \
+    R1( 5, 12, UINT32_C(0x04787c62a)) \
+    R1( 6, 17, UINT32_C(0x0a8304613)) \
+    R1( 7, 22, UINT32_C(0x0fd469501)) \
+    R1( 8,  7, UINT32_C(0x0698098d8)) \
+    R1( 9, 12, UINT32_C(0x08b44f7af)) \
+    R1(10, 17, UINT32_C(0x0ffff5bb1)) \
+    R1(11, 22, UINT32_C(0x0895cd7be)) \
+    R1(12,  7, UINT32_C(0x06b901122)) \
+    R1(13, 12, UINT32_C(0x0fd987193)) \
+    R1(14, 17, UINT32_C(0x0a679438e)) \
+    R1(15, 22, UINT32_C(0x049b40821)) \
+    R2( 1,  5, UINT32_C(0x0f61e2562)) \
+    R2( 6,  9, UINT32_C(0x0c040b340)) \
+    R2(11, 14, UINT32_C(0x0265e5a51)) \
+    R2( 0, 20, UINT32_C(0x0e9b6c7aa)) \
+    R2( 5,  5, UINT32_C(0x0d62f105d)) \
+    R2(10,  9, UINT32_C(0x002441453)) \
+    R2(15, 14, UINT32_C(0x0d8a1e681)) \
+    R2( 4, 20, UINT32_C(0x0e7d3fbc8)) \
+    R2( 9,  5, UINT32_C(0x021e1cde6)) \
+    R2(14,  9, UINT32_C(0x0c33707d6)) \
+    R2( 3, 14, UINT32_C(0x0f4d50d87)) \
+    R2( 8, 20, UINT32_C(0x0455a14ed)) \
+    R2(13,  5, UINT32_C(0x0a9e3e905)) \
+    R2( 2,  9, UINT32_C(0x0fcefa3f8)) \
+    R2( 7, 14, UINT32_C(0x0676f02d9)) \
+    R2(12, 20, UINT32_C(0x08d2a4c8a)) \
+    R3( 5,  4, UINT32_C(0x0fffa3942)) \
+    R3( 8, 11, UINT32_C(0x08771f681)) \
+    R3(11, 16, UINT32_C(0x06d9d6122)) \
+    R3(14, 23, UINT32_C(0x0fde5380c)) \
+    R3( 1,  4, UINT32_C(0x0a4beea44)) \
+    R3( 4, 11, UINT32_C(0x04bdecfa9)) \
+    R3( 7, 16, UINT32_C(0x0f6bb4b60)) \
+    R3(10, 23, UINT32_C(0x0bebfbc70)) \
+    R3(13,  4, UINT32_C(0x0289b7ec6)) \
+    R3( 0, 11, UINT32_C(0x0eaa127fa)) \
+    R3( 3, 16, UINT32_C(0x0d4ef3085)) \
+    R3( 6, 23, UINT32_C(0x004881d05)) \
+    R3( 9,  4, UINT32_C(0x0d9d4d039)) \
+    R3(12, 11, UINT32_C(0x0e6db99e5)) \
+    R3(15, 16, UINT32_C(0x01fa27cf8)) \
+    R3( 2, 23, UINT32_C(0x0c4ac5665)) \
+    R4( 0,  6, UINT32_C(0x0f4292244)) \
+    R4( 7, 10, UINT32_C(0x0432aff97)) \
+    R4(14, 15, UINT32_C(0x0ab9423a7)) \
+    R4( 5, 21, UINT32_C(0x0fc93a039)) \
+    R4(12,  6, UINT32_C(0x0655b59c3)) \
+    R4( 3, 10, UINT32_C(0x08f0ccc92)) \
+    R4(10, 15, UINT32_C(0x0ffeff47d)) \
+    R4( 1, 21, UINT32_C(0x085845dd1)) \
+    R4( 8,  6, UINT32_C(0x06fa87e4f)) \
+    R4(15, 10, UINT32_C(0x0fe2ce6e0)) \
+    R4( 6, 15, UINT32_C(0x0a3014314)) \
+    R4(13, 21, UINT32_C(0x04e0811a1)) \
+    R4( 4,  6, UINT32_C(0x0f7537e82)) \
+    R4(11, 10, UINT32_C(0x0bd3af235)) \
+    R4( 2, 15, UINT32_C(0x02ad7d2bb)) \
+    R4( 9, 21, UINT32_C(0x0eb86d391))
+
+TFLAC_PRIVATE
+void tflac_md5_transform_block(tflac_md5* m, const tflac_u8* block) {
+    tflac_u32 A = m->a;
+    tflac_u32 B = m->b;
+    tflac_u32 C = m->c;
+    tflac_u32 D = m->d;
+
+    tflac_u32 F = 0;
+
+    tflac_u32 M[16];
+
+    M[0]  = tflac_unpack_u32le(&block[ (0 * 4)]);
+    M[1]  = tflac_unpack_u32le(&block[ (1 * 4)]);
+    M[2]  = tflac_unpack_u32le(&block[ (2 * 4)]);
+    M[3]  = tflac_unpack_u32le(&block[ (3 * 4)]);
+    M[4]  = tflac_unpack_u32le(&block[ (4 * 4)]);
+    M[5]  = tflac_unpack_u32le(&block[ (5 * 4)]);
+    M[6]  = tflac_unpack_u32le(&block[ (6 * 4)]);
+    M[7]  = tflac_unpack_u32le(&block[ (7 * 4)]);
+    M[8]  = tflac_unpack_u32le(&block[ (8 * 4)]);
+    M[9]  = tflac_unpack_u32le(&block[ (9 * 4)]);
+    M[10] = tflac_unpack_u32le(&block[(10 * 4)]);
+    M[11] = tflac_unpack_u32le(&block[(11 * 4)]);
+    M[12] = tflac_unpack_u32le(&block[(12 * 4)]);
+    M[13] = tflac_unpack_u32le(&block[(13 * 4)]);
+    M[14] = tflac_unpack_u32le(&block[(14 * 4)]);
+    M[15] = tflac_unpack_u32le(&block[(15 * 4)]);
+
+
+#define TFLAC_MD5_TRANSFORM_TAIL(g, s, k, expr) \
+        F = A + k + M[g] + (expr); \
+        A = D; \
+        D = C; \
+        C = B; \
+        B += TFLAC_MD5_LEFTROTATE(F, s);
+
+#define TFLAC_MD5_ROUND1(g,s,k) \
+        TFLAC_MD5_TRANSFORM_TAIL(g, s, k, D ^ (B & (C ^ D)))
+
+#define TFLAC_MD5_ROUND2(g,s,k) \
+        TFLAC_MD5_TRANSFORM_TAIL(g, s, k, C ^ (D & (B ^ C)))
+
+#define TFLAC_MD5_ROUND3(g,s,k) \
+        TFLAC_MD5_TRANSFORM_TAIL(g, s, k, B ^ C ^ D)
+
+#define TFLAC_MD5_ROUND4(g,s,k) \
+        TFLAC_MD5_TRANSFORM_TAIL(g, s, k, C ^ (B | (~D) ) )
+
+    TFLAC_MD5_STEPS(TFLAC_MD5_ROUND1, TFLAC_MD5_ROUND2, TFLAC_MD5_ROUND3, TFLAC_MD5_ROUND4)
+
+
+    m->a += A;
+    m->b += B;
+    m->c += C;
+    m->d += D;
+}
+
+TFLAC_PRIVATE
+TFLAC_INLINE
+void tflac_md5_transform(tflac_md5* m) {
+    tflac_md5_transform_block(m, m->buffer);
+}
+
+TFLAC_PRIVATE
+TFLAC_INLINE
+void tflac_md5_addsample(tflac_md5* m, tflac_u32 bits, tflac_uint val) {
+    tflac_u32 bytes;
+
+    TFLAC_U64_ADD_WORD(m->total,bits);
+
+    bytes = bits / 8;
+
+    tflac_pack_uintle(&m->buffer[m->pos], val);
+    m->pos += bytes;
+
+    if(m->pos >= 64) {
+        tflac_md5_transform(m);
+        m->pos %= 64;
+        bytes = m->pos;
+        while(bytes--) {
+            m->buffer[bytes] = m->buffer[64+bytes];
+        }
+    }
+}
+
+TFLAC_PRIVATE
+void tflac_md5_update(tflac_md5* m, const tflac_u8* data, tflac_u32 len) {
+    tflac_u32 n;
+
+    TFLAC_U64_ADD_WORD(m->total, len * 8);
+
+    if(m->pos != 0) {
+        n = 64 - m->pos;
+        if(n > len) n = len;
+        len -= n;
+        while(n--) {
+            m->buffer[m->pos++] = *data++;
+        }
+        if(m->pos < 64) return;
+        tflac_md5_transform(m);
+        m->pos = 0;
+    }
+
+    while(len >= 64) {
+        tflac_md5_transform_block(m, data);
+        data += 64;
+        len -= 64;
+    }
+
+    while(len--) {
+        m->buffer[m->pos++] = *data++;
+    }
+}
+
+TFLAC_PRIVATE
+TFLAC_INLINE
+void tflac_md5_finalize(tflac_md5* m) {
+    tflac_u64 len = m->total;
+    /* add the stop bit */
+    tflac_md5_addsample(m, 8, 0x80);
+
+    /* pad zeroes until we have 8 bytes left */
+    while(m->pos != 56) {
+        tflac_md5_addsample(m, 8, 0x00);
+    }
+
+    tflac_pack_u64le(&m->buffer[56],len);
+    tflac_md5_transform(m);
+}
+
+TFLAC_PRIVATE void tflac_md5_transform_multi_std(tflac_md5** m, tflac_u32 n) {
+    tflac_u32 i = 0;
+    for(i=0;i<n;i++) {
+        tflac_md5_transform(m[i]);
+    }
+}
+
+/* next sample from a planar lane, interleaved lanes read directly */
+TFLAC_PRIVATE TFLAC_INLINE tflac_uint tflac_md5_lane_planar(tflac_md5_lane* l) {
+    tflac_uint v = l->wide ?
+      (tflac_uint)((const tflac_s32* const*)l->samples)[l->c][l->f] :
+      (tflac_uint)((const tflac_s16* const*)l->samples)[l->c][l->f];
+    if(++l->c == l->channels) {
+        l->c = 0;
+        l->f++;
+    }
+    return v;
+}
+
+/* packs samples into the lane's block until it's full or the lane
+ * runs out, returns non-zero when there's a block to transform.
+ * Samples are combined into whole words before storing like the
+ * update_md5 packers, the transform reloading a block written with
+ * overlapping stores is a lot slower */
+TFLAC_PRIVATE int tflac_md5_lane_fill(tflac_md5_lane* l) {
+    tflac_md5* m = l->m;
+    const tflac_uint mask = TFLAC_UINT_MAX >> (TFLAC_BW_BITS - l->bits);
+    const tflac_u32 bytes = l->bits / 8;
+    const tflac_u32 per = (tflac_u32)sizeof(tflac_uint) / bytes;
+    tflac_u32 n = 0;
+    tflac_u32 k = 0;
+    tflac_u32 j = 0;
+    tflac_uint v;
+    tflac_u8* d;
+
+    if(m->pos >= 64) return 1;
+
+    /* enough samples to reach the end of the block, the last word
+     * can spill into the extra 8 bytes like addsample does */
+    n = (64 - m->pos + bytes - 1) / bytes;
+    if(n > l->total - l->i) n = l->total - l->i;
+    if(n == 0) return 0;
+
+    TFLAC_U64_ADD_WORD(m->total, n * l->bits);
+    d = &m->buffer[m->pos];
+    m->pos += n * bytes;
+
+#define TFLAC_MD5_LANE_PACK(next) \
+    while(n) { \
+        k = n < per ? n : per; \
+        n -= k; \
+        v = (next) & mask; \
+        for(j=1;j<k;j++) { \
+            v |= ((next) & mask) << (j * l->bits); \
+        } \
+        tflac_pack_uintle(d, v); \
+        d += k * bytes; \
+    }
+
+    if(l->planar) {
+        l->i += n;
+        TFLAC_MD5_LANE_PACK(tflac_md5_lane_planar(l))
+    } else if(l->wide) {
+        const tflac_s32* s32 = &((const tflac_s32*)l->samples)[l->i];
+        l->i += n;
+        TFLAC_MD5_LANE_PACK((tflac_uint)*s32++)
+    } else {
+        const tflac_s16* s16 = &((const tflac_s16*)l->samples)[l->i];
+        l->i += n;
+        TFLAC_MD5_LANE_PACK((tflac_uint)*s16++)
+    }
+
+#undef TFLAC_MD5_LANE_PACK
+
+    return m->pos >= 64;
+}
+
+/* runs lanes until all of them are out of samples, whichever have
+ * a full block get transformed together */
+TFLAC_PRIVATE void tflac_md5_lanes(tflac_md5_lane* lanes, tflac_u32 count) {
+    tflac_md5 scratch;
+    tflac_md5* m[TFLAC_MD5_LANES];
+    tflac_u32 i = 0;
+    tflac_u32 n = 0;
+    tflac_u32 bytes = 0;
+
+    tflac_md5_init(&scratch);
+    for(i=0;i<sizeof(scratch.buffer);i++) {
+        scratch.buffer[i] = 0;
+    }
+
+    for(;;) {
+        n = 0;
+        for(i=0;i<count;i++) {
+            if(tflac_md5_lane_fill(&lanes[i])) m[n++] = lanes[i].m;
+        }
+        if(n == 0) break;
+
+        if(n == 1) {
+            tflac_md5_transform(m[0]);
+        } else {
+            for(i=n;i<TFLAC_MD5_LANES;i++) {
+                m[i] = &scratch;
+            }
+            tflac_md5_transform_multi(m, n);
+        }
+
+        for(i=0;i<n;i++) {
+            m[i]->pos %= 64;
+            bytes = m[i]->pos;
+            while(bytes--) {
+                m[i]->buffer[bytes] = m[i]->buffer[64+bytes];
+            }
+        }
+    }
+}
+
+TFLAC_PRIVATE void tflac_update_md5_multi(tflac** t, tflac_u32 count, const tflac_u32* blocksizes, const void* const* samples, tflac_u32 planar, tflac_u32 wide) {
+    tflac_md5_lane lanes[TFLAC_MD5_LANES];
+    tflac_u32 n = 0;
+    tflac_u32 i = 0;
+
+    for(i=0;i<count;i++) {
+        if(!t[i]->enable_md5) continue;
+        if(t[i]->md5_push != NULL) {
+            t[i]->md5_push(t[i], (wide << 1) | (planar ^ 1), blocksizes[i], samples[i]);
+            continue;
+        }
+
+        lanes[n].m = &t[i]->md5_ctx;
+        lanes[n].samples = samples[i];
+        lanes[n].planar = planar;
+        lanes[n].wide = wide;
+        lanes[n].bits = (7 + t[i]->bitdepth) & 0xF8;
+        lanes[n].channels = t[i]->channels;
+        lanes[n].total = blocksizes[i] * t[i]->channels;
+        lanes[n].i = 0;
+        lanes[n].c = 0;
+        lanes[n].f = 0;
+
+        if(++n == TFLAC_MD5_LANES) {
+            tflac_md5_lanes(lanes, n);
+            n = 0;
+        }
+    }
+
+    if(n) tflac_md5_lanes(lanes, n);
+}
+
+TFLAC_PRIVATE
+void tflac_md5_digest(const tflac_md5* m, tflac_u8 out[16]) {
+    out[0]  = (tflac_u8)(m->a);
+    out[1]  = (tflac_u8)(m->a >> 8);
+    out[2]  = (tflac_u8)(m->a >> 16);
+    out[3]  = (tflac_u8)(m->a >> 24);
+    out[4]  = (tflac_u8)(m->b);
+    out[5]  = (tflac_u8)(m->b >> 8);
+    out[6]  = (tflac_u8)(m->b >> 16);
+    out[7]  = (tflac_u8)(m->b >> 24);
+    out[8]  = (tflac_u8)(m->c);
+    out[9]  = (tflac_u8)(m->c >> 8);
+    out[10] = (tflac_u8)(m->c >> 16);
+    out[11] = (tflac_u8)(m->c >> 24);
+    out[12] = (tflac_u8)(m->d);
+    out[13] = (tflac_u8)(m->d >> 8);
+    out[14] = (tflac_u8)(m->d >> 16);
+    out[15] = (tflac_u8)(m->d >> 24);
+}
+
+TFLAC_CONST TFLAC_PRIVATE
+tflac_u32 tflac_verbatim_subframe_bits(tflac_u32 blocksize, tflac_u32 bitdepth) {
+    return 8 + (blocksize * bitdepth);
+}
+
+TFLAC_PRIVATE
+int tflac_encode_subframe_verbatim(tflac* t) {
+    tflac_u32 i = 0;
+    tflac_u8 w = (tflac_u8)t->wasted_bits;
+    const tflac_s32* residuals_0 = TFLAC_ASSUME_ALIGNED(t->residuals[0], 16);
+    int r;
+
+    if( (r = tflac_bitwriter_add(&t->bw, 8, 0x02 | (!!w) )) != 0) return r;
+    if(w) if( (r = tflac_bitwriter_add(&t->bw, w, 1)) != 0) return r;
+
+    for(i=0;i<t->cur_blocksize;i++) {
+        if( (r = tflac_bitwriter_add(&t->bw, t->subframe_bitdepth - t->wasted_bits, (tflac_u32)residuals_0[i])) != 0) return r;
+    }
+
+    return tflac_bitwriter_flush(&t->bw);
+}
+
+TFLAC_PRIVATE
+int tflac_encode_subframe_constant(tflac* t) {
+    int r;
+    if( (r = tflac_bitwriter_add(&t->bw, 8, 0x00)) != 0) return r;
+    if( (r = tflac_bitwriter_add(&t->bw, t->subframe_bitdepth, ((tflac_u32) t->residuals[0][0]) << t->wasted_bits)) != 0) return r;
+    return tflac_bitwriter_flush(&t->bw);
+}
+
+TFLAC_PRIVATE TFLAC_INLINE void tflac_rescale_samples(tflac* t) {
+    tflac_u32 i = 0;
+    tflac_s32* TFLAC_RESTRICT residuals_0 = TFLAC_ASSUME_ALIGNED(t->residuals[0], 16);
+
+    if( (!t->constant) && t->wasted_bits) {
+        /* rescale residuals for order 0 */
+        for(i=0;i<t->cur_blocksize;i++) {
+            residuals_0[i] = residuals_0[i] / (1 << t->wasted_bits);
+        }
+        /* since we scaled down there's no way we have INT32_MIN in there anymore */
+        t->residual_errors[0] = TFLAC_U64_ZERO;
+    }
+
+    return;
+}
+
+TFLAC_PRIVATE
+void tflac_md5_pack_s16_std(tflac_u8* TFLAC_RESTRICT out, const tflac_s16* TFLAC_RESTRICT in, tflac_u32 len, tflac_u32 bytes) {
+    tflac_u32 i = 0;
+    tflac_u32 v;
+
+    switch(bytes) {
+        case 1: {
+            for(i=0;i<len;i++) {
+                out[i] = (tflac_u8)in[i];
+            }
+            break;
+        }
+        case 2: {
+            for(i=0;i<len;i++) {
+                v = (tflac_u32)in[i];
+                out[0] = (tflac_u8)v;
+                out[1] = (tflac_u8)(v >> 8);
+                out += 2;
+            }
+            break;
+        }
+        default: break;
+    }
+}
+
+TFLAC_PRIVATE
+void tflac_md5_pack_s32_std(tflac_u8* TFLAC_RESTRICT out, const tflac_s32* TFLAC_RESTRICT in, tflac_u32 len, tflac_u32 bytes) {
+    tflac_u32 i = 0;
+    tflac_u32 v;
+
+    switch(bytes) {
+        case 1: {
+            for(i=0;i<len;i++) {
+                out[i] = (tflac_u8)in[i];
+            }
+            break;
+        }
+        case 2: {
+            for(i=0;i<len;i++) {
+                v = (tflac_u32)in[i];
+                out[0] = (tflac_u8)v;
+                out[1] = (tflac_u8)(v >> 8);
+                out += 2;
+            }
+            break;
+        }
+        case 3: {
+            for(i=0;i<len;i++) {
+                v = (tflac_u32)in[i];
+                out[0] = (tflac_u8)v;
+                out[1] = (tflac_u8)(v >> 8);
+                out[2] = (tflac_u8)(v >> 16);
+                out += 3;
+            }
+            break;
+        }
+        case 4: {
+            for(i=0;i<len;i++) {
+                tflac_pack_u32le(out, (tflac_u32)in[i]);
+                out += 4;
+            }
+            break;
+        }
+        default: break;
+    }
+}
+
+/* little-endian samples that fill their whole type are already in MD5
+ * order and get hashed in place, everything else is packed a chunk at
+ * a time */
+TFLAC_PRIVATE
+TFLAC_INLINE
+int tflac_md5_in_place(void) {
+    const tflac_u16 one = 1;
+    return *(const tflac_u8*)&one == 1;
+}
+
+TFLAC_PRIVATE
+void tflac_md5_update_int16(tflac_md5* m, const tflac_s16* samples, tflac_u32 len, tflac_u32 bytes) {
+    tflac_u8 chunk[TFLAC_MD5_CHUNK + 16];
+    const tflac_u32 step = TFLAC_MD5_CHUNK / bytes;
+    tflac_u32 n;
+
+    if(bytes == 2 && tflac_md5_in_place()) {
+        tflac_md5_update(m, (const tflac_u8*)samples, len * 2);
+        return;
+    }
+
+    while(len) {
+        n = len < step ? len : step;
+        tflac_md5_pack_s16(chunk, samples, n, bytes);
+        tflac_md5_update(m, chunk, n * bytes);
+        samples += n;
+        len -= n;
+    }
+}
+
+TFLAC_PRIVATE
+void tflac_md5_update_int32(tflac_md5* m, const tflac_s32* samples, tflac_u32 len, tflac_u32 bytes) {
+    tflac_u8 chunk[TFLAC_MD5_CHUNK + 16];
+    const tflac_u32 step = TFLAC_MD5_CHUNK / bytes;
+    tflac_u32 n;
+
+    if(bytes == 4 && tflac_md5_in_place()) {
+        tflac_md5_update(m, (const tflac_u8*)samples, len * 4);
+        return;
+    }
+
+    while(len) {
+        n = len < step ? len : step;
+        tflac_md5_pack_s32(chunk, samples, n, bytes);
+        tflac_md5_update(m, chunk, n * bytes);
+        samples += n;
+        len -= n;
+    }
+}
+
+/* the md5 calculators, named by how many bytes each sample takes */
+TFLAC_PRIVATE void tflac_update_md5_s16i_1(tflac* t, const tflac_s16* samples) {
+    tflac_md5_update_int16(&t->md5_ctx, samples, t->cur_blocksize * t->channels, 1);
+}
+
+TFLAC_PRIVATE void tflac_update_md5_s16i_2(tflac* t, const tflac_s16* samples) {
+    tflac_md5_update_int16(&t->md5_ctx, samples, t->cur_blocksize * t->channels, 2);
+}
+
+TFLAC_PRIVATE void tflac_update_md5_s32i_1(tflac* t, const tflac_s32* samples) {
+    tflac_md5_update_int32(&t->md5_ctx, samples, t->cur_blocksize * t->channels, 1);
+}
+
+TFLAC_PRIVATE void tflac_update_md5_s32i_2(tflac* t, const tflac_s32* samples) {
+    tflac_md5_update_int32(&t->md5_ctx, samples, t->cur_blocksize * t->channels, 2);
+}
+
+TFLAC_PRIVATE void tflac_update_md5_s32i_3(tflac* t, const tflac_s32* samples) {
+    tflac_md5_update_int32(&t->md5_ctx, samples, t->cur_blocksize * t->channels, 3);
+}
+
+TFLAC_PRIVATE void tflac_update_md5_s32i_4(tflac* t, const tflac_s32* samples) {
+    tflac_md5_update_int32(&t->md5_ctx, samples, t->cur_blocksize * t->channels, 4);
+}
+
+/* planar samples get interleaved a chunk at a time first */
+TFLAC_PRIVATE void tflac_update_md5_int16_planar(tflac* t, const tflac_s16** samples) {
+    tflac_s16 frames[TFLAC_MD5_CHUNK];
+    tflac_u32 bytes = ((7 + t->bitdepth) & 0xF8) / 8;
+    tflac_u32 step = TFLAC_MD5_CHUNK / (bytes * t->channels);
+    tflac_u32 i = 0;
+    tflac_u32 j = 0;
+    tflac_u32 c = 0;
+    tflac_u32 n = 0;
+
+    for(i=0;i<t->cur_blocksize;i+=n) {
+        n = t->cur_blocksize - i;
+        if(n > step) n = step;
+        if(t->channels == 2) {
+            /* simple enough for the compiler to vectorize */
+            for(j=0;j<n;j++) {
+                frames[(j * 2) + 0] = samples[0][i+j];
+                frames[(j * 2) + 1] = samples[1][i+j];
+            }
+        } else {
+            for(c=0;c<t->channels;c++) {
+                for(j=0;j<n;j++) {
+                    frames[(j * t->channels) + c] = samples[c][i+j];
+                }
+            }
+        }
+        tflac_md5_update_int16(&t->md5_ctx, frames, n * t->channels, bytes);
+    }
+}
+
+TFLAC_PRIVATE void tflac_update_md5_int32_planar(tflac* t, const tflac_s32** samples) {
+    tflac_s32 frames[TFLAC_MD5_CHUNK];
+    tflac_u32 bytes = ((7 + t->bitdepth) & 0xF8) / 8;
+    tflac_u32 step = TFLAC_MD5_CHUNK / (bytes * t->channels);
+    tflac_u32 i = 0;
+    tflac_u32 j = 0;
+    tflac_u32 c = 0;
+    tflac_u32 n = 0;
+
+    for(i=0;i<t->cur_blocksize;i+=n) {
+        n = t->cur_blocksize - i;
+        if(n > step) n = step;
+        if(t->channels == 2) {
+            /* simple enough for the compiler to vectorize */
+            for(j=0;j<n;j++) {
+                frames[(j * 2) + 0] = samples[0][i+j];
+                frames[(j * 2) + 1] = samples[1][i+j];
+            }
+        } else {
+            for(c=0;c<t->channels;c++) {
+                for(j=0;j<n;j++) {
+                    frames[(j * t->channels) + c] = samples[c][i+j];
+                }
+            }
+        }
+        tflac_md5_update_int32(&t->md5_ctx, frames, n * t->channels, bytes);
+    }
+}
+
+
+/* the decorrelation kernels convert one channel into residuals[0], op
+ * picks whether that's left, right, side (left - right) or mid
+ * ((left + right) >> 1). Each sample is computed as
+ * ((left & lmask) + (+/- right & rmask)) >> shift so the same loop
+ * handles all four without branching.
+ *
+ * info[0] gets the OR of every value (for wasted bits), info[1] the OR
+ * of every value XOR'd with the first (zero means a constant subframe),
+ * info[2] is non-zero if INT32_MIN showed up.
+ *
+ * The interleaved stereo kernels fill both channels of a frame in one
+ * pass over the samples, with op0/op1 and info[0..2]/info[3..5] for
+ * each channel. */
+#define TFLAC_DECORRELATE_SAMPLE(n, l, r) \
+    ((tflac_s32)( \
+      ( ((tflac_u32)(l)) & lmask ## n ) + \
+      ( ( ( ((tflac_u32)(r)) ^ rneg ## n ) - rneg ## n ) & rmask ## n ) \
+    ) >> shift ## n)
+
+#define TFLAC_DECORRELATE_MASKS(n, op) \
+    const tflac_u32 lmask ## n = (op) == TFLAC_DECORRELATE_RIGHT ? 0 : UINT32_C(0xFFFFFFFF); \
+    const tflac_u32 rmask ## n = (op) == TFLAC_DECORRELATE_LEFT ? 0 : UINT32_C(0xFFFFFFFF); \
+    const tflac_u32 rneg ## n = (op) == TFLAC_DECORRELATE_SIDE ? UINT32_C(0xFFFFFFFF) : 0; \
+    const tflac_u32 shift ## n = (op) == TFLAC_DECORRELATE_MID
+
+#define TFLAC_DECORRELATE_ACCUMULATE(n, v) \
+    do { \
+        bits ## n |= (tflac_u32)(v); \
+        non_constant ## n |= (tflac_u32)(v) ^ first ## n; \
+        min_found ## n |= (v) == INT32_MIN; \
+    } while(0)
+
+/* accumulates into info, used directly for odd strides and for the
+ * leftovers of the SIMD kernels */
+TFLAC_PRIVATE TFLAC_INLINE void tflac_decorrelate_int16_tail(tflac_u32 blocksize, tflac_u32 stride, tflac_u32 op, const tflac_s16* left, const tflac_s16* right, tflac_s32* TFLAC_RESTRICT residuals, tflac_u32 first0, tflac_u32* info) {
+    TFLAC_DECORRELATE_MASKS(0, op);
+    tflac_u32 i = 0;
+    tflac_u32 j = 0;
+    tflac_s32 v = 0;
+
+    tflac_u32 bits0 = 0;
+    tflac_u32 non_constant0 = 0;
+    tflac_u32 min_found0 = 0;
+
+    for(i=0;i<blocksize;i++) {
+        v = TFLAC_DECORRELATE_SAMPLE(0, left[j], right[j]);
+        residuals[i] = v;
+        TFLAC_DECORRELATE_ACCUMULATE(0, v);
+        j += stride;
+    }
+
+    info[0] |= bits0;
+    info[1] |= non_constant0;
+    info[2] |= min_found0;
+}
+
+TFLAC_PRIVATE TFLAC_INLINE void tflac_decorrelate_int32_tail(tflac_u32 blocksize, tflac_u32 stride, tflac_u32 op, const tflac_s32* left, const tflac_s32* right, tflac_s32* TFLAC_RESTRICT residuals, tflac_u32 first0, tflac_u32* info) {
+    TFLAC_DECORRELATE_MASKS(0, op);
+    tflac_u32 i = 0;
+    tflac_u32 j = 0;
+    tflac_s32 v = 0;
+
+    tflac_u32 bits0 = 0;
+    tflac_u32 non_constant0 = 0;
+    tflac_u32 min_found0 = 0;
+
+    for(i=0;i<blocksize;i++) {
+        v = TFLAC_DECORRELATE_SAMPLE(0, left[j], right[j]);
+        residuals[i] = v;
+        TFLAC_DECORRELATE_ACCUMULATE(0, v);
+        j += stride;
+    }
+
+    info[0] |= bits0;
+    info[1] |= non_constant0;
+    info[2] |= min_found0;
+}
+
+TFLAC_PRIVATE TFLAC_INLINE void tflac_decorrelate_s16i_tail(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s16* samples, tflac_s32* TFLAC_RESTRICT out0, tflac_s32* TFLAC_RESTRICT out1, tflac_u32 first0, tflac_u32 first1, tflac_u32* info) {
+    TFLAC_DECORRELATE_MASKS(0, op0);
+    TFLAC_DECORRELATE_MASKS(1, op1);
+    tflac_u32 i = 0;
+    tflac_s32 v0 = 0;
+    tflac_s32 v1 = 0;
+
+    tflac_u32 bits0 = 0;
+    tflac_u32 non_constant0 = 0;
+    tflac_u32 min_found0 = 0;
+    tflac_u32 bits1 = 0;
+    tflac_u32 non_constant1 = 0;
+    tflac_u32 min_found1 = 0;
+
+    for(i=0;i<blocksize;i++) {
+        v0 = TFLAC_DECORRELATE_SAMPLE(0, samples[i*2], samples[(i*2)+1]);
+        v1 = TFLAC_DECORRELATE_SAMPLE(1, samples[i*2], samples[(i*2)+1]);
+        out0[i] = v0;
+        out1[i] = v1;
+        TFLAC_DECORRELATE_ACCUMULATE(0, v0);
+        TFLAC_DECORRELATE_ACCUMULATE(1, v1);
+    }
+
+    info[0] |= bits0;
+    info[1] |= non_constant0;
+    info[2] |= min_found0;
+    info[3] |= bits1;
+    info[4] |= non_constant1;
+    info[5] |= min_found1;
+}
+
+TFLAC_PRIVATE TFLAC_INLINE void tflac_decorrelate_s32i_tail(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s32* samples, tflac_s32* TFLAC_RESTRICT out0, tflac_s32* TFLAC_RESTRICT out1, tflac_u32 first0, tflac_u32 first1, tflac_u32* info) {
+    TFLAC_DECORRELATE_MASKS(0, op0);
+    TFLAC_DECORRELATE_MASKS(1, op1);
+    tflac_u32 i = 0;
+    tflac_s32 v0 = 0;
+    tflac_s32 v1 = 0;
+
+    tflac_u32 bits0 = 0;
+    tflac_u32 non_constant0 = 0;
+    tflac_u32 min_found0 = 0;
+    tflac_u32 bits1 = 0;
+    tflac_u32 non_constant1 = 0;
+    tflac_u32 min_found1 = 0;
+
+    for(i=0;i<blocksize;i++) {
+        v0 = TFLAC_DECORRELATE_SAMPLE(0, samples[i*2], samples[(i*2)+1]);
+        v1 = TFLAC_DECORRELATE_SAMPLE(1, samples[i*2], samples[(i*2)+1]);
+        out0[i] = v0;
+        out1[i] = v1;
+        TFLAC_DECORRELATE_ACCUMULATE(0, v0);
+        TFLAC_DECORRELATE_ACCUMULATE(1, v1);
+    }
+
+    info[0] |= bits0;
+    info[1] |= non_constant0;
+    info[2] |= min_found0;
+    info[3] |= bits1;
+    info[4] |= non_constant1;
+    info[5] |= min_found1;
+}
+
+#undef TFLAC_DECORRELATE_ACCUMULATE
+
+/* the value every sample gets compared against for constant detection */
+TFLAC_PRIVATE TFLAC_INLINE tflac_u32 tflac_decorrelate_int16_first(tflac_u32 op, const tflac_s16* left, const tflac_s16* right) {
+    TFLAC_DECORRELATE_MASKS(0, op);
+    return (tflac_u32)TFLAC_DECORRELATE_SAMPLE(0, left[0], right[0]);
+}
+
+TFLAC_PRIVATE TFLAC_INLINE tflac_u32 tflac_decorrelate_int32_first(tflac_u32 op, const tflac_s32* left, const tflac_s32* right) {
+    TFLAC_DECORRELATE_MASKS(0, op);
+    return (tflac_u32)TFLAC_DECORRELATE_SAMPLE(0, left[0], right[0]);
+}
+
+TFLAC_PRIVATE void tflac_decorrelate_int16_std(tflac_u32 blocksize, tflac_u32 stride, tflac_u32 op, const tflac_s16* left, const tflac_s16* right, tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* info) {
+    info[0] = 0;
+    info[1] = 0;
+    info[2] = 0;
+    if(blocksize == 0) return;
+    tflac_decorrelate_int16_tail(blocksize, stride, op, left, right, residuals,
+      tflac_decorrelate_int16_first(op, left, right), info);
+}
+
+TFLAC_PRIVATE void tflac_decorrelate_int32_std(tflac_u32 blocksize, tflac_u32 stride, tflac_u32 op, const tflac_s32* left, const tflac_s32* right, tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* info) {
+    info[0] = 0;
+    info[1] = 0;
+    info[2] = 0;
+    if(blocksize == 0) return;
+    tflac_decorrelate_int32_tail(blocksize, stride, op, left, right, residuals,
+      tflac_decorrelate_int32_first(op, left, right), info);
+}
+
+TFLAC_PRIVATE void tflac_decorrelate_s16i_std(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s16* samples, tflac_s32* TFLAC_RESTRICT out0, tflac_s32* TFLAC_RESTRICT out1, tflac_u32* info) {
+    info[0] = 0;
+    info[1] = 0;
+    info[2] = 0;
+    info[3] = 0;
+    info[4] = 0;
+    info[5] = 0;
+    if(blocksize == 0) return;
+    tflac_decorrelate_s16i_tail(blocksize, op0, op1, samples, out0, out1,
+      tflac_decorrelate_int16_first(op0, &samples[0], &samples[1]),
+      tflac_decorrelate_int16_first(op1, &samples[0], &samples[1]),
+      info);
+}
+
+TFLAC_PRIVATE void tflac_decorrelate_s16p_std(tflac_u32 blocksize, tflac_u32 op, const tflac_s16* left, const tflac_s16* right, tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* info) {
+    tflac_decorrelate_int16_std(blocksize, 1, op, left, right, residuals, info);
+}
+
+TFLAC_PRIVATE void tflac_decorrelate_s32i_std(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s32* samples, tflac_s32* TFLAC_RESTRICT out0, tflac_s32* TFLAC_RESTRICT out1, tflac_u32* info) {
+    info[0] = 0;
+    info[1] = 0;
+    info[2] = 0;
+    info[3] = 0;
+    info[4] = 0;
+    info[5] = 0;
+    if(blocksize == 0) return;
+    tflac_decorrelate_s32i_tail(blocksize, op0, op1, samples, out0, out1,
+      tflac_decorrelate_int32_first(op0, &samples[0], &samples[1]),
+      tflac_decorrelate_int32_first(op1, &samples[0], &samples[1]),
+      info);
+}
+
+TFLAC_PRIVATE void tflac_decorrelate_s32p_std(tflac_u32 blocksize, tflac_u32 op, const tflac_s32* left, const tflac_s32* right, tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* info) {
+    tflac_decorrelate_int32_std(blocksize, 1, op, left, right, residuals, info);
+}
+
+TFLAC_PRIVATE TFLAC_INLINE tflac_u32 tflac_decorrelate_op(const tflac* t, tflac_u32 channel) {
+    switch( (enum TFLAC_CHANNEL_MODE)t->cur_channel_mode) {
+        case TFLAC_CHANNEL_LEFT_SIDE:  return channel == 0 ? TFLAC_DECORRELATE_LEFT : TFLAC_DECORRELATE_SIDE;
+        case TFLAC_CHANNEL_SIDE_RIGHT: return channel == 0 ? TFLAC_DECORRELATE_SIDE : TFLAC_DECORRELATE_RIGHT;
+        case TFLAC_CHANNEL_MID_SIDE:   return channel == 0 ? TFLAC_DECORRELATE_MID : TFLAC_DECORRELATE_SIDE;
+        default: break;
+    }
+    return channel == 0 ? TFLAC_DECORRELATE_LEFT : TFLAC_DECORRELATE_RIGHT;
+}
+
+TFLAC_PRIVATE TFLAC_INLINE void tflac_decorrelate_finish(tflac* t, tflac_u32 op, const tflac_u32* info) {
+    t->subframe_bitdepth = t->bitdepth + (op == TFLAC_DECORRELATE_SIDE);
+    t->constant = !info[1];
+    t->wasted_bits = t->constant ? 0 : tflac_wasted_bits((tflac_s32)info[0], t->subframe_bitdepth);
+    t->residual_errors[0] = info[2] ? TFLAC_U64_MAX : TFLAC_U64_ZERO;
+}
+
+/* with interleaved stereo the first channel decorrelates both, the
+ * second one just swaps its buffer in */
+TFLAC_PRIVATE TFLAC_INLINE void tflac_decorrelate_second_channel(tflac* t) {
+    tflac_s32* tmp = t->residuals[0];
+    t->residuals[0] = t->stereo_residuals;
+    t->stereo_residuals = tmp;
+    tflac_decorrelate_finish(t, tflac_decorrelate_op(t, 1), &t->stereo_info[3]);
+}
+
+TFLAC_PRIVATE void tflac_stereo_decorrelate_int16_planar(tflac* t, tflac_u32 channel, const tflac_s16** samples) {
+    tflac_u32 info[3];
+    tflac_u32 op = TFLAC_DECORRELATE_LEFT;
+    const tflac_s16* left = samples[channel];
+    const tflac_s16* right = samples[channel];
+
+    if(t->channels == 2) {
+        op = tflac_decorrelate_op(t, channel);
+        left = samples[0];
+        right = samples[1];
+    }
+
+    t->decorrelate_s16p(t->cur_blocksize, op, left, right, t->residuals[0], info);
+    tflac_decorrelate_finish(t, op, info);
+}
+
+TFLAC_PRIVATE void tflac_stereo_decorrelate_int16_interleaved(tflac* t, tflac_u32 channel, const tflac_s16* samples) {
+    tflac_u32 info[3];
+    tflac_u32 op = TFLAC_DECORRELATE_LEFT;
+
+    switch(t->channels) {
+        case 1: t->decorrelate_s16p(t->cur_blocksize, op, samples, samples, t->residuals[0], info); break;
+        case 2: {
+            if(channel == 1) {
+                tflac_decorrelate_second_channel(t);
+                return;
+            }
+            op = tflac_decorrelate_op(t, 0);
+            t->decorrelate_s16i(t->cur_blocksize, op, tflac_decorrelate_op(t, 1), samples,
+              t->residuals[0], t->stereo_residuals, t->stereo_info);
+            tflac_decorrelate_finish(t, op, &t->stereo_info[0]);
+            return;
+        }
+        default: tflac_decorrelate_int16_std(t->cur_blocksize, t->channels, op, &samples[channel], &samples[channel], t->residuals[0], info); break;
+    }
+    tflac_decorrelate_finish(t, op, info);
+}
+
+TFLAC_PRIVATE void tflac_stereo_decorrelate_int32_planar(tflac* t, tflac_u32 channel, const tflac_s32** samples) {
+    tflac_u32 info[3];
+    tflac_u32 op = TFLAC_DECORRELATE_LEFT;
+    const tflac_s32* left = samples[channel];
+    const tflac_s32* right = samples[channel];
+
+    if(t->channels == 2) {
+        op = tflac_decorrelate_op(t, channel);
+        left = samples[0];
+        right = samples[1];
+    }
+
+    t->decorrelate_s32p(t->cur_blocksize, op, left, right, t->residuals[0], info);
+    tflac_decorrelate_finish(t, op, info);
+}
+
+TFLAC_PRIVATE void tflac_stereo_decorrelate_int32_interleaved(tflac* t, tflac_u32 channel, const tflac_s32* samples) {
+    tflac_u32 info[3];
+    tflac_u32 op = TFLAC_DECORRELATE_LEFT;
+
+    switch(t->channels) {
+        case 1: t->decorrelate_s32p(t->cur_blocksize, op, samples, samples, t->residuals[0], info); break;
+        case 2: {
+            if(channel == 1) {
+                tflac_decorrelate_second_channel(t);
+                return;
+            }
+            op = tflac_decorrelate_op(t, 0);
+            t->decorrelate_s32i(t->cur_blocksize, op, tflac_decorrelate_op(t, 1), samples,
+              t->residuals[0], t->stereo_residuals, t->stereo_info);
+            tflac_decorrelate_finish(t, op, &t->stereo_info[0]);
+            return;
+        }
+        default: tflac_decorrelate_int32_std(t->cur_blocksize, t->channels, op, &samples[channel], &samples[channel], t->residuals[0], info); break;
+    }
+    tflac_decorrelate_finish(t, op, info);
+}
+
+/* the estimators make a single pass over both channels, summing the
+ * order 2 residuals of left, right, mid and side, then pick the mode
+ * with the cheapest pair of channels */
+TFLAC_PRIVATE void tflac_stereo_estimate_int16(tflac* t, tflac_u32 stride, const tflac_s16* left, const tflac_s16* right) {
+    tflac_u64 errors[4]; /* left, right, mid, side */
+    tflac_s32 l, r, m, s;
+    tflac_s32 l1, r1, m1, s1;
+    tflac_s32 l2, r2, m2, s2;
+    tflac_u32 i = 0;
+    tflac_u32 j = 0;
+
+    errors[0] = TFLAC_U64_ZERO;
+    errors[1] = TFLAC_U64_ZERO;
+    errors[2] = TFLAC_U64_ZERO;
+    errors[3] = TFLAC_U64_ZERO;
+
+    if(t->cur_blocksize < 3) {
+        t->cur_channel_mode = TFLAC_CHANNEL_INDEPENDENT;
+        return;
+    }
+
+    l2 = (tflac_s32)left[0];
+    r2 = (tflac_s32)right[0];
+    m2 = (l2 + r2) >> 1;
+    s2 = l2 - r2;
+
+    l1 = (tflac_s32)left[stride];
+    r1 = (tflac_s32)right[stride];
+    m1 = (l1 + r1) >> 1;
+    s1 = l1 - r1;
+
+    j = 2 * stride;
+    for(i=2;i<t->cur_blocksize;i++) {
+        l = (tflac_s32)left[j];
+        r = (tflac_s32)right[j];
+        m = (l + r) >> 1;
+        s = l - r;
+
+        TFLAC_U64_ADD_WORD(errors[0], (tflac_u32)tflac_s32_abs(l - (2 * l1) + l2));
+        TFLAC_U64_ADD_WORD(errors[1], (tflac_u32)tflac_s32_abs(r - (2 * r1) + r2));
+        TFLAC_U64_ADD_WORD(errors[2], (tflac_u32)tflac_s32_abs(m - (2 * m1) + m2));
+        TFLAC_U64_ADD_WORD(errors[3], (tflac_u32)tflac_s32_abs(s - (2 * s1) + s2));
+
+        l2 = l1; l1 = l;
+        r2 = r1; r1 = r;
+        m2 = m1; m1 = m;
+        s2 = s1; s1 = s;
+
+        j += stride;
+    }
+
+    tflac_stereo_pick_mode(t, errors);
+}
+
+TFLAC_PRIVATE void tflac_stereo_estimate_int32(tflac* t, tflac_u32 stride, const tflac_s32* left, const tflac_s32* right) {
+    tflac_u64 errors[4]; /* left, right, mid, side */
+    tflac_s32 l, r, m, s;
+    tflac_s32 l1, r1, m1, s1;
+    tflac_s32 l2, r2, m2, s2;
+    tflac_u32 i = 0;
+    tflac_u32 j = 0;
+
+    /* drop low bits from anything over 28 bits so the order 2 side
+     * residual fits in 32 bits, this is only an estimate */
+    tflac_u32 shift = t->bitdepth > 28 ? t->bitdepth - 28 : 0;
+
+    errors[0] = TFLAC_U64_ZERO;
+    errors[1] = TFLAC_U64_ZERO;
+    errors[2] = TFLAC_U64_ZERO;
+    errors[3] = TFLAC_U64_ZERO;
+
+    if(t->cur_blocksize < 3) {
+        t->cur_channel_mode = TFLAC_CHANNEL_INDEPENDENT;
+        return;
+    }
+
+    l2 = left[0] >> shift;
+    r2 = right[0] >> shift;
+    m2 = (l2 + r2) >> 1;
+    s2 = l2 - r2;
+
+    l1 = left[stride] >> shift;
+    r1 = right[stride] >> shift;
+    m1 = (l1 + r1) >> 1;
+    s1 = l1 - r1;
+
+    j = 2 * stride;
+    for(i=2;i<t->cur_blocksize;i++) {
+        l = left[j] >> shift;
+        r = right[j] >> shift;
+        m = (l + r) >> 1;
+        s = l - r;
+
+        TFLAC_U64_ADD_WORD(errors[0], (tflac_u32)tflac_s32_abs(l - (2 * l1) + l2));
+        TFLAC_U64_ADD_WORD(errors[1], (tflac_u32)tflac_s32_abs(r - (2 * r1) + r2));
+        TFLAC_U64_ADD_WORD(errors[2], (tflac_u32)tflac_s32_abs(m - (2 * m1) + m2));
+        TFLAC_U64_ADD_WORD(errors[3], (tflac_u32)tflac_s32_abs(s - (2 * s1) + s2));
+
+        l2 = l1; l1 = l;
+        r2 = r1; r1 = r;
+        m2 = m1; m1 = m;
+        s2 = s1; s1 = s;
+
+        j += stride;
+    }
+
+    tflac_stereo_pick_mode(t, errors);
+}
+
+TFLAC_PRIVATE void tflac_stereo_estimate_int16_planar(tflac* t, const tflac_s16** samples) {
+    tflac_stereo_estimate_int16(t, 1, samples[0], samples[1]);
+}
+
+TFLAC_PRIVATE void tflac_stereo_estimate_int16_interleaved(tflac* t, const tflac_s16* samples) {
+    tflac_stereo_estimate_int16(t, t->channels, &samples[0], &samples[1]);
+}
+
+TFLAC_PRIVATE void tflac_stereo_estimate_int32_planar(tflac* t, const tflac_s32** samples) {
+    tflac_stereo_estimate_int32(t, 1, samples[0], samples[1]);
+}
+
+TFLAC_PRIVATE void tflac_stereo_estimate_int32_interleaved(tflac* t, const tflac_s32* samples) {
+    tflac_stereo_estimate_int32(t, t->channels, &samples[0], &samples[1]);
+}
+
+TFLAC_PRIVATE void tflac_cfr_order0_std(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+
+    tflac_u32 i = 0;
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    tflac_u32 residual_abs = 0;
+    tflac_u64 residual_err;
+
+    residual_err = TFLAC_U64_ZERO;
+
+    for(i=4;i<blocksize;i++) {
+        residual_abs = (tflac_u32)tflac_s32_abs(samples[i]);
+        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+    }
+
+    *residual_error = residual_err;
+    (void)_residuals;
+}
+
+
+TFLAC_PRIVATE void tflac_cfr_order1_std(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    tflac_u32 i = 0;
+
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    tflac_u32 residual_abs = 0;
+    tflac_u64 residual_err;
+
+    residual_err = TFLAC_U64_ZERO;
+
+    residuals[0] = samples[0];
+    residuals[1] = samples[1] - samples[0];
+    residuals[2] = samples[2] - samples[1];
+    residuals[3] = samples[3] - samples[2];
+
+    for(i=4;i<blocksize;i++) {
+        residuals[i] = samples[i] - samples[i-1];
+        residual_abs = (tflac_u32)tflac_s32_abs(residuals[i]);
+        TFLAC_U64_ADD_WORD(residual_err, residual_abs);
+    }
+
+    *residual_error = residual_err;
+}
+
+TFLAC_PRIVATE void tflac_cfr_order2_std(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    tflac_u32 i = 0;
+
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    tflac_u32 residual_abs = 0;
+    tflac_u64 residual_err;
+    residual_err = TFLAC_U64_ZERO;
+
+    residuals[0] = samples[0];
+    residuals[1] = samples[1];
+    residuals[2] = samples[2] - (2 * samples[1]) - (-1 * samples[0]);
+    residuals[3] = samples[3] - (2 * samples[2]) - (-1 * samples[1]);;
+
+    for(i=4;i<blocksize;i++) {
+        residuals[i] = samples[i] - (2 * samples[i-1]) - (-1 * samples[i-2] );
+        residual_abs = (tflac_u32)tflac_s32_abs(residuals[i]);
+        TFLAC_U64_ADD_WORD(residual_err, residual_abs);
+    }
+
+    *residual_error = residual_err;
+}
+
+TFLAC_PRIVATE void tflac_cfr_order3_std(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    tflac_u32 i = 0;
+
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+
+    tflac_u32 residual_abs = 0;
+    tflac_u64 residual_err;
+    residual_err = TFLAC_U64_ZERO;
+
+    residuals[0] = samples[0];
+    residuals[1] = samples[1];
+    residuals[2] = samples[2];
+    residuals[3] = samples[3] - (3 * samples[2]) - (-3 * samples[1]) - samples[0];
+
+    for(i=4;i<blocksize;i++) {
+        residuals[i] = samples[i] - (3 * samples[i-1]) - (-3 * samples[i-2]) - samples[i-3];
+        residual_abs = (tflac_u32)tflac_s32_abs(residuals[i]);
+        TFLAC_U64_ADD_WORD(residual_err, residual_abs);
+    }
+
+    *residual_error = residual_err;
+}
+
+TFLAC_PRIVATE void tflac_cfr_order4_std(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    tflac_u32 i = 0;
+
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+
+    tflac_u32 residual_abs = 0;
+    tflac_u64 residual_err;
+    residual_err = TFLAC_U64_ZERO;
+
+    residuals[0] = samples[0];
+    residuals[1] = samples[1];
+    residuals[2] = samples[2];
+    residuals[3] = samples[3];
+
+    for(i=4;i<blocksize;i++) {
+        residuals[i] = samples[i] - (4 * samples[i-1]) - (-6 * samples[i-2]) - (4 * samples[i-3]) - (-1 * samples[i-4]);
+        residual_abs = (tflac_u32)tflac_s32_abs(residuals[i]);
+        TFLAC_U64_ADD_WORD(residual_err, residual_abs);
+    }
+
+    *residual_error = residual_err;
+}
+
+/* the fused variants compute the error sums of all 5 fixed orders
+ * in a single pass over the samples, without storing any residuals.
+ * Once an order is picked, its residuals are calculated again with
+ * the regular per-order calculator. These are only valid when none
+ * of the orders need the wide (64-bit) calculators. */
+
+/* calculates samples [start,end) with scalar code, adding the errors
+ * into residual_errors. start has to be at least 4. */
+TFLAC_PRIVATE TFLAC_INLINE void tflac_cfr_fused_range(
+      tflac_u32 start,
+      tflac_u32 end,
+      const tflac_s32* TFLAC_RESTRICT samples,
+      tflac_u64* TFLAC_RESTRICT residual_errors) {
+
+    tflac_u32 i = 0;
+    tflac_u32 residual_abs = 0;
+    tflac_s32 order1, order2, order3, order4;
+    tflac_s32 prev1, prev2, prev3;
+    tflac_u64 err0, err1, err2, err3, err4;
+
+    err0 = TFLAC_U64_ZERO;
+    err1 = TFLAC_U64_ZERO;
+    err2 = TFLAC_U64_ZERO;
+    err3 = TFLAC_U64_ZERO;
+    err4 = TFLAC_U64_ZERO;
+
+    /* each order is the difference of the previous order's residuals,
+     * so we just need to carry the last residual of orders 1-3 */
+    prev1 = samples[start-1] - samples[start-2];
+    prev2 = prev1 - (samples[start-2] - samples[start-3]);
+    prev3 = prev2 - ((samples[start-2] - samples[start-3]) - (samples[start-3] - samples[start-4]));
+
+    for(i=start;i<end;i++) {
+        order1 = samples[i] - samples[i-1];
+        order2 = order1 - prev1;
+        order3 = order2 - prev2;
+        order4 = order3 - prev3;
+
+        residual_abs = (tflac_u32)tflac_s32_abs(samples[i]);
+        TFLAC_U64_ADD_WORD(err0, residual_abs);
+        residual_abs = (tflac_u32)tflac_s32_abs(order1);
+        TFLAC_U64_ADD_WORD(err1, residual_abs);
+        residual_abs = (tflac_u32)tflac_s32_abs(order2);
+        TFLAC_U64_ADD_WORD(err2, residual_abs);
+        residual_abs = (tflac_u32)tflac_s32_abs(order3);
+        TFLAC_U64_ADD_WORD(err3, residual_abs);
+        residual_abs = (tflac_u32)tflac_s32_abs(order4);
+        TFLAC_U64_ADD_WORD(err4, residual_abs);
+
+        prev1 = order1;
+        prev2 = order2;
+        prev3 = order3;
+    }
+
+    TFLAC_U64_ADD(residual_errors[0], err0);
+    TFLAC_U64_ADD(residual_errors[1], err1);
+    TFLAC_U64_ADD(residual_errors[2], err2);
+    TFLAC_U64_ADD(residual_errors[3], err3);
+    TFLAC_U64_ADD(residual_errors[4], err4);
+}
+
+TFLAC_PRIVATE void tflac_cfr_fused_std(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_u64* TFLAC_RESTRICT residual_errors) {
+
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+
+    residual_errors[0] = TFLAC_U64_ZERO;
+    residual_errors[1] = TFLAC_U64_ZERO;
+    residual_errors[2] = TFLAC_U64_ZERO;
+    residual_errors[3] = TFLAC_U64_ZERO;
+    residual_errors[4] = TFLAC_U64_ZERO;
+
+    tflac_cfr_fused_range(4, blocksize, samples, residual_errors);
+}
+
+#if defined(TFLAC_ENABLE_SSE2) || defined(TFLAC_ENABLE_SSSE3) || defined(TFLAC_ENABLE_SSE4_1) || defined(TFLAC_ENABLE_AVX2)
+
+#ifdef TFLAC_32BIT_ONLY
+#define TFLAC_SSE_ADD64(d,m) \
+    do { \
+        tflac_u32 u32val = ((tflac_u32)_mm_cvtsi128_si32(m)); \
+        d.hi += (d.lo += u32val) < u32val; \
+        d.hi += ((tflac_u32)_mm_cvtsi128_si32(_mm_shuffle_epi32(m,0x55))); \
+    } while(0)
+#else
+
+#ifdef TFLAC_X64
+#define TFLAC_SSE_ADD64(d,m) \
+    d += ((tflac_u64)_mm_cvtsi128_si64(m));
+#else
+#define TFLAC_SSE_ADD64(d,m) \
+    d += ((tflac_u64)_mm_cvtsi128_si32(m)); \
+    d += (((tflac_u64)_mm_cvtsi128_si32(_mm_shuffle_epi32(m,0x55))) << 32);
+#endif /* X64 */
+#endif /* 32BIT */
+
+#endif
+
+#ifdef TFLAC_ENABLE_SSE2
+
+TFLAC_PRIVATE void tflac_cfr_order0_sse2(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+
+    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i sum = _mm_setzero_si128();
+    tflac_u64 residual_err;
+    tflac_u32 len = blocksize - 4;
+
+    tflac_u32 residual_abs = 0;
+
+    residual_err = TFLAC_U64_ZERO;
+
+    samples0 += 4;
+
+    while(len >= 4) {
+        __m128i samples = _mm_load_si128((const __m128i *)samples0);
+        __m128i masks   = _mm_srai_epi32(samples,31);
+
+        samples = _mm_xor_si128(samples, masks);
+        samples = _mm_sub_epi32(samples, masks);
+
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(samples, zero));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(samples, zero));
+
+        samples0 += 4;
+        len -= 4;
+    }
+
+    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
+    TFLAC_SSE_ADD64(residual_err,sum);
+
+    while(len--) {
+        residual_abs = (tflac_u32)tflac_s32_abs(*samples0);
+        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+        samples0++;
+    }
+
+    *residual_error = residual_err;
+    (void)_residuals;
+}
+
+TFLAC_PRIVATE void tflac_cfr_order1_sse2(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
+    const __m128i zero = _mm_setzero_si128();
+
+    tflac_u32 len = blocksize - 4;
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+
+    tflac_u32 residual_abs = 0;
+    tflac_s32 residual = 0;
+    tflac_u64 residual_err;
+    __m128i sum = _mm_setzero_si128();
+
+    residual_err = TFLAC_U64_ZERO;
+
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++ - *samples1++;
+    *residuals++ = *samples0++ - *samples1++;
+    *residuals++ = *samples0++ - *samples1++;
+
+    while(len > 4) {
+        __m128i masks;
+        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
+        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
+
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+
+        _mm_store_si128( (__m128i*)residuals, msamples0);
+
+        masks = _mm_srai_epi32(msamples0,31);
+
+        msamples0 = _mm_xor_si128(msamples0, masks);
+        msamples0 = _mm_sub_epi32(msamples0, masks);
+
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+
+        residuals += 4;
+        samples0 += 4;
+        samples1 += 4;
+        len -= 4;
+    }
+
+    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
+    TFLAC_SSE_ADD64(residual_err,sum);
+
+    while(len--) {
+        residual = *samples0++ - *samples1++;
+        *residuals++ = residual;
+
+        residual_abs = (tflac_u32)tflac_s32_abs(residual);
+        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+    }
+
+    *residual_error = residual_err;
+}
+
+TFLAC_PRIVATE void tflac_cfr_order2_sse2(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
+    const __m128i zero = _mm_setzero_si128();
+
+    tflac_u32 len = blocksize - 4;
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+
+    tflac_u32 residual_abs = 0;
+    tflac_s32 residual = 0;
+    tflac_u64 residual_err;
+    __m128i sum = _mm_setzero_si128();
+
+    residual_err = TFLAC_U64_ZERO;
+
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+    samples1++;
+
+    *residuals++ = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
+    *residuals++ = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
+
+    while(len > 4) {
+        __m128i masks;
+        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
+        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
+        __m128i msamples2 = _mm_loadu_si128((const __m128i *)samples2);
+
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+        msamples0 = _mm_add_epi32(msamples0, msamples2);
+
+        _mm_store_si128( (__m128i*)residuals, msamples0);
+
+        masks = _mm_srai_epi32(msamples0,31);
+
+        msamples0 = _mm_xor_si128(msamples0, masks);
+        msamples0 = _mm_sub_epi32(msamples0, masks);
+
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+
+        residuals += 4;
+        samples0 += 4;
+        samples1 += 4;
+        samples2 += 4;
+        len -= 4;
+    }
+
+    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
+    TFLAC_SSE_ADD64(residual_err,sum);
+
+    while(len--) {
+        residual = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
+
+        residual_abs = (tflac_u32)tflac_s32_abs(residual);
+        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+
+        *residuals++ = residual;
+    }
+
+    *residual_error = residual_err;
+}
+
+TFLAC_PRIVATE void tflac_cfr_order3_sse2(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples3 = _samples;
+    const __m128i zero = _mm_setzero_si128();
+
+    tflac_u32 len = blocksize - 4;
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+
+    tflac_u32 residual_abs = 0;
+    tflac_s32 residual = 0;
+    tflac_u64 residual_err;
+    __m128i sum = _mm_setzero_si128();
+
+    residual_err = TFLAC_U64_ZERO;
+
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+
+    samples1++; samples1++;
+    samples2++;
+
+    *residuals++ = *samples0++ - (3 * (*samples1++)) - (-3 * (*samples2++)) - *samples3++;
+
+    while(len > 4) {
+        __m128i masks;
+        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
+        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
+        __m128i msamples2 = _mm_loadu_si128((const __m128i *)samples2);
+        __m128i msamples3 = _mm_loadu_si128((const __m128i *)samples3);
+
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+
+        msamples0 = _mm_add_epi32(msamples0, msamples2);
+        msamples0 = _mm_add_epi32(msamples0, msamples2);
+        msamples0 = _mm_add_epi32(msamples0, msamples2);
+
+        msamples0 = _mm_sub_epi32(msamples0, msamples3);
+
+        _mm_store_si128( (__m128i*)residuals, msamples0);
+
+        masks = _mm_srai_epi32(msamples0,31);
+
+        msamples0 = _mm_xor_si128(msamples0, masks);
+        msamples0 = _mm_sub_epi32(msamples0, masks);
+
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+
+        residuals += 4;
+        samples0 += 4;
+        samples1 += 4;
+        samples2 += 4;
+        samples3 += 4;
+        len -= 4;
+    }
+
+    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
+    TFLAC_SSE_ADD64(residual_err,sum);
+
+    while(len--) {
+        residual = *samples0++ - (3 * (*samples1++)) - (-3 * (*samples2++)) - *samples3++;
+
+        residual_abs = (tflac_u32)tflac_s32_abs(residual);
+        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+
+        *residuals++ = residual;
+    }
+
+    *residual_error = residual_err;
+}
+
+TFLAC_PRIVATE void tflac_cfr_order4_sse2(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples3 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples4 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const __m128i zero = _mm_setzero_si128();
+
+    tflac_u32 len = blocksize - 4;
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+
+    tflac_u32 residual_abs = 0;
+    tflac_s32 residual = 0;
+    tflac_u64 residual_err;
+    __m128i sum = _mm_setzero_si128();
+
+    residual_err = TFLAC_U64_ZERO;
+
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+
+    samples1++; samples1++; samples1++;
+    samples2++; samples2++;
+    samples3++;
+
+    while(len > 4) {
+        __m128i masks;
+        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
+        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
+        __m128i msamples2 = _mm_loadu_si128((const __m128i *)samples2);
+        __m128i msamples3 = _mm_loadu_si128((const __m128i *)samples3);
+        __m128i msamples4 = _mm_load_si128((const __m128i *)samples4);
+
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+
+        msamples0 = _mm_add_epi32(msamples0, msamples2);
+        msamples0 = _mm_add_epi32(msamples0, msamples2);
+        msamples0 = _mm_add_epi32(msamples0, msamples2);
+        msamples0 = _mm_add_epi32(msamples0, msamples2);
+        msamples0 = _mm_add_epi32(msamples0, msamples2);
+        msamples0 = _mm_add_epi32(msamples0, msamples2);
+
+        msamples0 = _mm_sub_epi32(msamples0, msamples3);
+        msamples0 = _mm_sub_epi32(msamples0, msamples3);
+        msamples0 = _mm_sub_epi32(msamples0, msamples3);
+        msamples0 = _mm_sub_epi32(msamples0, msamples3);
+
+        msamples0 = _mm_add_epi32(msamples0, msamples4);
+
+        _mm_store_si128( (__m128i*)residuals, msamples0);
+
+        masks = _mm_srai_epi32(msamples0,31);
+
+        msamples0 = _mm_xor_si128(msamples0, masks);
+        msamples0 = _mm_sub_epi32(msamples0, masks);
+
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+
+        residuals += 4;
+        samples0 += 4;
+        samples1 += 4;
+        samples2 += 4;
+        samples3 += 4;
+        samples4 += 4;
+        len -= 4;
+    }
+
+    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
+    TFLAC_SSE_ADD64(residual_err,sum);
+
+    while(len--) {
+        residual = *samples0++ - (4 * (*samples1++)) - (-6 * (*samples2++)) - (4 * (*samples3++)) - (-1 * (*samples4++));
+
+        residual_abs = (tflac_u32)tflac_s32_abs(residual);
+        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+
+        *residuals++ = residual;
+    }
+
+    *residual_error = residual_err;
+}
+#endif /* TFLAC_ENABLE_SSE2 */
+
+#ifdef TFLAC_ENABLE_SSSE3
+TFLAC_PRIVATE void tflac_cfr_order0_ssse3(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+
+    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i sum = _mm_setzero_si128();
+    tflac_u64 residual_err;
+    tflac_u32 len = blocksize - 4;
+
+    tflac_u32 residual_abs = 0;
+
+    residual_err = TFLAC_U64_ZERO;
+
+    samples0 += 4;
+
+    while(len >= 4) {
+        __m128i samples = _mm_load_si128((const __m128i *)samples0);
+        samples = _mm_abs_epi32(samples);
+
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(samples, zero));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(samples, zero));
+
+        samples0 += 4;
+        len -= 4;
+    }
+
+    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
+    TFLAC_SSE_ADD64(residual_err,sum);
+
+    while(len--) {
+        residual_abs = (tflac_u32)tflac_s32_abs(*samples0);
+        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+        samples0++;
+    }
+
+    *residual_error = residual_err;
+    (void)_residuals;
+}
+
+TFLAC_PRIVATE void tflac_cfr_order1_ssse3(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
+    const __m128i zero = _mm_setzero_si128();
+
+    tflac_u32 len = blocksize - 4;
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+
+    tflac_u32 residual_abs = 0;
+    tflac_s32 residual = 0;
+    tflac_u64 residual_err;
+    __m128i sum = _mm_setzero_si128();
+
+    residual_err = TFLAC_U64_ZERO;
+
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++ - *samples1++;
+    *residuals++ = *samples0++ - *samples1++;
+    *residuals++ = *samples0++ - *samples1++;
+
+    while(len > 4) {
+        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
+        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
+
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+
+        _mm_store_si128( (__m128i*)residuals, msamples0);
+
+        msamples0 = _mm_abs_epi32(msamples0);
+
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+
+        residuals += 4;
+        samples0 += 4;
+        samples1 += 4;
+        len -= 4;
+    }
+
+    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
+    TFLAC_SSE_ADD64(residual_err,sum);
+
+    while(len--) {
+        residual = *samples0++ - *samples1++;
+        *residuals++ = residual;
+
+        residual_abs = (tflac_u32)tflac_s32_abs(residual);
+        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+    }
+
+    *residual_error = residual_err;
+}
+
+TFLAC_PRIVATE void tflac_cfr_order2_ssse3(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
+    const __m128i zero = _mm_setzero_si128();
+
+    tflac_u32 len = blocksize - 4;
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+
+    tflac_u32 residual_abs = 0;
+    tflac_s32 residual = 0;
+    tflac_u64 residual_err;
+    __m128i sum = _mm_setzero_si128();
+
+    residual_err = TFLAC_U64_ZERO;
+
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+    samples1++;
+
+    *residuals++ = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
+    *residuals++ = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
+
+    while(len > 4) {
+        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
+        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
+        __m128i msamples2 = _mm_loadu_si128((const __m128i *)samples2);
+
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+        msamples0 = _mm_add_epi32(msamples0, msamples2);
+
+        _mm_store_si128( (__m128i*)residuals, msamples0);
+
+        msamples0 = _mm_abs_epi32(msamples0);
+
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+
+        residuals += 4;
+        samples0 += 4;
+        samples1 += 4;
+        samples2 += 4;
+        len -= 4;
+    }
+
+    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
+    TFLAC_SSE_ADD64(residual_err,sum);
+
+    while(len--) {
+        residual = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
+
+        residual_abs = (tflac_u32)tflac_s32_abs(residual);
+        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+
+        *residuals++ = residual;
+    }
+
+    *residual_error = residual_err;
+}
+
+TFLAC_PRIVATE void tflac_cfr_order3_ssse3(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples3 = _samples;
+    const __m128i zero = _mm_setzero_si128();
+
+    tflac_u32 len = blocksize - 4;
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+
+    tflac_u32 residual_abs = 0;
+    tflac_s32 residual = 0;
+    tflac_u64 residual_err;
+    __m128i sum = _mm_setzero_si128();
+
+    residual_err = TFLAC_U64_ZERO;
+
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+
+    samples1++; samples1++;
+    samples2++;
+
+    *residuals++ = *samples0++ - (3 * (*samples1++)) - (-3 * (*samples2++)) - *samples3++;
+
+    while(len > 4) {
+        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
+        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
+        __m128i msamples2 = _mm_loadu_si128((const __m128i *)samples2);
+        __m128i msamples3 = _mm_loadu_si128((const __m128i *)samples3);
+
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+
+        msamples0 = _mm_add_epi32(msamples0, msamples2);
+        msamples0 = _mm_add_epi32(msamples0, msamples2);
+        msamples0 = _mm_add_epi32(msamples0, msamples2);
+
+        msamples0 = _mm_sub_epi32(msamples0, msamples3);
+
+        _mm_store_si128( (__m128i*)residuals, msamples0);
+
+        msamples0 = _mm_abs_epi32(msamples0);
+
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+
+        residuals += 4;
+        samples0 += 4;
+        samples1 += 4;
+        samples2 += 4;
+        samples3 += 4;
+        len -= 4;
+    }
+
+    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
+    TFLAC_SSE_ADD64(residual_err,sum);
+
+    while(len--) {
+        residual = *samples0++ - (3 * (*samples1++)) - (-3 * (*samples2++)) - *samples3++;
+
+        residual_abs = (tflac_u32)tflac_s32_abs(residual);
+        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+
+        *residuals++ = residual;
+    }
+
+    *residual_error = residual_err;
+}
+
+TFLAC_PRIVATE void tflac_cfr_order4_ssse3(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples3 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples4 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const __m128i zero = _mm_setzero_si128();
+
+    tflac_u32 len = blocksize - 4;
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+
+    tflac_u32 residual_abs = 0;
+    tflac_s32 residual = 0;
+    tflac_u64 residual_err;
+    __m128i sum = _mm_setzero_si128();
+
+    residual_err = TFLAC_U64_ZERO;
+
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+
+    samples1++; samples1++; samples1++;
+    samples2++; samples2++;
+    samples3++;
+
+    while(len > 4) {
+        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
+        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
+        __m128i msamples2 = _mm_loadu_si128((const __m128i *)samples2);
+        __m128i msamples3 = _mm_loadu_si128((const __m128i *)samples3);
+        __m128i msamples4 = _mm_load_si128((const __m128i *)samples4);
+
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+
+        msamples0 = _mm_add_epi32(msamples0, msamples2);
+        msamples0 = _mm_add_epi32(msamples0, msamples2);
+        msamples0 = _mm_add_epi32(msamples0, msamples2);
+        msamples0 = _mm_add_epi32(msamples0, msamples2);
+        msamples0 = _mm_add_epi32(msamples0, msamples2);
+        msamples0 = _mm_add_epi32(msamples0, msamples2);
+
+        msamples0 = _mm_sub_epi32(msamples0, msamples3);
+        msamples0 = _mm_sub_epi32(msamples0, msamples3);
+        msamples0 = _mm_sub_epi32(msamples0, msamples3);
+        msamples0 = _mm_sub_epi32(msamples0, msamples3);
+
+        msamples0 = _mm_add_epi32(msamples0, msamples4);
+
+        _mm_store_si128( (__m128i*)residuals, msamples0);
+
+        msamples0 = _mm_abs_epi32(msamples0);
+
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+
+        residuals += 4;
+        samples0 += 4;
+        samples1 += 4;
+        samples2 += 4;
+        samples3 += 4;
+        samples4 += 4;
+        len -= 4;
+    }
+
+    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
+    TFLAC_SSE_ADD64(residual_err,sum);
+
+    while(len--) {
+        residual = *samples0++ - (4 * (*samples1++)) - (-6 * (*samples2++)) - (4 * (*samples3++)) - (-1 * (*samples4++));
+
+        residual_abs = (tflac_u32)tflac_s32_abs(residual);
+        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+
+        *residuals++ = residual;
+    }
+
+    *residual_error = residual_err;
+}
+
+/* 24-bit samples drop every 4th byte, 16 samples make three stores */
+TFLAC_PRIVATE void tflac_md5_pack_s32_ssse3(tflac_u8* TFLAC_RESTRICT out, const tflac_s32* TFLAC_RESTRICT in, tflac_u32 len, tflac_u32 bytes) {
+    tflac_u32 i = 0;
+    const __m128i shuf = _mm_set_epi8(-1, -1, -1, -1, 14, 13, 12, 10, 9, 8, 6, 5, 4, 2, 1, 0);
+    __m128i a, b, c, d;
+
+    if(bytes != 3) {
+        tflac_md5_pack_s32_sse2(out, in, len, bytes);
+        return;
+    }
+
+    for(i=0;i+16<=len;i+=16) {
+        a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&in[i]), shuf);
+        b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&in[i+4]), shuf);
+        c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&in[i+8]), shuf);
+        d = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&in[i+12]), shuf);
+        _mm_storeu_si128((__m128i*)&out[0], _mm_or_si128(a, _mm_slli_si128(b, 12)));
+        _mm_storeu_si128((__m128i*)&out[16], _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+        _mm_storeu_si128((__m128i*)&out[32], _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+        out += 48;
+    }
+
+    tflac_md5_pack_s32_std(out, &in[i], len - i, 3);
+}
+#endif
+
+#ifdef TFLAC_ENABLE_SSE4_1
+TFLAC_PRIVATE void tflac_cfr_order0_sse4_1(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+
+    tflac_cfr_order0_ssse3(blocksize, _samples, _residuals, residual_error);
+}
+
+TFLAC_PRIVATE void tflac_cfr_order1_sse4_1(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    tflac_cfr_order1_ssse3(blocksize, _samples, _residuals, residual_error);
+}
+
+TFLAC_PRIVATE void tflac_cfr_order2_sse4_1(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i two   = _mm_set1_epi32(2);
+    const __m128i neg_one  = _mm_set1_epi32(-1);
+
+    tflac_u32 len = blocksize - 4;
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+
+    tflac_u32 residual_abs = 0;
+    tflac_s32 residual = 0;
+    tflac_u64 residual_err;
+    __m128i sum = _mm_setzero_si128();
+
+    residual_err = TFLAC_U64_ZERO;
+
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+    samples1++;
+
+    *residuals++ = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
+    *residuals++ = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
+
+    while(len > 4) {
+        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
+        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
+        __m128i msamples2 = _mm_loadu_si128((const __m128i *)samples2);
+
+        msamples1 = _mm_mullo_epi32(msamples1,two);
+        msamples2 = _mm_mullo_epi32(msamples2,neg_one);
+
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+        msamples0 = _mm_sub_epi32(msamples0, msamples2);
+
+        _mm_store_si128( (__m128i*)residuals, msamples0);
+
+        msamples0 = _mm_abs_epi32(msamples0);
+
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+
+        residuals += 4;
+        samples0 += 4;
+        samples1 += 4;
+        samples2 += 4;
+        len -= 4;
+    }
+
+    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
+    TFLAC_SSE_ADD64(residual_err,sum);
+
+    while(len--) {
+        residual = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
+
+        residual_abs = (tflac_u32)tflac_s32_abs(residual);
+        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+
+        *residuals++ = residual;
+    }
+
+    *residual_error = residual_err;
+}
+
+TFLAC_PRIVATE void tflac_cfr_order3_sse4_1(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples3 = _samples;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i three = _mm_set1_epi32(3);
+    const __m128i neg_three = _mm_set1_epi32(-3);
+
+    tflac_u32 len = blocksize - 4;
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+
+    tflac_u32 residual_abs = 0;
+    tflac_s32 residual = 0;
+    tflac_u64 residual_err;
+    __m128i sum = _mm_setzero_si128();
+
+    residual_err = TFLAC_U64_ZERO;
+
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+
+    samples1++; samples1++;
+    samples2++;
+
+    *residuals++ = *samples0++ - (3 * (*samples1++)) - (-3 * (*samples2++)) - *samples3++;
+
+    while(len > 4) {
+        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
+        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
+        __m128i msamples2 = _mm_loadu_si128((const __m128i *)samples2);
+        __m128i msamples3 = _mm_loadu_si128((const __m128i *)samples3);
+
+        msamples1 = _mm_mullo_epi32(msamples1, three);
+        msamples2 = _mm_mullo_epi32(msamples2, neg_three);
+
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+        msamples0 = _mm_sub_epi32(msamples0, msamples2);
+        msamples0 = _mm_sub_epi32(msamples0, msamples3);
+
+        _mm_store_si128( (__m128i*)residuals, msamples0);
+
+        msamples0 = _mm_abs_epi32(msamples0);
+
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+
+        residuals += 4;
+        samples0 += 4;
+        samples1 += 4;
+        samples2 += 4;
+        samples3 += 4;
+        len -= 4;
+    }
+
+    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
+    TFLAC_SSE_ADD64(residual_err,sum);
+
+    while(len--) {
+        residual = *samples0++ - (3 * (*samples1++)) - (-3 * (*samples2++)) - *samples3++;
+
+        residual_abs = (tflac_u32)tflac_s32_abs(residual);
+        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+
+        *residuals++ = residual;
+    }
+
+    *residual_error = residual_err;
+}
+
+TFLAC_PRIVATE void tflac_cfr_order4_sse4_1(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples3 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples4 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i four = _mm_set1_epi32(4);
+    const __m128i neg_six = _mm_set1_epi32(-6);
+    const __m128i neg_one = _mm_set1_epi32(-1);
+
+    tflac_u32 len = blocksize - 4;
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+
+    tflac_u32 residual_abs = 0;
+    tflac_s32 residual = 0;
+    tflac_u64 residual_err;
+    __m128i sum = _mm_setzero_si128();
+
+    residual_err = TFLAC_U64_ZERO;
+
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+
+    samples1++; samples1++; samples1++;
+    samples2++; samples2++;
+    samples3++;
+
+    while(len > 4) {
+        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
+        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
+        __m128i msamples2 = _mm_loadu_si128((const __m128i *)samples2);
+        __m128i msamples3 = _mm_loadu_si128((const __m128i *)samples3);
+        __m128i msamples4 = _mm_load_si128((const __m128i *)samples4);
+
+        msamples1 = _mm_mullo_epi32(msamples1, four);
+        msamples2 = _mm_mullo_epi32(msamples2, neg_six);
+        msamples3 = _mm_mullo_epi32(msamples3, four);
+        msamples4 = _mm_mullo_epi32(msamples4, neg_one);
+
+        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+        msamples0 = _mm_sub_epi32(msamples0, msamples2);
+        msamples0 = _mm_sub_epi32(msamples0, msamples3);
+        msamples0 = _mm_sub_epi32(msamples0, msamples4);
+
+        _mm_store_si128( (__m128i*)residuals, msamples0);
+
+        msamples0 = _mm_abs_epi32(msamples0);
+
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+
+        residuals += 4;
+        samples0 += 4;
+        samples1 += 4;
+        samples2 += 4;
+        samples3 += 4;
+        samples4 += 4;
+        len -= 4;
+    }
+
+    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
+    TFLAC_SSE_ADD64(residual_err,sum);
+
+    while(len--) {
+        residual = *samples0++ - (4 * (*samples1++)) - (-6 * (*samples2++)) - (4 * (*samples3++)) - (-1 * (*samples4++));
+
+        residual_abs = (tflac_u32)tflac_s32_abs(residual);
+        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+
+        *residuals++ = residual;
+    }
+
+    *residual_error = residual_err;
+}
+
+/* wide versions, these widen the samples to 64-bit lanes so overflow can
+ * be caught the same way the _std versions catch it. The multiplies are
+ * shifts and adds */
+
+/* sign-extends 4 samples into two vectors of 64-bit lanes */
+#define TFLAC_SSE4_1_WIDE_LOAD(lo, hi, p) \
+    do { \
+        __m128i m128 = _mm_loadu_si128((const __m128i*)(p)); \
+        lo = _mm_cvtepi32_epi64(m128); \
+        hi = _mm_cvtepi32_epi64(_mm_srli_si128(m128, 8)); \
+    } while(0)
+
+/* stores the low halves of 4 wide residuals and adds up their absolute
+ * values. A residual is out of range if adding 2^31 leaves anything in
+ * the upper half, or if it's INT32_MIN */
+#define TFLAC_SSE4_1_WIDE_STORE(p, lo, hi) \
+    do { \
+        __m128i m128 = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(2,0,2,0))); \
+        _mm_store_si128((__m128i*)(p), m128); \
+        overflow = _mm_or_si128(overflow, _mm_srli_epi64(_mm_add_epi64(lo, bias), 32)); \
+        overflow = _mm_or_si128(overflow, _mm_srli_epi64(_mm_add_epi64(hi, bias), 32)); \
+        overflow = _mm_or_si128(overflow, _mm_cmpeq_epi32(m128, min)); \
+        m128 = _mm_abs_epi32(m128); \
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(m128, zero)); \
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(m128, zero)); \
+    } while(0)
+
+#define TFLAC_SSE4_1_WIDE_FINISH() \
+    do { \
+        sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2))); \
+        TFLAC_SSE_ADD64(residual_err,sum); \
+        max_found |= (tflac_u32)!_mm_testz_si128(overflow, overflow); \
+    } while(0)
+
+TFLAC_PRIVATE void tflac_cfr_order1_wide_sse4_1(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set_epi32(0, INT32_MIN, 0, INT32_MIN);
+    const __m128i min = _mm_set1_epi32(INT32_MIN);
+
+    tflac_u32 i = 4;
+    tflac_u32 max_found = 0;
+    tflac_u64 residual_err;
+    __m128i sum = _mm_setzero_si128();
+    __m128i overflow = _mm_setzero_si128();
+    __m128i s0_lo, s0_hi, s1_lo, s1_hi;
+
+    residual_err = TFLAC_U64_ZERO;
+
+    residuals[0] = samples[0];
+    tflac_cfr_wide_range(1, 1, 4, samples, residuals, &residual_err, &max_found);
+
+    for(;blocksize - i >= 4;i+=4) {
+        TFLAC_SSE4_1_WIDE_LOAD(s0_lo, s0_hi, &samples[i]);
+        TFLAC_SSE4_1_WIDE_LOAD(s1_lo, s1_hi, &samples[i-1]);
+
+        s0_lo = _mm_sub_epi64(s0_lo, s1_lo);
+        s0_hi = _mm_sub_epi64(s0_hi, s1_hi);
+
+        TFLAC_SSE4_1_WIDE_STORE(&residuals[i], s0_lo, s0_hi);
+    }
+
+    TFLAC_SSE4_1_WIDE_FINISH();
+    tflac_cfr_wide_range(1, i, blocksize, samples, residuals, &residual_err, &max_found);
+
+    *residual_error = max_found ? TFLAC_U64_MAX : residual_err;
+}
+
+TFLAC_PRIVATE void tflac_cfr_order2_wide_sse4_1(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set_epi32(0, INT32_MIN, 0, INT32_MIN);
+    const __m128i min = _mm_set1_epi32(INT32_MIN);
+
+    tflac_u32 i = 4;
+    tflac_u32 max_found = 0;
+    tflac_u64 residual_err;
+    __m128i sum = _mm_setzero_si128();
+    __m128i overflow = _mm_setzero_si128();
+    __m128i s0_lo, s0_hi, s1_lo, s1_hi, s2_lo, s2_hi;
+
+    residual_err = TFLAC_U64_ZERO;
+
+    residuals[0] = samples[0];
+    residuals[1] = samples[1];
+    tflac_cfr_wide_range(2, 2, 4, samples, residuals, &residual_err, &max_found);
+
+    for(;blocksize - i >= 4;i+=4) {
+        TFLAC_SSE4_1_WIDE_LOAD(s0_lo, s0_hi, &samples[i]);
+        TFLAC_SSE4_1_WIDE_LOAD(s1_lo, s1_hi, &samples[i-1]);
+        TFLAC_SSE4_1_WIDE_LOAD(s2_lo, s2_hi, &samples[i-2]);
+
+        /* s0 + s2 - 2*s1 */
+        s0_lo = _mm_sub_epi64(_mm_add_epi64(s0_lo, s2_lo), _mm_slli_epi64(s1_lo, 1));
+        s0_hi = _mm_sub_epi64(_mm_add_epi64(s0_hi, s2_hi), _mm_slli_epi64(s1_hi, 1));
+
+        TFLAC_SSE4_1_WIDE_STORE(&residuals[i], s0_lo, s0_hi);
+    }
+
+    TFLAC_SSE4_1_WIDE_FINISH();
+    tflac_cfr_wide_range(2, i, blocksize, samples, residuals, &residual_err, &max_found);
+
+    *residual_error = max_found ? TFLAC_U64_MAX : residual_err;
+}
+
+TFLAC_PRIVATE void tflac_cfr_order3_wide_sse4_1(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set_epi32(0, INT32_MIN, 0, INT32_MIN);
+    const __m128i min = _mm_set1_epi32(INT32_MIN);
+
+    tflac_u32 i = 4;
+    tflac_u32 max_found = 0;
+    tflac_u64 residual_err;
+    __m128i sum = _mm_setzero_si128();
+    __m128i overflow = _mm_setzero_si128();
+    __m128i s0_lo, s0_hi, s1_lo, s1_hi, s2_lo, s2_hi, s3_lo, s3_hi;
+
+    residual_err = TFLAC_U64_ZERO;
+
+    residuals[0] = samples[0];
+    residuals[1] = samples[1];
+    residuals[2] = samples[2];
+    tflac_cfr_wide_range(3, 3, 4, samples, residuals, &residual_err, &max_found);
+
+    for(;blocksize - i >= 4;i+=4) {
+        TFLAC_SSE4_1_WIDE_LOAD(s0_lo, s0_hi, &samples[i]);
+        TFLAC_SSE4_1_WIDE_LOAD(s1_lo, s1_hi, &samples[i-1]);
+        TFLAC_SSE4_1_WIDE_LOAD(s2_lo, s2_hi, &samples[i-2]);
+        TFLAC_SSE4_1_WIDE_LOAD(s3_lo, s3_hi, &samples[i-3]);
+
+        /* s0 - s3 + 3*(s2 - s1) */
+        s2_lo = _mm_sub_epi64(s2_lo, s1_lo);
+        s2_hi = _mm_sub_epi64(s2_hi, s1_hi);
+        s2_lo = _mm_add_epi64(_mm_slli_epi64(s2_lo, 1), s2_lo);
+        s2_hi = _mm_add_epi64(_mm_slli_epi64(s2_hi, 1), s2_hi);
+        s0_lo = _mm_add_epi64(_mm_sub_epi64(s0_lo, s3_lo), s2_lo);
+        s0_hi = _mm_add_epi64(_mm_sub_epi64(s0_hi, s3_hi), s2_hi);
+
+        TFLAC_SSE4_1_WIDE_STORE(&residuals[i], s0_lo, s0_hi);
+    }
+
+    TFLAC_SSE4_1_WIDE_FINISH();
+    tflac_cfr_wide_range(3, i, blocksize, samples, residuals, &residual_err, &max_found);
+
+    *residual_error = max_found ? TFLAC_U64_MAX : residual_err;
+}
+
+TFLAC_PRIVATE void tflac_cfr_order4_wide_sse4_1(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set_epi32(0, INT32_MIN, 0, INT32_MIN);
+    const __m128i min = _mm_set1_epi32(INT32_MIN);
 
-TFLAC_PRIVATE
-TFLAC_INLINE
-void tflac_md5_transform(tflac_md5* m) {
-    tflac_u32 A = m->a;
-    tflac_u32 B = m->b;
-    tflac_u32 C = m->c;
-    tflac_u32 D = m->d;
+    tflac_u32 i = 4;
+    tflac_u32 max_found = 0;
+    tflac_u64 residual_err;
+    __m128i sum = _mm_setzero_si128();
+    __m128i overflow = _mm_setzero_si128();
+    __m128i s0_lo, s0_hi, s1_lo, s1_hi, s2_lo, s2_hi, s3_lo, s3_hi, s4_lo, s4_hi;
 
-    tflac_u32 F = 0;
+    residual_err = TFLAC_U64_ZERO;
 
-    tflac_u32 M[16];
+    residuals[0] = samples[0];
+    residuals[1] = samples[1];
+    residuals[2] = samples[2];
+    residuals[3] = samples[3];
 
-    M[0]  = tflac_unpack_u32le(&m->buffer[  (0  * 4) ]);
-    M[1]  = tflac_unpack_u32le(&m->buffer[  (1  * 4) ]);
-    M[2]  = tflac_unpack_u32le(&m->buffer[  (2  * 4) ]);
-    M[3]  = tflac_unpack_u32le(&m->buffer[  (3  * 4) ]);
-    M[4]  = tflac_unpack_u32le(&m->buffer[  (4  * 4) ]);
-    M[5]  = tflac_unpack_u32le(&m->buffer[  (5  * 4) ]);
-    M[6]  = tflac_unpack_u32le(&m->buffer[  (6  * 4) ]);
-    M[7]  = tflac_unpack_u32le(&m->buffer[  (7  * 4) ]);
-    M[8]  = tflac_unpack_u32le(&m->buffer[  (8  * 4) ]);
-    M[9]  = tflac_unpack_u32le(&m->buffer[  (9  * 4) ]);
-    M[10] = tflac_unpack_u32le(&m->buffer[ (10  * 4) ]);
-    M[11] = tflac_unpack_u32le(&m->buffer[ (11  * 4) ]);
-    M[12] = tflac_unpack_u32le(&m->buffer[ (12  * 4) ]);
-    M[13] = tflac_unpack_u32le(&m->buffer[ (13  * 4) ]);
-    M[14] = tflac_unpack_u32le(&m->buffer[ (14  * 4) ]);
-    M[15] = tflac_unpack_u32le(&m->buffer[ (15  * 4) ]);
+    for(;blocksize - i >= 4;i+=4) {
+        TFLAC_SSE4_1_WIDE_LOAD(s0_lo, s0_hi, &samples[i]);
+        TFLAC_SSE4_1_WIDE_LOAD(s1_lo, s1_hi, &samples[i-1]);
+        TFLAC_SSE4_1_WIDE_LOAD(s2_lo, s2_hi, &samples[i-2]);
+        TFLAC_SSE4_1_WIDE_LOAD(s3_lo, s3_hi, &samples[i-3]);
+        TFLAC_SSE4_1_WIDE_LOAD(s4_lo, s4_hi, &samples[i-4]);
+
+        /* s0 + s4 + 6*s2 - 4*(s1 + s3) */
+        s1_lo = _mm_slli_epi64(_mm_add_epi64(s1_lo, s3_lo), 2);
+        s1_hi = _mm_slli_epi64(_mm_add_epi64(s1_hi, s3_hi), 2);
+        s2_lo = _mm_add_epi64(_mm_slli_epi64(s2_lo, 2), _mm_slli_epi64(s2_lo, 1));
+        s2_hi = _mm_add_epi64(_mm_slli_epi64(s2_hi, 2), _mm_slli_epi64(s2_hi, 1));
+        s0_lo = _mm_sub_epi64(_mm_add_epi64(_mm_add_epi64(s0_lo, s4_lo), s2_lo), s1_lo);
+        s0_hi = _mm_sub_epi64(_mm_add_epi64(_mm_add_epi64(s0_hi, s4_hi), s2_hi), s1_hi);
+
+        TFLAC_SSE4_1_WIDE_STORE(&residuals[i], s0_lo, s0_hi);
+    }
 
+    TFLAC_SSE4_1_WIDE_FINISH();
+    tflac_cfr_wide_range(4, i, blocksize, samples, residuals, &residual_err, &max_found);
 
-#define TFLAC_MD5_TRANSFORM_TAIL(g, s, k, expr) \
-        F = A + k + M[g] + (expr); \
-        A = D; \
-        D = C; \
-        C = B; \
-        B += TFLAC_MD5_LEFTROTATE(F, s);
+    *residual_error = max_found ? TFLAC_U64_MAX : residual_err;
+}
 
-#define TFLAC_MD5_ROUND1(g,s,k) \
-        TFLAC_MD5_TRANSFORM_TAIL(g, s, k, D ^ (B & (C ^ D)))
+#undef TFLAC_SSE4_1_WIDE_LOAD
+#undef TFLAC_SSE4_1_WIDE_STORE
+#undef TFLAC_SSE4_1_WIDE_FINISH
+#endif
 
-#define TFLAC_MD5_ROUND2(g,s,k) \
-        TFLAC_MD5_TRANSFORM_TAIL(g, s, k, C ^ (D & (B ^ C)))
+#if defined(TFLAC_ENABLE_SSE2) || defined(TFLAC_ENABLE_SSSE3) || defined(TFLAC_ENABLE_SSE4_1)
+/* only uses SSE2 instructions, so it's used by all the SSE levels */
+TFLAC_PRIVATE void tflac_cfr_fused_sse2(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_u64* TFLAC_RESTRICT residual_errors) {
 
-#define TFLAC_MD5_ROUND3(g,s,k) \
-        TFLAC_MD5_TRANSFORM_TAIL(g, s, k, B ^ C ^ D)
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const __m128i zero = _mm_setzero_si128();
 
-#define TFLAC_MD5_ROUND4(g,s,k) \
-        TFLAC_MD5_TRANSFORM_TAIL(g, s, k, C ^ (B | (~D) ) )
+    tflac_u32 i = 4;
+    __m128i sum0 = _mm_setzero_si128();
+    __m128i sum1 = _mm_setzero_si128();
+    __m128i sum2 = _mm_setzero_si128();
+    __m128i sum3 = _mm_setzero_si128();
+    __m128i sum4 = _mm_setzero_si128();
 
-    TFLAC_MD5_ROUND1( 0,  7, UINT32_C(0x0d76aa478))
-    TFLAC_MD5_ROUND1( 1, 12, UINT32_C(0x0e8c7b756))
-    TFLAC_MD5_ROUND1( 2, 17, UINT32_C(0x0242070db))
-    TFLAC_MD5_ROUND1( 3, 22, UINT32_C(0x0c1bdceee))
-    TFLAC_MD5_ROUND1( 4,  7, UINT32_C(0x0f57c0faf))
-    TFLAC_MD5_ROUND1( 5, 12, UINT32_C(0x04787c62a))
-    TFLAC_MD5_ROUND1( 6, 17, UINT32_C(0x0a8304613))
-    TFLAC_MD5_ROUND1( 7, 22, UINT32_C(0x0fd469501))
-    TFLAC_MD5_ROUND1( 8,  7, UINT32_C(0x0698098d8))
-    TFLAC_MD5_ROUND1( 9, 12, UINT32_C(0x08b44f7af))
-    TFLAC_MD5_ROUND1(10, 17, UINT32_C(0x0ffff5bb1))
-    TFLAC_MD5_ROUND1(11, 22, UINT32_C(0x0895cd7be))
-    TFLAC_MD5_ROUND1(12,  7, UINT32_C(0x06b901122))
-    TFLAC_MD5_ROUND1(13, 12, UINT32_C(0x0fd987193))
-    TFLAC_MD5_ROUND1(14, 17, UINT32_C(0x0a679438e))
-    TFLAC_MD5_ROUND1(15, 22, UINT32_C(0x049b40821))
-
-    TFLAC_MD5_ROUND2( 1,  5, UINT32_C(0x0f61e2562))
-    TFLAC_MD5_ROUND2( 6,  9, UINT32_C(0x0c040b340))
-    TFLAC_MD5_ROUND2(11, 14, UINT32_C(0x0265e5a51))
-    TFLAC_MD5_ROUND2( 0, 20, UINT32_C(0x0e9b6c7aa))
-    TFLAC_MD5_ROUND2( 5,  5, UINT32_C(0x0d62f105d))
-    TFLAC_MD5_ROUND2(10,  9, UINT32_C(0x002441453))
-    TFLAC_MD5_ROUND2(15, 14, UINT32_C(0x0d8a1e681))
-    TFLAC_MD5_ROUND2( 4, 20, UINT32_C(0x0e7d3fbc8))
-    TFLAC_MD5_ROUND2( 9,  5, UINT32_C(0x021e1cde6))
-    TFLAC_MD5_ROUND2(14,  9, UINT32_C(0x0c33707d6))
-    TFLAC_MD5_ROUND2( 3, 14, UINT32_C(0x0f4d50d87))
-    TFLAC_MD5_ROUND2( 8, 20, UINT32_C(0x0455a14ed))
-    TFLAC_MD5_ROUND2(13,  5, UINT32_C(0x0a9e3e905))
-    TFLAC_MD5_ROUND2( 2,  9, UINT32_C(0x0fcefa3f8))
-    TFLAC_MD5_ROUND2( 7, 14, UINT32_C(0x0676f02d9))
-    TFLAC_MD5_ROUND2(12, 20, UINT32_C(0x08d2a4c8a))
-
-    TFLAC_MD5_ROUND3( 5,  4, UINT32_C(0x0fffa3942))
-    TFLAC_MD5_ROUND3( 8, 11, UINT32_C(0x08771f681))
-    TFLAC_MD5_ROUND3(11, 16, UINT32_C(0x06d9d6122))
-    TFLAC_MD5_ROUND3(14, 23, UINT32_C(0x0fde5380c))
-    TFLAC_MD5_ROUND3( 1,  4, UINT32_C(0x0a4beea44))
-    TFLAC_MD5_ROUND3( 4, 11, UINT32_C(0x04bdecfa9))
-    TFLAC_MD5_ROUND3( 7, 16, UINT32_C(0x0f6bb4b60))
-    TFLAC_MD5_ROUND3(10, 23, UINT32_C(0x0bebfbc70))
-    TFLAC_MD5_ROUND3(13,  4, UINT32_C(0x0289b7ec6))
-    TFLAC_MD5_ROUND3( 0, 11, UINT32_C(0x0eaa127fa))
-    TFLAC_MD5_ROUND3( 3, 16, UINT32_C(0x0d4ef3085))
-    TFLAC_MD5_ROUND3( 6, 23, UINT32_C(0x004881d05))
-    TFLAC_MD5_ROUND3( 9,  4, UINT32_C(0x0d9d4d039))
-    TFLAC_MD5_ROUND3(12, 11, UINT32_C(0x0e6db99e5))
-    TFLAC_MD5_ROUND3(15, 16, UINT32_C(0x01fa27cf8))
-    TFLAC_MD5_ROUND3( 2, 23, UINT32_C(0x0c4ac5665))
-
-    TFLAC_MD5_ROUND4( 0,  6, UINT32_C(0x0f4292244))
-    TFLAC_MD5_ROUND4( 7, 10, UINT32_C(0x0432aff97))
-    TFLAC_MD5_ROUND4(14, 15, UINT32_C(0x0ab9423a7))
-    TFLAC_MD5_ROUND4( 5, 21, UINT32_C(0x0fc93a039))
-    TFLAC_MD5_ROUND4(12,  6, UINT32_C(0x0655b59c3))
-    TFLAC_MD5_ROUND4( 3, 10, UINT32_C(0x08f0ccc92))
-    TFLAC_MD5_ROUND4(10, 15, UINT32_C(0x0ffeff47d))
-    TFLAC_MD5_ROUND4( 1, 21, UINT32_C(0x085845dd1))
-    TFLAC_MD5_ROUND4( 8,  6, UINT32_C(0x06fa87e4f))
-    TFLAC_MD5_ROUND4(15, 10, UINT32_C(0x0fe2ce6e0))
-    TFLAC_MD5_ROUND4( 6, 15, UINT32_C(0x0a3014314))
-    TFLAC_MD5_ROUND4(13, 21, UINT32_C(0x04e0811a1))
-    TFLAC_MD5_ROUND4( 4,  6, UINT32_C(0x0f7537e82))
-    TFLAC_MD5_ROUND4(11, 10, UINT32_C(0x0bd3af235))
-    TFLAC_MD5_ROUND4( 2, 15, UINT32_C(0x02ad7d2bb))
-    TFLAC_MD5_ROUND4( 9, 21, UINT32_C(0x0eb86d391))
+    residual_errors[0] = TFLAC_U64_ZERO;
+    residual_errors[1] = TFLAC_U64_ZERO;
+    residual_errors[2] = TFLAC_U64_ZERO;
+    residual_errors[3] = TFLAC_U64_ZERO;
+    residual_errors[4] = TFLAC_U64_ZERO;
 
+#define TFLAC_SSE2_ABS_SUM(sum,v) \
+    do { \
+        __m128i mask = _mm_srai_epi32(v,31); \
+        __m128i vabs = _mm_sub_epi32(_mm_xor_si128(v, mask), mask); \
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(vabs, zero)); \
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(vabs, zero)); \
+    } while(0)
 
-    m->a += A;
-    m->b += B;
-    m->c += C;
-    m->d += D;
-}
+    while(i + 4 <= blocksize) {
+        __m128i msamples0 = _mm_load_si128((const __m128i *)&samples[i]);
+        __m128i msamples1 = _mm_loadu_si128((const __m128i *)&samples[i-1]);
+        __m128i msamples2 = _mm_loadu_si128((const __m128i *)&samples[i-2]);
+        __m128i msamples3 = _mm_loadu_si128((const __m128i *)&samples[i-3]);
+        __m128i msamples4 = _mm_load_si128((const __m128i *)&samples[i-4]);
 
-TFLAC_PRIVATE
-TFLAC_INLINE
-void tflac_md5_addsample(tflac_md5* m, tflac_u32 bits, tflac_uint val) {
-    tflac_u32 bytes;
+        /* first-order differences at i, i-1, i-2, i-3 */
+        __m128i order1 = _mm_sub_epi32(msamples0, msamples1);
+        __m128i diff1  = _mm_sub_epi32(msamples1, msamples2);
+        __m128i diff2  = _mm_sub_epi32(msamples2, msamples3);
+        __m128i diff3  = _mm_sub_epi32(msamples3, msamples4);
 
-    TFLAC_U64_ADD_WORD(m->total,bits);
+        __m128i order2 = _mm_sub_epi32(order1, diff1);
+        __m128i order3;
+        __m128i order4;
 
-    bytes = bits / 8;
+        diff1 = _mm_sub_epi32(diff1, diff2);
+        diff2 = _mm_sub_epi32(diff2, diff3);
 
-    tflac_pack_uintle(&m->buffer[m->pos], val);
-    m->pos += bytes;
+        order3 = _mm_sub_epi32(order2, diff1);
+        diff1 = _mm_sub_epi32(diff1, diff2);
 
-    if(m->pos >= 64) {
-        tflac_md5_transform(m);
-        m->pos %= 64;
-        bytes = m->pos;
-        while(bytes--) {
-            m->buffer[bytes] = m->buffer[64+bytes];
-        }
-    }
-}
+        order4 = _mm_sub_epi32(order3, diff1);
 
-TFLAC_PRIVATE
-TFLAC_INLINE
-void tflac_md5_finalize(tflac_md5* m) {
-    tflac_u64 len = m->total;
-    /* add the stop bit */
-    tflac_md5_addsample(m, 8, 0x80);
+        TFLAC_SSE2_ABS_SUM(sum0, msamples0);
+        TFLAC_SSE2_ABS_SUM(sum1, order1);
+        TFLAC_SSE2_ABS_SUM(sum2, order2);
+        TFLAC_SSE2_ABS_SUM(sum3, order3);
+        TFLAC_SSE2_ABS_SUM(sum4, order4);
 
-    /* pad zeroes until we have 8 bytes left */
-    while(m->pos != 56) {
-        tflac_md5_addsample(m, 8, 0x00);
+        i += 4;
     }
 
-    tflac_pack_u64le(&m->buffer[56],len);
-    tflac_md5_transform(m);
-}
+#undef TFLAC_SSE2_ABS_SUM
+
+    sum0 = _mm_add_epi64(sum0, _mm_shuffle_epi32(sum0,_MM_SHUFFLE(1,0,3,2)));
+    sum1 = _mm_add_epi64(sum1, _mm_shuffle_epi32(sum1,_MM_SHUFFLE(1,0,3,2)));
+    sum2 = _mm_add_epi64(sum2, _mm_shuffle_epi32(sum2,_MM_SHUFFLE(1,0,3,2)));
+    sum3 = _mm_add_epi64(sum3, _mm_shuffle_epi32(sum3,_MM_SHUFFLE(1,0,3,2)));
+    sum4 = _mm_add_epi64(sum4, _mm_shuffle_epi32(sum4,_MM_SHUFFLE(1,0,3,2)));
+    TFLAC_SSE_ADD64(residual_errors[0],sum0);
+    TFLAC_SSE_ADD64(residual_errors[1],sum1);
+    TFLAC_SSE_ADD64(residual_errors[2],sum2);
+    TFLAC_SSE_ADD64(residual_errors[3],sum3);
+    TFLAC_SSE_ADD64(residual_errors[4],sum4);
+
+    tflac_cfr_fused_range(i, blocksize, samples, residual_errors);
+}
+
+/* decorrelation kernels, see tflac_decorrelate_int16_tail. Only SSE2
+ * instructions, so these get used by all the SSE levels */
+#define TFLAC_SSE2_DECORRELATE_SETUP(n, op) \
+    const __m128i lmask ## n = _mm_set1_epi32((op) == TFLAC_DECORRELATE_RIGHT ? 0 : -1); \
+    const __m128i rmask ## n = _mm_set1_epi32((op) == TFLAC_DECORRELATE_LEFT ? 0 : -1); \
+    const __m128i rneg ## n = _mm_set1_epi32((op) == TFLAC_DECORRELATE_SIDE ? -1 : 0); \
+    const __m128i shift ## n = _mm_cvtsi32_si128((op) == TFLAC_DECORRELATE_MID); \
+    __m128i bits ## n = _mm_setzero_si128(); \
+    __m128i non_constant ## n = _mm_setzero_si128(); \
+    __m128i min_found ## n = _mm_setzero_si128(); \
+    __m128i first ## n
+
+#define TFLAC_SSE2_DECORRELATE_STEP(n, out) \
+    do { \
+        v = _mm_sra_epi32(_mm_add_epi32( \
+          _mm_and_si128(l, lmask ## n), \
+          _mm_and_si128(_mm_sub_epi32(_mm_xor_si128(r, rneg ## n), rneg ## n), rmask ## n)), shift ## n); \
+        _mm_store_si128((__m128i*)&out[i], v); \
+        bits ## n = _mm_or_si128(bits ## n, v); \
+        non_constant ## n = _mm_or_si128(non_constant ## n, _mm_xor_si128(v, first ## n)); \
+        min_found ## n = _mm_or_si128(min_found ## n, _mm_cmpeq_epi32(v, vmin)); \
+    } while(0)
 
-TFLAC_PRIVATE
-void tflac_md5_digest(const tflac_md5* m, tflac_u8 out[16]) {
-    out[0]  = (tflac_u8)(m->a);
-    out[1]  = (tflac_u8)(m->a >> 8);
-    out[2]  = (tflac_u8)(m->a >> 16);
-    out[3]  = (tflac_u8)(m->a >> 24);
-    out[4]  = (tflac_u8)(m->b);
-    out[5]  = (tflac_u8)(m->b >> 8);
-    out[6]  = (tflac_u8)(m->b >> 16);
-    out[7]  = (tflac_u8)(m->b >> 24);
-    out[8]  = (tflac_u8)(m->c);
-    out[9]  = (tflac_u8)(m->c >> 8);
-    out[10] = (tflac_u8)(m->c >> 16);
-    out[11] = (tflac_u8)(m->c >> 24);
-    out[12] = (tflac_u8)(m->d);
-    out[13] = (tflac_u8)(m->d >> 8);
-    out[14] = (tflac_u8)(m->d >> 16);
-    out[15] = (tflac_u8)(m->d >> 24);
-}
+#define TFLAC_SSE2_DECORRELATE_FINISH(n, info) \
+    do { \
+        (info)[0] = tflac_sse2_or_reduce(bits ## n); \
+        (info)[1] = tflac_sse2_or_reduce(non_constant ## n); \
+        (info)[2] = tflac_sse2_or_reduce(min_found ## n); \
+    } while(0)
 
-TFLAC_CONST TFLAC_PRIVATE
-tflac_u32 tflac_verbatim_subframe_bits(tflac_u32 blocksize, tflac_u32 bitdepth) {
-    return 8 + (blocksize * bitdepth);
+TFLAC_PRIVATE TFLAC_INLINE tflac_u32 tflac_sse2_or_reduce(__m128i v) {
+    v = _mm_or_si128(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1,0,3,2)));
+    v = _mm_or_si128(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2,3,0,1)));
+    return (tflac_u32)_mm_cvtsi128_si32(v);
 }
 
-TFLAC_PRIVATE
-int tflac_encode_subframe_verbatim(tflac* t) {
+TFLAC_PRIVATE void tflac_decorrelate_s16i_sse2(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s16* samples, tflac_s32* TFLAC_RESTRICT _out0, tflac_s32* TFLAC_RESTRICT _out1, tflac_u32* info) {
+    tflac_s32* TFLAC_RESTRICT out0 = TFLAC_ASSUME_ALIGNED(_out0, 16);
+    tflac_s32* TFLAC_RESTRICT out1 = TFLAC_ASSUME_ALIGNED(_out1, 16);
+    const __m128i vmin = _mm_set1_epi32(INT32_MIN);
     tflac_u32 i = 0;
-    tflac_u8 w = (tflac_u8)t->wasted_bits;
-    const tflac_s32* residuals_0 = TFLAC_ASSUME_ALIGNED(t->residuals[0], 16);
-    int r;
+    tflac_u32 f0;
+    tflac_u32 f1;
+    __m128i l;
+    __m128i r;
+    __m128i v;
+    TFLAC_SSE2_DECORRELATE_SETUP(0, op0);
+    TFLAC_SSE2_DECORRELATE_SETUP(1, op1);
+
+    if(blocksize == 0) {
+        tflac_decorrelate_s16i_std(blocksize, op0, op1, samples, out0, out1, info);
+        return;
+    }
+    f0 = tflac_decorrelate_int16_first(op0, &samples[0], &samples[1]);
+    f1 = tflac_decorrelate_int16_first(op1, &samples[0], &samples[1]);
+    first0 = _mm_set1_epi32((int)f0);
+    first1 = _mm_set1_epi32((int)f1);
+
+    while(i + 4 <= blocksize) {
+        /* l0 r0 l1 r1 ... as 32-bit lanes, the low half is left */
+        v = _mm_loadu_si128((const __m128i*)&samples[i*2]);
+        l = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+        r = _mm_srai_epi32(v, 16);
+        TFLAC_SSE2_DECORRELATE_STEP(0, out0);
+        TFLAC_SSE2_DECORRELATE_STEP(1, out1);
+        i += 4;
+    }
 
-    if( (r = tflac_bitwriter_add(&t->bw, 8, 0x02 | (!!w) )) != 0) return r;
-    if(w) if( (r = tflac_bitwriter_add(&t->bw, w, 1)) != 0) return r;
+    TFLAC_SSE2_DECORRELATE_FINISH(0, &info[0]);
+    TFLAC_SSE2_DECORRELATE_FINISH(1, &info[3]);
+    tflac_decorrelate_s16i_tail(blocksize - i, op0, op1, &samples[i*2], &out0[i], &out1[i], f0, f1, info);
+}
 
-    for(i=0;i<t->cur_blocksize;i++) {
-        if( (r = tflac_bitwriter_add(&t->bw, t->subframe_bitdepth - t->wasted_bits, (tflac_u32)residuals_0[i])) != 0) return r;
+TFLAC_PRIVATE void tflac_decorrelate_s16p_sse2(tflac_u32 blocksize, tflac_u32 op, const tflac_s16* left, const tflac_s16* right, tflac_s32* TFLAC_RESTRICT _residuals, tflac_u32* info) {
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const __m128i vmin = _mm_set1_epi32(INT32_MIN);
+    tflac_u32 i = 0;
+    tflac_u32 f;
+    __m128i l;
+    __m128i r;
+    __m128i v;
+    TFLAC_SSE2_DECORRELATE_SETUP(0, op);
+
+    if(blocksize == 0) {
+        tflac_decorrelate_s16p_std(blocksize, op, left, right, residuals, info);
+        return;
+    }
+    f = tflac_decorrelate_int16_first(op, left, right);
+    first0 = _mm_set1_epi32((int)f);
+
+    while(i + 4 <= blocksize) {
+        l = _mm_loadl_epi64((const __m128i*)&left[i]);
+        r = _mm_loadl_epi64((const __m128i*)&right[i]);
+        l = _mm_srai_epi32(_mm_unpacklo_epi16(l, l), 16);
+        r = _mm_srai_epi32(_mm_unpacklo_epi16(r, r), 16);
+        TFLAC_SSE2_DECORRELATE_STEP(0, residuals);
+        i += 4;
     }
 
-    return tflac_bitwriter_flush(&t->bw);
+    TFLAC_SSE2_DECORRELATE_FINISH(0, info);
+    tflac_decorrelate_int16_tail(blocksize - i, 1, op, &left[i], &right[i], &residuals[i], f, info);
 }
 
-TFLAC_PRIVATE
-int tflac_encode_subframe_constant(tflac* t) {
-    int r;
-    if( (r = tflac_bitwriter_add(&t->bw, 8, 0x00)) != 0) return r;
-    if( (r = tflac_bitwriter_add(&t->bw, t->subframe_bitdepth, ((tflac_u32) t->residuals[0][0]) << t->wasted_bits)) != 0) return r;
-    return tflac_bitwriter_flush(&t->bw);
+TFLAC_PRIVATE void tflac_decorrelate_s32i_sse2(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s32* samples, tflac_s32* TFLAC_RESTRICT _out0, tflac_s32* TFLAC_RESTRICT _out1, tflac_u32* info) {
+    tflac_s32* TFLAC_RESTRICT out0 = TFLAC_ASSUME_ALIGNED(_out0, 16);
+    tflac_s32* TFLAC_RESTRICT out1 = TFLAC_ASSUME_ALIGNED(_out1, 16);
+    const __m128i vmin = _mm_set1_epi32(INT32_MIN);
+    tflac_u32 i = 0;
+    tflac_u32 f0;
+    tflac_u32 f1;
+    __m128 a;
+    __m128 b;
+    __m128i l;
+    __m128i r;
+    __m128i v;
+    TFLAC_SSE2_DECORRELATE_SETUP(0, op0);
+    TFLAC_SSE2_DECORRELATE_SETUP(1, op1);
+
+    if(blocksize == 0) {
+        tflac_decorrelate_s32i_std(blocksize, op0, op1, samples, out0, out1, info);
+        return;
+    }
+    f0 = tflac_decorrelate_int32_first(op0, &samples[0], &samples[1]);
+    f1 = tflac_decorrelate_int32_first(op1, &samples[0], &samples[1]);
+    first0 = _mm_set1_epi32((int)f0);
+    first1 = _mm_set1_epi32((int)f1);
+
+    while(i + 4 <= blocksize) {
+        a = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)&samples[i*2]));
+        b = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)&samples[(i*2) + 4]));
+        l = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0)));
+        r = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1)));
+        TFLAC_SSE2_DECORRELATE_STEP(0, out0);
+        TFLAC_SSE2_DECORRELATE_STEP(1, out1);
+        i += 4;
+    }
+
+    TFLAC_SSE2_DECORRELATE_FINISH(0, &info[0]);
+    TFLAC_SSE2_DECORRELATE_FINISH(1, &info[3]);
+    tflac_decorrelate_s32i_tail(blocksize - i, op0, op1, &samples[i*2], &out0[i], &out1[i], f0, f1, info);
 }
 
-TFLAC_PRIVATE TFLAC_INLINE void tflac_rescale_samples(tflac* t) {
+TFLAC_PRIVATE void tflac_decorrelate_s32p_sse2(tflac_u32 blocksize, tflac_u32 op, const tflac_s32* left, const tflac_s32* right, tflac_s32* TFLAC_RESTRICT _residuals, tflac_u32* info) {
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const __m128i vmin = _mm_set1_epi32(INT32_MIN);
     tflac_u32 i = 0;
-    tflac_s32* TFLAC_RESTRICT residuals_0 = TFLAC_ASSUME_ALIGNED(t->residuals[0], 16);
-
-    if( (!t->constant) && t->wasted_bits) {
-        /* rescale residuals for order 0 */
-        for(i=0;i<t->cur_blocksize;i++) {
-            residuals_0[i] = residuals_0[i] / (1 << t->wasted_bits);
-        }
-        /* since we scaled down there's no way we have INT32_MIN in there anymore */
-        t->residual_errors[0] = TFLAC_U64_ZERO;
+    tflac_u32 f;
+    __m128i l;
+    __m128i r;
+    __m128i v;
+    TFLAC_SSE2_DECORRELATE_SETUP(0, op);
+
+    if(blocksize == 0) {
+        tflac_decorrelate_s32p_std(blocksize, op, left, right, residuals, info);
+        return;
+    }
+    f = tflac_decorrelate_int32_first(op, left, right);
+    first0 = _mm_set1_epi32((int)f);
+
+    while(i + 4 <= blocksize) {
+        l = _mm_loadu_si128((const __m128i*)&left[i]);
+        r = _mm_loadu_si128((const __m128i*)&right[i]);
+        TFLAC_SSE2_DECORRELATE_STEP(0, residuals);
+        i += 4;
     }
 
-    return;
+    TFLAC_SSE2_DECORRELATE_FINISH(0, info);
+    tflac_decorrelate_int32_tail(blocksize - i, 1, op, &left[i], &right[i], &residuals[i], f, info);
 }
 
-/* versions of the md5_interleaved that pack samples before calling addsample */
+#undef TFLAC_SSE2_DECORRELATE_SETUP
+#undef TFLAC_SSE2_DECORRELATE_STEP
+#undef TFLAC_SSE2_DECORRELATE_FINISH
 
-/* used with 1-byte input */
-TFLAC_PRIVATE void tflac_update_md5_s16i_1(tflac* t, const tflac_s16* samples) {
-    tflac_u32 b = t->cur_blocksize * t->channels;
-    const tflac_u32 step = sizeof(tflac_uint);
-    tflac_uint v;
+/* 4 MD5 contexts at once, each 32-bit lane is one context */
+#define TFLAC_SSE2_MD5_STEP(g, s, k, expr) \
+    F = _mm_add_epi32(_mm_add_epi32(A, _mm_set1_epi32((int)k)), _mm_add_epi32(M[g], expr)); \
+    A = D; \
+    D = C; \
+    C = B; \
+    B = _mm_add_epi32(B, _mm_or_si128(_mm_slli_epi32(F, s), _mm_srli_epi32(F, 32 - s)));
 
-    while(b >= step) {
-        v  = (((tflac_uint)samples[0]) & 0xFF) << 0;
-        v |= (((tflac_uint)samples[1]) & 0xFF) << 8;
-        v |= (((tflac_uint)samples[2]) & 0xFF) << 16;
-        v |= (((tflac_uint)samples[3]) & 0xFF) << 24;
-#ifndef TFLAC_32BIT_ONLY
-        v |= (((tflac_uint)samples[4]) & 0xFF) << 32;
-        v |= (((tflac_uint)samples[5]) & 0xFF) << 40;
-        v |= (((tflac_uint)samples[6]) & 0xFF) << 48;
-        v |= (((tflac_uint)samples[7]) & 0xFF) << 56;
-#endif
-        tflac_md5_addsample(&t->md5_ctx, TFLAC_BW_BITS, v);
+#define TFLAC_SSE2_MD5_ROUND1(g,s,k) \
+    TFLAC_SSE2_MD5_STEP(g, s, k, _mm_xor_si128(D, _mm_and_si128(B, _mm_xor_si128(C, D))))
 
-        b -= step;
-        samples += step;
-    }
+#define TFLAC_SSE2_MD5_ROUND2(g,s,k) \
+    TFLAC_SSE2_MD5_STEP(g, s, k, _mm_xor_si128(C, _mm_and_si128(D, _mm_xor_si128(B, C))))
+
+#define TFLAC_SSE2_MD5_ROUND3(g,s,k) \
+    TFLAC_SSE2_MD5_STEP(g, s, k, _mm_xor_si128(_mm_xor_si128(B, C), D))
 
-    while(b--) {
-        tflac_md5_addsample(&t->md5_ctx, 8, (tflac_uint)*samples++);
+#define TFLAC_SSE2_MD5_ROUND4(g,s,k) \
+    TFLAC_SSE2_MD5_STEP(g, s, k, _mm_xor_si128(C, _mm_or_si128(B, _mm_xor_si128(D, ones))))
+
+TFLAC_PRIVATE void tflac_md5_transform_x4_sse2(tflac_md5** m) {
+    const __m128i ones = _mm_set1_epi32(-1);
+    __m128i A, B, C, D, F;
+    __m128i a, b, c, d;
+    __m128i r0, r1, r2, r3;
+    __m128i M[16];
+    tflac_u32 i = 0;
+    tflac_u32 out[4][4];
+
+    /* transpose so M[g] has word g of each block */
+    for(i=0;i<4;i++) {
+        r0 = _mm_loadu_si128((const __m128i*)&m[0]->buffer[i * 16]);
+        r1 = _mm_loadu_si128((const __m128i*)&m[1]->buffer[i * 16]);
+        r2 = _mm_loadu_si128((const __m128i*)&m[2]->buffer[i * 16]);
+        r3 = _mm_loadu_si128((const __m128i*)&m[3]->buffer[i * 16]);
+        A = _mm_unpacklo_epi32(r0, r1);
+        B = _mm_unpacklo_epi32(r2, r3);
+        C = _mm_unpackhi_epi32(r0, r1);
+        D = _mm_unpackhi_epi32(r2, r3);
+        M[(i * 4) + 0] = _mm_unpacklo_epi64(A, B);
+        M[(i * 4) + 1] = _mm_unpackhi_epi64(A, B);
+        M[(i * 4) + 2] = _mm_unpacklo_epi64(C, D);
+        M[(i * 4) + 3] = _mm_unpackhi_epi64(C, D);
     }
-}
 
-TFLAC_PRIVATE void tflac_update_md5_s16i_2(tflac* t, const tflac_s16* samples) {
-    tflac_u32 b = t->cur_blocksize * t->channels;
-    const tflac_u32 step = (sizeof(tflac_uint)/2);
-    tflac_uint v;
+    a = A = _mm_set_epi32((int)m[3]->a, (int)m[2]->a, (int)m[1]->a, (int)m[0]->a);
+    b = B = _mm_set_epi32((int)m[3]->b, (int)m[2]->b, (int)m[1]->b, (int)m[0]->b);
+    c = C = _mm_set_epi32((int)m[3]->c, (int)m[2]->c, (int)m[1]->c, (int)m[0]->c);
+    d = D = _mm_set_epi32((int)m[3]->d, (int)m[2]->d, (int)m[1]->d, (int)m[0]->d);
 
-    while(b >= step) {
-        v  = (((tflac_uint)samples[0]) & UINT32_C(0xFFFF)) << 0;
-        v |= (((tflac_uint)samples[1]) & UINT32_C(0xFFFF)) << 16;
-#ifndef TFLAC_32BIT_ONLY
-        v |= (((tflac_uint)samples[2]) & UINT32_C(0xFFFF)) << 32;
-        v |= (((tflac_uint)samples[3]) & UINT32_C(0xFFFF)) << 48;
-#endif
-        tflac_md5_addsample(&t->md5_ctx, TFLAC_BW_BITS, v);
+    TFLAC_MD5_STEPS(TFLAC_SSE2_MD5_ROUND1, TFLAC_SSE2_MD5_ROUND2, TFLAC_SSE2_MD5_ROUND3, TFLAC_SSE2_MD5_ROUND4)
 
-        b -= step;
-        samples += step;
-    }
+    _mm_storeu_si128((__m128i*)out[0], _mm_add_epi32(a, A));
+    _mm_storeu_si128((__m128i*)out[1], _mm_add_epi32(b, B));
+    _mm_storeu_si128((__m128i*)out[2], _mm_add_epi32(c, C));
+    _mm_storeu_si128((__m128i*)out[3], _mm_add_epi32(d, D));
 
-    while(b--) {
-        tflac_md5_addsample(&t->md5_ctx, 16, (tflac_uint)*samples++);
+    for(i=0;i<4;i++) {
+        m[i]->a = out[0][i];
+        m[i]->b = out[1][i];
+        m[i]->c = out[2][i];
+        m[i]->d = out[3][i];
     }
 }
 
-TFLAC_PRIVATE void tflac_update_md5_s32i_1(tflac* t, const tflac_s32* samples) {
-    tflac_u32 b = t->cur_blocksize * t->channels;
-    const tflac_u32 step = sizeof(tflac_uint);
-    tflac_uint v;
+TFLAC_PRIVATE void tflac_md5_transform_multi_sse2(tflac_md5** m, tflac_u32 n) {
+    tflac_md5_transform_x4_sse2(&m[0]);
+    if(n > 4) tflac_md5_transform_x4_sse2(&m[4]);
+}
 
-    while(b >= step) {
-        v  = (((tflac_uint)samples[0]) & 0xFF) << 0;
-        v |= (((tflac_uint)samples[1]) & 0xFF) << 8;
-        v |= (((tflac_uint)samples[2]) & 0xFF) << 16;
-        v |= (((tflac_uint)samples[3]) & 0xFF) << 24;
-#ifndef TFLAC_32BIT_ONLY
-        v |= (((tflac_uint)samples[4]) & 0xFF) << 32;
-        v |= (((tflac_uint)samples[5]) & 0xFF) << 40;
-        v |= (((tflac_uint)samples[6]) & 0xFF) << 48;
-        v |= (((tflac_uint)samples[7]) & 0xFF) << 56;
-#endif
-        tflac_md5_addsample(&t->md5_ctx, TFLAC_BW_BITS, v);
+#undef TFLAC_SSE2_MD5_STEP
+#undef TFLAC_SSE2_MD5_ROUND1
+#undef TFLAC_SSE2_MD5_ROUND2
+#undef TFLAC_SSE2_MD5_ROUND3
+#undef TFLAC_SSE2_MD5_ROUND4
 
-        b -= step;
-        samples += step;
+/* samples are sign-extended from their low bits before the saturating
+ * packs, so anything outside the bitdepth still gets truncated like
+ * the scalar version */
+TFLAC_PRIVATE void tflac_md5_pack_s16_sse2(tflac_u8* TFLAC_RESTRICT out, const tflac_s16* TFLAC_RESTRICT in, tflac_u32 len, tflac_u32 bytes) {
+    tflac_u32 i = 0;
+    __m128i a, b;
+
+    if(bytes == 1) {
+        for(i=0;i+16<=len;i+=16) {
+            a = _mm_loadu_si128((const __m128i*)&in[i]);
+            b = _mm_loadu_si128((const __m128i*)&in[i+8]);
+            a = _mm_srai_epi16(_mm_slli_epi16(a, 8), 8);
+            b = _mm_srai_epi16(_mm_slli_epi16(b, 8), 8);
+            _mm_storeu_si128((__m128i*)&out[i], _mm_packs_epi16(a, b));
+        }
     }
 
-    while(b--) {
-        tflac_md5_addsample(&t->md5_ctx, 8, (tflac_uint)*samples++);
+    tflac_md5_pack_s16_std(&out[i * bytes], &in[i], len - i, bytes);
+}
+
+TFLAC_PRIVATE void tflac_md5_pack_s32_sse2(tflac_u8* TFLAC_RESTRICT out, const tflac_s32* TFLAC_RESTRICT in, tflac_u32 len, tflac_u32 bytes) {
+    tflac_u32 i = 0;
+    __m128i a, b, c, d;
+
+    switch(bytes) {
+        case 1: {
+            for(i=0;i+16<=len;i+=16) {
+                a = _mm_loadu_si128((const __m128i*)&in[i]);
+                b = _mm_loadu_si128((const __m128i*)&in[i+4]);
+                c = _mm_loadu_si128((const __m128i*)&in[i+8]);
+                d = _mm_loadu_si128((const __m128i*)&in[i+12]);
+                a = _mm_srai_epi32(_mm_slli_epi32(a, 24), 24);
+                b = _mm_srai_epi32(_mm_slli_epi32(b, 24), 24);
+                c = _mm_srai_epi32(_mm_slli_epi32(c, 24), 24);
+                d = _mm_srai_epi32(_mm_slli_epi32(d, 24), 24);
+                a = _mm_packs_epi32(a, b);
+                c = _mm_packs_epi32(c, d);
+                _mm_storeu_si128((__m128i*)&out[i], _mm_packs_epi16(a, c));
+            }
+            break;
+        }
+        case 2: {
+            for(i=0;i+8<=len;i+=8) {
+                a = _mm_loadu_si128((const __m128i*)&in[i]);
+                b = _mm_loadu_si128((const __m128i*)&in[i+4]);
+                a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+                b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+                _mm_storeu_si128((__m128i*)&out[i * 2], _mm_packs_epi32(a, b));
+            }
+            break;
+        }
+        default: break;
     }
+
+    tflac_md5_pack_s32_std(&out[i * bytes], &in[i], len - i, bytes);
 }
 
-TFLAC_PRIVATE void tflac_update_md5_s32i_2(tflac* t, const tflac_s32* samples) {
-    tflac_u32 b = t->cur_blocksize * t->channels;
-    const tflac_u32 step = (sizeof(tflac_uint)/2);
-    tflac_uint v;
+/* the zig-zag is (r << 1) ^ (r >> 31) here, which is the same as
+ * doubling the absolute value and subtracting the sign bit */
+TFLAC_PRIVATE void tflac_fold_residuals_sse2(
+      tflac_u32 blocksize,
+      tflac_u32 predictor_order,
+      tflac_u32 partition_order,
+      const tflac_s32* TFLAC_RESTRICT residuals,
+      tflac_u32* TFLAC_RESTRICT folded,
+      tflac_u64* TFLAC_RESTRICT sums) {
+    const __m128i zero = _mm_setzero_si128();
+    tflac_u32 partitions = UINT32_C(1) << partition_order;
+    tflac_u32 partition_length = blocksize >> partition_order;
+    tflac_u32 offset = predictor_order;
+    tflac_u32 end = 0;
+    tflac_u32 i = 0;
+    tflac_u32 res_abs = 0;
+    tflac_u64 sum;
+    __m128i r;
+    __m128i sign;
+    __m128i acc;
 
-    while(b >= step) {
-        v  = (((tflac_uint)samples[0]) & UINT32_C(0xFFFF)) << 0;
-        v |= (((tflac_uint)samples[1]) & UINT32_C(0xFFFF)) << 16;
-#ifndef TFLAC_32BIT_ONLY
-        v |= (((tflac_uint)samples[2]) & UINT32_C(0xFFFF)) << 32;
-        v |= (((tflac_uint)samples[3]) & UINT32_C(0xFFFF)) << 48;
-#endif
-        tflac_md5_addsample(&t->md5_ctx, TFLAC_BW_BITS, v);
+    for(i=0;i<partitions;i++) {
+        end = (i + 1) * partition_length;
+        acc = _mm_setzero_si128();
 
-        b -= step;
-        samples += step;
-    }
+        while(end - offset >= 4) {
+            r = _mm_loadu_si128((const __m128i*)&residuals[offset]);
+            sign = _mm_srai_epi32(r, 31);
+
+            _mm_storeu_si128((__m128i*)&folded[offset], _mm_xor_si128(_mm_slli_epi32(r, 1), sign));
+
+            r = _mm_sub_epi32(_mm_xor_si128(r, sign), sign);
+            acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(r, zero));
+            acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(r, zero));
+            offset += 4;
+        }
 
-    while(b--) {
-        tflac_md5_addsample(&t->md5_ctx, 16, (tflac_uint)*samples++);
+        sum = TFLAC_U64_ZERO;
+        acc = _mm_add_epi64(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1,0,3,2)));
+        TFLAC_SSE_ADD64(sum, acc);
+
+        for(;offset<end;offset++) {
+            res_abs = (tflac_u32)tflac_s32_abs(residuals[offset]);
+            folded[offset] = (res_abs << 1) - ((tflac_u32)residuals[offset] >> 31);
+            TFLAC_U64_ADD_WORD(sum, res_abs);
+        }
+        sums[i] = sum;
     }
 }
+#endif
 
-TFLAC_PRIVATE void tflac_update_md5_s32i_3(tflac* t, const tflac_s32* samples) {
-    tflac_u32 b = t->cur_blocksize * t->channels;
+#ifdef TFLAC_ENABLE_AVX2
 
-#ifndef TFLAC_32BIT_ONLY
-    tflac_uint v;
+#define TFLAC_AVX2_ADD64(d,m) \
+    do { \
+        __m128i m128 = _mm_add_epi64(_mm256_castsi256_si128(m), _mm256_extracti128_si256(m,1)); \
+        m128 = _mm_add_epi64(m128, _mm_shuffle_epi32(m128,_MM_SHUFFLE(1,0,3,2))); \
+        TFLAC_SSE_ADD64(d,m128); \
+    } while(0)
 
-    while(b >= 2) {
-        v  = (((tflac_uint)samples[0]) & UINT32_C(0xFFFFFF)) << 0;
-        v |= (((tflac_uint)samples[1]) & UINT32_C(0xFFFFFF)) << 24;
-        tflac_md5_addsample(&t->md5_ctx, 48, v);
+/* the residual/sample buffers are only guaranteed to be 16-byte aligned,
+ * and the first vector starts at index 4, so all the AVX2 loads and
+ * stores are unaligned. The multiplies are done with shifts and adds,
+ * which give the same wrapped 32-bit results as the scalar versions. */
 
-        b -= 2;
-        samples += 2;
-    }
-#endif
+TFLAC_PRIVATE void tflac_cfr_order0_avx2(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
 
-    while(b--) {
-        tflac_md5_addsample(&t->md5_ctx, 24,  (tflac_uint) *samples++);
-    }
-}
+    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const __m256i zero = _mm256_setzero_si256();
 
-TFLAC_PRIVATE void tflac_update_md5_s32i_4(tflac* t, const tflac_s32* samples) {
-    tflac_u32 b = t->cur_blocksize * t->channels;
+    __m256i sum = _mm256_setzero_si256();
+    tflac_u64 residual_err;
+    tflac_u32 len = blocksize - 4;
 
-#ifndef TFLAC_32BIT_ONLY
-    tflac_uint v;
+    tflac_u32 residual_abs = 0;
 
-    while(b >= 2) {
-        v  = (((tflac_uint)samples[0]) & UINT32_C(0xFFFFFFFF)) << 0;
-        v |= (((tflac_uint)samples[1]) & UINT32_C(0xFFFFFFFF)) << 32;
-        tflac_md5_addsample(&t->md5_ctx, 64, v);
+    residual_err = TFLAC_U64_ZERO;
 
-        b -= 2;
-        samples += 2;
-    }
-#endif
+    samples0 += 4;
 
-    while(b--) {
-        tflac_md5_addsample(&t->md5_ctx, 32, (tflac_uint) *samples++);
-    }
-}
+    while(len >= 8) {
+        __m256i samples = _mm256_loadu_si256((const __m256i *)samples0);
+        samples = _mm256_abs_epi32(samples);
 
-TFLAC_PRIVATE void tflac_update_md5_int16_planar(tflac* t, const tflac_s16** samples) {
-    tflac_u32 i = 0;
-    tflac_u32 c = 0;
-    tflac_u32 bits = (7 + t->bitdepth) & 0xF8;
+        sum = _mm256_add_epi64(sum, _mm256_unpacklo_epi32(samples, zero));
+        sum = _mm256_add_epi64(sum, _mm256_unpackhi_epi32(samples, zero));
 
-    for(i=0;i<t->cur_blocksize;i++) {
-        for(c=0;i<t->channels;c++) {
-            tflac_md5_addsample(&t->md5_ctx,bits,(tflac_uint)samples[c][i]);
-        }
+        samples0 += 8;
+        len -= 8;
     }
-}
 
-TFLAC_PRIVATE void tflac_update_md5_int32_planar(tflac* t, const tflac_s32** samples) {
-    tflac_u32 i = 0;
-    tflac_u32 c = 0;
-    tflac_u32 bits = (7 + t->bitdepth) & 0xF8;
+    TFLAC_AVX2_ADD64(residual_err,sum);
 
-    for(i=0;i<t->cur_blocksize;i++) {
-        for(c=0;i<t->channels;c++) {
-            tflac_md5_addsample(&t->md5_ctx,bits,(tflac_uint)samples[c][i]);
-        }
+    while(len--) {
+        residual_abs = (tflac_u32)tflac_s32_abs(*samples0);
+        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+        samples0++;
     }
+
+    *residual_error = residual_err;
+    (void)_residuals;
 }
 
+TFLAC_PRIVATE void tflac_cfr_order1_avx2(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
+    const __m256i zero = _mm256_setzero_si256();
+
+    tflac_u32 len = blocksize - 4;
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
 
-TFLAC_PRIVATE void tflac_stereo_decorrelate_independent_int16(tflac* t, tflac_u32 channel, tflac_u32 stride, const tflac_s16* samples, void* nothing) {
-    tflac_s32* TFLAC_RESTRICT residuals_0 = TFLAC_ASSUME_ALIGNED(t->residuals[0], 16);
-    tflac_u32 i = 0;
-    tflac_u32 j = 0;
+    tflac_u32 residual_abs = 0;
+    tflac_s32 residual = 0;
+    tflac_u64 residual_err;
+    __m256i sum = _mm256_setzero_si256();
 
-    tflac_u32 wasted_bits = 0;
-    tflac_u32 non_constant = 0;
-    tflac_u32 min_found = 0;
+    residual_err = TFLAC_U64_ZERO;
 
-    (void)channel;
-    (void)nothing;
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++ - *samples1++;
+    *residuals++ = *samples0++ - *samples1++;
+    *residuals++ = *samples0++ - *samples1++;
 
-    while(i < t->cur_blocksize) {
-        residuals_0[i] = (tflac_s32)samples[j];
+    while(len >= 8) {
+        __m256i msamples0 = _mm256_loadu_si256((const __m256i *)samples0);
+        __m256i msamples1 = _mm256_loadu_si256((const __m256i *)samples1);
 
-        wasted_bits = tflac_wasted_bits(residuals_0[i], t->subframe_bitdepth);
-        if(wasted_bits < t->wasted_bits) t->wasted_bits = wasted_bits;
-        non_constant |= (tflac_u32)residuals_0[i] ^ (tflac_u32)residuals_0[0];
-        min_found |= residuals_0[i] == INT32_MIN;
+        msamples0 = _mm256_sub_epi32(msamples0, msamples1);
 
-        i++;
-        j += stride;
-    }
-    t->subframe_bitdepth = t->bitdepth;
-    t->constant = !non_constant;
-    t->wasted_bits %= t->subframe_bitdepth;
-    t->residual_errors[0] = min_found ? TFLAC_U64_MAX : TFLAC_U64_ZERO;
-}
+        _mm256_storeu_si256( (__m256i*)residuals, msamples0);
 
-TFLAC_PRIVATE void tflac_stereo_decorrelate_independent_int32(tflac* t, tflac_u32 channel, tflac_u32 stride, const tflac_s32* samples, void* nothing) {
-    tflac_s32* TFLAC_RESTRICT residuals_0 = TFLAC_ASSUME_ALIGNED(t->residuals[0], 16);
-    tflac_u32 i = 0;
-    tflac_u32 j = 0;
+        msamples0 = _mm256_abs_epi32(msamples0);
 
-    tflac_u32 wasted_bits = 0;
-    tflac_u32 non_constant = 0;
-    tflac_u32 min_found = 0;
+        sum = _mm256_add_epi64(sum, _mm256_unpacklo_epi32(msamples0, zero));
+        sum = _mm256_add_epi64(sum, _mm256_unpackhi_epi32(msamples0, zero));
 
-    (void)channel;
-    (void)nothing;
+        residuals += 8;
+        samples0 += 8;
+        samples1 += 8;
+        len -= 8;
+    }
 
-    while(i < t->cur_blocksize) {
-        residuals_0[i] = samples[j];
+    TFLAC_AVX2_ADD64(residual_err,sum);
 
-        wasted_bits = tflac_wasted_bits(residuals_0[i], t->subframe_bitdepth);
-        if(wasted_bits < t->wasted_bits) t->wasted_bits = wasted_bits;
-        non_constant |= (tflac_u32)residuals_0[i] ^ (tflac_u32)residuals_0[0];
-        min_found |= residuals_0[i] == INT32_MIN;
+    while(len--) {
+        residual = *samples0++ - *samples1++;
+        *residuals++ = residual;
 
-        i++;
-        j += stride;
+        residual_abs = (tflac_u32)tflac_s32_abs(residual);
+        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
     }
-    t->subframe_bitdepth = t->bitdepth;
-    t->constant = !non_constant;
-    t->wasted_bits %= t->subframe_bitdepth;
-    t->residual_errors[0] = min_found ? TFLAC_U64_MAX : TFLAC_U64_ZERO;
+
+    *residual_error = residual_err;
 }
 
-TFLAC_PRIVATE void tflac_stereo_decorrelate_left_side_int16(tflac* t, tflac_u32 channel, tflac_u32 stride, const tflac_s16* left, const tflac_s16* right) {
-    tflac_s32* TFLAC_RESTRICT residuals_0 = TFLAC_ASSUME_ALIGNED(t->residuals[0], 16);
-    tflac_u32 i = 0;
+TFLAC_PRIVATE void tflac_cfr_order2_avx2(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
+    const __m256i zero = _mm256_setzero_si256();
 
-    tflac_u32 l = 0;
-    tflac_u32 r = 0;
+    tflac_u32 len = blocksize - 4;
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
 
-    tflac_u32 wasted_bits = 0;
-    tflac_u32 non_constant = 0;
-    tflac_u32 min_found = 0;
+    tflac_u32 residual_abs = 0;
+    tflac_s32 residual = 0;
+    tflac_u64 residual_err;
+    __m256i sum = _mm256_setzero_si256();
 
-    if(channel == 0) {
-        t->subframe_bitdepth = t->bitdepth;
-        while(i < t->cur_blocksize) {
-            residuals_0[i] = (tflac_s32)left[l];
+    residual_err = TFLAC_U64_ZERO;
 
-            wasted_bits = tflac_wasted_bits(residuals_0[i], t->subframe_bitdepth);
-            if(wasted_bits < t->wasted_bits) t->wasted_bits = wasted_bits;
-            non_constant |= (tflac_u32)residuals_0[i] ^ (tflac_u32)residuals_0[0];
-            min_found |= residuals_0[i] == INT32_MIN;
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+    samples1++;
 
-            i++;
-            l += stride;
-        }
-    } else {
-        t->subframe_bitdepth = t->bitdepth + 1;
-        while(i < t->cur_blocksize) {
-            residuals_0[i] = ((tflac_s32)left[l]) - ((tflac_s32)right[r]);
+    *residuals++ = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
+    *residuals++ = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
 
-            wasted_bits = tflac_wasted_bits(residuals_0[i], t->subframe_bitdepth);
-            if(wasted_bits < t->wasted_bits) t->wasted_bits = wasted_bits;
-            non_constant |= (tflac_u32)residuals_0[i] ^ (tflac_u32)residuals_0[0];
-            min_found |= residuals_0[i] == INT32_MIN;
+    while(len >= 8) {
+        __m256i msamples0 = _mm256_loadu_si256((const __m256i *)samples0);
+        __m256i msamples1 = _mm256_loadu_si256((const __m256i *)samples1);
+        __m256i msamples2 = _mm256_loadu_si256((const __m256i *)samples2);
 
-            i++;
-            l += stride;
-            r += stride;
-        }
-    }
-    t->constant = !non_constant;
-    t->wasted_bits %= t->subframe_bitdepth;
-    t->residual_errors[0] = min_found ? TFLAC_U64_MAX : TFLAC_U64_ZERO;
-}
+        /* s0 - 2*s1 + s2 */
+        msamples0 = _mm256_add_epi32(msamples0, msamples2);
+        msamples0 = _mm256_sub_epi32(msamples0, _mm256_add_epi32(msamples1, msamples1));
 
-TFLAC_PRIVATE void tflac_stereo_decorrelate_left_side_int32(tflac* t, tflac_u32 channel, tflac_u32 stride, const tflac_s32* left, const tflac_s32* right) {
-    tflac_s32* TFLAC_RESTRICT residuals_0 = TFLAC_ASSUME_ALIGNED(t->residuals[0], 16);
-    tflac_u32 i = 0;
+        _mm256_storeu_si256( (__m256i*)residuals, msamples0);
 
-    tflac_u32 l = 0;
-    tflac_u32 r = 0;
+        msamples0 = _mm256_abs_epi32(msamples0);
 
-    tflac_u32 wasted_bits = 0;
-    tflac_u32 non_constant = 0;
-    tflac_u32 min_found = 0;
+        sum = _mm256_add_epi64(sum, _mm256_unpacklo_epi32(msamples0, zero));
+        sum = _mm256_add_epi64(sum, _mm256_unpackhi_epi32(msamples0, zero));
 
-    if(channel == 0) {
-        t->subframe_bitdepth = t->bitdepth;
-        while(i < t->cur_blocksize) {
-            residuals_0[i] = left[l];
+        residuals += 8;
+        samples0 += 8;
+        samples1 += 8;
+        samples2 += 8;
+        len -= 8;
+    }
 
-            wasted_bits = tflac_wasted_bits(residuals_0[i], t->subframe_bitdepth);
-            if(wasted_bits < t->wasted_bits) t->wasted_bits = wasted_bits;
-            non_constant |= (tflac_u32)residuals_0[i] ^ (tflac_u32)residuals_0[0];
-            min_found |= residuals_0[i] == INT32_MIN;
+    TFLAC_AVX2_ADD64(residual_err,sum);
 
-            i++;
-            l += stride;
-        }
-    } else {
-        t->subframe_bitdepth = t->bitdepth + 1;
-        while(i < t->cur_blocksize) {
-            residuals_0[i] = left[l] - right[r];
+    while(len--) {
+        residual = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
 
-            wasted_bits = tflac_wasted_bits(residuals_0[i], t->subframe_bitdepth);
-            if(wasted_bits < t->wasted_bits) t->wasted_bits = wasted_bits;
-            non_constant |= (tflac_u32)residuals_0[i] ^ (tflac_u32)residuals_0[0];
-            min_found |= residuals_0[i] == INT32_MIN;
+        residual_abs = (tflac_u32)tflac_s32_abs(residual);
+        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
 
-            i++;
-            l += stride;
-            r += stride;
-        }
+        *residuals++ = residual;
     }
-    t->constant = !non_constant;
-    t->wasted_bits %= t->subframe_bitdepth;
-    t->residual_errors[0] = min_found ? TFLAC_U64_MAX : TFLAC_U64_ZERO;
+
+    *residual_error = residual_err;
 }
 
+TFLAC_PRIVATE void tflac_cfr_order3_avx2(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples3 = _samples;
+    const __m256i zero = _mm256_setzero_si256();
 
-TFLAC_PRIVATE void tflac_stereo_decorrelate_side_right_int16(tflac* t, tflac_u32 channel, tflac_u32 stride, const tflac_s16* left, const tflac_s16* right) {
-    tflac_s32* TFLAC_RESTRICT residuals_0 = TFLAC_ASSUME_ALIGNED(t->residuals[0], 16);
-    tflac_u32 i = 0;
+    tflac_u32 len = blocksize - 4;
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
 
-    tflac_u32 l = 0;
-    tflac_u32 r = 0;
+    tflac_u32 residual_abs = 0;
+    tflac_s32 residual = 0;
+    tflac_u64 residual_err;
+    __m256i sum = _mm256_setzero_si256();
 
-    tflac_u32 wasted_bits = 0;
-    tflac_u32 non_constant = 0;
-    tflac_u32 min_found = 0;
+    residual_err = TFLAC_U64_ZERO;
 
-    if(channel == 1) {
-        t->subframe_bitdepth = t->bitdepth;
-        while(i < t->cur_blocksize) {
-            residuals_0[i] = (tflac_s32)right[r];
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
 
-            wasted_bits = tflac_wasted_bits(residuals_0[i], t->subframe_bitdepth);
-            if(wasted_bits < t->wasted_bits) t->wasted_bits = wasted_bits;
-            non_constant |= (tflac_u32)residuals_0[i] ^ (tflac_u32)residuals_0[0];
-            min_found |= residuals_0[i] == INT32_MIN;
+    samples1++; samples1++;
+    samples2++;
 
-            i++;
-            r += stride;
-        }
-    } else {
-        t->subframe_bitdepth = t->bitdepth + 1;
-        while(i < t->cur_blocksize) {
-            residuals_0[i] = ((tflac_s32)left[l]) - ((tflac_s32)right[r]);
+    *residuals++ = *samples0++ - (3 * (*samples1++)) - (-3 * (*samples2++)) - *samples3++;
 
-            wasted_bits = tflac_wasted_bits(residuals_0[i], t->subframe_bitdepth);
-            if(wasted_bits < t->wasted_bits) t->wasted_bits = wasted_bits;
-            non_constant |= (tflac_u32)residuals_0[i] ^ (tflac_u32)residuals_0[0];
-            min_found |= residuals_0[i] == INT32_MIN;
+    while(len >= 8) {
+        __m256i msamples0 = _mm256_loadu_si256((const __m256i *)samples0);
+        __m256i msamples1 = _mm256_loadu_si256((const __m256i *)samples1);
+        __m256i msamples2 = _mm256_loadu_si256((const __m256i *)samples2);
+        __m256i msamples3 = _mm256_loadu_si256((const __m256i *)samples3);
 
-            i++;
-            l += stride;
-            r += stride;
-        }
-    }
-    t->constant = !non_constant;
-    t->wasted_bits %= t->subframe_bitdepth;
-    t->residual_errors[0] = min_found ? TFLAC_U64_MAX : TFLAC_U64_ZERO;
-}
+        /* s0 - s3 + 3*(s2 - s1) */
+        msamples2 = _mm256_sub_epi32(msamples2, msamples1);
+        msamples2 = _mm256_add_epi32(msamples2, _mm256_add_epi32(msamples2, msamples2));
 
-TFLAC_PRIVATE void tflac_stereo_decorrelate_side_right_int32(tflac* t, tflac_u32 channel, tflac_u32 stride, const tflac_s32* left, const tflac_s32* right) {
-    tflac_s32* TFLAC_RESTRICT residuals_0 = TFLAC_ASSUME_ALIGNED(t->residuals[0], 16);
-    tflac_u32 i = 0;
+        msamples0 = _mm256_sub_epi32(msamples0, msamples3);
+        msamples0 = _mm256_add_epi32(msamples0, msamples2);
 
-    tflac_u32 l = 0;
-    tflac_u32 r = 0;
+        _mm256_storeu_si256( (__m256i*)residuals, msamples0);
 
-    tflac_u32 wasted_bits = 0;
-    tflac_u32 non_constant = 0;
-    tflac_u32 min_found = 0;
+        msamples0 = _mm256_abs_epi32(msamples0);
 
-    if(channel == 1) {
-        t->subframe_bitdepth = t->bitdepth;
-        while(i < t->cur_blocksize) {
-            residuals_0[i] = right[r];
+        sum = _mm256_add_epi64(sum, _mm256_unpacklo_epi32(msamples0, zero));
+        sum = _mm256_add_epi64(sum, _mm256_unpackhi_epi32(msamples0, zero));
 
-            wasted_bits = tflac_wasted_bits(residuals_0[i], t->subframe_bitdepth);
-            if(wasted_bits < t->wasted_bits) t->wasted_bits = wasted_bits;
-            non_constant |= (tflac_u32)residuals_0[i] ^ (tflac_u32)residuals_0[0];
-            min_found |= residuals_0[i] == INT32_MIN;
+        residuals += 8;
+        samples0 += 8;
+        samples1 += 8;
+        samples2 += 8;
+        samples3 += 8;
+        len -= 8;
+    }
 
-            i++;
-            r += stride;
-        }
-    } else {
-        t->subframe_bitdepth = t->bitdepth + 1;
-        while(i < t->cur_blocksize) {
-            residuals_0[i] = left[l] - right[r];
+    TFLAC_AVX2_ADD64(residual_err,sum);
 
-            wasted_bits = tflac_wasted_bits(residuals_0[i], t->subframe_bitdepth);
-            if(wasted_bits < t->wasted_bits) t->wasted_bits = wasted_bits;
-            non_constant |= (tflac_u32)residuals_0[i] ^ (tflac_u32)residuals_0[0];
-            min_found |= residuals_0[i] == INT32_MIN;
+    while(len--) {
+        residual = *samples0++ - (3 * (*samples1++)) - (-3 * (*samples2++)) - *samples3++;
 
-            i++;
-            l += stride;
-            r += stride;
-        }
+        residual_abs = (tflac_u32)tflac_s32_abs(residual);
+        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+
+        *residuals++ = residual;
     }
-    t->constant = !non_constant;
-    t->wasted_bits %= t->subframe_bitdepth;
-    t->residual_errors[0] = min_found ? TFLAC_U64_MAX : TFLAC_U64_ZERO;
+
+    *residual_error = residual_err;
 }
 
-TFLAC_PRIVATE void tflac_stereo_decorrelate_mid_side_int16(tflac* t, tflac_u32 channel, tflac_u32 stride, const tflac_s16* left, const tflac_s16* right) {
-    tflac_s32* TFLAC_RESTRICT residuals_0 = TFLAC_ASSUME_ALIGNED(t->residuals[0], 16);
-    tflac_u32 i = 0;
+TFLAC_PRIVATE void tflac_cfr_order4_avx2(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples3 = _samples;
+    const tflac_s32* TFLAC_RESTRICT samples4 = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const __m256i zero = _mm256_setzero_si256();
 
-    tflac_u32 l = 0;
-    tflac_u32 r = 0;
+    tflac_u32 len = blocksize - 4;
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
 
-    tflac_u32 wasted_bits = 0;
-    tflac_u32 non_constant = 0;
-    tflac_u32 min_found = 0;
+    tflac_u32 residual_abs = 0;
+    tflac_s32 residual = 0;
+    tflac_u64 residual_err;
+    __m256i sum = _mm256_setzero_si256();
 
-    if(channel == 0) {
-        t->subframe_bitdepth = t->bitdepth;
-        while(i < t->cur_blocksize) {
-            residuals_0[i] = (((tflac_s32)left[l]) + ((tflac_s32)right[r])) >> 1;
+    residual_err = TFLAC_U64_ZERO;
 
-            wasted_bits = tflac_wasted_bits(residuals_0[i], t->subframe_bitdepth);
-            if(wasted_bits < t->wasted_bits) t->wasted_bits = wasted_bits;
-            non_constant |= (tflac_u32)residuals_0[i] ^ (tflac_u32)residuals_0[0];
-            min_found |= residuals_0[i] == INT32_MIN;
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
+    *residuals++ = *samples0++;
 
-            i++;
-            l += stride;
-            r += stride;
-        }
-    } else {
-        t->subframe_bitdepth = t->bitdepth + 1;
-        while(i < t->cur_blocksize) {
-            residuals_0[i] = ((tflac_s32)left[l]) - ((tflac_s32)right[r]);
+    samples1++; samples1++; samples1++;
+    samples2++; samples2++;
+    samples3++;
 
-            wasted_bits = tflac_wasted_bits(residuals_0[i], t->subframe_bitdepth);
-            if(wasted_bits < t->wasted_bits) t->wasted_bits = wasted_bits;
-            non_constant |= (tflac_u32)residuals_0[i] ^ (tflac_u32)residuals_0[0];
-            min_found |= residuals_0[i] == INT32_MIN;
+    while(len >= 8) {
+        __m256i msamples0 = _mm256_loadu_si256((const __m256i *)samples0);
+        __m256i msamples1 = _mm256_loadu_si256((const __m256i *)samples1);
+        __m256i msamples2 = _mm256_loadu_si256((const __m256i *)samples2);
+        __m256i msamples3 = _mm256_loadu_si256((const __m256i *)samples3);
+        __m256i msamples4 = _mm256_loadu_si256((const __m256i *)samples4);
+
+        /* s0 + s4 + 6*s2 - 4*(s1 + s3) */
+        msamples1 = _mm256_slli_epi32(_mm256_add_epi32(msamples1, msamples3), 2);
+        msamples2 = _mm256_add_epi32(_mm256_slli_epi32(msamples2, 2), _mm256_slli_epi32(msamples2, 1));
+
+        msamples0 = _mm256_add_epi32(msamples0, msamples4);
+        msamples0 = _mm256_add_epi32(msamples0, msamples2);
+        msamples0 = _mm256_sub_epi32(msamples0, msamples1);
+
+        _mm256_storeu_si256( (__m256i*)residuals, msamples0);
+
+        msamples0 = _mm256_abs_epi32(msamples0);
+
+        sum = _mm256_add_epi64(sum, _mm256_unpacklo_epi32(msamples0, zero));
+        sum = _mm256_add_epi64(sum, _mm256_unpackhi_epi32(msamples0, zero));
+
+        residuals += 8;
+        samples0 += 8;
+        samples1 += 8;
+        samples2 += 8;
+        samples3 += 8;
+        samples4 += 8;
+        len -= 8;
+    }
 
-            i++;
+    TFLAC_AVX2_ADD64(residual_err,sum);
 
-            l += stride;
-            r += stride;
-        }
+    while(len--) {
+        residual = *samples0++ - (4 * (*samples1++)) - (-6 * (*samples2++)) - (4 * (*samples3++)) - (-1 * (*samples4++));
+
+        residual_abs = (tflac_u32)tflac_s32_abs(residual);
+        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+
+        *residuals++ = residual;
     }
-    t->constant = !non_constant;
-    t->wasted_bits %= t->subframe_bitdepth;
-    t->residual_errors[0] = min_found ? TFLAC_U64_MAX : TFLAC_U64_ZERO;
+
+    *residual_error = residual_err;
 }
 
-TFLAC_PRIVATE void tflac_stereo_decorrelate_mid_side_int32(tflac* t, tflac_u32 channel, tflac_u32 stride, const tflac_s32* left, const tflac_s32* right) {
-    tflac_s32* TFLAC_RESTRICT residuals_0 = TFLAC_ASSUME_ALIGNED(t->residuals[0], 16);
-    tflac_u32 i = 0;
+TFLAC_PRIVATE void tflac_cfr_fused_avx2(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_u64* TFLAC_RESTRICT residual_errors) {
 
-    tflac_u32 l = 0;
-    tflac_u32 r = 0;
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const __m256i zero = _mm256_setzero_si256();
+
+    tflac_u32 i = 4;
+    __m256i sum0 = _mm256_setzero_si256();
+    __m256i sum1 = _mm256_setzero_si256();
+    __m256i sum2 = _mm256_setzero_si256();
+    __m256i sum3 = _mm256_setzero_si256();
+    __m256i sum4 = _mm256_setzero_si256();
+
+    residual_errors[0] = TFLAC_U64_ZERO;
+    residual_errors[1] = TFLAC_U64_ZERO;
+    residual_errors[2] = TFLAC_U64_ZERO;
+    residual_errors[3] = TFLAC_U64_ZERO;
+    residual_errors[4] = TFLAC_U64_ZERO;
+
+#define TFLAC_AVX2_ABS_SUM(sum,v) \
+    do { \
+        __m256i vabs = _mm256_abs_epi32(v); \
+        sum = _mm256_add_epi64(sum, _mm256_unpacklo_epi32(vabs, zero)); \
+        sum = _mm256_add_epi64(sum, _mm256_unpackhi_epi32(vabs, zero)); \
+    } while(0)
 
-    tflac_u32 wasted_bits = 0;
-    tflac_u32 non_constant = 0;
-    tflac_u32 min_found = 0;
+    while(i + 8 <= blocksize) {
+        __m256i msamples0 = _mm256_loadu_si256((const __m256i *)&samples[i]);
+        __m256i msamples1 = _mm256_loadu_si256((const __m256i *)&samples[i-1]);
+        __m256i msamples2 = _mm256_loadu_si256((const __m256i *)&samples[i-2]);
+        __m256i msamples3 = _mm256_loadu_si256((const __m256i *)&samples[i-3]);
+        __m256i msamples4 = _mm256_loadu_si256((const __m256i *)&samples[i-4]);
 
-    if(channel == 0) {
-        t->subframe_bitdepth = t->bitdepth;
-        while(i < t->cur_blocksize) {
-            residuals_0[i] = (left[l] + right[r]) >> 1;
+        /* first-order differences at i, i-1, i-2, i-3 */
+        __m256i order1 = _mm256_sub_epi32(msamples0, msamples1);
+        __m256i diff1  = _mm256_sub_epi32(msamples1, msamples2);
+        __m256i diff2  = _mm256_sub_epi32(msamples2, msamples3);
+        __m256i diff3  = _mm256_sub_epi32(msamples3, msamples4);
 
-            wasted_bits = tflac_wasted_bits(residuals_0[i], t->subframe_bitdepth);
-            if(wasted_bits < t->wasted_bits) t->wasted_bits = wasted_bits;
-            non_constant |= (tflac_u32)residuals_0[i] ^ (tflac_u32)residuals_0[0];
-            min_found |= residuals_0[i] == INT32_MIN;
+        __m256i order2 = _mm256_sub_epi32(order1, diff1);
+        __m256i order3;
+        __m256i order4;
 
-            i++;
-            l += stride;
-            r += stride;
-        }
-    } else {
-        t->subframe_bitdepth = t->bitdepth + 1;
-        while(i < t->cur_blocksize) {
-            residuals_0[i] = left[l] - right[r];
+        diff1 = _mm256_sub_epi32(diff1, diff2);
+        diff2 = _mm256_sub_epi32(diff2, diff3);
 
-            wasted_bits = tflac_wasted_bits(residuals_0[i], t->subframe_bitdepth);
-            if(wasted_bits < t->wasted_bits) t->wasted_bits = wasted_bits;
-            non_constant |= (tflac_u32)residuals_0[i] ^ (tflac_u32)residuals_0[0];
-            min_found |= residuals_0[i] == INT32_MIN;
+        order3 = _mm256_sub_epi32(order2, diff1);
+        diff1 = _mm256_sub_epi32(diff1, diff2);
 
-            i++;
-            l += stride;
-            r += stride;
-        }
-    }
-    t->constant = !non_constant;
-    t->wasted_bits %= t->subframe_bitdepth;
-    t->residual_errors[0] = min_found ? TFLAC_U64_MAX : TFLAC_U64_ZERO;
-}
+        order4 = _mm256_sub_epi32(order3, diff1);
 
-TFLAC_PRIVATE void tflac_stereo_decorrelate_int16_planar(tflac* t, tflac_u32 channel, const tflac_s16** samples) {
-    switch( (enum TFLAC_CHANNEL_MODE)t->channel_mode) {
-        case TFLAC_CHANNEL_INDEPENDENT: tflac_stereo_decorrelate_independent_int16(t, channel, 1, samples[channel], NULL); break;
-        case TFLAC_CHANNEL_LEFT_SIDE:   tflac_stereo_decorrelate_left_side_int16(t, channel, 1, samples[0], samples[1]); break;
-        case TFLAC_CHANNEL_SIDE_RIGHT:  tflac_stereo_decorrelate_side_right_int16(t, channel, 1, samples[0], samples[1]); break;
-        case TFLAC_CHANNEL_MID_SIDE:     tflac_stereo_decorrelate_mid_side_int16(t, channel, 1, samples[0], samples[1]); break;
-        default: break;
-    }
-}
+        TFLAC_AVX2_ABS_SUM(sum0, msamples0);
+        TFLAC_AVX2_ABS_SUM(sum1, order1);
+        TFLAC_AVX2_ABS_SUM(sum2, order2);
+        TFLAC_AVX2_ABS_SUM(sum3, order3);
+        TFLAC_AVX2_ABS_SUM(sum4, order4);
 
-TFLAC_PRIVATE void tflac_stereo_decorrelate_int16_interleaved(tflac* t, tflac_u32 channel, const tflac_s16* samples) {
-    switch( (enum TFLAC_CHANNEL_MODE)t->channel_mode) {
-        case TFLAC_CHANNEL_INDEPENDENT: tflac_stereo_decorrelate_independent_int16(t, channel, t->channels, &samples[channel], NULL); break;
-        case TFLAC_CHANNEL_LEFT_SIDE:   tflac_stereo_decorrelate_left_side_int16(t, channel, t->channels, &samples[0], &samples[1]); break;
-        case TFLAC_CHANNEL_SIDE_RIGHT:  tflac_stereo_decorrelate_side_right_int16(t, channel, t->channels, &samples[0], &samples[1]); break;
-        case TFLAC_CHANNEL_MID_SIDE:    tflac_stereo_decorrelate_mid_side_int16(t, channel, t->channels, &samples[0], &samples[1]); break;
-        default: break;
+        i += 8;
     }
-}
 
-TFLAC_PRIVATE void tflac_stereo_decorrelate_int32_planar(tflac* t, tflac_u32 channel, const tflac_s32** samples) {
-    switch( (enum TFLAC_CHANNEL_MODE)t->channel_mode) {
-        case TFLAC_CHANNEL_INDEPENDENT: tflac_stereo_decorrelate_independent_int32(t, channel, 1, samples[channel], NULL); break;
-        case TFLAC_CHANNEL_LEFT_SIDE:   tflac_stereo_decorrelate_left_side_int32(t, channel, 1, samples[0], samples[1]); break;
-        case TFLAC_CHANNEL_SIDE_RIGHT:  tflac_stereo_decorrelate_side_right_int32(t, channel, 1, samples[0], samples[1]); break;
-        case TFLAC_CHANNEL_MID_SIDE:    tflac_stereo_decorrelate_mid_side_int32(t, channel, 1, samples[0], samples[1]); break;
-        default: break;
-    }
-}
+#undef TFLAC_AVX2_ABS_SUM
 
-TFLAC_PRIVATE void tflac_stereo_decorrelate_int32_interleaved(tflac* t, tflac_u32 channel, const tflac_s32* samples) {
-    switch( (enum TFLAC_CHANNEL_MODE)t->channel_mode) {
-        case TFLAC_CHANNEL_INDEPENDENT: tflac_stereo_decorrelate_independent_int32(t, channel, t->channels, &samples[channel], NULL); break;
-        case TFLAC_CHANNEL_LEFT_SIDE:   tflac_stereo_decorrelate_left_side_int32(t, channel, t->channels, &samples[0], &samples[1]); break;
-        case TFLAC_CHANNEL_SIDE_RIGHT:  tflac_stereo_decorrelate_side_right_int32(t, channel, t->channels, &samples[0], &samples[1]); break;
-        case TFLAC_CHANNEL_MID_SIDE:    tflac_stereo_decorrelate_mid_side_int32(t, channel, t->channels, &samples[0], &samples[1]); break;
-        default: break;
-    }
-}
+    TFLAC_AVX2_ADD64(residual_errors[0],sum0);
+    TFLAC_AVX2_ADD64(residual_errors[1],sum1);
+    TFLAC_AVX2_ADD64(residual_errors[2],sum2);
+    TFLAC_AVX2_ADD64(residual_errors[3],sum3);
+    TFLAC_AVX2_ADD64(residual_errors[4],sum4);
 
-TFLAC_PRIVATE void tflac_cfr_order0_std(
-      tflac_u32 blocksize,
-      const tflac_s32* TFLAC_RESTRICT _samples,
-      tflac_s32* TFLAC_RESTRICT _residuals,
-      tflac_u64* TFLAC_RESTRICT residual_error) {
+    tflac_cfr_fused_range(i, blocksize, samples, residual_errors);
+}
 
-    tflac_u32 i = 0;
-    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
-    tflac_u32 residual_abs = 0;
-    tflac_u64 residual_err;
+/* decorrelation kernels, see tflac_decorrelate_int16_tail */
+#define TFLAC_AVX2_DECORRELATE_SETUP(n, op) \
+    const __m256i lmask ## n = _mm256_set1_epi32((op) == TFLAC_DECORRELATE_RIGHT ? 0 : -1); \
+    const __m256i rmask ## n = _mm256_set1_epi32((op) == TFLAC_DECORRELATE_LEFT ? 0 : -1); \
+    const __m256i rneg ## n = _mm256_set1_epi32((op) == TFLAC_DECORRELATE_SIDE ? -1 : 0); \
+    const __m128i shift ## n = _mm_cvtsi32_si128((op) == TFLAC_DECORRELATE_MID); \
+    __m256i bits ## n = _mm256_setzero_si256(); \
+    __m256i non_constant ## n = _mm256_setzero_si256(); \
+    __m256i min_found ## n = _mm256_setzero_si256(); \
+    __m256i first ## n
 
-    residual_err = TFLAC_U64_ZERO;
+#define TFLAC_AVX2_DECORRELATE_STEP(n, out) \
+    do { \
+        v = _mm256_sra_epi32(_mm256_add_epi32( \
+          _mm256_and_si256(l, lmask ## n), \
+          _mm256_and_si256(_mm256_sub_epi32(_mm256_xor_si256(r, rneg ## n), rneg ## n), rmask ## n)), shift ## n); \
+        _mm256_storeu_si256((__m256i*)&out[i], v); \
+        bits ## n = _mm256_or_si256(bits ## n, v); \
+        non_constant ## n = _mm256_or_si256(non_constant ## n, _mm256_xor_si256(v, first ## n)); \
+        min_found ## n = _mm256_or_si256(min_found ## n, _mm256_cmpeq_epi32(v, vmin)); \
+    } while(0)
 
-    for(i=4;i<blocksize;i++) {
-        residual_abs = (tflac_u32)tflac_s32_abs(samples[i]);
-        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
-    }
+#define TFLAC_AVX2_DECORRELATE_FINISH(n, info) \
+    do { \
+        (info)[0] = tflac_avx2_or_reduce(bits ## n); \
+        (info)[1] = tflac_avx2_or_reduce(non_constant ## n); \
+        (info)[2] = tflac_avx2_or_reduce(min_found ## n); \
+    } while(0)
 
-    *residual_error = residual_err;
-    (void)_residuals;
+TFLAC_PRIVATE TFLAC_INLINE tflac_u32 tflac_avx2_or_reduce(__m256i v) {
+    __m128i x = _mm_or_si128(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    x = _mm_or_si128(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(1,0,3,2)));
+    x = _mm_or_si128(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(2,3,0,1)));
+    return (tflac_u32)_mm_cvtsi128_si32(x);
 }
 
-
-TFLAC_PRIVATE void tflac_cfr_order1_std(
-      tflac_u32 blocksize,
-      const tflac_s32* TFLAC_RESTRICT _samples,
-      tflac_s32* TFLAC_RESTRICT _residuals,
-      tflac_u64* TFLAC_RESTRICT residual_error) {
+TFLAC_PRIVATE void tflac_decorrelate_s16i_avx2(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s16* samples, tflac_s32* TFLAC_RESTRICT _out0, tflac_s32* TFLAC_RESTRICT _out1, tflac_u32* info) {
+    tflac_s32* TFLAC_RESTRICT out0 = TFLAC_ASSUME_ALIGNED(_out0, 16);
+    tflac_s32* TFLAC_RESTRICT out1 = TFLAC_ASSUME_ALIGNED(_out1, 16);
+    const __m256i vmin = _mm256_set1_epi32(INT32_MIN);
     tflac_u32 i = 0;
+    tflac_u32 f0;
+    tflac_u32 f1;
+    __m256i l;
+    __m256i r;
+    __m256i v;
+    TFLAC_AVX2_DECORRELATE_SETUP(0, op0);
+    TFLAC_AVX2_DECORRELATE_SETUP(1, op1);
+
+    if(blocksize == 0) {
+        tflac_decorrelate_s16i_std(blocksize, op0, op1, samples, out0, out1, info);
+        return;
+    }
+    f0 = tflac_decorrelate_int16_first(op0, &samples[0], &samples[1]);
+    f1 = tflac_decorrelate_int16_first(op1, &samples[0], &samples[1]);
+    first0 = _mm256_set1_epi32((int)f0);
+    first1 = _mm256_set1_epi32((int)f1);
+
+    while(i + 8 <= blocksize) {
+        /* l0 r0 l1 r1 ... as 32-bit lanes, the low half is left */
+        v = _mm256_loadu_si256((const __m256i*)&samples[i*2]);
+        l = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+        r = _mm256_srai_epi32(v, 16);
+        TFLAC_AVX2_DECORRELATE_STEP(0, out0);
+        TFLAC_AVX2_DECORRELATE_STEP(1, out1);
+        i += 8;
+    }
 
-    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    TFLAC_AVX2_DECORRELATE_FINISH(0, &info[0]);
+    TFLAC_AVX2_DECORRELATE_FINISH(1, &info[3]);
+    tflac_decorrelate_s16i_tail(blocksize - i, op0, op1, &samples[i*2], &out0[i], &out1[i], f0, f1, info);
+}
 
+TFLAC_PRIVATE void tflac_decorrelate_s16p_avx2(tflac_u32 blocksize, tflac_u32 op, const tflac_s16* left, const tflac_s16* right, tflac_s32* TFLAC_RESTRICT _residuals, tflac_u32* info) {
     tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
-    tflac_u32 residual_abs = 0;
-    tflac_u64 residual_err;
-
-    residual_err = TFLAC_U64_ZERO;
-
-    residuals[0] = samples[0];
-    residuals[1] = samples[1] - samples[0];
-    residuals[2] = samples[2] - samples[1];
-    residuals[3] = samples[3] - samples[2];
+    const __m256i vmin = _mm256_set1_epi32(INT32_MIN);
+    tflac_u32 i = 0;
+    tflac_u32 f;
+    __m256i l;
+    __m256i r;
+    __m256i v;
+    TFLAC_AVX2_DECORRELATE_SETUP(0, op);
+
+    if(blocksize == 0) {
+        tflac_decorrelate_s16p_std(blocksize, op, left, right, residuals, info);
+        return;
+    }
+    f = tflac_decorrelate_int16_first(op, left, right);
+    first0 = _mm256_set1_epi32((int)f);
+
+    while(i + 8 <= blocksize) {
+        l = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)&left[i]));
+        r = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)&right[i]));
+        TFLAC_AVX2_DECORRELATE_STEP(0, residuals);
+        i += 8;
+    }
 
-    for(i=4;i<blocksize;i++) {
-        residuals[i] = samples[i] - samples[i-1];
-        residual_abs = (tflac_u32)tflac_s32_abs(residuals[i]);
-        TFLAC_U64_ADD_WORD(residual_err, residual_abs);
+    TFLAC_AVX2_DECORRELATE_FINISH(0, info);
+    tflac_decorrelate_int16_tail(blocksize - i, 1, op, &left[i], &right[i], &residuals[i], f, info);
+}
+
+TFLAC_PRIVATE void tflac_decorrelate_s32i_avx2(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s32* samples, tflac_s32* TFLAC_RESTRICT _out0, tflac_s32* TFLAC_RESTRICT _out1, tflac_u32* info) {
+    tflac_s32* TFLAC_RESTRICT out0 = TFLAC_ASSUME_ALIGNED(_out0, 16);
+    tflac_s32* TFLAC_RESTRICT out1 = TFLAC_ASSUME_ALIGNED(_out1, 16);
+    const __m256i vmin = _mm256_set1_epi32(INT32_MIN);
+    tflac_u32 i = 0;
+    tflac_u32 f0;
+    tflac_u32 f1;
+    __m256 a;
+    __m256 b;
+    __m256i l;
+    __m256i r;
+    __m256i v;
+    TFLAC_AVX2_DECORRELATE_SETUP(0, op0);
+    TFLAC_AVX2_DECORRELATE_SETUP(1, op1);
+
+    if(blocksize == 0) {
+        tflac_decorrelate_s32i_std(blocksize, op0, op1, samples, out0, out1, info);
+        return;
+    }
+    f0 = tflac_decorrelate_int32_first(op0, &samples[0], &samples[1]);
+    f1 = tflac_decorrelate_int32_first(op1, &samples[0], &samples[1]);
+    first0 = _mm256_set1_epi32((int)f0);
+    first1 = _mm256_set1_epi32((int)f1);
+
+    while(i + 8 <= blocksize) {
+        /* the shuffle works per 128-bit lane, leaving
+         * l0 l1 l4 l5 l2 l3 l6 l7, the permute puts them back in order */
+        a = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)&samples[i*2]));
+        b = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)&samples[(i*2) + 8]));
+        l = _mm256_permute4x64_epi64(_mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0))), _MM_SHUFFLE(3,1,2,0));
+        r = _mm256_permute4x64_epi64(_mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1))), _MM_SHUFFLE(3,1,2,0));
+        TFLAC_AVX2_DECORRELATE_STEP(0, out0);
+        TFLAC_AVX2_DECORRELATE_STEP(1, out1);
+        i += 8;
     }
 
-    *residual_error = residual_err;
+    TFLAC_AVX2_DECORRELATE_FINISH(0, &info[0]);
+    TFLAC_AVX2_DECORRELATE_FINISH(1, &info[3]);
+    tflac_decorrelate_s32i_tail(blocksize - i, op0, op1, &samples[i*2], &out0[i], &out1[i], f0, f1, info);
 }
 
-TFLAC_PRIVATE void tflac_cfr_order2_std(
-      tflac_u32 blocksize,
-      const tflac_s32* TFLAC_RESTRICT _samples,
-      tflac_s32* TFLAC_RESTRICT _residuals,
-      tflac_u64* TFLAC_RESTRICT residual_error) {
+TFLAC_PRIVATE void tflac_decorrelate_s32p_avx2(tflac_u32 blocksize, tflac_u32 op, const tflac_s32* left, const tflac_s32* right, tflac_s32* TFLAC_RESTRICT _residuals, tflac_u32* info) {
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const __m256i vmin = _mm256_set1_epi32(INT32_MIN);
     tflac_u32 i = 0;
+    tflac_u32 f;
+    __m256i l;
+    __m256i r;
+    __m256i v;
+    TFLAC_AVX2_DECORRELATE_SETUP(0, op);
+
+    if(blocksize == 0) {
+        tflac_decorrelate_s32p_std(blocksize, op, left, right, residuals, info);
+        return;
+    }
+    f = tflac_decorrelate_int32_first(op, left, right);
+    first0 = _mm256_set1_epi32((int)f);
+
+    while(i + 8 <= blocksize) {
+        l = _mm256_loadu_si256((const __m256i*)&left[i]);
+        r = _mm256_loadu_si256((const __m256i*)&right[i]);
+        TFLAC_AVX2_DECORRELATE_STEP(0, residuals);
+        i += 8;
+    }
 
-    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    TFLAC_AVX2_DECORRELATE_FINISH(0, info);
+    tflac_decorrelate_int32_tail(blocksize - i, 1, op, &left[i], &right[i], &residuals[i], f, info);
+}
 
-    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
-    tflac_u32 residual_abs = 0;
-    tflac_u64 residual_err;
-    residual_err = TFLAC_U64_ZERO;
+#undef TFLAC_AVX2_DECORRELATE_SETUP
+#undef TFLAC_AVX2_DECORRELATE_STEP
+#undef TFLAC_AVX2_DECORRELATE_FINISH
 
-    residuals[0] = samples[0];
-    residuals[1] = samples[1];
-    residuals[2] = samples[2] - (2 * samples[1]) - (-1 * samples[0]);
-    residuals[3] = samples[3] - (2 * samples[2]) - (-1 * samples[1]);;
+/* 8 MD5 contexts at once */
+#define TFLAC_AVX2_MD5_STEP(g, s, k, expr) \
+    F = _mm256_add_epi32(_mm256_add_epi32(A, _mm256_set1_epi32((int)k)), _mm256_add_epi32(M[g], expr)); \
+    A = D; \
+    D = C; \
+    C = B; \
+    B = _mm256_add_epi32(B, _mm256_or_si256(_mm256_slli_epi32(F, s), _mm256_srli_epi32(F, 32 - s)));
 
-    for(i=4;i<blocksize;i++) {
-        residuals[i] = samples[i] - (2 * samples[i-1]) - (-1 * samples[i-2] );
-        residual_abs = (tflac_u32)tflac_s32_abs(residuals[i]);
-        TFLAC_U64_ADD_WORD(residual_err, residual_abs);
-    }
+#define TFLAC_AVX2_MD5_ROUND1(g,s,k) \
+    TFLAC_AVX2_MD5_STEP(g, s, k, _mm256_xor_si256(D, _mm256_and_si256(B, _mm256_xor_si256(C, D))))
 
-    *residual_error = residual_err;
-}
+#define TFLAC_AVX2_MD5_ROUND2(g,s,k) \
+    TFLAC_AVX2_MD5_STEP(g, s, k, _mm256_xor_si256(C, _mm256_and_si256(D, _mm256_xor_si256(B, C))))
 
-TFLAC_PRIVATE void tflac_cfr_order3_std(
-      tflac_u32 blocksize,
-      const tflac_s32* TFLAC_RESTRICT _samples,
-      tflac_s32* TFLAC_RESTRICT _residuals,
-      tflac_u64* TFLAC_RESTRICT residual_error) {
+#define TFLAC_AVX2_MD5_ROUND3(g,s,k) \
+    TFLAC_AVX2_MD5_STEP(g, s, k, _mm256_xor_si256(_mm256_xor_si256(B, C), D))
+
+#define TFLAC_AVX2_MD5_ROUND4(g,s,k) \
+    TFLAC_AVX2_MD5_STEP(g, s, k, _mm256_xor_si256(C, _mm256_or_si256(B, _mm256_xor_si256(D, ones))))
+
+#define TFLAC_AVX2_MD5_STATE(f) \
+    _mm256_set_epi32((int)m[7]->f, (int)m[6]->f, (int)m[5]->f, (int)m[4]->f, \
+      (int)m[3]->f, (int)m[2]->f, (int)m[1]->f, (int)m[0]->f)
+
+TFLAC_PRIVATE void tflac_md5_transform_multi_avx2(tflac_md5** m, tflac_u32 n) {
+    const __m256i ones = _mm256_set1_epi32(-1);
+    __m256i A, B, C, D, F;
+    __m256i a, b, c, d;
+    __m256i r[8];
+    __m256i u[8];
+    __m256i M[16];
     tflac_u32 i = 0;
+    tflac_u32 out[4][8];
+
+    (void)n;
+
+    /* 8x8 transpose of each half of the blocks */
+    for(i=0;i<2;i++) {
+        r[0] = _mm256_loadu_si256((const __m256i*)&m[0]->buffer[i * 32]);
+        r[1] = _mm256_loadu_si256((const __m256i*)&m[1]->buffer[i * 32]);
+        r[2] = _mm256_loadu_si256((const __m256i*)&m[2]->buffer[i * 32]);
+        r[3] = _mm256_loadu_si256((const __m256i*)&m[3]->buffer[i * 32]);
+        r[4] = _mm256_loadu_si256((const __m256i*)&m[4]->buffer[i * 32]);
+        r[5] = _mm256_loadu_si256((const __m256i*)&m[5]->buffer[i * 32]);
+        r[6] = _mm256_loadu_si256((const __m256i*)&m[6]->buffer[i * 32]);
+        r[7] = _mm256_loadu_si256((const __m256i*)&m[7]->buffer[i * 32]);
+
+        u[0] = _mm256_unpacklo_epi32(r[0], r[1]);
+        u[1] = _mm256_unpackhi_epi32(r[0], r[1]);
+        u[2] = _mm256_unpacklo_epi32(r[2], r[3]);
+        u[3] = _mm256_unpackhi_epi32(r[2], r[3]);
+        u[4] = _mm256_unpacklo_epi32(r[4], r[5]);
+        u[5] = _mm256_unpackhi_epi32(r[4], r[5]);
+        u[6] = _mm256_unpacklo_epi32(r[6], r[7]);
+        u[7] = _mm256_unpackhi_epi32(r[6], r[7]);
+
+        r[0] = _mm256_unpacklo_epi64(u[0], u[2]);
+        r[1] = _mm256_unpackhi_epi64(u[0], u[2]);
+        r[2] = _mm256_unpacklo_epi64(u[1], u[3]);
+        r[3] = _mm256_unpackhi_epi64(u[1], u[3]);
+        r[4] = _mm256_unpacklo_epi64(u[4], u[6]);
+        r[5] = _mm256_unpackhi_epi64(u[4], u[6]);
+        r[6] = _mm256_unpacklo_epi64(u[5], u[7]);
+        r[7] = _mm256_unpackhi_epi64(u[5], u[7]);
+
+        M[(i * 8) + 0] = _mm256_permute2x128_si256(r[0], r[4], 0x20);
+        M[(i * 8) + 1] = _mm256_permute2x128_si256(r[1], r[5], 0x20);
+        M[(i * 8) + 2] = _mm256_permute2x128_si256(r[2], r[6], 0x20);
+        M[(i * 8) + 3] = _mm256_permute2x128_si256(r[3], r[7], 0x20);
+        M[(i * 8) + 4] = _mm256_permute2x128_si256(r[0], r[4], 0x31);
+        M[(i * 8) + 5] = _mm256_permute2x128_si256(r[1], r[5], 0x31);
+        M[(i * 8) + 6] = _mm256_permute2x128_si256(r[2], r[6], 0x31);
+        M[(i * 8) + 7] = _mm256_permute2x128_si256(r[3], r[7], 0x31);
+    }
 
-    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
-    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    a = A = TFLAC_AVX2_MD5_STATE(a);
+    b = B = TFLAC_AVX2_MD5_STATE(b);
+    c = C = TFLAC_AVX2_MD5_STATE(c);
+    d = D = TFLAC_AVX2_MD5_STATE(d);
 
-    tflac_u32 residual_abs = 0;
-    tflac_u64 residual_err;
-    residual_err = TFLAC_U64_ZERO;
+    TFLAC_MD5_STEPS(TFLAC_AVX2_MD5_ROUND1, TFLAC_AVX2_MD5_ROUND2, TFLAC_AVX2_MD5_ROUND3, TFLAC_AVX2_MD5_ROUND4)
 
-    residuals[0] = samples[0];
-    residuals[1] = samples[1];
-    residuals[2] = samples[2];
-    residuals[3] = samples[3] - (3 * samples[2]) - (-3 * samples[1]) - samples[0];
+    _mm256_storeu_si256((__m256i*)out[0], _mm256_add_epi32(a, A));
+    _mm256_storeu_si256((__m256i*)out[1], _mm256_add_epi32(b, B));
+    _mm256_storeu_si256((__m256i*)out[2], _mm256_add_epi32(c, C));
+    _mm256_storeu_si256((__m256i*)out[3], _mm256_add_epi32(d, D));
 
-    for(i=4;i<blocksize;i++) {
-        residuals[i] = samples[i] - (3 * samples[i-1]) - (-3 * samples[i-2]) - samples[i-3];
-        residual_abs = (tflac_u32)tflac_s32_abs(residuals[i]);
-        TFLAC_U64_ADD_WORD(residual_err, residual_abs);
+    for(i=0;i<8;i++) {
+        m[i]->a = out[0][i];
+        m[i]->b = out[1][i];
+        m[i]->c = out[2][i];
+        m[i]->d = out[3][i];
     }
-
-    *residual_error = residual_err;
 }
 
-TFLAC_PRIVATE void tflac_cfr_order4_std(
+#undef TFLAC_AVX2_MD5_STEP
+#undef TFLAC_AVX2_MD5_ROUND1
+#undef TFLAC_AVX2_MD5_ROUND2
+#undef TFLAC_AVX2_MD5_ROUND3
+#undef TFLAC_AVX2_MD5_ROUND4
+#undef TFLAC_AVX2_MD5_STATE
+
+TFLAC_PRIVATE void tflac_fold_residuals_avx2(
       tflac_u32 blocksize,
-      const tflac_s32* TFLAC_RESTRICT _samples,
-      tflac_s32* TFLAC_RESTRICT _residuals,
-      tflac_u64* TFLAC_RESTRICT residual_error) {
+      tflac_u32 predictor_order,
+      tflac_u32 partition_order,
+      const tflac_s32* TFLAC_RESTRICT residuals,
+      tflac_u32* TFLAC_RESTRICT folded,
+      tflac_u64* TFLAC_RESTRICT sums) {
+    const __m256i zero = _mm256_setzero_si256();
+    tflac_u32 partitions = UINT32_C(1) << partition_order;
+    tflac_u32 partition_length = blocksize >> partition_order;
+    tflac_u32 offset = predictor_order;
+    tflac_u32 end = 0;
     tflac_u32 i = 0;
+    tflac_u32 res_abs = 0;
+    tflac_u64 sum;
+    __m256i r;
+    __m256i acc;
 
-    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
-    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    for(i=0;i<partitions;i++) {
+        end = (i + 1) * partition_length;
+        acc = _mm256_setzero_si256();
 
-    tflac_u32 residual_abs = 0;
-    tflac_u64 residual_err;
-    residual_err = TFLAC_U64_ZERO;
+        while(end - offset >= 8) {
+            r = _mm256_loadu_si256((const __m256i*)&residuals[offset]);
 
-    residuals[0] = samples[0];
-    residuals[1] = samples[1];
-    residuals[2] = samples[2];
-    residuals[3] = samples[3];
+            _mm256_storeu_si256((__m256i*)&folded[offset],
+              _mm256_xor_si256(_mm256_slli_epi32(r, 1), _mm256_srai_epi32(r, 31)));
 
-    for(i=4;i<blocksize;i++) {
-        residuals[i] = samples[i] - (4 * samples[i-1]) - (-6 * samples[i-2]) - (4 * samples[i-3]) - (-1 * samples[i-4]);
-        residual_abs = (tflac_u32)tflac_s32_abs(residuals[i]);
-        TFLAC_U64_ADD_WORD(residual_err, residual_abs);
-    }
+            r = _mm256_abs_epi32(r);
+            acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(r, zero));
+            acc = _mm256_add_epi64(acc, _mm256_unpackhi_epi32(r, zero));
+            offset += 8;
+        }
 
-    *residual_error = residual_err;
+        sum = TFLAC_U64_ZERO;
+        TFLAC_AVX2_ADD64(sum, acc);
+
+        for(;offset<end;offset++) {
+            res_abs = (tflac_u32)tflac_s32_abs(residuals[offset]);
+            folded[offset] = (res_abs << 1) - ((tflac_u32)residuals[offset] >> 31);
+            TFLAC_U64_ADD_WORD(sum, res_abs);
+        }
+        sums[i] = sum;
+    }
 }
 
-#if defined(TFLAC_ENABLE_SSE2) || defined(TFLAC_ENABLE_SSSE3) || defined(TFLAC_ENABLE_SSE4_1)
+/* wide versions, same idea as the SSE4.1 ones with 8 residuals
+ * per loop */
 
-#ifdef TFLAC_32BIT_ONLY
-#define TFLAC_SSE_ADD64(d,m) \
+#define TFLAC_AVX2_WIDE_LOAD(lo, hi, p) \
     do { \
-        tflac_u32 u32val = ((tflac_u32)_mm_cvtsi128_si32(m)); \
-        d.hi += (d.lo += u32val) < u32val; \
-        d.hi += ((tflac_u32)_mm_cvtsi128_si32(_mm_shuffle_epi32(m,0x55))); \
+        __m256i m256 = _mm256_loadu_si256((const __m256i*)(p)); \
+        lo = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(m256)); \
+        hi = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(m256, 1)); \
     } while(0)
-#else
-
-#ifdef TFLAC_X64
-#define TFLAC_SSE_ADD64(d,m) \
-    d += ((tflac_u64)_mm_cvtsi128_si64(m));
-#else
-#define TFLAC_SSE_ADD64(d,m) \
-    d += ((tflac_u64)_mm_cvtsi128_si32(m)); \
-    d += (((tflac_u64)_mm_cvtsi128_si32(_mm_shuffle_epi32(m,0x55))) << 32);
-#endif /* X64 */
-#endif /* 32BIT */
 
-#endif
+/* the in-lane shuffle leaves the low halves as lo0 lo1 hi0 hi1 lo2 lo3 hi2 hi3,
+ * the permute puts them back in order */
+#define TFLAC_AVX2_WIDE_STORE(p, lo, hi) \
+    do { \
+        __m256i m256 = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(lo), _mm256_castsi256_ps(hi), _MM_SHUFFLE(2,0,2,0))); \
+        m256 = _mm256_permute4x64_epi64(m256, _MM_SHUFFLE(3,1,2,0)); \
+        _mm256_storeu_si256((__m256i*)(p), m256); \
+        overflow = _mm256_or_si256(overflow, _mm256_srli_epi64(_mm256_add_epi64(lo, bias), 32)); \
+        overflow = _mm256_or_si256(overflow, _mm256_srli_epi64(_mm256_add_epi64(hi, bias), 32)); \
+        overflow = _mm256_or_si256(overflow, _mm256_cmpeq_epi32(m256, min)); \
+        m256 = _mm256_abs_epi32(m256); \
+        sum = _mm256_add_epi64(sum, _mm256_unpacklo_epi32(m256, zero)); \
+        sum = _mm256_add_epi64(sum, _mm256_unpackhi_epi32(m256, zero)); \
+    } while(0)
 
-#ifdef TFLAC_ENABLE_SSE2
+#define TFLAC_AVX2_WIDE_FINISH() \
+    do { \
+        TFLAC_AVX2_ADD64(residual_err,sum); \
+        max_found |= (tflac_u32)!_mm256_testz_si256(overflow, overflow); \
+    } while(0)
 
-TFLAC_PRIVATE void tflac_cfr_order0_sse2(
+TFLAC_PRIVATE void tflac_cfr_order1_wide_avx2(
       tflac_u32 blocksize,
       const tflac_s32* TFLAC_RESTRICT _samples,
       tflac_s32* TFLAC_RESTRICT _residuals,
       tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i bias = _mm256_set_epi32(0, INT32_MIN, 0, INT32_MIN, 0, INT32_MIN, 0, INT32_MIN);
+    const __m256i min = _mm256_set1_epi32(INT32_MIN);
 
-    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
-    const __m128i zero = _mm_setzero_si128();
-
-    __m128i sum = _mm_setzero_si128();
+    tflac_u32 i = 4;
+    tflac_u32 max_found = 0;
     tflac_u64 residual_err;
-    tflac_u32 len = blocksize - 4;
-
-    tflac_u32 residual_abs = 0;
+    __m256i sum = _mm256_setzero_si256();
+    __m256i overflow = _mm256_setzero_si256();
+    __m256i s0_lo, s0_hi, s1_lo, s1_hi;
 
     residual_err = TFLAC_U64_ZERO;
 
-    samples0 += 4;
-
-    while(len >= 4) {
-        __m128i samples = _mm_load_si128((const __m128i *)samples0);
-        __m128i masks   = _mm_srai_epi32(samples,31);
+    residuals[0] = samples[0];
+    tflac_cfr_wide_range(1, 1, 4, samples, residuals, &residual_err, &max_found);
 
-        samples = _mm_xor_si128(samples, masks);
-        samples = _mm_sub_epi32(samples, masks);
+    for(;blocksize - i >= 8;i+=8) {
+        TFLAC_AVX2_WIDE_LOAD(s0_lo, s0_hi, &samples[i]);
+        TFLAC_AVX2_WIDE_LOAD(s1_lo, s1_hi, &samples[i-1]);
 
-        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(samples, zero));
-        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(samples, zero));
+        s0_lo = _mm256_sub_epi64(s0_lo, s1_lo);
+        s0_hi = _mm256_sub_epi64(s0_hi, s1_hi);
 
-        samples0 += 4;
-        len -= 4;
+        TFLAC_AVX2_WIDE_STORE(&residuals[i], s0_lo, s0_hi);
     }
 
-    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
-    TFLAC_SSE_ADD64(residual_err,sum);
-
-    while(len--) {
-        residual_abs = (tflac_u32)tflac_s32_abs(*samples0);
-        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
-        samples0++;
-    }
+    TFLAC_AVX2_WIDE_FINISH();
+    tflac_cfr_wide_range(1, i, blocksize, samples, residuals, &residual_err, &max_found);
 
-    *residual_error = residual_err;
-    (void)_residuals;
+    *residual_error = max_found ? TFLAC_U64_MAX : residual_err;
 }
 
-TFLAC_PRIVATE void tflac_cfr_order1_sse2(
+TFLAC_PRIVATE void tflac_cfr_order2_wide_avx2(
       tflac_u32 blocksize,
       const tflac_s32* TFLAC_RESTRICT _samples,
       tflac_s32* TFLAC_RESTRICT _residuals,
       tflac_u64* TFLAC_RESTRICT residual_error) {
-    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
-    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
-    const __m128i zero = _mm_setzero_si128();
-
-    tflac_u32 len = blocksize - 4;
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
     tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i bias = _mm256_set_epi32(0, INT32_MIN, 0, INT32_MIN, 0, INT32_MIN, 0, INT32_MIN);
+    const __m256i min = _mm256_set1_epi32(INT32_MIN);
 
-    tflac_u32 residual_abs = 0;
-    tflac_s32 residual = 0;
+    tflac_u32 i = 4;
+    tflac_u32 max_found = 0;
     tflac_u64 residual_err;
-    __m128i sum = _mm_setzero_si128();
+    __m256i sum = _mm256_setzero_si256();
+    __m256i overflow = _mm256_setzero_si256();
+    __m256i s0_lo, s0_hi, s1_lo, s1_hi, s2_lo, s2_hi;
 
     residual_err = TFLAC_U64_ZERO;
 
-    *residuals++ = *samples0++;
-    *residuals++ = *samples0++ - *samples1++;
-    *residuals++ = *samples0++ - *samples1++;
-    *residuals++ = *samples0++ - *samples1++;
-
-    while(len > 4) {
-        __m128i masks;
-        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
-        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
+    residuals[0] = samples[0];
+    residuals[1] = samples[1];
+    tflac_cfr_wide_range(2, 2, 4, samples, residuals, &residual_err, &max_found);
 
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+    for(;blocksize - i >= 8;i+=8) {
+        TFLAC_AVX2_WIDE_LOAD(s0_lo, s0_hi, &samples[i]);
+        TFLAC_AVX2_WIDE_LOAD(s1_lo, s1_hi, &samples[i-1]);
+        TFLAC_AVX2_WIDE_LOAD(s2_lo, s2_hi, &samples[i-2]);
 
-        _mm_store_si128( (__m128i*)residuals, msamples0);
+        /* s0 + s2 - 2*s1 */
+        s0_lo = _mm256_sub_epi64(_mm256_add_epi64(s0_lo, s2_lo), _mm256_slli_epi64(s1_lo, 1));
+        s0_hi = _mm256_sub_epi64(_mm256_add_epi64(s0_hi, s2_hi), _mm256_slli_epi64(s1_hi, 1));
 
-        masks = _mm_srai_epi32(msamples0,31);
+        TFLAC_AVX2_WIDE_STORE(&residuals[i], s0_lo, s0_hi);
+    }
 
-        msamples0 = _mm_xor_si128(msamples0, masks);
-        msamples0 = _mm_sub_epi32(msamples0, masks);
+    TFLAC_AVX2_WIDE_FINISH();
+    tflac_cfr_wide_range(2, i, blocksize, samples, residuals, &residual_err, &max_found);
 
-        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
-        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+    *residual_error = max_found ? TFLAC_U64_MAX : residual_err;
+}
 
-        residuals += 4;
-        samples0 += 4;
-        samples1 += 4;
-        len -= 4;
-    }
+TFLAC_PRIVATE void tflac_cfr_order3_wide_avx2(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i bias = _mm256_set_epi32(0, INT32_MIN, 0, INT32_MIN, 0, INT32_MIN, 0, INT32_MIN);
+    const __m256i min = _mm256_set1_epi32(INT32_MIN);
 
-    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
-    TFLAC_SSE_ADD64(residual_err,sum);
+    tflac_u32 i = 4;
+    tflac_u32 max_found = 0;
+    tflac_u64 residual_err;
+    __m256i sum = _mm256_setzero_si256();
+    __m256i overflow = _mm256_setzero_si256();
+    __m256i s0_lo, s0_hi, s1_lo, s1_hi, s2_lo, s2_hi, s3_lo, s3_hi;
 
-    while(len--) {
-        residual = *samples0++ - *samples1++;
-        *residuals++ = residual;
+    residual_err = TFLAC_U64_ZERO;
 
-        residual_abs = (tflac_u32)tflac_s32_abs(residual);
-        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+    residuals[0] = samples[0];
+    residuals[1] = samples[1];
+    residuals[2] = samples[2];
+    tflac_cfr_wide_range(3, 3, 4, samples, residuals, &residual_err, &max_found);
+
+    for(;blocksize - i >= 8;i+=8) {
+        TFLAC_AVX2_WIDE_LOAD(s0_lo, s0_hi, &samples[i]);
+        TFLAC_AVX2_WIDE_LOAD(s1_lo, s1_hi, &samples[i-1]);
+        TFLAC_AVX2_WIDE_LOAD(s2_lo, s2_hi, &samples[i-2]);
+        TFLAC_AVX2_WIDE_LOAD(s3_lo, s3_hi, &samples[i-3]);
+
+        /* s0 - s3 + 3*(s2 - s1) */
+        s2_lo = _mm256_sub_epi64(s2_lo, s1_lo);
+        s2_hi = _mm256_sub_epi64(s2_hi, s1_hi);
+        s2_lo = _mm256_add_epi64(_mm256_slli_epi64(s2_lo, 1), s2_lo);
+        s2_hi = _mm256_add_epi64(_mm256_slli_epi64(s2_hi, 1), s2_hi);
+        s0_lo = _mm256_add_epi64(_mm256_sub_epi64(s0_lo, s3_lo), s2_lo);
+        s0_hi = _mm256_add_epi64(_mm256_sub_epi64(s0_hi, s3_hi), s2_hi);
+
+        TFLAC_AVX2_WIDE_STORE(&residuals[i], s0_lo, s0_hi);
     }
 
-    *residual_error = residual_err;
+    TFLAC_AVX2_WIDE_FINISH();
+    tflac_cfr_wide_range(3, i, blocksize, samples, residuals, &residual_err, &max_found);
+
+    *residual_error = max_found ? TFLAC_U64_MAX : residual_err;
 }
 
-TFLAC_PRIVATE void tflac_cfr_order2_sse2(
+TFLAC_PRIVATE void tflac_cfr_order4_wide_avx2(
       tflac_u32 blocksize,
       const tflac_s32* TFLAC_RESTRICT _samples,
       tflac_s32* TFLAC_RESTRICT _residuals,
       tflac_u64* TFLAC_RESTRICT residual_error) {
-    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
-    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
-    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
-    const __m128i zero = _mm_setzero_si128();
-
-    tflac_u32 len = blocksize - 4;
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
     tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i bias = _mm256_set_epi32(0, INT32_MIN, 0, INT32_MIN, 0, INT32_MIN, 0, INT32_MIN);
+    const __m256i min = _mm256_set1_epi32(INT32_MIN);
 
-    tflac_u32 residual_abs = 0;
-    tflac_s32 residual = 0;
+    tflac_u32 i = 4;
+    tflac_u32 max_found = 0;
     tflac_u64 residual_err;
-    __m128i sum = _mm_setzero_si128();
+    __m256i sum = _mm256_setzero_si256();
+    __m256i overflow = _mm256_setzero_si256();
+    __m256i s0_lo, s0_hi, s1_lo, s1_hi, s2_lo, s2_hi, s3_lo, s3_hi, s4_lo, s4_hi;
 
     residual_err = TFLAC_U64_ZERO;
 
-    *residuals++ = *samples0++;
-    *residuals++ = *samples0++;
-    samples1++;
+    residuals[0] = samples[0];
+    residuals[1] = samples[1];
+    residuals[2] = samples[2];
+    residuals[3] = samples[3];
 
-    *residuals++ = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
-    *residuals++ = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
+    for(;blocksize - i >= 8;i+=8) {
+        TFLAC_AVX2_WIDE_LOAD(s0_lo, s0_hi, &samples[i]);
+        TFLAC_AVX2_WIDE_LOAD(s1_lo, s1_hi, &samples[i-1]);
+        TFLAC_AVX2_WIDE_LOAD(s2_lo, s2_hi, &samples[i-2]);
+        TFLAC_AVX2_WIDE_LOAD(s3_lo, s3_hi, &samples[i-3]);
+        TFLAC_AVX2_WIDE_LOAD(s4_lo, s4_hi, &samples[i-4]);
+
+        /* s0 + s4 + 6*s2 - 4*(s1 + s3) */
+        s1_lo = _mm256_slli_epi64(_mm256_add_epi64(s1_lo, s3_lo), 2);
+        s1_hi = _mm256_slli_epi64(_mm256_add_epi64(s1_hi, s3_hi), 2);
+        s2_lo = _mm256_add_epi64(_mm256_slli_epi64(s2_lo, 2), _mm256_slli_epi64(s2_lo, 1));
+        s2_hi = _mm256_add_epi64(_mm256_slli_epi64(s2_hi, 2), _mm256_slli_epi64(s2_hi, 1));
+        s0_lo = _mm256_sub_epi64(_mm256_add_epi64(_mm256_add_epi64(s0_lo, s4_lo), s2_lo), s1_lo);
+        s0_hi = _mm256_sub_epi64(_mm256_add_epi64(_mm256_add_epi64(s0_hi, s4_hi), s2_hi), s1_hi);
+
+        TFLAC_AVX2_WIDE_STORE(&residuals[i], s0_lo, s0_hi);
+    }
 
-    while(len > 4) {
-        __m128i masks;
-        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
-        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
-        __m128i msamples2 = _mm_loadu_si128((const __m128i *)samples2);
+    TFLAC_AVX2_WIDE_FINISH();
+    tflac_cfr_wide_range(4, i, blocksize, samples, residuals, &residual_err, &max_found);
 
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
-        msamples0 = _mm_add_epi32(msamples0, msamples2);
+    *residual_error = max_found ? TFLAC_U64_MAX : residual_err;
+}
 
-        _mm_store_si128( (__m128i*)residuals, msamples0);
+#undef TFLAC_AVX2_WIDE_LOAD
+#undef TFLAC_AVX2_WIDE_STORE
+#undef TFLAC_AVX2_WIDE_FINISH
+#endif
 
-        masks = _mm_srai_epi32(msamples0,31);
+#ifdef TFLAC_ENABLE_AVX512
 
-        msamples0 = _mm_xor_si128(msamples0, masks);
-        msamples0 = _mm_sub_epi32(msamples0, masks);
+#define TFLAC_AVX512_ADD64(d,m) \
+    do { \
+        __m256i m256 = _mm256_add_epi64(_mm512_castsi512_si256(m), _mm512_extracti64x4_epi64(m,1)); \
+        TFLAC_AVX2_ADD64(d,m256); \
+    } while(0)
 
-        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
-        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+/* lanes [0,len) of a 16-lane vector */
+#define TFLAC_AVX512_MASK(len) \
+    ((__mmask16)((len) >= 16 ? 0xFFFF : (1U << (len)) - 1))
 
-        residuals += 4;
-        samples0 += 4;
-        samples1 += 4;
-        samples2 += 4;
-        len -= 4;
-    }
+/* samples[i-n .. i-n+15], given the vectors at i and i-16 */
+#define TFLAC_AVX512_PREV(cur, prev, n) \
+    _mm512_alignr_epi32(cur, prev, 16 - (n))
+
+#define TFLAC_AVX512_ABS_SUM(sum, k, v) \
+    do { \
+        __m512i vabs = _mm512_maskz_abs_epi32(k, v); \
+        sum = _mm512_add_epi64(sum, _mm512_unpacklo_epi32(vabs, zero)); \
+        sum = _mm512_add_epi64(sum, _mm512_unpackhi_epi32(vabs, zero)); \
+    } while(0)
+
+/* the AVX-512 kernels go through the block 16 samples at a time and
+ * keep the previous vector around, the older samples are shifted in
+ * from it instead of being loaded again. The vector before the block is
+ * all zeroes, the warm-up lanes (below the predictor order) get the
+ * samples blended back in, and lanes 0-3 are left out of the error sum.
+ * The last vector is loaded and stored with a mask, so there's no
+ * scalar head or tail. */
+
+TFLAC_PRIVATE void tflac_cfr_order0_avx512(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
 
-    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
-    TFLAC_SSE_ADD64(residual_err,sum);
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const __m512i zero = _mm512_setzero_si512();
 
-    while(len--) {
-        residual = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
+    __m512i sum = _mm512_setzero_si512();
+    __mmask16 sum_mask = 0xFFF0;
+    tflac_u64 residual_err;
+    tflac_u32 i = 0;
 
-        residual_abs = (tflac_u32)tflac_s32_abs(residual);
-        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+    residual_err = TFLAC_U64_ZERO;
 
-        *residuals++ = residual;
+    while(i < blocksize) {
+        __mmask16 mask = TFLAC_AVX512_MASK(blocksize - i);
+        __m512i msamples0 = _mm512_maskz_loadu_epi32(mask, &samples[i]);
+
+        TFLAC_AVX512_ABS_SUM(sum, mask & sum_mask, msamples0);
+
+        sum_mask = 0xFFFF;
+        i += 16;
     }
 
+    TFLAC_AVX512_ADD64(residual_err,sum);
+
     *residual_error = residual_err;
+    (void)_residuals;
 }
 
-TFLAC_PRIVATE void tflac_cfr_order3_sse2(
+TFLAC_PRIVATE void tflac_cfr_order1_avx512(
       tflac_u32 blocksize,
       const tflac_s32* TFLAC_RESTRICT _samples,
       tflac_s32* TFLAC_RESTRICT _residuals,
       tflac_u64* TFLAC_RESTRICT residual_error) {
-    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
-    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
-    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
-    const tflac_s32* TFLAC_RESTRICT samples3 = _samples;
-    const __m128i zero = _mm_setzero_si128();
 
-    tflac_u32 len = blocksize - 4;
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
     tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const __m512i zero = _mm512_setzero_si512();
 
-    tflac_u32 residual_abs = 0;
-    tflac_s32 residual = 0;
+    __m512i sum = _mm512_setzero_si512();
+    __m512i prev = _mm512_setzero_si512();
+    __mmask16 sum_mask = 0xFFF0;
+    __mmask16 warmup = 0x0001;
     tflac_u64 residual_err;
-    __m128i sum = _mm_setzero_si128();
+    tflac_u32 i = 0;
 
     residual_err = TFLAC_U64_ZERO;
 
-    *residuals++ = *samples0++;
-    *residuals++ = *samples0++;
-    *residuals++ = *samples0++;
-
-    samples1++; samples1++;
-    samples2++;
+    while(i < blocksize) {
+        __mmask16 mask = TFLAC_AVX512_MASK(blocksize - i);
+        __m512i msamples0 = _mm512_maskz_loadu_epi32(mask, &samples[i]);
+        __m512i msamples1 = TFLAC_AVX512_PREV(msamples0, prev, 1);
+        __m512i residual;
 
-    *residuals++ = *samples0++ - (3 * (*samples1++)) - (-3 * (*samples2++)) - *samples3++;
+        residual = _mm512_sub_epi32(msamples0, msamples1);
+        residual = _mm512_mask_mov_epi32(residual, warmup, msamples0);
 
-    while(len > 4) {
-        __m128i masks;
-        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
-        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
-        __m128i msamples2 = _mm_loadu_si128((const __m128i *)samples2);
-        __m128i msamples3 = _mm_loadu_si128((const __m128i *)samples3);
+        _mm512_mask_storeu_epi32(&residuals[i], mask, residual);
+        TFLAC_AVX512_ABS_SUM(sum, mask & sum_mask, residual);
 
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+        prev = msamples0;
+        sum_mask = 0xFFFF;
+        warmup = 0;
+        i += 16;
+    }
 
-        msamples0 = _mm_add_epi32(msamples0, msamples2);
-        msamples0 = _mm_add_epi32(msamples0, msamples2);
-        msamples0 = _mm_add_epi32(msamples0, msamples2);
+    TFLAC_AVX512_ADD64(residual_err,sum);
 
-        msamples0 = _mm_sub_epi32(msamples0, msamples3);
+    *residual_error = residual_err;
+}
 
-        _mm_store_si128( (__m128i*)residuals, msamples0);
+TFLAC_PRIVATE void tflac_cfr_order2_avx512(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
 
-        masks = _mm_srai_epi32(msamples0,31);
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const __m512i zero = _mm512_setzero_si512();
 
-        msamples0 = _mm_xor_si128(msamples0, masks);
-        msamples0 = _mm_sub_epi32(msamples0, masks);
+    __m512i sum = _mm512_setzero_si512();
+    __m512i prev = _mm512_setzero_si512();
+    __mmask16 sum_mask = 0xFFF0;
+    __mmask16 warmup = 0x0003;
+    tflac_u64 residual_err;
+    tflac_u32 i = 0;
 
-        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
-        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+    residual_err = TFLAC_U64_ZERO;
 
-        residuals += 4;
-        samples0 += 4;
-        samples1 += 4;
-        samples2 += 4;
-        samples3 += 4;
-        len -= 4;
+    while(i < blocksize) {
+        __mmask16 mask = TFLAC_AVX512_MASK(blocksize - i);
+        __m512i msamples0 = _mm512_maskz_loadu_epi32(mask, &samples[i]);
+        __m512i msamples1 = TFLAC_AVX512_PREV(msamples0, prev, 1);
+        __m512i msamples2 = TFLAC_AVX512_PREV(msamples0, prev, 2);
+        __m512i residual;
+
+        /* s0 + s2 - 2*s1 */
+        residual = _mm512_add_epi32(msamples0, msamples2);
+        residual = _mm512_sub_epi32(residual, _mm512_slli_epi32(msamples1, 1));
+        residual = _mm512_mask_mov_epi32(residual, warmup, msamples0);
+
+        _mm512_mask_storeu_epi32(&residuals[i], mask, residual);
+        TFLAC_AVX512_ABS_SUM(sum, mask & sum_mask, residual);
+
+        prev = msamples0;
+        sum_mask = 0xFFFF;
+        warmup = 0;
+        i += 16;
     }
 
-    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
-    TFLAC_SSE_ADD64(residual_err,sum);
+    TFLAC_AVX512_ADD64(residual_err,sum);
 
-    while(len--) {
-        residual = *samples0++ - (3 * (*samples1++)) - (-3 * (*samples2++)) - *samples3++;
+    *residual_error = residual_err;
+}
 
-        residual_abs = (tflac_u32)tflac_s32_abs(residual);
-        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+TFLAC_PRIVATE void tflac_cfr_order3_avx512(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
 
-        *residuals++ = residual;
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const __m512i zero = _mm512_setzero_si512();
+
+    __m512i sum = _mm512_setzero_si512();
+    __m512i prev = _mm512_setzero_si512();
+    __mmask16 sum_mask = 0xFFF0;
+    __mmask16 warmup = 0x0007;
+    tflac_u64 residual_err;
+    tflac_u32 i = 0;
+
+    residual_err = TFLAC_U64_ZERO;
+
+    while(i < blocksize) {
+        __mmask16 mask = TFLAC_AVX512_MASK(blocksize - i);
+        __m512i msamples0 = _mm512_maskz_loadu_epi32(mask, &samples[i]);
+        __m512i msamples1 = TFLAC_AVX512_PREV(msamples0, prev, 1);
+        __m512i msamples2 = TFLAC_AVX512_PREV(msamples0, prev, 2);
+        __m512i msamples3 = TFLAC_AVX512_PREV(msamples0, prev, 3);
+        __m512i diff;
+        __m512i residual;
+
+        /* s0 - s3 + 3*(s2 - s1) */
+        diff = _mm512_sub_epi32(msamples2, msamples1);
+        residual = _mm512_sub_epi32(msamples0, msamples3);
+        residual = _mm512_add_epi32(residual, diff);
+        residual = _mm512_add_epi32(residual, _mm512_slli_epi32(diff, 1));
+        residual = _mm512_mask_mov_epi32(residual, warmup, msamples0);
+
+        _mm512_mask_storeu_epi32(&residuals[i], mask, residual);
+        TFLAC_AVX512_ABS_SUM(sum, mask & sum_mask, residual);
+
+        prev = msamples0;
+        sum_mask = 0xFFFF;
+        warmup = 0;
+        i += 16;
     }
 
+    TFLAC_AVX512_ADD64(residual_err,sum);
+
     *residual_error = residual_err;
 }
 
-TFLAC_PRIVATE void tflac_cfr_order4_sse2(
+TFLAC_PRIVATE void tflac_cfr_order4_avx512(
       tflac_u32 blocksize,
       const tflac_s32* TFLAC_RESTRICT _samples,
       tflac_s32* TFLAC_RESTRICT _residuals,
       tflac_u64* TFLAC_RESTRICT residual_error) {
-    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
-    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
-    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
-    const tflac_s32* TFLAC_RESTRICT samples3 = _samples;
-    const tflac_s32* TFLAC_RESTRICT samples4 = TFLAC_ASSUME_ALIGNED(_samples, 16);
-    const __m128i zero = _mm_setzero_si128();
 
-    tflac_u32 len = blocksize - 4;
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
     tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const __m512i zero = _mm512_setzero_si512();
 
-    tflac_u32 residual_abs = 0;
-    tflac_s32 residual = 0;
+    __m512i sum = _mm512_setzero_si512();
+    __m512i prev = _mm512_setzero_si512();
+    __mmask16 sum_mask = 0xFFF0;
+    __mmask16 warmup = 0x000F;
     tflac_u64 residual_err;
-    __m128i sum = _mm_setzero_si128();
+    tflac_u32 i = 0;
 
     residual_err = TFLAC_U64_ZERO;
 
-    *residuals++ = *samples0++;
-    *residuals++ = *samples0++;
-    *residuals++ = *samples0++;
-    *residuals++ = *samples0++;
+    while(i < blocksize) {
+        __mmask16 mask = TFLAC_AVX512_MASK(blocksize - i);
+        __m512i msamples0 = _mm512_maskz_loadu_epi32(mask, &samples[i]);
+        __m512i msamples1 = TFLAC_AVX512_PREV(msamples0, prev, 1);
+        __m512i msamples2 = TFLAC_AVX512_PREV(msamples0, prev, 2);
+        __m512i msamples3 = TFLAC_AVX512_PREV(msamples0, prev, 3);
+        __m512i msamples4 = TFLAC_AVX512_PREV(msamples0, prev, 4);
+        __m512i residual;
+
+        /* s0 + s4 + 6*s2 - 4*(s1 + s3) */
+        msamples1 = _mm512_slli_epi32(_mm512_add_epi32(msamples1, msamples3), 2);
+        msamples2 = _mm512_add_epi32(_mm512_slli_epi32(msamples2, 2), _mm512_slli_epi32(msamples2, 1));
+
+        residual = _mm512_add_epi32(msamples0, msamples4);
+        residual = _mm512_add_epi32(residual, msamples2);
+        residual = _mm512_sub_epi32(residual, msamples1);
+        residual = _mm512_mask_mov_epi32(residual, warmup, msamples0);
+
+        _mm512_mask_storeu_epi32(&residuals[i], mask, residual);
+        TFLAC_AVX512_ABS_SUM(sum, mask & sum_mask, residual);
+
+        prev = msamples0;
+        sum_mask = 0xFFFF;
+        warmup = 0;
+        i += 16;
+    }
 
-    samples1++; samples1++; samples1++;
-    samples2++; samples2++;
-    samples3++;
+    TFLAC_AVX512_ADD64(residual_err,sum);
 
-    while(len > 4) {
-        __m128i masks;
-        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
-        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
-        __m128i msamples2 = _mm_loadu_si128((const __m128i *)samples2);
-        __m128i msamples3 = _mm_loadu_si128((const __m128i *)samples3);
-        __m128i msamples4 = _mm_load_si128((const __m128i *)samples4);
+    *residual_error = residual_err;
+}
 
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+TFLAC_PRIVATE void tflac_cfr_fused_avx512(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_u64* TFLAC_RESTRICT residual_errors) {
 
-        msamples0 = _mm_add_epi32(msamples0, msamples2);
-        msamples0 = _mm_add_epi32(msamples0, msamples2);
-        msamples0 = _mm_add_epi32(msamples0, msamples2);
-        msamples0 = _mm_add_epi32(msamples0, msamples2);
-        msamples0 = _mm_add_epi32(msamples0, msamples2);
-        msamples0 = _mm_add_epi32(msamples0, msamples2);
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    const __m512i zero = _mm512_setzero_si512();
+
+    __m512i sum0 = _mm512_setzero_si512();
+    __m512i sum1 = _mm512_setzero_si512();
+    __m512i sum2 = _mm512_setzero_si512();
+    __m512i sum3 = _mm512_setzero_si512();
+    __m512i sum4 = _mm512_setzero_si512();
+    __m512i prev = _mm512_setzero_si512();
+    __mmask16 sum_mask = 0xFFF0;
+    tflac_u32 i = 0;
 
-        msamples0 = _mm_sub_epi32(msamples0, msamples3);
-        msamples0 = _mm_sub_epi32(msamples0, msamples3);
-        msamples0 = _mm_sub_epi32(msamples0, msamples3);
-        msamples0 = _mm_sub_epi32(msamples0, msamples3);
+    residual_errors[0] = TFLAC_U64_ZERO;
+    residual_errors[1] = TFLAC_U64_ZERO;
+    residual_errors[2] = TFLAC_U64_ZERO;
+    residual_errors[3] = TFLAC_U64_ZERO;
+    residual_errors[4] = TFLAC_U64_ZERO;
+
+    while(i < blocksize) {
+        __mmask16 mask = TFLAC_AVX512_MASK(blocksize - i);
+        __m512i msamples0 = _mm512_maskz_loadu_epi32(mask, &samples[i]);
+        __m512i msamples1 = TFLAC_AVX512_PREV(msamples0, prev, 1);
+        __m512i msamples2 = TFLAC_AVX512_PREV(msamples0, prev, 2);
+        __m512i msamples3 = TFLAC_AVX512_PREV(msamples0, prev, 3);
+        __m512i msamples4 = TFLAC_AVX512_PREV(msamples0, prev, 4);
+
+        /* first-order differences at i, i-1, i-2, i-3 */
+        __m512i order1 = _mm512_sub_epi32(msamples0, msamples1);
+        __m512i diff1  = _mm512_sub_epi32(msamples1, msamples2);
+        __m512i diff2  = _mm512_sub_epi32(msamples2, msamples3);
+        __m512i diff3  = _mm512_sub_epi32(msamples3, msamples4);
+
+        __m512i order2 = _mm512_sub_epi32(order1, diff1);
+        __m512i order3;
+        __m512i order4;
+
+        diff1 = _mm512_sub_epi32(diff1, diff2);
+        diff2 = _mm512_sub_epi32(diff2, diff3);
+
+        order3 = _mm512_sub_epi32(order2, diff1);
+        diff1 = _mm512_sub_epi32(diff1, diff2);
+
+        order4 = _mm512_sub_epi32(order3, diff1);
+
+        mask &= sum_mask;
+        TFLAC_AVX512_ABS_SUM(sum0, mask, msamples0);
+        TFLAC_AVX512_ABS_SUM(sum1, mask, order1);
+        TFLAC_AVX512_ABS_SUM(sum2, mask, order2);
+        TFLAC_AVX512_ABS_SUM(sum3, mask, order3);
+        TFLAC_AVX512_ABS_SUM(sum4, mask, order4);
+
+        prev = msamples0;
+        sum_mask = 0xFFFF;
+        i += 16;
+    }
 
-        msamples0 = _mm_add_epi32(msamples0, msamples4);
+    TFLAC_AVX512_ADD64(residual_errors[0],sum0);
+    TFLAC_AVX512_ADD64(residual_errors[1],sum1);
+    TFLAC_AVX512_ADD64(residual_errors[2],sum2);
+    TFLAC_AVX512_ADD64(residual_errors[3],sum3);
+    TFLAC_AVX512_ADD64(residual_errors[4],sum4);
+}
 
-        _mm_store_si128( (__m128i*)residuals, msamples0);
+#undef TFLAC_AVX512_ADD64
+#undef TFLAC_AVX512_MASK
+#undef TFLAC_AVX512_PREV
+#undef TFLAC_AVX512_ABS_SUM
+#endif
 
-        masks = _mm_srai_epi32(msamples0,31);
+#ifdef TFLAC_ENABLE_NEON
 
-        msamples0 = _mm_xor_si128(msamples0, masks);
-        msamples0 = _mm_sub_epi32(msamples0, masks);
+#ifdef TFLAC_32BIT_ONLY
+#define TFLAC_NEON_ADD64(d,m) \
+    do { \
+        uint32x2_t m64 = vreinterpret_u32_u64(vadd_u64(vget_low_u64(m), vget_high_u64(m))); \
+        tflac_u32 u32val = vget_lane_u32(m64, 0); \
+        d.hi += (d.lo += u32val) < u32val; \
+        d.hi += vget_lane_u32(m64, 1); \
+    } while(0)
+#else
+#define TFLAC_NEON_ADD64(d,m) \
+    d += ((tflac_u64)vaddvq_u64(m));
+#endif
 
-        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
-        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+/* adds the absolute values of v into the two 64-bit lanes of sum,
+ * vabsq leaves INT32_MIN alone which is 2^31 as unsigned, same as
+ * the (tflac_u32) cast in the scalar versions */
+#define TFLAC_NEON_ABS_SUM(sum,v) \
+    sum = vpadalq_u32(sum, vreinterpretq_u32_s32(vabsq_s32(v)))
 
-        residuals += 4;
-        samples0 += 4;
-        samples1 += 4;
-        samples2 += 4;
-        samples3 += 4;
-        samples4 += 4;
-        len -= 4;
-    }
+/* NEON loads and stores don't have alignment requirements, and the
+ * multiplies are done with shifts and adds, which give the same
+ * wrapped 32-bit results as the scalar versions. */
 
-    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
-    TFLAC_SSE_ADD64(residual_err,sum);
+TFLAC_PRIVATE void tflac_cfr_order0_neon(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
 
-    while(len--) {
-        residual = *samples0++ - (4 * (*samples1++)) - (-6 * (*samples2++)) - (4 * (*samples3++)) - (-1 * (*samples4++));
+    tflac_u32 i = 4;
+    tflac_u32 residual_abs = 0;
+    tflac_u64 residual_err;
+    uint64x2_t sum = vdupq_n_u64(0);
 
-        residual_abs = (tflac_u32)tflac_s32_abs(residual);
-        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+    residual_err = TFLAC_U64_ZERO;
 
-        *residuals++ = residual;
+    for(;i + 4 <= blocksize;i+=4) {
+        TFLAC_NEON_ABS_SUM(sum, vld1q_s32(&samples[i]));
+    }
+
+    TFLAC_NEON_ADD64(residual_err, sum);
+
+    for(;i<blocksize;i++) {
+        residual_abs = (tflac_u32)tflac_s32_abs(samples[i]);
+        TFLAC_U64_ADD_WORD(residual_err, residual_abs);
     }
 
     *residual_error = residual_err;
+    (void)_residuals;
 }
-#endif /* TFLAC_ENABLE_SSE2 */
 
-#ifdef TFLAC_ENABLE_SSSE3
-TFLAC_PRIVATE void tflac_cfr_order0_ssse3(
+TFLAC_PRIVATE void tflac_cfr_order1_neon(
       tflac_u32 blocksize,
       const tflac_s32* TFLAC_RESTRICT _samples,
       tflac_s32* TFLAC_RESTRICT _residuals,
       tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
 
-    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
-    const __m128i zero = _mm_setzero_si128();
-
-    __m128i sum = _mm_setzero_si128();
-    tflac_u64 residual_err;
-    tflac_u32 len = blocksize - 4;
-
+    tflac_u32 i = 4;
     tflac_u32 residual_abs = 0;
+    tflac_u64 residual_err;
+    uint64x2_t sum = vdupq_n_u64(0);
+    int32x4_t v;
 
     residual_err = TFLAC_U64_ZERO;
 
-    samples0 += 4;
-
-    while(len >= 4) {
-        __m128i samples = _mm_load_si128((const __m128i *)samples0);
-        samples = _mm_abs_epi32(samples);
-
-        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(samples, zero));
-        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(samples, zero));
+    residuals[0] = samples[0];
+    residuals[1] = samples[1] - samples[0];
+    residuals[2] = samples[2] - samples[1];
+    residuals[3] = samples[3] - samples[2];
 
-        samples0 += 4;
-        len -= 4;
+    for(;i + 4 <= blocksize;i+=4) {
+        v = vsubq_s32(vld1q_s32(&samples[i]), vld1q_s32(&samples[i-1]));
+        vst1q_s32(&residuals[i], v);
+        TFLAC_NEON_ABS_SUM(sum, v);
     }
 
-    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
-    TFLAC_SSE_ADD64(residual_err,sum);
+    TFLAC_NEON_ADD64(residual_err, sum);
 
-    while(len--) {
-        residual_abs = (tflac_u32)tflac_s32_abs(*samples0);
-        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
-        samples0++;
+    for(;i<blocksize;i++) {
+        residuals[i] = samples[i] - samples[i-1];
+        residual_abs = (tflac_u32)tflac_s32_abs(residuals[i]);
+        TFLAC_U64_ADD_WORD(residual_err, residual_abs);
     }
 
     *residual_error = residual_err;
-    (void)_residuals;
 }
 
-TFLAC_PRIVATE void tflac_cfr_order1_ssse3(
+TFLAC_PRIVATE void tflac_cfr_order2_neon(
       tflac_u32 blocksize,
       const tflac_s32* TFLAC_RESTRICT _samples,
       tflac_s32* TFLAC_RESTRICT _residuals,
       tflac_u64* TFLAC_RESTRICT residual_error) {
-    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
-    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
-    const __m128i zero = _mm_setzero_si128();
-
-    tflac_u32 len = blocksize - 4;
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
     tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
 
+    tflac_u32 i = 4;
     tflac_u32 residual_abs = 0;
-    tflac_s32 residual = 0;
     tflac_u64 residual_err;
-    __m128i sum = _mm_setzero_si128();
+    uint64x2_t sum = vdupq_n_u64(0);
+    int32x4_t v;
 
     residual_err = TFLAC_U64_ZERO;
 
-    *residuals++ = *samples0++;
-    *residuals++ = *samples0++ - *samples1++;
-    *residuals++ = *samples0++ - *samples1++;
-    *residuals++ = *samples0++ - *samples1++;
+    residuals[0] = samples[0];
+    residuals[1] = samples[1];
+    residuals[2] = samples[2] - (2 * samples[1]) + samples[0];
+    residuals[3] = samples[3] - (2 * samples[2]) + samples[1];
+
+    for(;i + 4 <= blocksize;i+=4) {
+        /* s0 + s2 - 2*s1 */
+        v = vaddq_s32(vld1q_s32(&samples[i]), vld1q_s32(&samples[i-2]));
+        v = vsubq_s32(v, vshlq_n_s32(vld1q_s32(&samples[i-1]), 1));
+        vst1q_s32(&residuals[i], v);
+        TFLAC_NEON_ABS_SUM(sum, v);
+    }
 
-    while(len > 4) {
-        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
-        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
+    TFLAC_NEON_ADD64(residual_err, sum);
 
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+    for(;i<blocksize;i++) {
+        residuals[i] = samples[i] - (2 * samples[i-1]) + samples[i-2];
+        residual_abs = (tflac_u32)tflac_s32_abs(residuals[i]);
+        TFLAC_U64_ADD_WORD(residual_err, residual_abs);
+    }
 
-        _mm_store_si128( (__m128i*)residuals, msamples0);
+    *residual_error = residual_err;
+}
+
+TFLAC_PRIVATE void tflac_cfr_order3_neon(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
 
-        msamples0 = _mm_abs_epi32(msamples0);
+    tflac_u32 i = 4;
+    tflac_u32 residual_abs = 0;
+    tflac_u64 residual_err;
+    uint64x2_t sum = vdupq_n_u64(0);
+    int32x4_t v;
+    int32x4_t d;
 
-        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
-        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+    residual_err = TFLAC_U64_ZERO;
 
-        residuals += 4;
-        samples0 += 4;
-        samples1 += 4;
-        len -= 4;
+    residuals[0] = samples[0];
+    residuals[1] = samples[1];
+    residuals[2] = samples[2];
+    residuals[3] = samples[3] - (3 * samples[2]) + (3 * samples[1]) - samples[0];
+
+    for(;i + 4 <= blocksize;i+=4) {
+        /* s0 - s3 + 3*(s2 - s1) */
+        d = vsubq_s32(vld1q_s32(&samples[i-2]), vld1q_s32(&samples[i-1]));
+        d = vaddq_s32(vshlq_n_s32(d, 1), d);
+        v = vsubq_s32(vld1q_s32(&samples[i]), vld1q_s32(&samples[i-3]));
+        v = vaddq_s32(v, d);
+        vst1q_s32(&residuals[i], v);
+        TFLAC_NEON_ABS_SUM(sum, v);
     }
 
-    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
-    TFLAC_SSE_ADD64(residual_err,sum);
-
-    while(len--) {
-        residual = *samples0++ - *samples1++;
-        *residuals++ = residual;
+    TFLAC_NEON_ADD64(residual_err, sum);
 
-        residual_abs = (tflac_u32)tflac_s32_abs(residual);
-        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+    for(;i<blocksize;i++) {
+        residuals[i] = samples[i] - (3 * samples[i-1]) + (3 * samples[i-2]) - samples[i-3];
+        residual_abs = (tflac_u32)tflac_s32_abs(residuals[i]);
+        TFLAC_U64_ADD_WORD(residual_err, residual_abs);
     }
 
     *residual_error = residual_err;
 }
 
-TFLAC_PRIVATE void tflac_cfr_order2_ssse3(
+TFLAC_PRIVATE void tflac_cfr_order4_neon(
       tflac_u32 blocksize,
       const tflac_s32* TFLAC_RESTRICT _samples,
       tflac_s32* TFLAC_RESTRICT _residuals,
       tflac_u64* TFLAC_RESTRICT residual_error) {
-    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
-    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
-    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
-    const __m128i zero = _mm_setzero_si128();
-
-    tflac_u32 len = blocksize - 4;
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
     tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
 
+    tflac_u32 i = 4;
     tflac_u32 residual_abs = 0;
-    tflac_s32 residual = 0;
     tflac_u64 residual_err;
-    __m128i sum = _mm_setzero_si128();
+    uint64x2_t sum = vdupq_n_u64(0);
+    int32x4_t v;
+    int32x4_t s1;
+    int32x4_t s2;
 
     residual_err = TFLAC_U64_ZERO;
 
-    *residuals++ = *samples0++;
-    *residuals++ = *samples0++;
-    samples1++;
-
-    *residuals++ = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
-    *residuals++ = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
+    residuals[0] = samples[0];
+    residuals[1] = samples[1];
+    residuals[2] = samples[2];
+    residuals[3] = samples[3];
 
-    while(len > 4) {
-        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
-        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
-        __m128i msamples2 = _mm_loadu_si128((const __m128i *)samples2);
+    for(;i + 4 <= blocksize;i+=4) {
+        /* s0 + s4 + 6*s2 - 4*(s1 + s3) */
+        s1 = vshlq_n_s32(vaddq_s32(vld1q_s32(&samples[i-1]), vld1q_s32(&samples[i-3])), 2);
+        s2 = vld1q_s32(&samples[i-2]);
+        s2 = vaddq_s32(vshlq_n_s32(s2, 2), vshlq_n_s32(s2, 1));
+        v = vaddq_s32(vld1q_s32(&samples[i]), vld1q_s32(&samples[i-4]));
+        v = vsubq_s32(vaddq_s32(v, s2), s1);
+        vst1q_s32(&residuals[i], v);
+        TFLAC_NEON_ABS_SUM(sum, v);
+    }
 
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
-        msamples0 = _mm_add_epi32(msamples0, msamples2);
+    TFLAC_NEON_ADD64(residual_err, sum);
 
-        _mm_store_si128( (__m128i*)residuals, msamples0);
+    for(;i<blocksize;i++) {
+        residuals[i] = samples[i] - (4 * samples[i-1]) + (6 * samples[i-2]) - (4 * samples[i-3]) + samples[i-4];
+        residual_abs = (tflac_u32)tflac_s32_abs(residuals[i]);
+        TFLAC_U64_ADD_WORD(residual_err, residual_abs);
+    }
 
-        msamples0 = _mm_abs_epi32(msamples0);
+    *residual_error = residual_err;
+}
 
-        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
-        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+TFLAC_PRIVATE void tflac_cfr_fused_neon(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_u64* TFLAC_RESTRICT residual_errors) {
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
 
-        residuals += 4;
-        samples0 += 4;
-        samples1 += 4;
-        samples2 += 4;
-        len -= 4;
+    tflac_u32 i = 4;
+    uint64x2_t sum0 = vdupq_n_u64(0);
+    uint64x2_t sum1 = vdupq_n_u64(0);
+    uint64x2_t sum2 = vdupq_n_u64(0);
+    uint64x2_t sum3 = vdupq_n_u64(0);
+    uint64x2_t sum4 = vdupq_n_u64(0);
+
+    residual_errors[0] = TFLAC_U64_ZERO;
+    residual_errors[1] = TFLAC_U64_ZERO;
+    residual_errors[2] = TFLAC_U64_ZERO;
+    residual_errors[3] = TFLAC_U64_ZERO;
+    residual_errors[4] = TFLAC_U64_ZERO;
+
+    while(i + 4 <= blocksize) {
+        int32x4_t msamples0 = vld1q_s32(&samples[i]);
+        int32x4_t msamples1 = vld1q_s32(&samples[i-1]);
+        int32x4_t msamples2 = vld1q_s32(&samples[i-2]);
+        int32x4_t msamples3 = vld1q_s32(&samples[i-3]);
+        int32x4_t msamples4 = vld1q_s32(&samples[i-4]);
+
+        /* first-order differences at i, i-1, i-2, i-3 */
+        int32x4_t order1 = vsubq_s32(msamples0, msamples1);
+        int32x4_t diff1  = vsubq_s32(msamples1, msamples2);
+        int32x4_t diff2  = vsubq_s32(msamples2, msamples3);
+        int32x4_t diff3  = vsubq_s32(msamples3, msamples4);
+
+        int32x4_t order2 = vsubq_s32(order1, diff1);
+        int32x4_t order3;
+        int32x4_t order4;
+
+        diff1 = vsubq_s32(diff1, diff2);
+        diff2 = vsubq_s32(diff2, diff3);
+
+        order3 = vsubq_s32(order2, diff1);
+        diff1 = vsubq_s32(diff1, diff2);
+
+        order4 = vsubq_s32(order3, diff1);
+
+        TFLAC_NEON_ABS_SUM(sum0, msamples0);
+        TFLAC_NEON_ABS_SUM(sum1, order1);
+        TFLAC_NEON_ABS_SUM(sum2, order2);
+        TFLAC_NEON_ABS_SUM(sum3, order3);
+        TFLAC_NEON_ABS_SUM(sum4, order4);
+
+        i += 4;
     }
 
-    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
-    TFLAC_SSE_ADD64(residual_err,sum);
+    TFLAC_NEON_ADD64(residual_errors[0], sum0);
+    TFLAC_NEON_ADD64(residual_errors[1], sum1);
+    TFLAC_NEON_ADD64(residual_errors[2], sum2);
+    TFLAC_NEON_ADD64(residual_errors[3], sum3);
+    TFLAC_NEON_ADD64(residual_errors[4], sum4);
 
-    while(len--) {
-        residual = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
+    tflac_cfr_fused_range(i, blocksize, samples, residual_errors);
+}
 
-        residual_abs = (tflac_u32)tflac_s32_abs(residual);
-        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+/* the wide calculators widen each half of 4 samples to 64-bit lanes.
+ * Anything with an absolute value over INT32_MAX (which includes
+ * INT32_MIN) sets overflow, otherwise the 64-bit absolute values
+ * can go straight into the sum */
+#define TFLAC_NEON_WIDE_LOAD(lo, hi, ptr) \
+    do { \
+        int32x4_t m128 = vld1q_s32(ptr); \
+        lo = vmovl_s32(vget_low_s32(m128)); \
+        hi = vmovl_s32(vget_high_s32(m128)); \
+    } while(0)
 
-        *residuals++ = residual;
-    }
+#define TFLAC_NEON_WIDE_STORE(ptr, lo, hi) \
+    do { \
+        vst1q_s32(ptr, vcombine_s32(vmovn_s64(lo), vmovn_s64(hi))); \
+        lo = vabsq_s64(lo); \
+        hi = vabsq_s64(hi); \
+        overflow = vorrq_u64(overflow, vcgtq_s64(lo, max)); \
+        overflow = vorrq_u64(overflow, vcgtq_s64(hi, max)); \
+        sum = vaddq_u64(sum, vreinterpretq_u64_s64(lo)); \
+        sum = vaddq_u64(sum, vreinterpretq_u64_s64(hi)); \
+    } while(0)
 
-    *residual_error = residual_err;
-}
+#define TFLAC_NEON_WIDE_FINISH() \
+    do { \
+        TFLAC_NEON_ADD64(residual_err, sum); \
+        max_found |= vmaxvq_u32(vreinterpretq_u32_u64(overflow)) != 0; \
+    } while(0)
 
-TFLAC_PRIVATE void tflac_cfr_order3_ssse3(
+TFLAC_PRIVATE void tflac_cfr_order1_wide_neon(
       tflac_u32 blocksize,
       const tflac_s32* TFLAC_RESTRICT _samples,
       tflac_s32* TFLAC_RESTRICT _residuals,
       tflac_u64* TFLAC_RESTRICT residual_error) {
-    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
-    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
-    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
-    const tflac_s32* TFLAC_RESTRICT samples3 = _samples;
-    const __m128i zero = _mm_setzero_si128();
-
-    tflac_u32 len = blocksize - 4;
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
     tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const int64x2_t max = vdupq_n_s64(INT32_MAX);
 
-    tflac_u32 residual_abs = 0;
-    tflac_s32 residual = 0;
+    tflac_u32 i = 4;
+    tflac_u32 max_found = 0;
     tflac_u64 residual_err;
-    __m128i sum = _mm_setzero_si128();
+    uint64x2_t sum = vdupq_n_u64(0);
+    uint64x2_t overflow = vdupq_n_u64(0);
+    int64x2_t s0_lo, s0_hi, s1_lo, s1_hi;
 
     residual_err = TFLAC_U64_ZERO;
 
-    *residuals++ = *samples0++;
-    *residuals++ = *samples0++;
-    *residuals++ = *samples0++;
+    residuals[0] = samples[0];
+    tflac_cfr_wide_range(1, 1, 4, samples, residuals, &residual_err, &max_found);
 
-    samples1++; samples1++;
-    samples2++;
+    for(;blocksize - i >= 4;i+=4) {
+        TFLAC_NEON_WIDE_LOAD(s0_lo, s0_hi, &samples[i]);
+        TFLAC_NEON_WIDE_LOAD(s1_lo, s1_hi, &samples[i-1]);
 
-    *residuals++ = *samples0++ - (3 * (*samples1++)) - (-3 * (*samples2++)) - *samples3++;
+        s0_lo = vsubq_s64(s0_lo, s1_lo);
+        s0_hi = vsubq_s64(s0_hi, s1_hi);
 
-    while(len > 4) {
-        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
-        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
-        __m128i msamples2 = _mm_loadu_si128((const __m128i *)samples2);
-        __m128i msamples3 = _mm_loadu_si128((const __m128i *)samples3);
+        TFLAC_NEON_WIDE_STORE(&residuals[i], s0_lo, s0_hi);
+    }
 
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+    TFLAC_NEON_WIDE_FINISH();
+    tflac_cfr_wide_range(1, i, blocksize, samples, residuals, &residual_err, &max_found);
 
-        msamples0 = _mm_add_epi32(msamples0, msamples2);
-        msamples0 = _mm_add_epi32(msamples0, msamples2);
-        msamples0 = _mm_add_epi32(msamples0, msamples2);
+    *residual_error = max_found ? TFLAC_U64_MAX : residual_err;
+}
 
-        msamples0 = _mm_sub_epi32(msamples0, msamples3);
+TFLAC_PRIVATE void tflac_cfr_order2_wide_neon(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const int64x2_t max = vdupq_n_s64(INT32_MAX);
 
-        _mm_store_si128( (__m128i*)residuals, msamples0);
+    tflac_u32 i = 4;
+    tflac_u32 max_found = 0;
+    tflac_u64 residual_err;
+    uint64x2_t sum = vdupq_n_u64(0);
+    uint64x2_t overflow = vdupq_n_u64(0);
+    int64x2_t s0_lo, s0_hi, s1_lo, s1_hi, s2_lo, s2_hi;
 
-        msamples0 = _mm_abs_epi32(msamples0);
+    residual_err = TFLAC_U64_ZERO;
 
-        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
-        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+    residuals[0] = samples[0];
+    residuals[1] = samples[1];
+    tflac_cfr_wide_range(2, 2, 4, samples, residuals, &residual_err, &max_found);
 
-        residuals += 4;
-        samples0 += 4;
-        samples1 += 4;
-        samples2 += 4;
-        samples3 += 4;
-        len -= 4;
+    for(;blocksize - i >= 4;i+=4) {
+        TFLAC_NEON_WIDE_LOAD(s0_lo, s0_hi, &samples[i]);
+        TFLAC_NEON_WIDE_LOAD(s1_lo, s1_hi, &samples[i-1]);
+        TFLAC_NEON_WIDE_LOAD(s2_lo, s2_hi, &samples[i-2]);
+
+        /* s0 + s2 - 2*s1 */
+        s0_lo = vsubq_s64(vaddq_s64(s0_lo, s2_lo), vshlq_n_s64(s1_lo, 1));
+        s0_hi = vsubq_s64(vaddq_s64(s0_hi, s2_hi), vshlq_n_s64(s1_hi, 1));
+
+        TFLAC_NEON_WIDE_STORE(&residuals[i], s0_lo, s0_hi);
     }
 
-    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
-    TFLAC_SSE_ADD64(residual_err,sum);
+    TFLAC_NEON_WIDE_FINISH();
+    tflac_cfr_wide_range(2, i, blocksize, samples, residuals, &residual_err, &max_found);
 
-    while(len--) {
-        residual = *samples0++ - (3 * (*samples1++)) - (-3 * (*samples2++)) - *samples3++;
+    *residual_error = max_found ? TFLAC_U64_MAX : residual_err;
+}
 
-        residual_abs = (tflac_u32)tflac_s32_abs(residual);
-        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+TFLAC_PRIVATE void tflac_cfr_order3_wide_neon(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const int64x2_t max = vdupq_n_s64(INT32_MAX);
 
-        *residuals++ = residual;
+    tflac_u32 i = 4;
+    tflac_u32 max_found = 0;
+    tflac_u64 residual_err;
+    uint64x2_t sum = vdupq_n_u64(0);
+    uint64x2_t overflow = vdupq_n_u64(0);
+    int64x2_t s0_lo, s0_hi, s1_lo, s1_hi, s2_lo, s2_hi, s3_lo, s3_hi;
+
+    residual_err = TFLAC_U64_ZERO;
+
+    residuals[0] = samples[0];
+    residuals[1] = samples[1];
+    residuals[2] = samples[2];
+    tflac_cfr_wide_range(3, 3, 4, samples, residuals, &residual_err, &max_found);
+
+    for(;blocksize - i >= 4;i+=4) {
+        TFLAC_NEON_WIDE_LOAD(s0_lo, s0_hi, &samples[i]);
+        TFLAC_NEON_WIDE_LOAD(s1_lo, s1_hi, &samples[i-1]);
+        TFLAC_NEON_WIDE_LOAD(s2_lo, s2_hi, &samples[i-2]);
+        TFLAC_NEON_WIDE_LOAD(s3_lo, s3_hi, &samples[i-3]);
+
+        /* s0 - s3 + 3*(s2 - s1) */
+        s2_lo = vsubq_s64(s2_lo, s1_lo);
+        s2_hi = vsubq_s64(s2_hi, s1_hi);
+        s2_lo = vaddq_s64(vshlq_n_s64(s2_lo, 1), s2_lo);
+        s2_hi = vaddq_s64(vshlq_n_s64(s2_hi, 1), s2_hi);
+        s0_lo = vaddq_s64(vsubq_s64(s0_lo, s3_lo), s2_lo);
+        s0_hi = vaddq_s64(vsubq_s64(s0_hi, s3_hi), s2_hi);
+
+        TFLAC_NEON_WIDE_STORE(&residuals[i], s0_lo, s0_hi);
     }
 
-    *residual_error = residual_err;
+    TFLAC_NEON_WIDE_FINISH();
+    tflac_cfr_wide_range(3, i, blocksize, samples, residuals, &residual_err, &max_found);
+
+    *residual_error = max_found ? TFLAC_U64_MAX : residual_err;
 }
 
-TFLAC_PRIVATE void tflac_cfr_order4_ssse3(
+TFLAC_PRIVATE void tflac_cfr_order4_wide_neon(
       tflac_u32 blocksize,
       const tflac_s32* TFLAC_RESTRICT _samples,
       tflac_s32* TFLAC_RESTRICT _residuals,
       tflac_u64* TFLAC_RESTRICT residual_error) {
-    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
-    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
-    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
-    const tflac_s32* TFLAC_RESTRICT samples3 = _samples;
-    const tflac_s32* TFLAC_RESTRICT samples4 = TFLAC_ASSUME_ALIGNED(_samples, 16);
-    const __m128i zero = _mm_setzero_si128();
-
-    tflac_u32 len = blocksize - 4;
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
     tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const int64x2_t max = vdupq_n_s64(INT32_MAX);
 
-    tflac_u32 residual_abs = 0;
-    tflac_s32 residual = 0;
+    tflac_u32 i = 4;
+    tflac_u32 max_found = 0;
     tflac_u64 residual_err;
-    __m128i sum = _mm_setzero_si128();
+    uint64x2_t sum = vdupq_n_u64(0);
+    uint64x2_t overflow = vdupq_n_u64(0);
+    int64x2_t s0_lo, s0_hi, s1_lo, s1_hi, s2_lo, s2_hi, s3_lo, s3_hi, s4_lo, s4_hi;
 
     residual_err = TFLAC_U64_ZERO;
 
-    *residuals++ = *samples0++;
-    *residuals++ = *samples0++;
-    *residuals++ = *samples0++;
-    *residuals++ = *samples0++;
+    residuals[0] = samples[0];
+    residuals[1] = samples[1];
+    residuals[2] = samples[2];
+    residuals[3] = samples[3];
 
-    samples1++; samples1++; samples1++;
-    samples2++; samples2++;
-    samples3++;
+    for(;blocksize - i >= 4;i+=4) {
+        TFLAC_NEON_WIDE_LOAD(s0_lo, s0_hi, &samples[i]);
+        TFLAC_NEON_WIDE_LOAD(s1_lo, s1_hi, &samples[i-1]);
+        TFLAC_NEON_WIDE_LOAD(s2_lo, s2_hi, &samples[i-2]);
+        TFLAC_NEON_WIDE_LOAD(s3_lo, s3_hi, &samples[i-3]);
+        TFLAC_NEON_WIDE_LOAD(s4_lo, s4_hi, &samples[i-4]);
+
+        /* s0 + s4 + 6*s2 - 4*(s1 + s3) */
+        s1_lo = vshlq_n_s64(vaddq_s64(s1_lo, s3_lo), 2);
+        s1_hi = vshlq_n_s64(vaddq_s64(s1_hi, s3_hi), 2);
+        s2_lo = vaddq_s64(vshlq_n_s64(s2_lo, 2), vshlq_n_s64(s2_lo, 1));
+        s2_hi = vaddq_s64(vshlq_n_s64(s2_hi, 2), vshlq_n_s64(s2_hi, 1));
+        s0_lo = vsubq_s64(vaddq_s64(vaddq_s64(s0_lo, s4_lo), s2_lo), s1_lo);
+        s0_hi = vsubq_s64(vaddq_s64(vaddq_s64(s0_hi, s4_hi), s2_hi), s1_hi);
+
+        TFLAC_NEON_WIDE_STORE(&residuals[i], s0_lo, s0_hi);
+    }
 
-    while(len > 4) {
-        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
-        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
-        __m128i msamples2 = _mm_loadu_si128((const __m128i *)samples2);
-        __m128i msamples3 = _mm_loadu_si128((const __m128i *)samples3);
-        __m128i msamples4 = _mm_load_si128((const __m128i *)samples4);
+    TFLAC_NEON_WIDE_FINISH();
+    tflac_cfr_wide_range(4, i, blocksize, samples, residuals, &residual_err, &max_found);
 
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
+    *residual_error = max_found ? TFLAC_U64_MAX : residual_err;
+}
 
-        msamples0 = _mm_add_epi32(msamples0, msamples2);
-        msamples0 = _mm_add_epi32(msamples0, msamples2);
-        msamples0 = _mm_add_epi32(msamples0, msamples2);
-        msamples0 = _mm_add_epi32(msamples0, msamples2);
-        msamples0 = _mm_add_epi32(msamples0, msamples2);
-        msamples0 = _mm_add_epi32(msamples0, msamples2);
+#undef TFLAC_NEON_WIDE_LOAD
+#undef TFLAC_NEON_WIDE_STORE
+#undef TFLAC_NEON_WIDE_FINISH
+
+/* decorrelation kernels, see tflac_decorrelate_int16_tail. The mid
+ * shift is a shift left by -1, NEON doesn't have a variable right
+ * shift */
+#define TFLAC_NEON_DECORRELATE_SETUP(n, op) \
+    const uint32x4_t lmask ## n = vdupq_n_u32((op) == TFLAC_DECORRELATE_RIGHT ? 0 : UINT32_C(0xFFFFFFFF)); \
+    const uint32x4_t rmask ## n = vdupq_n_u32((op) == TFLAC_DECORRELATE_LEFT ? 0 : UINT32_C(0xFFFFFFFF)); \
+    const uint32x4_t rneg ## n = vdupq_n_u32((op) == TFLAC_DECORRELATE_SIDE ? UINT32_C(0xFFFFFFFF) : 0); \
+    const int32x4_t shift ## n = vdupq_n_s32((op) == TFLAC_DECORRELATE_MID ? -1 : 0); \
+    uint32x4_t bits ## n = vdupq_n_u32(0); \
+    uint32x4_t non_constant ## n = vdupq_n_u32(0); \
+    uint32x4_t min_found ## n = vdupq_n_u32(0); \
+    uint32x4_t first ## n
+
+#define TFLAC_NEON_DECORRELATE_STEP(n, out) \
+    do { \
+        v = vreinterpretq_u32_s32(vshlq_s32(vreinterpretq_s32_u32(vaddq_u32( \
+          vandq_u32(l, lmask ## n), \
+          vandq_u32(vsubq_u32(veorq_u32(r, rneg ## n), rneg ## n), rmask ## n))), shift ## n)); \
+        vst1q_s32(&out[i], vreinterpretq_s32_u32(v)); \
+        bits ## n = vorrq_u32(bits ## n, v); \
+        non_constant ## n = vorrq_u32(non_constant ## n, veorq_u32(v, first ## n)); \
+        min_found ## n = vorrq_u32(min_found ## n, vceqq_u32(v, vmin)); \
+    } while(0)
 
-        msamples0 = _mm_sub_epi32(msamples0, msamples3);
-        msamples0 = _mm_sub_epi32(msamples0, msamples3);
-        msamples0 = _mm_sub_epi32(msamples0, msamples3);
-        msamples0 = _mm_sub_epi32(msamples0, msamples3);
+#define TFLAC_NEON_DECORRELATE_FINISH(n, info) \
+    do { \
+        (info)[0] = tflac_neon_or_reduce(bits ## n); \
+        (info)[1] = tflac_neon_or_reduce(non_constant ## n); \
+        (info)[2] = tflac_neon_or_reduce(min_found ## n); \
+    } while(0)
 
-        msamples0 = _mm_add_epi32(msamples0, msamples4);
+TFLAC_PRIVATE TFLAC_INLINE tflac_u32 tflac_neon_or_reduce(uint32x4_t v) {
+    v = vorrq_u32(v, vextq_u32(v, v, 2));
+    v = vorrq_u32(v, vextq_u32(v, v, 1));
+    return vgetq_lane_u32(v, 0);
+}
 
-        _mm_store_si128( (__m128i*)residuals, msamples0);
+TFLAC_PRIVATE void tflac_decorrelate_s16i_neon(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s16* samples, tflac_s32* TFLAC_RESTRICT _out0, tflac_s32* TFLAC_RESTRICT _out1, tflac_u32* info) {
+    tflac_s32* TFLAC_RESTRICT out0 = TFLAC_ASSUME_ALIGNED(_out0, 16);
+    tflac_s32* TFLAC_RESTRICT out1 = TFLAC_ASSUME_ALIGNED(_out1, 16);
+    const uint32x4_t vmin = vdupq_n_u32(UINT32_C(0x80000000));
+    tflac_u32 i = 0;
+    tflac_u32 f0;
+    tflac_u32 f1;
+    int16x4x2_t lr;
+    uint32x4_t l;
+    uint32x4_t r;
+    uint32x4_t v;
+    TFLAC_NEON_DECORRELATE_SETUP(0, op0);
+    TFLAC_NEON_DECORRELATE_SETUP(1, op1);
+
+    if(blocksize == 0) {
+        tflac_decorrelate_s16i_std(blocksize, op0, op1, samples, out0, out1, info);
+        return;
+    }
+    f0 = tflac_decorrelate_int16_first(op0, &samples[0], &samples[1]);
+    f1 = tflac_decorrelate_int16_first(op1, &samples[0], &samples[1]);
+    first0 = vdupq_n_u32(f0);
+    first1 = vdupq_n_u32(f1);
+
+    while(i + 4 <= blocksize) {
+        /* vld2 splits the left and right samples for us */
+        lr = vld2_s16(&samples[i*2]);
+        l = vreinterpretq_u32_s32(vmovl_s16(lr.val[0]));
+        r = vreinterpretq_u32_s32(vmovl_s16(lr.val[1]));
+        TFLAC_NEON_DECORRELATE_STEP(0, out0);
+        TFLAC_NEON_DECORRELATE_STEP(1, out1);
+        i += 4;
+    }
 
-        msamples0 = _mm_abs_epi32(msamples0);
+    TFLAC_NEON_DECORRELATE_FINISH(0, &info[0]);
+    TFLAC_NEON_DECORRELATE_FINISH(1, &info[3]);
+    tflac_decorrelate_s16i_tail(blocksize - i, op0, op1, &samples[i*2], &out0[i], &out1[i], f0, f1, info);
+}
 
-        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
-        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+TFLAC_PRIVATE void tflac_decorrelate_s16p_neon(tflac_u32 blocksize, tflac_u32 op, const tflac_s16* left, const tflac_s16* right, tflac_s32* TFLAC_RESTRICT _residuals, tflac_u32* info) {
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const uint32x4_t vmin = vdupq_n_u32(UINT32_C(0x80000000));
+    tflac_u32 i = 0;
+    tflac_u32 f;
+    uint32x4_t l;
+    uint32x4_t r;
+    uint32x4_t v;
+    TFLAC_NEON_DECORRELATE_SETUP(0, op);
+
+    if(blocksize == 0) {
+        tflac_decorrelate_s16p_std(blocksize, op, left, right, residuals, info);
+        return;
+    }
+    f = tflac_decorrelate_int16_first(op, left, right);
+    first0 = vdupq_n_u32(f);
+
+    while(i + 4 <= blocksize) {
+        l = vreinterpretq_u32_s32(vmovl_s16(vld1_s16(&left[i])));
+        r = vreinterpretq_u32_s32(vmovl_s16(vld1_s16(&right[i])));
+        TFLAC_NEON_DECORRELATE_STEP(0, residuals);
+        i += 4;
+    }
 
-        residuals += 4;
-        samples0 += 4;
-        samples1 += 4;
-        samples2 += 4;
-        samples3 += 4;
-        samples4 += 4;
-        len -= 4;
+    TFLAC_NEON_DECORRELATE_FINISH(0, info);
+    tflac_decorrelate_int16_tail(blocksize - i, 1, op, &left[i], &right[i], &residuals[i], f, info);
+}
+
+TFLAC_PRIVATE void tflac_decorrelate_s32i_neon(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s32* samples, tflac_s32* TFLAC_RESTRICT _out0, tflac_s32* TFLAC_RESTRICT _out1, tflac_u32* info) {
+    tflac_s32* TFLAC_RESTRICT out0 = TFLAC_ASSUME_ALIGNED(_out0, 16);
+    tflac_s32* TFLAC_RESTRICT out1 = TFLAC_ASSUME_ALIGNED(_out1, 16);
+    const uint32x4_t vmin = vdupq_n_u32(UINT32_C(0x80000000));
+    tflac_u32 i = 0;
+    tflac_u32 f0;
+    tflac_u32 f1;
+    int32x4x2_t lr;
+    uint32x4_t l;
+    uint32x4_t r;
+    uint32x4_t v;
+    TFLAC_NEON_DECORRELATE_SETUP(0, op0);
+    TFLAC_NEON_DECORRELATE_SETUP(1, op1);
+
+    if(blocksize == 0) {
+        tflac_decorrelate_s32i_std(blocksize, op0, op1, samples, out0, out1, info);
+        return;
+    }
+    f0 = tflac_decorrelate_int32_first(op0, &samples[0], &samples[1]);
+    f1 = tflac_decorrelate_int32_first(op1, &samples[0], &samples[1]);
+    first0 = vdupq_n_u32(f0);
+    first1 = vdupq_n_u32(f1);
+
+    while(i + 4 <= blocksize) {
+        lr = vld2q_s32(&samples[i*2]);
+        l = vreinterpretq_u32_s32(lr.val[0]);
+        r = vreinterpretq_u32_s32(lr.val[1]);
+        TFLAC_NEON_DECORRELATE_STEP(0, out0);
+        TFLAC_NEON_DECORRELATE_STEP(1, out1);
+        i += 4;
+    }
+
+    TFLAC_NEON_DECORRELATE_FINISH(0, &info[0]);
+    TFLAC_NEON_DECORRELATE_FINISH(1, &info[3]);
+    tflac_decorrelate_s32i_tail(blocksize - i, op0, op1, &samples[i*2], &out0[i], &out1[i], f0, f1, info);
+}
+
+TFLAC_PRIVATE void tflac_decorrelate_s32p_neon(tflac_u32 blocksize, tflac_u32 op, const tflac_s32* left, const tflac_s32* right, tflac_s32* TFLAC_RESTRICT _residuals, tflac_u32* info) {
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const uint32x4_t vmin = vdupq_n_u32(UINT32_C(0x80000000));
+    tflac_u32 i = 0;
+    tflac_u32 f;
+    uint32x4_t l;
+    uint32x4_t r;
+    uint32x4_t v;
+    TFLAC_NEON_DECORRELATE_SETUP(0, op);
+
+    if(blocksize == 0) {
+        tflac_decorrelate_s32p_std(blocksize, op, left, right, residuals, info);
+        return;
+    }
+    f = tflac_decorrelate_int32_first(op, left, right);
+    first0 = vdupq_n_u32(f);
+
+    while(i + 4 <= blocksize) {
+        l = vreinterpretq_u32_s32(vld1q_s32(&left[i]));
+        r = vreinterpretq_u32_s32(vld1q_s32(&right[i]));
+        TFLAC_NEON_DECORRELATE_STEP(0, residuals);
+        i += 4;
     }
 
-    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
-    TFLAC_SSE_ADD64(residual_err,sum);
-
-    while(len--) {
-        residual = *samples0++ - (4 * (*samples1++)) - (-6 * (*samples2++)) - (4 * (*samples3++)) - (-1 * (*samples4++));
+    TFLAC_NEON_DECORRELATE_FINISH(0, info);
+    tflac_decorrelate_int32_tail(blocksize - i, 1, op, &left[i], &right[i], &residuals[i], f, info);
+}
 
-        residual_abs = (tflac_u32)tflac_s32_abs(residual);
-        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+#undef TFLAC_NEON_DECORRELATE_SETUP
+#undef TFLAC_NEON_DECORRELATE_STEP
+#undef TFLAC_NEON_DECORRELATE_FINISH
 
-        *residuals++ = residual;
+/* the packers narrow out each byte of the samples into its own vector
+ * and let vst2/vst3/vst4 interleave them, so they don't depend on the
+ * byte order of the vector registers */
+TFLAC_PRIVATE void tflac_md5_pack_s16_neon(tflac_u8* TFLAC_RESTRICT out, const tflac_s16* TFLAC_RESTRICT in, tflac_u32 len, tflac_u32 bytes) {
+    tflac_u32 i = 0;
+    uint16x8_t a;
+    uint8x8x2_t b;
+
+    switch(bytes) {
+        case 1: {
+            for(i=0;i+8<=len;i+=8) {
+                a = vreinterpretq_u16_s16(vld1q_s16(&in[i]));
+                vst1_u8(&out[i], vmovn_u16(a));
+            }
+            break;
+        }
+        case 2: {
+            for(i=0;i+8<=len;i+=8) {
+                a = vreinterpretq_u16_s16(vld1q_s16(&in[i]));
+                b.val[0] = vmovn_u16(a);
+                b.val[1] = vshrn_n_u16(a, 8);
+                vst2_u8(&out[i * 2], b);
+            }
+            break;
+        }
+        default: break;
     }
 
-    *residual_error = residual_err;
+    tflac_md5_pack_s16_std(&out[i * bytes], &in[i], len - i, bytes);
 }
-#endif
 
-#ifdef TFLAC_ENABLE_SSE4_1
-TFLAC_PRIVATE void tflac_cfr_order0_sse4_1(
-      tflac_u32 blocksize,
-      const tflac_s32* TFLAC_RESTRICT _samples,
-      tflac_s32* TFLAC_RESTRICT _residuals,
-      tflac_u64* TFLAC_RESTRICT residual_error) {
+TFLAC_PRIVATE void tflac_md5_pack_s32_neon(tflac_u8* TFLAC_RESTRICT out, const tflac_s32* TFLAC_RESTRICT in, tflac_u32 len, tflac_u32 bytes) {
+    tflac_u32 i = 0;
+    uint32x4_t a, b;
+    uint16x8_t lo, hi;
+    uint8x8x2_t c2;
+    uint8x8x3_t c3;
+    uint8x8x4_t c4;
+
+#define TFLAC_NEON_PACK_LOAD() \
+    a = vreinterpretq_u32_s32(vld1q_s32(&in[i])); \
+    b = vreinterpretq_u32_s32(vld1q_s32(&in[i+4])); \
+    lo = vcombine_u16(vmovn_u32(a), vmovn_u32(b)); \
+    hi = vcombine_u16(vshrn_n_u32(a, 16), vshrn_n_u32(b, 16))
+
+    switch(bytes) {
+        case 1: {
+            for(i=0;i+8<=len;i+=8) {
+                TFLAC_NEON_PACK_LOAD();
+                vst1_u8(&out[i], vmovn_u16(lo));
+            }
+            break;
+        }
+        case 2: {
+            for(i=0;i+8<=len;i+=8) {
+                TFLAC_NEON_PACK_LOAD();
+                c2.val[0] = vmovn_u16(lo);
+                c2.val[1] = vshrn_n_u16(lo, 8);
+                vst2_u8(&out[i * 2], c2);
+            }
+            break;
+        }
+        case 3: {
+            for(i=0;i+8<=len;i+=8) {
+                TFLAC_NEON_PACK_LOAD();
+                c3.val[0] = vmovn_u16(lo);
+                c3.val[1] = vshrn_n_u16(lo, 8);
+                c3.val[2] = vmovn_u16(hi);
+                vst3_u8(&out[i * 3], c3);
+            }
+            break;
+        }
+        case 4: {
+            for(i=0;i+8<=len;i+=8) {
+                TFLAC_NEON_PACK_LOAD();
+                c4.val[0] = vmovn_u16(lo);
+                c4.val[1] = vshrn_n_u16(lo, 8);
+                c4.val[2] = vmovn_u16(hi);
+                c4.val[3] = vshrn_n_u16(hi, 8);
+                vst4_u8(&out[i * 4], c4);
+            }
+            break;
+        }
+        default: break;
+    }
 
-    tflac_cfr_order0_ssse3(blocksize, _samples, _residuals, residual_error);
+#undef TFLAC_NEON_PACK_LOAD
+
+    tflac_md5_pack_s32_std(&out[i * bytes], &in[i], len - i, bytes);
 }
 
-TFLAC_PRIVATE void tflac_cfr_order1_sse4_1(
+/* same zig-zag as the SSE2 version */
+TFLAC_PRIVATE void tflac_fold_residuals_neon(
       tflac_u32 blocksize,
-      const tflac_s32* TFLAC_RESTRICT _samples,
-      tflac_s32* TFLAC_RESTRICT _residuals,
-      tflac_u64* TFLAC_RESTRICT residual_error) {
-    tflac_cfr_order1_ssse3(blocksize, _samples, _residuals, residual_error);
+      tflac_u32 predictor_order,
+      tflac_u32 partition_order,
+      const tflac_s32* TFLAC_RESTRICT residuals,
+      tflac_u32* TFLAC_RESTRICT folded,
+      tflac_u64* TFLAC_RESTRICT sums) {
+    tflac_u32 partitions = UINT32_C(1) << partition_order;
+    tflac_u32 partition_length = blocksize >> partition_order;
+    tflac_u32 offset = predictor_order;
+    tflac_u32 end = 0;
+    tflac_u32 i = 0;
+    tflac_u32 res_abs = 0;
+    tflac_u64 sum;
+    int32x4_t r;
+    uint64x2_t acc;
+
+    for(i=0;i<partitions;i++) {
+        end = (i + 1) * partition_length;
+        acc = vdupq_n_u64(0);
+
+        while(end - offset >= 4) {
+            r = vld1q_s32(&residuals[offset]);
+            vst1q_u32(&folded[offset], veorq_u32(
+              vreinterpretq_u32_s32(vshlq_n_s32(r, 1)),
+              vreinterpretq_u32_s32(vshrq_n_s32(r, 31))));
+            TFLAC_NEON_ABS_SUM(acc, r);
+            offset += 4;
+        }
+
+        sum = TFLAC_U64_ZERO;
+        TFLAC_NEON_ADD64(sum, acc);
+
+        for(;offset<end;offset++) {
+            res_abs = (tflac_u32)tflac_s32_abs(residuals[offset]);
+            folded[offset] = (res_abs << 1) - ((tflac_u32)residuals[offset] >> 31);
+            TFLAC_U64_ADD_WORD(sum, res_abs);
+        }
+        sums[i] = sum;
+    }
 }
 
-TFLAC_PRIVATE void tflac_cfr_order2_sse4_1(
+#undef TFLAC_NEON_ABS_SUM
+#endif /* TFLAC_ENABLE_NEON */
+
+#ifdef TFLAC_ENABLE_SIMD128
+
+#ifdef TFLAC_32BIT_ONLY
+#define TFLAC_SIMD128_ADD64(d,m) \
+    do { \
+        v128_t m64 = wasm_i64x2_add(m, wasm_i64x2_shuffle(m, m, 1, 0)); \
+        tflac_u32 u32val = (tflac_u32)wasm_i32x4_extract_lane(m64, 0); \
+        d.hi += (d.lo += u32val) < u32val; \
+        d.hi += (tflac_u32)wasm_i32x4_extract_lane(m64, 1); \
+    } while(0)
+#else
+#define TFLAC_SIMD128_ADD64(d,m) \
+    d += ((tflac_u64)wasm_i64x2_extract_lane(m, 0) + (tflac_u64)wasm_i64x2_extract_lane(m, 1));
+#endif
+
+/* adds the absolute values of v into the two 64-bit lanes of sum,
+ * wasm_i32x4_abs leaves INT32_MIN alone which is 2^31 once it's
+ * zero-extended, same as the (tflac_u32) cast in the scalar versions */
+#define TFLAC_SIMD128_ABS_SUM(sum,v) \
+    do { \
+        v128_t vabs = wasm_i32x4_abs(v); \
+        sum = wasm_i64x2_add(sum, wasm_u64x2_extend_low_u32x4(vabs)); \
+        sum = wasm_i64x2_add(sum, wasm_u64x2_extend_high_u32x4(vabs)); \
+    } while(0)
+
+/* wasm_v128_load/store don't have alignment requirements, and the
+ * multiplies are done with shifts and adds, which give the same
+ * wrapped 32-bit results as the scalar versions. */
+
+TFLAC_PRIVATE void tflac_cfr_order0_simd128(
       tflac_u32 blocksize,
       const tflac_s32* TFLAC_RESTRICT _samples,
       tflac_s32* TFLAC_RESTRICT _residuals,
       tflac_u64* TFLAC_RESTRICT residual_error) {
-    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
-    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
-    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
-    const __m128i zero  = _mm_setzero_si128();
-    const __m128i two   = _mm_set1_epi32(2);
-    const __m128i neg_one  = _mm_set1_epi32(-1);
-
-    tflac_u32 len = blocksize - 4;
-    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
 
+    tflac_u32 i = 4;
     tflac_u32 residual_abs = 0;
-    tflac_s32 residual = 0;
     tflac_u64 residual_err;
-    __m128i sum = _mm_setzero_si128();
+    v128_t sum = wasm_i64x2_splat(0);
 
     residual_err = TFLAC_U64_ZERO;
 
-    *residuals++ = *samples0++;
-    *residuals++ = *samples0++;
-    samples1++;
+    for(;i + 4 <= blocksize;i+=4) {
+        TFLAC_SIMD128_ABS_SUM(sum, wasm_v128_load(&samples[i]));
+    }
 
-    *residuals++ = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
-    *residuals++ = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
+    TFLAC_SIMD128_ADD64(residual_err, sum);
 
-    while(len > 4) {
-        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
-        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
-        __m128i msamples2 = _mm_loadu_si128((const __m128i *)samples2);
+    for(;i<blocksize;i++) {
+        residual_abs = (tflac_u32)tflac_s32_abs(samples[i]);
+        TFLAC_U64_ADD_WORD(residual_err, residual_abs);
+    }
 
-        msamples1 = _mm_mullo_epi32(msamples1,two);
-        msamples2 = _mm_mullo_epi32(msamples2,neg_one);
+    *residual_error = residual_err;
+    (void)_residuals;
+}
 
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
-        msamples0 = _mm_sub_epi32(msamples0, msamples2);
+TFLAC_PRIVATE void tflac_cfr_order1_simd128(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
 
-        _mm_store_si128( (__m128i*)residuals, msamples0);
+    tflac_u32 i = 4;
+    tflac_u32 residual_abs = 0;
+    tflac_u64 residual_err;
+    v128_t sum = wasm_i64x2_splat(0);
+    v128_t v;
 
-        msamples0 = _mm_abs_epi32(msamples0);
+    residual_err = TFLAC_U64_ZERO;
 
-        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
-        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+    residuals[0] = samples[0];
+    residuals[1] = samples[1] - samples[0];
+    residuals[2] = samples[2] - samples[1];
+    residuals[3] = samples[3] - samples[2];
 
-        residuals += 4;
-        samples0 += 4;
-        samples1 += 4;
-        samples2 += 4;
-        len -= 4;
+    for(;i + 4 <= blocksize;i+=4) {
+        v = wasm_i32x4_sub(wasm_v128_load(&samples[i]), wasm_v128_load(&samples[i-1]));
+        wasm_v128_store(&residuals[i], v);
+        TFLAC_SIMD128_ABS_SUM(sum, v);
     }
 
-    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
-    TFLAC_SSE_ADD64(residual_err,sum);
-
-    while(len--) {
-        residual = (*samples0++) - (2 * (*samples1++)) - (-1 * (*samples2++));
-
-        residual_abs = (tflac_u32)tflac_s32_abs(residual);
-        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+    TFLAC_SIMD128_ADD64(residual_err, sum);
 
-        *residuals++ = residual;
+    for(;i<blocksize;i++) {
+        residuals[i] = samples[i] - samples[i-1];
+        residual_abs = (tflac_u32)tflac_s32_abs(residuals[i]);
+        TFLAC_U64_ADD_WORD(residual_err, residual_abs);
     }
 
     *residual_error = residual_err;
 }
 
-TFLAC_PRIVATE void tflac_cfr_order3_sse4_1(
+TFLAC_PRIVATE void tflac_cfr_order2_simd128(
       tflac_u32 blocksize,
       const tflac_s32* TFLAC_RESTRICT _samples,
       tflac_s32* TFLAC_RESTRICT _residuals,
       tflac_u64* TFLAC_RESTRICT residual_error) {
-    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
-    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
-    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
-    const tflac_s32* TFLAC_RESTRICT samples3 = _samples;
-    const __m128i zero = _mm_setzero_si128();
-    const __m128i three = _mm_set1_epi32(3);
-    const __m128i neg_three = _mm_set1_epi32(-3);
-
-    tflac_u32 len = blocksize - 4;
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
     tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
 
+    tflac_u32 i = 4;
     tflac_u32 residual_abs = 0;
-    tflac_s32 residual = 0;
     tflac_u64 residual_err;
-    __m128i sum = _mm_setzero_si128();
+    v128_t sum = wasm_i64x2_splat(0);
+    v128_t v;
 
     residual_err = TFLAC_U64_ZERO;
 
-    *residuals++ = *samples0++;
-    *residuals++ = *samples0++;
-    *residuals++ = *samples0++;
-
-    samples1++; samples1++;
-    samples2++;
-
-    *residuals++ = *samples0++ - (3 * (*samples1++)) - (-3 * (*samples2++)) - *samples3++;
+    residuals[0] = samples[0];
+    residuals[1] = samples[1];
+    residuals[2] = samples[2] - (2 * samples[1]) + samples[0];
+    residuals[3] = samples[3] - (2 * samples[2]) + samples[1];
+
+    for(;i + 4 <= blocksize;i+=4) {
+        /* s0 + s2 - 2*s1 */
+        v = wasm_i32x4_add(wasm_v128_load(&samples[i]), wasm_v128_load(&samples[i-2]));
+        v = wasm_i32x4_sub(v, wasm_i32x4_shl(wasm_v128_load(&samples[i-1]), 1));
+        wasm_v128_store(&residuals[i], v);
+        TFLAC_SIMD128_ABS_SUM(sum, v);
+    }
 
-    while(len > 4) {
-        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
-        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
-        __m128i msamples2 = _mm_loadu_si128((const __m128i *)samples2);
-        __m128i msamples3 = _mm_loadu_si128((const __m128i *)samples3);
+    TFLAC_SIMD128_ADD64(residual_err, sum);
 
-        msamples1 = _mm_mullo_epi32(msamples1, three);
-        msamples2 = _mm_mullo_epi32(msamples2, neg_three);
+    for(;i<blocksize;i++) {
+        residuals[i] = samples[i] - (2 * samples[i-1]) + samples[i-2];
+        residual_abs = (tflac_u32)tflac_s32_abs(residuals[i]);
+        TFLAC_U64_ADD_WORD(residual_err, residual_abs);
+    }
 
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
-        msamples0 = _mm_sub_epi32(msamples0, msamples2);
-        msamples0 = _mm_sub_epi32(msamples0, msamples3);
+    *residual_error = residual_err;
+}
 
-        _mm_store_si128( (__m128i*)residuals, msamples0);
+TFLAC_PRIVATE void tflac_cfr_order3_simd128(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_s32* TFLAC_RESTRICT _residuals,
+      tflac_u64* TFLAC_RESTRICT residual_error) {
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
 
-        msamples0 = _mm_abs_epi32(msamples0);
+    tflac_u32 i = 4;
+    tflac_u32 residual_abs = 0;
+    tflac_u64 residual_err;
+    v128_t sum = wasm_i64x2_splat(0);
+    v128_t v;
+    v128_t d;
 
-        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
-        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+    residual_err = TFLAC_U64_ZERO;
 
-        residuals += 4;
-        samples0 += 4;
-        samples1 += 4;
-        samples2 += 4;
-        samples3 += 4;
-        len -= 4;
+    residuals[0] = samples[0];
+    residuals[1] = samples[1];
+    residuals[2] = samples[2];
+    residuals[3] = samples[3] - (3 * samples[2]) + (3 * samples[1]) - samples[0];
+
+    for(;i + 4 <= blocksize;i+=4) {
+        /* s0 - s3 + 3*(s2 - s1) */
+        d = wasm_i32x4_sub(wasm_v128_load(&samples[i-2]), wasm_v128_load(&samples[i-1]));
+        d = wasm_i32x4_add(wasm_i32x4_shl(d, 1), d);
+        v = wasm_i32x4_sub(wasm_v128_load(&samples[i]), wasm_v128_load(&samples[i-3]));
+        v = wasm_i32x4_add(v, d);
+        wasm_v128_store(&residuals[i], v);
+        TFLAC_SIMD128_ABS_SUM(sum, v);
     }
 
-    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
-    TFLAC_SSE_ADD64(residual_err,sum);
-
-    while(len--) {
-        residual = *samples0++ - (3 * (*samples1++)) - (-3 * (*samples2++)) - *samples3++;
-
-        residual_abs = (tflac_u32)tflac_s32_abs(residual);
-        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+    TFLAC_SIMD128_ADD64(residual_err, sum);
 
-        *residuals++ = residual;
+    for(;i<blocksize;i++) {
+        residuals[i] = samples[i] - (3 * samples[i-1]) + (3 * samples[i-2]) - samples[i-3];
+        residual_abs = (tflac_u32)tflac_s32_abs(residuals[i]);
+        TFLAC_U64_ADD_WORD(residual_err, residual_abs);
     }
 
     *residual_error = residual_err;
 }
 
-TFLAC_PRIVATE void tflac_cfr_order4_sse4_1(
+TFLAC_PRIVATE void tflac_cfr_order4_simd128(
       tflac_u32 blocksize,
       const tflac_s32* TFLAC_RESTRICT _samples,
       tflac_s32* TFLAC_RESTRICT _residuals,
       tflac_u64* TFLAC_RESTRICT residual_error) {
-    const tflac_s32* TFLAC_RESTRICT samples0 = TFLAC_ASSUME_ALIGNED(_samples, 16);
-    const tflac_s32* TFLAC_RESTRICT samples1 = _samples;
-    const tflac_s32* TFLAC_RESTRICT samples2 = _samples;
-    const tflac_s32* TFLAC_RESTRICT samples3 = _samples;
-    const tflac_s32* TFLAC_RESTRICT samples4 = TFLAC_ASSUME_ALIGNED(_samples, 16);
-    const __m128i zero = _mm_setzero_si128();
-    const __m128i four = _mm_set1_epi32(4);
-    const __m128i neg_six = _mm_set1_epi32(-6);
-    const __m128i neg_one = _mm_set1_epi32(-1);
-
-    tflac_u32 len = blocksize - 4;
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
     tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
 
+    tflac_u32 i = 4;
     tflac_u32 residual_abs = 0;
-    tflac_s32 residual = 0;
     tflac_u64 residual_err;
-    __m128i sum = _mm_setzero_si128();
+    v128_t sum = wasm_i64x2_splat(0);
+    v128_t v;
+    v128_t s1;
+    v128_t s2;
 
     residual_err = TFLAC_U64_ZERO;
 
-    *residuals++ = *samples0++;
-    *residuals++ = *samples0++;
-    *residuals++ = *samples0++;
-    *residuals++ = *samples0++;
+    residuals[0] = samples[0];
+    residuals[1] = samples[1];
+    residuals[2] = samples[2];
+    residuals[3] = samples[3];
 
-    samples1++; samples1++; samples1++;
-    samples2++; samples2++;
-    samples3++;
+    for(;i + 4 <= blocksize;i+=4) {
+        /* s0 + s4 + 6*s2 - 4*(s1 + s3) */
+        s1 = wasm_i32x4_shl(wasm_i32x4_add(wasm_v128_load(&samples[i-1]), wasm_v128_load(&samples[i-3])), 2);
+        s2 = wasm_v128_load(&samples[i-2]);
+        s2 = wasm_i32x4_add(wasm_i32x4_shl(s2, 2), wasm_i32x4_shl(s2, 1));
+        v = wasm_i32x4_add(wasm_v128_load(&samples[i]), wasm_v128_load(&samples[i-4]));
+        v = wasm_i32x4_sub(wasm_i32x4_add(v, s2), s1);
+        wasm_v128_store(&residuals[i], v);
+        TFLAC_SIMD128_ABS_SUM(sum, v);
+    }
 
-    while(len > 4) {
-        __m128i msamples0 = _mm_load_si128((const __m128i *)samples0);
-        __m128i msamples1 = _mm_loadu_si128((const __m128i *)samples1);
-        __m128i msamples2 = _mm_loadu_si128((const __m128i *)samples2);
-        __m128i msamples3 = _mm_loadu_si128((const __m128i *)samples3);
-        __m128i msamples4 = _mm_load_si128((const __m128i *)samples4);
+    TFLAC_SIMD128_ADD64(residual_err, sum);
+
+    for(;i<blocksize;i++) {
+        residuals[i] = samples[i] - (4 * samples[i-1]) + (6 * samples[i-2]) - (4 * samples[i-3]) + samples[i-4];
+        residual_abs = (tflac_u32)tflac_s32_abs(residuals[i]);
+        TFLAC_U64_ADD_WORD(residual_err, residual_abs);
+    }
+
+    *residual_error = residual_err;
+}
+
+TFLAC_PRIVATE void tflac_cfr_fused_simd128(
+      tflac_u32 blocksize,
+      const tflac_s32* TFLAC_RESTRICT _samples,
+      tflac_u64* TFLAC_RESTRICT residual_errors) {
+    const tflac_s32* TFLAC_RESTRICT samples = TFLAC_ASSUME_ALIGNED(_samples, 16);
+
+    tflac_u32 i = 4;
+    v128_t sum0 = wasm_i64x2_splat(0);
+    v128_t sum1 = wasm_i64x2_splat(0);
+    v128_t sum2 = wasm_i64x2_splat(0);
+    v128_t sum3 = wasm_i64x2_splat(0);
+    v128_t sum4 = wasm_i64x2_splat(0);
+
+    residual_errors[0] = TFLAC_U64_ZERO;
+    residual_errors[1] = TFLAC_U64_ZERO;
+    residual_errors[2] = TFLAC_U64_ZERO;
+    residual_errors[3] = TFLAC_U64_ZERO;
+    residual_errors[4] = TFLAC_U64_ZERO;
+
+    while(i + 4 <= blocksize) {
+        v128_t msamples0 = wasm_v128_load(&samples[i]);
+        v128_t msamples1 = wasm_v128_load(&samples[i-1]);
+        v128_t msamples2 = wasm_v128_load(&samples[i-2]);
+        v128_t msamples3 = wasm_v128_load(&samples[i-3]);
+        v128_t msamples4 = wasm_v128_load(&samples[i-4]);
+
+        /* first-order differences at i, i-1, i-2, i-3 */
+        v128_t order1 = wasm_i32x4_sub(msamples0, msamples1);
+        v128_t diff1  = wasm_i32x4_sub(msamples1, msamples2);
+        v128_t diff2  = wasm_i32x4_sub(msamples2, msamples3);
+        v128_t diff3  = wasm_i32x4_sub(msamples3, msamples4);
+
+        v128_t order2 = wasm_i32x4_sub(order1, diff1);
+        v128_t order3;
+        v128_t order4;
+
+        diff1 = wasm_i32x4_sub(diff1, diff2);
+        diff2 = wasm_i32x4_sub(diff2, diff3);
+
+        order3 = wasm_i32x4_sub(order2, diff1);
+        diff1 = wasm_i32x4_sub(diff1, diff2);
+
+        order4 = wasm_i32x4_sub(order3, diff1);
+
+        TFLAC_SIMD128_ABS_SUM(sum0, msamples0);
+        TFLAC_SIMD128_ABS_SUM(sum1, order1);
+        TFLAC_SIMD128_ABS_SUM(sum2, order2);
+        TFLAC_SIMD128_ABS_SUM(sum3, order3);
+        TFLAC_SIMD128_ABS_SUM(sum4, order4);
+
+        i += 4;
+    }
 
-        msamples1 = _mm_mullo_epi32(msamples1, four);
-        msamples2 = _mm_mullo_epi32(msamples2, neg_six);
-        msamples3 = _mm_mullo_epi32(msamples3, four);
-        msamples4 = _mm_mullo_epi32(msamples4, neg_one);
+    TFLAC_SIMD128_ADD64(residual_errors[0], sum0);
+    TFLAC_SIMD128_ADD64(residual_errors[1], sum1);
+    TFLAC_SIMD128_ADD64(residual_errors[2], sum2);
+    TFLAC_SIMD128_ADD64(residual_errors[3], sum3);
+    TFLAC_SIMD128_ADD64(residual_errors[4], sum4);
 
-        msamples0 = _mm_sub_epi32(msamples0, msamples1);
-        msamples0 = _mm_sub_epi32(msamples0, msamples2);
-        msamples0 = _mm_sub_epi32(msamples0, msamples3);
-        msamples0 = _mm_sub_epi32(msamples0, msamples4);
+    tflac_cfr_fused_range(i, blocksize, samples, residual_errors);
+}
 
-        _mm_store_si128( (__m128i*)residuals, msamples0);
+/* decorrelation kernels, see tflac_decorrelate_int16_tail */
+#define TFLAC_SIMD128_DECORRELATE_SETUP(n, op) \
+    const v128_t lmask ## n = wasm_i32x4_splat((op) == TFLAC_DECORRELATE_RIGHT ? 0 : -1); \
+    const v128_t rmask ## n = wasm_i32x4_splat((op) == TFLAC_DECORRELATE_LEFT ? 0 : -1); \
+    const v128_t rneg ## n = wasm_i32x4_splat((op) == TFLAC_DECORRELATE_SIDE ? -1 : 0); \
+    const tflac_u32 shift ## n = (op) == TFLAC_DECORRELATE_MID ? 1 : 0; \
+    v128_t bits ## n = wasm_i32x4_splat(0); \
+    v128_t non_constant ## n = wasm_i32x4_splat(0); \
+    v128_t min_found ## n = wasm_i32x4_splat(0); \
+    v128_t first ## n
 
-        msamples0 = _mm_abs_epi32(msamples0);
+#define TFLAC_SIMD128_DECORRELATE_STEP(n, out) \
+    do { \
+        v = wasm_i32x4_shr(wasm_i32x4_add( \
+          wasm_v128_and(l, lmask ## n), \
+          wasm_v128_and(wasm_i32x4_sub(wasm_v128_xor(r, rneg ## n), rneg ## n), rmask ## n)), shift ## n); \
+        wasm_v128_store(&out[i], v); \
+        bits ## n = wasm_v128_or(bits ## n, v); \
+        non_constant ## n = wasm_v128_or(non_constant ## n, wasm_v128_xor(v, first ## n)); \
+        min_found ## n = wasm_v128_or(min_found ## n, wasm_i32x4_eq(v, vmin)); \
+    } while(0)
 
-        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(msamples0, zero));
-        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(msamples0, zero));
+#define TFLAC_SIMD128_DECORRELATE_FINISH(n, info) \
+    do { \
+        (info)[0] = tflac_simd128_or_reduce(bits ## n); \
+        (info)[1] = tflac_simd128_or_reduce(non_constant ## n); \
+        (info)[2] = tflac_simd128_or_reduce(min_found ## n); \
+    } while(0)
 
-        residuals += 4;
-        samples0 += 4;
-        samples1 += 4;
-        samples2 += 4;
-        samples3 += 4;
-        samples4 += 4;
-        len -= 4;
+TFLAC_PRIVATE TFLAC_INLINE tflac_u32 tflac_simd128_or_reduce(v128_t v) {
+    v = wasm_v128_or(v, wasm_i32x4_shuffle(v, v, 2, 3, 0, 1));
+    v = wasm_v128_or(v, wasm_i32x4_shuffle(v, v, 1, 0, 3, 2));
+    return (tflac_u32)wasm_i32x4_extract_lane(v, 0);
+}
+
+TFLAC_PRIVATE void tflac_decorrelate_s16i_simd128(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s16* samples, tflac_s32* TFLAC_RESTRICT _out0, tflac_s32* TFLAC_RESTRICT _out1, tflac_u32* info) {
+    tflac_s32* TFLAC_RESTRICT out0 = TFLAC_ASSUME_ALIGNED(_out0, 16);
+    tflac_s32* TFLAC_RESTRICT out1 = TFLAC_ASSUME_ALIGNED(_out1, 16);
+    const v128_t vmin = wasm_i32x4_splat(INT32_MIN);
+    tflac_u32 i = 0;
+    tflac_u32 f0;
+    tflac_u32 f1;
+    v128_t lr;
+    v128_t l;
+    v128_t r;
+    v128_t v;
+    TFLAC_SIMD128_DECORRELATE_SETUP(0, op0);
+    TFLAC_SIMD128_DECORRELATE_SETUP(1, op1);
+
+    if(blocksize == 0) {
+        tflac_decorrelate_s16i_std(blocksize, op0, op1, samples, out0, out1, info);
+        return;
+    }
+    f0 = tflac_decorrelate_int16_first(op0, &samples[0], &samples[1]);
+    f1 = tflac_decorrelate_int16_first(op1, &samples[0], &samples[1]);
+    first0 = wasm_i32x4_splat((tflac_s32)f0);
+    first1 = wasm_i32x4_splat((tflac_s32)f1);
+
+    while(i + 4 <= blocksize) {
+        /* gather the left samples into the low half, right into the high */
+        lr = wasm_v128_load(&samples[i*2]);
+        lr = wasm_i16x8_shuffle(lr, lr, 0, 2, 4, 6, 1, 3, 5, 7);
+        l = wasm_i32x4_extend_low_i16x8(lr);
+        r = wasm_i32x4_extend_high_i16x8(lr);
+        TFLAC_SIMD128_DECORRELATE_STEP(0, out0);
+        TFLAC_SIMD128_DECORRELATE_STEP(1, out1);
+        i += 4;
     }
 
-    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
-    TFLAC_SSE_ADD64(residual_err,sum);
+    TFLAC_SIMD128_DECORRELATE_FINISH(0, &info[0]);
+    TFLAC_SIMD128_DECORRELATE_FINISH(1, &info[3]);
+    tflac_decorrelate_s16i_tail(blocksize - i, op0, op1, &samples[i*2], &out0[i], &out1[i], f0, f1, info);
+}
 
-    while(len--) {
-        residual = *samples0++ - (4 * (*samples1++)) - (-6 * (*samples2++)) - (4 * (*samples3++)) - (-1 * (*samples4++));
+TFLAC_PRIVATE void tflac_decorrelate_s16p_simd128(tflac_u32 blocksize, tflac_u32 op, const tflac_s16* left, const tflac_s16* right, tflac_s32* TFLAC_RESTRICT _residuals, tflac_u32* info) {
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const v128_t vmin = wasm_i32x4_splat(INT32_MIN);
+    tflac_u32 i = 0;
+    tflac_u32 f;
+    v128_t l;
+    v128_t r;
+    v128_t v;
+    TFLAC_SIMD128_DECORRELATE_SETUP(0, op);
+
+    if(blocksize == 0) {
+        tflac_decorrelate_s16p_std(blocksize, op, left, right, residuals, info);
+        return;
+    }
+    f = tflac_decorrelate_int16_first(op, left, right);
+    first0 = wasm_i32x4_splat((tflac_s32)f);
+
+    while(i + 4 <= blocksize) {
+        l = wasm_i32x4_load16x4(&left[i]);
+        r = wasm_i32x4_load16x4(&right[i]);
+        TFLAC_SIMD128_DECORRELATE_STEP(0, residuals);
+        i += 4;
+    }
 
-        residual_abs = (tflac_u32)tflac_s32_abs(residual);
-        TFLAC_U64_ADD_WORD(residual_err,residual_abs);
+    TFLAC_SIMD128_DECORRELATE_FINISH(0, info);
+    tflac_decorrelate_int16_tail(blocksize - i, 1, op, &left[i], &right[i], &residuals[i], f, info);
+}
 
-        *residuals++ = residual;
+TFLAC_PRIVATE void tflac_decorrelate_s32i_simd128(tflac_u32 blocksize, tflac_u32 op0, tflac_u32 op1, const tflac_s32* samples, tflac_s32* TFLAC_RESTRICT _out0, tflac_s32* TFLAC_RESTRICT _out1, tflac_u32* info) {
+    tflac_s32* TFLAC_RESTRICT out0 = TFLAC_ASSUME_ALIGNED(_out0, 16);
+    tflac_s32* TFLAC_RESTRICT out1 = TFLAC_ASSUME_ALIGNED(_out1, 16);
+    const v128_t vmin = wasm_i32x4_splat(INT32_MIN);
+    tflac_u32 i = 0;
+    tflac_u32 f0;
+    tflac_u32 f1;
+    v128_t lr0;
+    v128_t lr1;
+    v128_t l;
+    v128_t r;
+    v128_t v;
+    TFLAC_SIMD128_DECORRELATE_SETUP(0, op0);
+    TFLAC_SIMD128_DECORRELATE_SETUP(1, op1);
+
+    if(blocksize == 0) {
+        tflac_decorrelate_s32i_std(blocksize, op0, op1, samples, out0, out1, info);
+        return;
+    }
+    f0 = tflac_decorrelate_int32_first(op0, &samples[0], &samples[1]);
+    f1 = tflac_decorrelate_int32_first(op1, &samples[0], &samples[1]);
+    first0 = wasm_i32x4_splat((tflac_s32)f0);
+    first1 = wasm_i32x4_splat((tflac_s32)f1);
+
+    while(i + 4 <= blocksize) {
+        lr0 = wasm_v128_load(&samples[i*2]);
+        lr1 = wasm_v128_load(&samples[i*2 + 4]);
+        l = wasm_i32x4_shuffle(lr0, lr1, 0, 2, 4, 6);
+        r = wasm_i32x4_shuffle(lr0, lr1, 1, 3, 5, 7);
+        TFLAC_SIMD128_DECORRELATE_STEP(0, out0);
+        TFLAC_SIMD128_DECORRELATE_STEP(1, out1);
+        i += 4;
     }
 
-    *residual_error = residual_err;
+    TFLAC_SIMD128_DECORRELATE_FINISH(0, &info[0]);
+    TFLAC_SIMD128_DECORRELATE_FINISH(1, &info[3]);
+    tflac_decorrelate_s32i_tail(blocksize - i, op0, op1, &samples[i*2], &out0[i], &out1[i], f0, f1, info);
 }
-#endif
+
+TFLAC_PRIVATE void tflac_decorrelate_s32p_simd128(tflac_u32 blocksize, tflac_u32 op, const tflac_s32* left, const tflac_s32* right, tflac_s32* TFLAC_RESTRICT _residuals, tflac_u32* info) {
+    tflac_s32* TFLAC_RESTRICT residuals = TFLAC_ASSUME_ALIGNED(_residuals, 16);
+    const v128_t vmin = wasm_i32x4_splat(INT32_MIN);
+    tflac_u32 i = 0;
+    tflac_u32 f;
+    v128_t l;
+    v128_t r;
+    v128_t v;
+    TFLAC_SIMD128_DECORRELATE_SETUP(0, op);
+
+    if(blocksize == 0) {
+        tflac_decorrelate_s32p_std(blocksize, op, left, right, residuals, info);
+        return;
+    }
+    f = tflac_decorrelate_int32_first(op, left, right);
+    first0 = wasm_i32x4_splat((tflac_s32)f);
+
+    while(i + 4 <= blocksize) {
+        l = wasm_v128_load(&left[i]);
+        r = wasm_v128_load(&right[i]);
+        TFLAC_SIMD128_DECORRELATE_STEP(0, residuals);
+        i += 4;
+    }
+
+    TFLAC_SIMD128_DECORRELATE_FINISH(0, info);
+    tflac_decorrelate_int32_tail(blocksize - i, 1, op, &left[i], &right[i], &residuals[i], f, info);
+}
+
+#undef TFLAC_SIMD128_DECORRELATE_SETUP
+#undef TFLAC_SIMD128_DECORRELATE_STEP
+#undef TFLAC_SIMD128_DECORRELATE_FINISH
+#undef TFLAC_SIMD128_ADD64
+#undef TFLAC_SIMD128_ABS_SUM
+#endif /* TFLAC_ENABLE_SIMD128 */
 
 TFLAC_PRIVATE void tflac_cfr_order1_wide_std(
       tflac_u32 blocksize,
@@ -3629,7 +8209,58 @@ TFLAC_PRIVATE void tflac_cfr_order4_wide_std(
     *residual_error = max_found ? TFLAC_U64_MAX : residual_err;
 }
 
+#if defined(TFLAC_ENABLE_SSE4_1) || defined(TFLAC_ENABLE_AVX2) || defined(TFLAC_ENABLE_NEON)
+/* does residuals[start] up to residuals[end - 1] for a wide predictor a
+ * sample at a time, for the heads and tails of the SIMD versions. Each
+ * pass takes the difference of neighboring values, after order passes
+ * that's the residual. Like the _std versions, residuals before index 4
+ * get checked but don't count towards the error */
+TFLAC_PRIVATE void tflac_cfr_wide_range(
+      tflac_u32 order,
+      tflac_u32 start,
+      tflac_u32 end,
+      const tflac_s32* TFLAC_RESTRICT samples,
+      tflac_s32* TFLAC_RESTRICT residuals,
+      tflac_u64* TFLAC_RESTRICT residual_err,
+      tflac_u32* TFLAC_RESTRICT max_found) {
+
+    tflac_u32 i = 0;
+    tflac_u32 j = 0;
+    tflac_u32 k = 0;
+
+    tflac_s64 d[5];
+    tflac_u64 residual_abs;
+#ifdef TFLAC_32BIT_ONLY
+    tflac_s64 prev;
+#endif
+
+    for(i=start;i<end;i++) {
+        for(j=0;j<=order;j++) {
+            TFLAC_S64_CAST(d[j],samples[i-order+j]);
+        }
+
+        for(k=0;k<order;k++) {
+            for(j=order;j>k;j--) {
+#ifdef TFLAC_32BIT_ONLY
+                prev = d[j-1];
+                TFLAC_S64_NEG(prev);
+                TFLAC_S64_ADD(d[j],prev);
+#else
+                d[j] -= d[j-1];
+#endif
+            }
+        }
+
+        TFLAC_S64_ABS(residual_abs,d[order]);
+        *max_found |= TFLAC_U64_GT_WORD(residual_abs,INT32_MAX);
+        TFLAC_S64_CAST32(residuals[i], d[order]);
+        if(i >= 4) TFLAC_U64_ADD(*residual_err,residual_abs);
+    }
+}
+#endif
+
 TFLAC_PRIVATE void tflac_cfr(tflac *t) {
+    tflac_u64 error;
 
     t->residual_errors[1] = TFLAC_U64_ZERO;
     t->residual_errors[2] = TFLAC_U64_ZERO;
@@ -3645,67 +8276,591 @@ TFLAC_PRIVATE void tflac_cfr(tflac *t) {
         return;
     }
 
+    if(TFLAC_LIKELY(t->calculate_fused != NULL)) {
+        /* keep the order 0 flag if it was set */
+        error = t->residual_errors[0];
+        t->calculate_fused(t->cur_blocksize,t->residuals[0],t->residual_errors);
+        if(TFLAC_UNLIKELY(!TFLAC_U64_EQ_WORD(error,0))) t->residual_errors[0] = error;
+        return;
+    }
+
     if(TFLAC_LIKELY(TFLAC_U64_EQ_WORD(t->residual_errors[0],0))) {
         t->calculate_order[0](t->cur_blocksize,t->residuals[0],NULL           ,&t->residual_errors[0]);
     }
-    t->calculate_order[1](t->cur_blocksize,t->residuals[0],t->residuals[1],&t->residual_errors[1]);
-    t->calculate_order[2](t->cur_blocksize,t->residuals[0],t->residuals[2],&t->residual_errors[2]);
-    t->calculate_order[3](t->cur_blocksize,t->residuals[0],t->residuals[3],&t->residual_errors[3]);
-    t->calculate_order[4](t->cur_blocksize,t->residuals[0],t->residuals[4],&t->residual_errors[4]);
+    /* orders 1-4 share a buffer, we only keep the error sums here and
+     * tflac_encode_subframe_fixed recalculates the chosen order */
+    t->calculate_order[1](t->cur_blocksize,t->residuals[0],t->residuals[1],&t->residual_errors[1]);
+    t->calculate_order[2](t->cur_blocksize,t->residuals[0],t->residuals[2],&t->residual_errors[2]);
+    t->calculate_order[3](t->cur_blocksize,t->residuals[0],t->residuals[3],&t->residual_errors[3]);
+    t->calculate_order[4](t->cur_blocksize,t->residuals[0],t->residuals[4],&t->residual_errors[4]);
+
+    return;
+}
+
+
+/* finds the rice parameter for a partition, the smallest one where
+ * (partition_length << rice) >= sum. The difference in bit lengths
+ * gets us there or one short of it, so we only need a single compare */
+TFLAC_PRIVATE
+TFLAC_INLINE
+tflac_u32 tflac_rice_parameter(tflac_u64 sum, tflac_u32 partition_length, tflac_u32 max_rice_value) {
+    tflac_u32 sum_bits = tflac_u64_bitlen(sum);
+    tflac_u32 len_bits = tflac_u32_bitlen(partition_length);
+    tflac_u32 rice;
+    tflac_u64 lim;
+
+    if(sum_bits <= len_bits) {
+        rice = 0;
+    } else {
+        rice = sum_bits - len_bits;
+        if(rice >= max_rice_value) return max_rice_value;
+    }
+
+#ifdef TFLAC_32BIT_ONLY
+    lim.lo = partition_length << rice;
+    lim.hi = rice ? partition_length >> (32 - rice) : 0;
+#else
+    lim = ((tflac_u64)partition_length) << rice;
+#endif
+
+    if(TFLAC_U64_LT(lim, sum)) rice++;
+
+    return rice > max_rice_value ? max_rice_value : rice;
+}
+
+/* checks the actual cost of rice-1, rice and rice+1 for a partition
+ * and returns the cheapest */
+TFLAC_PRIVATE
+tflac_u32 tflac_rice_parameter_exact(const tflac_u32* folded, tflac_u32 partition_length, tflac_u32 rice, tflac_u32 max_rice_value) {
+    tflac_u64 cost[3];
+    tflac_u32 lo = rice ? rice - 1 : 0;
+    tflac_u32 hi = rice < max_rice_value ? rice + 1 : rice;
+    tflac_u32 k;
+    tflac_u32 j;
+    tflac_u32 v;
+    tflac_u32 best;
+
+    for(k=lo;k<=hi;k++) {
+        TFLAC_U64_CAST(cost[k-lo], partition_length * (k + 1));
+    }
+
+    for(j=0;j<partition_length;j++) {
+        v = folded[j];
+        for(k=lo;k<=hi;k++) {
+            TFLAC_U64_ADD_WORD(cost[k-lo], v >> k);
+        }
+    }
+
+    best = lo;
+    for(k=lo+1;k<=hi;k++) {
+        if(TFLAC_U64_LT(cost[k-lo], cost[best-lo])) best = k;
+    }
+
+    return best;
+}
+
+TFLAC_PRIVATE
+TFLAC_INLINE
+double tflac_u64_to_double(tflac_u64 v) {
+#ifdef TFLAC_32BIT_ONLY
+    return ((double)v.hi * 4294967296.0) + (double)v.lo;
+#else
+    return (double)v;
+#endif
+}
+
+/* estimates the number of bits needed to rice-code count residuals
+ * whose absolute values add up to sum. Follows the same rule as
+ * tflac_encode_residuals for picking the parameter, then assumes
+ * every residual's low bits are about half of its zig-zagged value */
+TFLAC_PRIVATE
+double tflac_estimate_residual_bits(tflac_u64 sum, tflac_u32 count, tflac_u32 max_rice_value) {
+    tflac_u32 rice = tflac_rice_parameter(sum, count, max_rice_value);
+
+    return ((double)count * (double)(rice + 1)) + ((2.0 * tflac_u64_to_double(sum)) / (double)(UINT32_C(1) << rice));
+}
+
+TFLAC_PRIVATE void tflac_stereo_pick_mode(tflac* t, const tflac_u64* errors) {
+    double bits[4]; /* left, right, mid, side */
+    double cost[TFLAC_CHANNEL_MODE_COUNT];
+    tflac_u32 mode = 0;
+    tflac_u32 best = TFLAC_CHANNEL_INDEPENDENT;
+
+    for(mode=0;mode<4;mode++) {
+        bits[mode] = tflac_estimate_residual_bits(errors[mode], t->cur_blocksize - 2, t->max_rice_value);
+    }
+
+    cost[TFLAC_CHANNEL_INDEPENDENT] = bits[0] + bits[1];
+    cost[TFLAC_CHANNEL_LEFT_SIDE]   = bits[0] + bits[3];
+    cost[TFLAC_CHANNEL_SIDE_RIGHT]  = bits[3] + bits[1];
+    cost[TFLAC_CHANNEL_MID_SIDE]    = bits[2] + bits[3];
+
+    for(mode=1;mode<TFLAC_CHANNEL_MODE_COUNT;mode++) {
+        if(cost[mode] < cost[best]) best = mode;
+    }
+
+    t->cur_channel_mode = (tflac_u8)best;
+}
+
+/* cosine of a small angle (|x| <= pi/2), used to generate the
+ * window with a recurrence so we don't need libm */
+TFLAC_CONST
+TFLAC_PRIVATE
+double tflac_lpc_cos(double x) {
+    double x2 = x * x;
+    return 1.0 - x2 / 2.0 * (1.0 - x2 / 12.0 * (1.0 - x2 / 30.0 * (1.0 - x2 / 56.0 * (1.0 - x2 / 90.0 * (1.0 - x2 / 132.0)))));
+}
+
+/* base-2 logarithm, only needs to be good enough to compare
+ * predictor orders */
+TFLAC_CONST
+TFLAC_PRIVATE
+double tflac_lpc_log2(double x) {
+    double e = 0.0;
+    double y;
+
+    if(x <= 0.0) return -1024.0;
+
+    while(x >= 65536.0) { x /= 65536.0; e += 16.0; }
+    while(x < 1.0 / 65536.0) { x *= 65536.0; e -= 16.0; }
+    while(x >= 2.0) { x /= 2.0; e += 1.0; }
+    while(x < 1.0) { x *= 2.0; e -= 1.0; }
+
+    /* x is in [1,2), log2(x) = 2 * atanh(y) / ln(2) where y = (x-1)/(x+1) */
+    y = (x - 1.0) / (x + 1.0);
+    x = y * y;
+    return e + (2.0 * y * (1.0 + x * (1.0 / 3.0 + x * (1.0 / 5.0 + x * (1.0 / 7.0 + x * (1.0 / 9.0)))))) * 1.4426950408889634;
+}
+
+TFLAC_PRIVATE
+TFLAC_INLINE
+void tflac_lpc_autocorrelation_step(double* TFLAC_RESTRICT autoc, double* TFLAC_RESTRICT history, tflac_u32* pos, tflac_u32 lags, double val) {
+    tflac_u32 i;
+    const double* h;
+
+    /* history is a doubled ring buffer, so history[pos .. pos + lags - 1]
+     * is always the newest .. oldest windowed sample */
+    if(*pos == 0) *pos = lags;
+    (*pos)--;
+    history[*pos] = val;
+    history[*pos + lags] = val;
+
+    h = &history[*pos];
+    for(i=0;i<lags;i++) {
+        autoc[i] += val * h[i];
+    }
+}
+
+/* computes the autocorrelation of the samples with a Tukey(0.5) window
+ * applied. The windowed samples are never stored, we keep the last
+ * (max_lag + 1) of them in a small history buffer instead */
+TFLAC_PRIVATE
+void tflac_lpc_autocorrelation(const tflac_s32* TFLAC_RESTRICT samples, tflac_u32 blocksize, tflac_u32 max_lag, double* TFLAC_RESTRICT autoc) {
+    double history[2 * (TFLAC_MAX_LPC_ORDER + 1)];
+    double c1 = 0.0;
+    double c_prev;
+    double c_cur;
+    double c_next;
+    tflac_u32 lags = max_lag + 1;
+    tflac_u32 taper = blocksize / 4;
+    tflac_u32 pos = 0;
+    tflac_u32 i = 0;
+
+    for(i=0;i<lags;i++) {
+        autoc[i] = 0.0;
+        history[i] = 0.0;
+        history[i + lags] = 0.0;
+    }
+
+    if(taper < 2) taper = 0;
+    else c1 = tflac_lpc_cos(3.14159265358979323846 / (double)taper);
+
+    /* rising edge, 0.5 - 0.5 * cos(pi * n / taper) */
+    c_prev = c1;
+    c_cur = 1.0;
+    for(i=0;i<taper;i++) {
+        tflac_lpc_autocorrelation_step(autoc, history, &pos, lags, (0.5 - 0.5 * c_cur) * (double)samples[i]);
+        c_next = 2.0 * c1 * c_cur - c_prev;
+        c_prev = c_cur;
+        c_cur = c_next;
+    }
+
+    for(;i<blocksize-taper;i++) {
+        tflac_lpc_autocorrelation_step(autoc, history, &pos, lags, (double)samples[i]);
+    }
+
+    /* falling edge, 0.5 + 0.5 * cos(pi * n / taper) starting at n = 1 */
+    c_prev = 1.0;
+    c_cur = c1;
+    for(;i<blocksize;i++) {
+        tflac_lpc_autocorrelation_step(autoc, history, &pos, lags, (0.5 + 0.5 * c_cur) * (double)samples[i]);
+        c_next = 2.0 * c1 * c_cur - c_prev;
+        c_prev = c_cur;
+        c_cur = c_next;
+    }
+}
+
+/* Levinson-Durbin recursion, stores the prediction error of each order
+ * in error[0 .. order-1] and the predictor coefficients for the final order
+ * in lpc[0 .. order-1]. Returns the highest order that was computed, which
+ * may be less than requested if the signal is perfectly predictable */
+TFLAC_PRIVATE
+tflac_u32 tflac_lpc_levinson(const double* TFLAC_RESTRICT autoc, tflac_u32 order, double* TFLAC_RESTRICT lpc, double* TFLAC_RESTRICT error) {
+    double err = autoc[0];
+    double r;
+    double tmp;
+    tflac_u32 i;
+    tflac_u32 j;
+
+    for(i=0;i<order;i++) {
+        r = -autoc[i+1];
+        for(j=0;j<i;j++) {
+            r -= lpc[j] * autoc[i-j];
+        }
+        r /= err;
+
+        lpc[i] = r;
+        for(j=0;j<(i>>1);j++) {
+            tmp = lpc[j];
+            lpc[j] += r * lpc[i-1-j];
+            lpc[i-1-j] += r * tmp;
+        }
+        if(i & 1) lpc[j] += lpc[j] * r;
+
+        err *= (1.0 - r * r);
+        error[i] = err;
+
+        if(err <= 0.0) {
+            i++;
+            break;
+        }
+    }
+
+    /* flip the signs so we have prediction coefficients */
+    for(j=0;j<i;j++) {
+        lpc[j] = -lpc[j];
+    }
+
+    return i;
+}
+
+/* quantizes the coefficients to precision bits, returns -1 if they
+ * can't be represented with a non-negative shift */
+TFLAC_PRIVATE
+int tflac_lpc_quantize(const double* TFLAC_RESTRICT lpc, tflac_u32 order, tflac_u32 precision, tflac_s32* TFLAC_RESTRICT coefficients, tflac_u32* shift) {
+    tflac_s32 qmax = (tflac_s32)((UINT32_C(1) << (precision - 1)) - 1);
+    tflac_s32 qmin = -qmax - 1;
+    tflac_s32 q;
+    tflac_s32 log2cmax = 0;
+    tflac_s32 s;
+    double cmax = 0.0;
+    double scale = 1.0;
+    double err = 0.0;
+    tflac_u32 i;
+
+    for(i=0;i<order;i++) {
+        if(lpc[i] > cmax) cmax = lpc[i];
+        else if(-lpc[i] > cmax) cmax = -lpc[i];
+    }
+
+    if(cmax == 0.0) return -1;
+
+    while(cmax >= 2.0 && log2cmax < 64) { cmax /= 2.0; log2cmax++; }
+    while(cmax < 1.0 && log2cmax > -64) { cmax *= 2.0; log2cmax--; }
+
+    s = (tflac_s32)precision - 2 - log2cmax;
+    if(s < 0) return -1;
+    if(s > 15) s = 15;
+
+    for(i=0;i<(tflac_u32)s;i++) scale *= 2.0;
+
+    /* carry the rounding error forward into the next coefficient */
+    for(i=0;i<order;i++) {
+        err += lpc[i] * scale;
+        q = err >= 0.0 ? (tflac_s32)(err + 0.5) : -(tflac_s32)(-err + 0.5);
+        if(q > qmax) q = qmax;
+        else if(q < qmin) q = qmin;
+        err -= (double)q;
+        coefficients[i] = q;
+    }
+
+    *shift = (tflac_u32)s;
+    return 0;
+}
+
+/* calculates the LPC residual with a 32-bit accumulator, only valid
+ * when bitdepth + precision + ceil(log2(order)) <= 32. The first order
+ * entries are left alone, the warm-up samples get written straight from
+ * the samples (a copy loop here turns into a call to memmove) */
+TFLAC_PRIVATE
+void tflac_lpc_residual_narrow(tflac_u32 blocksize, const tflac_s32* TFLAC_RESTRICT samples, tflac_s32* TFLAC_RESTRICT residuals, tflac_u64* TFLAC_RESTRICT residual_error, const tflac_s32* TFLAC_RESTRICT coefficients, tflac_u32 order, tflac_u32 shift) {
+    tflac_u32 i;
+    tflac_u32 j;
+    tflac_s32 sum;
+    tflac_s32 res;
+    tflac_u32 max_found = 0;
+    tflac_u64 residual_err = TFLAC_U64_ZERO;
+
+    for(i=order;i<blocksize;i++) {
+        sum = 0;
+        for(j=0;j<order;j++) {
+            sum += coefficients[j] * samples[i-1-j];
+        }
+        res = (tflac_s32)((tflac_u32)samples[i] - (tflac_u32)(sum >> shift));
+        max_found |= res == INT32_MIN;
+        residuals[i] = res;
+        TFLAC_U64_ADD_WORD(residual_err, tflac_s32_abs(res));
+    }
+
+    *residual_error = max_found ? TFLAC_U64_MAX : residual_err;
+}
+
+#ifndef TFLAC_32BIT_ONLY
+/* calculates the LPC residual with a 64-bit accumulator */
+TFLAC_PRIVATE
+void tflac_lpc_residual_wide(tflac_u32 blocksize, const tflac_s32* TFLAC_RESTRICT samples, tflac_s32* TFLAC_RESTRICT residuals, tflac_u64* TFLAC_RESTRICT residual_error, const tflac_s32* TFLAC_RESTRICT coefficients, tflac_u32 order, tflac_u32 shift) {
+    tflac_u32 i;
+    tflac_u32 j;
+    tflac_s64 sum;
+    tflac_s64 res;
+    tflac_u32 max_found = 0;
+    tflac_u64 residual_err = TFLAC_U64_ZERO;
+
+    for(i=order;i<blocksize;i++) {
+        sum = 0;
+        for(j=0;j<order;j++) {
+            sum += (tflac_s64)coefficients[j] * (tflac_s64)samples[i-1-j];
+        }
+        res = (tflac_s64)samples[i] - (sum >> shift);
+        residuals[i] = (tflac_s32)res;
+        res = tflac_s64_abs(res);
+        max_found |= res > INT32_MAX;
+        TFLAC_U64_ADD_WORD(residual_err, res);
+    }
+
+    *residual_error = max_found ? TFLAC_U64_MAX : residual_err;
+}
+#endif
+
+TFLAC_CONST
+TFLAC_PRIVATE
+tflac_u32 tflac_lpc_default_precision(tflac_u32 blocksize, tflac_u32 bitdepth) {
+    if(bitdepth < 16) {
+        return 2 + bitdepth / 2 < 5 ? 5 : 2 + bitdepth / 2;
+    }
+    if(bitdepth > 16) return 15;
+
+    if(blocksize <= 192) return 7;
+    if(blocksize <= 384) return 8;
+    if(blocksize <= 576) return 9;
+    if(blocksize <= 1152) return 10;
+    if(blocksize <= 2304) return 11;
+    if(blocksize <= 4608) return 12;
+    return 13;
+}
+
+TFLAC_CONST
+TFLAC_PRIVATE
+tflac_u32 tflac_ilog2_ceil(tflac_u32 v) {
+    tflac_u32 r = 0;
+    while( (UINT32_C(1) << r) < v) r++;
+    return r;
+}
+
+/* picks an LPC order, quantizes the coefficients and calculates the
+ * residuals into lpc_residuals. Returns 0 if we have a usable candidate */
+TFLAC_PRIVATE
+int tflac_analyze_lpc(tflac* t) {
+    double autoc[TFLAC_MAX_LPC_ORDER + 1];
+    double lpc[TFLAC_MAX_LPC_ORDER];
+    double error[TFLAC_MAX_LPC_ORDER];
+    double bits;
+    double best_bits;
+    double error_scale;
+    tflac_u32 bitdepth = t->subframe_bitdepth - t->wasted_bits;
+    tflac_u32 precision;
+    tflac_u32 max_order = t->max_lpc_order;
+    tflac_u32 order = 0;
+    tflac_u32 shift = 0;
+    tflac_u32 i;
+
+    /* not worth it on tiny blocks */
+    if(t->cur_blocksize < 16) return -1;
+
+    while( max_order > 0 && t->cur_blocksize >> t->partition_order <= max_order ) max_order--;
+    if(max_order == 0) return -1;
+
+    precision = t->lpc_precision ? t->lpc_precision : tflac_lpc_default_precision(t->cur_blocksize, bitdepth);
+
+    tflac_lpc_autocorrelation(t->residuals[0], t->cur_blocksize, max_order, autoc);
+    if(autoc[0] == 0.0) return -1;
+
+    max_order = tflac_lpc_levinson(autoc, max_order, lpc, error);
+
+    /* estimate the size of each order's residuals from the prediction error */
+    best_bits = 0.0;
+    for(i=1;i<=max_order;i++) {
+        error_scale = 0.5 / (double)(t->cur_blocksize - i);
+        bits = error[i-1] > 0.0 ? 0.5 * tflac_lpc_log2(error_scale * error[i-1]) : 0.0;
+        if(bits < 0.0) bits = 0.0;
+        bits = bits * (double)(t->cur_blocksize - i) + (double)(i * (bitdepth + precision));
+        if(order == 0 || bits < best_bits) {
+            best_bits = bits;
+            order = i;
+        }
+    }
+
+#ifdef TFLAC_32BIT_ONLY
+    /* we only have a 32-bit accumulator, trade precision for headroom */
+    if(bitdepth + precision + tflac_ilog2_ceil(order) > 32) {
+        if(bitdepth + 5 + tflac_ilog2_ceil(order) > 32) return -1;
+        precision = 32 - bitdepth - tflac_ilog2_ceil(order);
+    }
+#endif
+
+    /* recompute the coefficients for the order we picked */
+    if(order != max_order) tflac_lpc_levinson(autoc, order, lpc, error);
+
+    if(tflac_lpc_quantize(lpc, order, precision, t->lpc_coefficients, &shift) != 0) return -1;
+
+    if(bitdepth + precision + tflac_ilog2_ceil(order) <= 32) {
+        tflac_lpc_residual_narrow(t->cur_blocksize, t->residuals[0], t->lpc_residuals, &t->lpc_residual_error,
+          t->lpc_coefficients, order, shift);
+    } else {
+#ifdef TFLAC_32BIT_ONLY
+        return -1;
+#else
+        tflac_lpc_residual_wide(t->cur_blocksize, t->residuals[0], t->lpc_residuals, &t->lpc_residual_error,
+          t->lpc_coefficients, order, shift);
+#endif
+    }
+
+    if(TFLAC_U64_EQ(t->lpc_residual_error, TFLAC_U64_MAX)) return -1;
+
+    t->lpc_order = (tflac_u8)order;
+    t->lpc_shift = (tflac_u8)shift;
+    t->lpc_coefficient_precision = (tflac_u8)precision;
+
+    return 0;
+}
+
+/* evaluates every partition order from partition_order down to
+ * min_partition_order. The partition sums for partition_order have
+ * to be filled in already, each lower order is made by merging pairs
+ * of partitions from the order above it. Returns the order with the
+ * lowest estimated size */
+TFLAC_PRIVATE
+tflac_u8 tflac_search_partition_order(tflac* t, tflac_u32 predictor_order, tflac_u8 partition_order) {
+    tflac_u64* TFLAC_RESTRICT sums = t->partition_sums;
+    tflac_u64 sum;
+    tflac_u32 rice_bits = t->max_rice_value > 14 ? 5 : 4;
+    tflac_u32 partitions = 0;
+    tflac_u32 partition_length = 0;
+    tflac_u32 i = 0;
+    tflac_u8 order = partition_order;
+    tflac_u8 best_order = partition_order;
+    double best_bits = 0.0;
+    double bits = 0.0;
+
+    for(;;) {
+        partitions = UINT32_C(1) << order;
+        partition_length = t->cur_blocksize >> order;
+
+        bits = (double)(partitions * rice_bits);
+        bits += tflac_estimate_residual_bits(sums[partitions], partition_length - predictor_order, t->max_rice_value);
+        for(i=1;i<partitions;i++) {
+            bits += tflac_estimate_residual_bits(sums[partitions + i], partition_length, t->max_rice_value);
+        }
+
+        if(order == partition_order || bits < best_bits) {
+            best_bits = bits;
+            best_order = order;
+        }
+
+        if(order <= t->min_partition_order) break;
+
+        /* merge pairs of partitions into the next order down */
+        order--;
+        partitions >>= 1;
+        for(i=0;i<partitions;i++) {
+            sum = sums[(partitions << 1) + (i << 1)];
+            TFLAC_U64_ADD(sum, sums[(partitions << 1) + (i << 1) + 1]);
+            sums[partitions + i] = sum;
+        }
+    }
 
-    return;
+    return best_order;
 }
 
+TFLAC_PRIVATE
+void tflac_fold_residuals_std(tflac_u32 blocksize, tflac_u32 predictor_order, tflac_u32 partition_order, const tflac_s32* TFLAC_RESTRICT residuals, tflac_u32* TFLAC_RESTRICT folded, tflac_u64* TFLAC_RESTRICT sums) {
+    tflac_u32 partitions = UINT32_C(1) << partition_order;
+    tflac_u32 partition_length = blocksize >> partition_order;
+    tflac_u32 offset = predictor_order;
+    tflac_u32 end = 0;
+    tflac_u32 i = 0;
+    tflac_u32 res_abs = 0;
+    tflac_u64 sum;
+
+    for(i=0;i<partitions;i++) {
+        end = (i + 1) * partition_length;
+
+        sum = TFLAC_U64_ZERO;
+        for(;offset<end;offset++) {
+            /* the original version is something like:
+             * if(residuals[offset] < 0) {
+             *   v = residuals[offset] * -2 - 1;
+             * } else {
+             *   v = residuals[offset] * 2
+             * }
+             * instead we just find the sign bit, double
+             * the absolute value, and subtract the sign bit */
+            res_abs = (tflac_u32)tflac_s32_abs(residuals[offset]);
+            folded[offset] = (res_abs << 1) - ((tflac_u32)residuals[offset] >> 31);
+            TFLAC_U64_ADD_WORD(sum, res_abs);
+        }
+        sums[i] = sum;
+    }
+}
 
 TFLAC_PRIVATE
-int tflac_encode_residuals(tflac* t, tflac_u8 predictor_order, tflac_u8 partition_order) {
+int tflac_encode_residuals(tflac* t, const tflac_s32* residuals, tflac_u32 predictor_order, tflac_u8 partition_order) {
     int r;
     tflac_u32 rice = 0;
     tflac_u32 i = 0;
     tflac_u32 j = 0;
 
-    tflac_u32 res_abs = 0;
     tflac_u32 v = 0;
-    tflac_u64 sum;
 
-    tflac_u8 w = (tflac_u8)t->wasted_bits;
+    tflac_u32 partitions = UINT32_C(1) << partition_order;
     tflac_u32 partition_length = 0;
     tflac_u32 offset = predictor_order;
     tflac_u32 msb = 0;
     tflac_u32 lsb = 0;
-    tflac_u32 neg = 0;
-    tflac_u32 bits = t->bw.tot;
-    const tflac_s32* residuals = TFLAC_ASSUME_ALIGNED(t->residuals[predictor_order], 16);
-
-    sum = TFLAC_U64_ZERO;
-
-    if( (r = tflac_bitwriter_add(&t->bw, 8, (tflac_uint)(0x10 | (predictor_order << 1) | (!!w))) ) != 0) return r;
-    if(w) if( (r = tflac_bitwriter_add(&t->bw, w, 1)) != 0) return r;
+    const tflac_u32* folded = t->folded_residuals;
 
+    /* fold everything and sum up each partition at the highest order, these
+     * are stored heap-style so partition i of order p is at partition_sums[(1 << p) + i] */
+    t->fold_residuals(t->cur_blocksize, predictor_order, partition_order,
+      residuals, t->folded_residuals, &t->partition_sums[partitions]);
 
-    for(i=0;i<predictor_order;i++) {
-        if( (r = tflac_bitwriter_add(&t->bw, t->subframe_bitdepth - t->wasted_bits, (tflac_u32)residuals[i])) != 0) return r;
+    if(t->enable_partition_search && partition_order > t->min_partition_order) {
+        partition_order = tflac_search_partition_order(t, predictor_order, partition_order);
+        partitions = UINT32_C(1) << partition_order;
     }
 
     if( (r = tflac_bitwriter_add(&t->bw, 6,
         ( (t->max_rice_value > 14 ? 0x10 : 0x00) ) | partition_order)) != 0) return r;
 
-    for(i=0;i < ( 1U << partition_order) ; i++) {
+    offset = predictor_order;
+    for(i=0;i<partitions;i++) {
 
         partition_length = t->cur_blocksize >> partition_order;
-        if(i == 0) partition_length -= (tflac_u32)predictor_order;
-
-        sum = TFLAC_U64_ZERO;
-        for(j=0;j<partition_length;j++) {
-            res_abs = (tflac_u32)tflac_s32_abs(residuals[j+offset]);
-            TFLAC_U64_ADD_WORD(sum, res_abs);
-        }
+        if(i == 0) partition_length -= predictor_order;
 
-        /* find the rice parameter for this partition */
-        rice = 0;
-        while( TFLAC_U64_GT_WORD(sum, (partition_length << rice)) ) {
-            if(rice == t->max_rice_value) break;
-            rice++;
+        rice = tflac_rice_parameter(t->partition_sums[partitions + i], partition_length, t->max_rice_value);
+        if(t->enable_exact_rice) {
+            rice = tflac_rice_parameter_exact(&folded[offset], partition_length, rice, t->max_rice_value);
         }
 
         if(t->max_rice_value > 14) {
@@ -3714,52 +8869,43 @@ int tflac_encode_residuals(tflac* t, tflac_u8 predictor_order, tflac_u8 partitio
             if( (r = tflac_bitwriter_add(&t->bw, 4, rice)) != 0) return r;
         }
 
-        for(j=0;j<partition_length;j++) {
-            /* the original version is something like:
-             * if(residuals[j+offset] < 0) {
-             *   v = residuals[j+offset] * -2 - 1;
-             * } else {
-             *   v = residuals[j+offset] * 2
-             * }
-             * instead we just find the sign bit, double
-             * the absolute value, and subtract the sign bit */
-            neg = (tflac_u32)(residuals[j+offset]) >> 31;
-            v = ((tflac_u32)tflac_s32_abs(residuals[j+offset])) << 1;
-            v -= neg;
+        if(tflac_bitwriter_rice_fits(&t->bw, t->partition_sums[partitions + i], partition_length, rice)) {
+            tflac_bitwriter_rice(&t->bw, &folded[offset], partition_length, rice);
+        } else {
+            /* might not fit, go a residual at a time so running out
+             * of buffer gets caught */
+            for(j=0;j<partition_length;j++) {
+                v = folded[j+offset];
 
-            msb = (tflac_u32)(v >> rice);
-            lsb = (tflac_u32)(v - (msb << rice));
+                msb = (tflac_u32)(v >> rice);
+                lsb = (tflac_u32)(v - (msb << rice));
 
-            if(msb) if( (r = tflac_bitwriter_zeroes(&t->bw, msb)) != 0) return r;
-            if( (r = tflac_bitwriter_add(&t->bw, rice + 1, (1 << rice) | lsb)) != 0) return r;
+                if(msb) if( (r = tflac_bitwriter_zeroes(&t->bw, msb)) != 0) return r;
+                if( (r = tflac_bitwriter_add(&t->bw, rice + 1, (1 << rice) | lsb)) != 0) return r;
+            }
         }
 
         offset += partition_length;
+        TFLAC_BW_UPDATE_CRC(&t->bw);
     }
 
     /* flush the output */
-    if( (r = tflac_bitwriter_flush(&t->bw)) != 0) return r;
-
-    if(t->bw.tot - bits > t->verbatim_subframe_bits) {
-        /* we somehow took more space than we would with a verbatim subframe? */
-        return -1;
-    }
-
-    return 0;
+    return tflac_bitwriter_flush(&t->bw);
 }
 
-
+/* picks the fixed order with the lowest residual error, returns 5 if
+ * no order is usable */
 TFLAC_PRIVATE
-int tflac_encode_subframe_fixed(tflac* t) {
+tflac_u8 tflac_choose_fixed_order(tflac* t) {
     tflac_u8 i = 0;
     tflac_u8 order = 5;
     tflac_u8 max_order = 4;
     tflac_u64 error;
-    tflac_u8 partition_order = t->partition_order;
 
     error = TFLAC_U64_MAX;
 
-    tflac_cfr(t);
+    if(!t->residual_errors_ready) tflac_cfr(t);
+    t->residual_errors_ready = 0;
 
     while( t->cur_blocksize >> t->partition_order <= max_order ) max_order--;
 
@@ -3770,15 +8916,81 @@ int tflac_encode_subframe_fixed(tflac* t) {
         }
     }
 
-    if(order == max_order+1) return -1;
+    return order;
+}
+
+TFLAC_PRIVATE
+int tflac_encode_subframe_fixed(tflac* t, tflac_u8 order) {
+    int r;
+    tflac_u32 i = 0;
+    tflac_u8 w = (tflac_u8)t->wasted_bits;
+    tflac_u32 bits = t->bw.tot;
+    const tflac_s32* residuals = TFLAC_ASSUME_ALIGNED(t->residuals[order], 16);
+    tflac_u64 error;
+
+    /* order selection only calculated the error sums, and the buffer may
+     * have been used by LPC since then, so get the residuals now */
+    if(order > 0) {
+        t->calculate_order[order](t->cur_blocksize,t->residuals[0],t->residuals[order],&error);
+    }
+
+    if( (r = tflac_bitwriter_add(&t->bw, 8, (tflac_uint)(0x10 | (order << 1) | (!!w))) ) != 0) return r;
+    if(w) if( (r = tflac_bitwriter_add(&t->bw, w, 1)) != 0) return r;
+
+    for(i=0;i<order;i++) {
+        if( (r = tflac_bitwriter_add(&t->bw, t->subframe_bitdepth - t->wasted_bits, (tflac_u32)residuals[i])) != 0) return r;
+    }
+
+    if( (r = tflac_encode_residuals(t, residuals, order, t->partition_order)) != 0) return r;
+
+    if(t->bw.tot - bits > t->verbatim_subframe_bits) {
+        /* we somehow took more space than we would with a verbatim subframe? */
+        return -1;
+    }
+
+    return 0;
+}
+
+TFLAC_PRIVATE
+int tflac_encode_subframe_lpc(tflac* t) {
+    int r;
+    tflac_u32 i = 0;
+    tflac_u8 w = (tflac_u8)t->wasted_bits;
+    tflac_u32 bits = t->bw.tot;
+    const tflac_s32* residuals = TFLAC_ASSUME_ALIGNED(t->lpc_residuals, 16);
+
+    if( (r = tflac_bitwriter_add(&t->bw, 8, (tflac_uint)(0x40 | ((t->lpc_order - 1) << 1) | (!!w))) ) != 0) return r;
+    if(w) if( (r = tflac_bitwriter_add(&t->bw, w, 1)) != 0) return r;
+
+    /* the LPC residual functions skip the warm-up samples */
+    for(i=0;i<t->lpc_order;i++) {
+        if( (r = tflac_bitwriter_add(&t->bw, t->subframe_bitdepth - t->wasted_bits, (tflac_u32)t->residuals[0][i])) != 0) return r;
+    }
+
+    if( (r = tflac_bitwriter_add(&t->bw, 4, (tflac_uint)(t->lpc_coefficient_precision - 1))) != 0) return r;
+    if( (r = tflac_bitwriter_add(&t->bw, 5, t->lpc_shift)) != 0) return r;
+
+    for(i=0;i<t->lpc_order;i++) {
+        if( (r = tflac_bitwriter_add(&t->bw, t->lpc_coefficient_precision, (tflac_u32)t->lpc_coefficients[i])) != 0) return r;
+    }
+
+    if( (r = tflac_encode_residuals(t, residuals, t->lpc_order, t->partition_order)) != 0) return r;
+
+    if(t->bw.tot - bits > t->verbatim_subframe_bits) {
+        return -1;
+    }
 
-    return tflac_encode_residuals(t, order, partition_order);
+    return 0;
 }
 
 TFLAC_PRIVATE
 int tflac_encode_subframe(tflac *t, tflac_u8 channel) {
     int r;
     tflac_bitwriter bw = t->bw;
+    tflac_u8 fixed_order = 5;
+    tflac_u32 bitdepth;
+    double fixed_bits = 0.0;
+    double lpc_bits = 0.0;
 
     t->verbatim_subframe_bits = tflac_verbatim_subframe_bits(t->cur_blocksize, t->subframe_bitdepth);
 
@@ -3796,8 +9008,34 @@ int tflac_encode_subframe(tflac *t, tflac_u8 channel) {
         t->bw = bw;
     }
 
+    bitdepth = t->subframe_bitdepth - t->wasted_bits;
+
     if(t->enable_fixed_subframe) {
-        if(tflac_encode_subframe_fixed(t) == 0) {
+        fixed_order = tflac_choose_fixed_order(t);
+        if(fixed_order < 5 && t->cur_blocksize > 4) {
+            /* the fixed residual error skips the first 4 samples */
+            fixed_bits = tflac_estimate_residual_bits(t->residual_errors[fixed_order], t->cur_blocksize - 4, t->max_rice_value)
+              + (double)(fixed_order * bitdepth);
+        }
+    }
+
+    if(t->enable_lpc_subframe && tflac_analyze_lpc(t) == 0) {
+        lpc_bits = tflac_estimate_residual_bits(t->lpc_residual_error, t->cur_blocksize - t->lpc_order, t->max_rice_value)
+          + (double)(t->lpc_order * (bitdepth + t->lpc_coefficient_precision) + 9);
+
+        if(fixed_order == 5 || lpc_bits < fixed_bits) {
+            if(tflac_encode_subframe_lpc(t) == 0) {
+#ifndef TFLAC_DISABLE_COUNTERS
+                TFLAC_U64_ADD_WORD(t->subframe_type_counts[channel][TFLAC_SUBFRAME_LPC],1);
+#endif
+                return 0;
+            }
+            t->bw = bw;
+        }
+    }
+
+    if(fixed_order < 5) {
+        if(tflac_encode_subframe_fixed(t, fixed_order) == 0) {
 #ifndef TFLAC_DISABLE_COUNTERS
             TFLAC_U64_ADD_WORD(t->subframe_type_counts[channel][TFLAC_SUBFRAME_FIXED],1);
 #endif
@@ -3815,53 +9053,83 @@ int tflac_encode_subframe(tflac *t, tflac_u8 channel) {
     return r;
 }
 
+/* writes a frame or sample number with FLAC's UTF-8-like coding, hi
+ * holds bits 32-35 (only sample numbers get that big) */
 TFLAC_PRIVATE
-int tflac_encode_frame_header(tflac *t) {
+int tflac_encode_coded_number(tflac_bitwriter* bw, tflac_u32 hi, tflac_u32 lo) {
     int r;
-    tflac_u8 frameno_bytes[6];
+    tflac_u8 bytes[7];
     unsigned int i = 0;
-    tflac_u8 frameno_len = 0;
+    tflac_u8 len = 0;
+
+    if(hi != 0 || lo >= ((tflac_u32)1 << 31)) {
+        bytes[0] = 0xFE;
+        bytes[1] = 0x80 | (((lo >> 30) | (hi << 2)) & 0x3F);
+        bytes[2] = 0x80 | ((lo >> 24) & 0x3F);
+        bytes[3] = 0x80 | ((lo >> 18) & 0x3F);
+        bytes[4] = 0x80 | ((lo >> 12) & 0x3F);
+        bytes[5] = 0x80 | ((lo >>  6) & 0x3F);
+        bytes[6] = 0x80 | ((lo      ) & 0x3F);
+        len = 7;
+    } else if(lo < ( (tflac_u32)1 << 7) ) {
+        bytes[0] = lo & 0x7F;
+        len = 1;
+    } else if(lo < ((tflac_u32)1 << 11)) {
+        bytes[0] = 0xC0 | ((lo >> 6) & 0x1F);
+        bytes[1] = 0x80 | ((lo     ) & 0x3F);
+        len = 2;
+    } else if(lo < ((tflac_u32)1 << 16)) {
+        bytes[0] = 0xE0 | ((lo >> 12) & 0x0F);
+        bytes[1] = 0x80 | ((lo >>  6) & 0x3F);
+        bytes[2] = 0x80 | ((lo      ) & 0x3F);
+        len = 3;
+    } else if(lo < ((tflac_u32)1 << 21)) {
+        bytes[0] = 0xF0 | ((lo >> 18) & 0x07);
+        bytes[1] = 0x80 | ((lo >> 12) & 0x3F);
+        bytes[2] = 0x80 | ((lo >>  6) & 0x3F);
+        bytes[3] = 0x80 | ((lo      ) & 0x3F);
+        len = 4;
+    } else if(lo < ((tflac_u32)1 << 26)) {
+        bytes[0] = 0xF8 | ((lo >> 24) & 0x03);
+        bytes[1] = 0x80 | ((lo >> 18) & 0x3F);
+        bytes[2] = 0x80 | ((lo >> 12) & 0x3F);
+        bytes[3] = 0x80 | ((lo >>  6) & 0x3F);
+        bytes[4] = 0x80 | ((lo      ) & 0x3F);
+        len = 5;
+    } else {
+        bytes[0] = 0xFC | ((lo >> 30) & 0x01);
+        bytes[1] = 0x80 | ((lo >> 24) & 0x3F);
+        bytes[2] = 0x80 | ((lo >> 18) & 0x3F);
+        bytes[3] = 0x80 | ((lo >> 12) & 0x3F);
+        bytes[4] = 0x80 | ((lo >>  6) & 0x3F);
+        bytes[5] = 0x80 | ((lo      ) & 0x3F);
+        len = 6;
+    }
+
+    for(i=0;i<len;i++) {
+        if( (r = tflac_bitwriter_add(bw, 8, bytes[i])) != 0) return r;
+    }
+
+    return 0;
+}
+
+TFLAC_PRIVATE
+int tflac_encode_frame_header(tflac *t) {
+    int r;
 
     if( (r = tflac_bitwriter_add(&t->bw, 32, t->frame_header)) != 0) return r;
 
-    if(t->frameno < ( (tflac_u32)1 << 7) ) {
-        frameno_bytes[0] = t->frameno & 0x7F;
-        frameno_len = 1;
-    } else if(t->frameno < ((tflac_u32)1 << 11)) {
-        frameno_bytes[0] = 0xC0 | ((t->frameno >> 6) & 0x1F);
-        frameno_bytes[1] = 0x80 | ((t->frameno     ) & 0x3F);
-        frameno_len = 2;
-    } else if(t->frameno < ((tflac_u32)1 << 16)) {
-        frameno_bytes[0] = 0xE0 | ((t->frameno >> 12) & 0x0F);
-        frameno_bytes[1] = 0x80 | ((t->frameno >>  6) & 0x3F);
-        frameno_bytes[2] = 0x80 | ((t->frameno      ) & 0x3F);
-        frameno_len = 3;
-    } else if(t->frameno < ((tflac_u32)1 << 21)) {
-        frameno_bytes[0] = 0xF0 | ((t->frameno >> 18) & 0x07);
-        frameno_bytes[1] = 0x80 | ((t->frameno >> 12) & 0x3F);
-        frameno_bytes[2] = 0x80 | ((t->frameno >>  6) & 0x3F);
-        frameno_bytes[3] = 0x80 | ((t->frameno      ) & 0x3F);
-        frameno_len = 4;
-    } else if(t->frameno < ((tflac_u32)1 << 26)) {
-        frameno_bytes[0] = 0xF8 | ((t->frameno >> 24) & 0x03);
-        frameno_bytes[1] = 0x80 | ((t->frameno >> 18) & 0x3F);
-        frameno_bytes[2] = 0x80 | ((t->frameno >> 12) & 0x3F);
-        frameno_bytes[3] = 0x80 | ((t->frameno >>  6) & 0x3F);
-        frameno_bytes[4] = 0x80 | ((t->frameno      ) & 0x3F);
-        frameno_len = 5;
+    /* variable blocksize streams number frames by their first sample */
+    if(t->enable_variable_blocksize) {
+#ifdef TFLAC_32BIT_ONLY
+        r = tflac_encode_coded_number(&t->bw, t->samplecount.hi, t->samplecount.lo);
+#else
+        r = tflac_encode_coded_number(&t->bw, (tflac_u32)(t->samplecount >> 32), (tflac_u32)t->samplecount);
+#endif
     } else {
-        frameno_bytes[0] = 0xFC | ((t->frameno >> 30) & 0x01);
-        frameno_bytes[1] = 0x80 | ((t->frameno >> 24) & 0x3F);
-        frameno_bytes[2] = 0x80 | ((t->frameno >> 18) & 0x3F);
-        frameno_bytes[3] = 0x80 | ((t->frameno >> 12) & 0x3F);
-        frameno_bytes[4] = 0x80 | ((t->frameno >>  6) & 0x3F);
-        frameno_bytes[5] = 0x80 | ((t->frameno      ) & 0x3F);
-        frameno_len = 6;
-    }
-
-    for(i=0;i<frameno_len;i++) {
-        if( (r = tflac_bitwriter_add(&t->bw, 8, frameno_bytes[i])) != 0) return r;
+        r = tflac_encode_coded_number(&t->bw, 0, t->frameno);
     }
+    if(r != 0) return r;
 
     switch( (t->frame_header >> 12) & 0x0F) {
         case 6: {
@@ -3906,17 +9174,25 @@ void tflac_init(tflac *t) {
     t->channels = 0;
     t->bitdepth = 0;
     t->channel_mode = (tflac_u8)TFLAC_CHANNEL_INDEPENDENT;
+    t->cur_channel_mode = (tflac_u8)TFLAC_CHANNEL_INDEPENDENT;
 
     t->subframe_bitdepth = 0;
     t->max_rice_value = 0;
     t->min_partition_order = 0;
     t->max_partition_order = 0;
     t->partition_order = 0;
+    t->enable_partition_search = 0;
+    t->enable_exact_rice = 0;
+    t->enable_variable_blocksize = 0;
 
     t->enable_constant_subframe = 1;
     t->enable_fixed_subframe = 1;
+    t->enable_lpc_subframe = 0;
     t->enable_md5 = 1;
 
+    t->max_lpc_order = 8;
+    t->lpc_precision = 0;
+
     t->frame_header = 0;
 
     t->samplecount = TFLAC_U64_ZERO;
@@ -3928,8 +9204,13 @@ void tflac_init(tflac *t) {
     t->min_frame_size = 0;
     t->max_frame_size = 0;
 
+    t->min_blocksize = 0;
+    t->max_blocksize = 0;
+    t->last_blocksize = 0;
+
     t->wasted_bits = 0;
     t->constant = 0;
+    t->residual_errors_ready = 0;
 
     t->md5_digest[0] = '\0';
     t->md5_digest[1] = '\0';
@@ -3948,17 +9229,38 @@ void tflac_init(tflac *t) {
     t->md5_digest[14] = '\0';
     t->md5_digest[15] = '\0';
 
+    t->md5_push = NULL;
+    t->md5_wait = NULL;
+    t->md5_userdata = NULL;
+
     t->calculate_order[0] = tflac_cfr_order0;
     t->calculate_order[1] = tflac_cfr_order1;
     t->calculate_order[2] = tflac_cfr_order2;
     t->calculate_order[3] = tflac_cfr_order3;
     t->calculate_order[4] = tflac_cfr_order4;
+    t->calculate_fused = tflac_cfr_fused;
+    t->decorrelate_s16i = tflac_decorrelate_s16i;
+    t->decorrelate_s16p = tflac_decorrelate_s16p;
+    t->decorrelate_s32i = tflac_decorrelate_s32i;
+    t->decorrelate_s32p = tflac_decorrelate_s32p;
+    t->calculate_crc16 = tflac_crc16;
+    t->fold_residuals = tflac_fold_residuals;
 
     t->residuals[0] = NULL;
     t->residuals[1] = NULL;
     t->residuals[2] = NULL;
     t->residuals[3] = NULL;
     t->residuals[4] = NULL;
+    t->stereo_residuals = NULL;
+
+    t->lpc_order = 0;
+    t->lpc_shift = 0;
+    t->lpc_coefficient_precision = 0;
+    t->lpc_residual_error = TFLAC_U64_ZERO;
+    t->lpc_residuals = NULL;
+
+    t->partition_sums = NULL;
+    t->folded_residuals = NULL;
 
 #ifndef TFLAC_DISABLE_COUNTERS
     {
@@ -3976,6 +9278,7 @@ void tflac_init(tflac *t) {
 TFLAC_PRIVATE
 void tflac_update_frame_header(tflac *t) {
     t->frame_header = UINT32_C(0xFFF8) << 16;
+    if(t->enable_variable_blocksize) t->frame_header |= UINT32_C(1) << 16;
 
     switch(t->cur_blocksize) {
         case 192:   t->frame_header |= ( UINT32_C(0x01) << 12); break;
@@ -4023,7 +9326,7 @@ void tflac_update_frame_header(tflac *t) {
         }
     }
 
-    switch((enum TFLAC_CHANNEL_MODE)t->channel_mode) {
+    switch((enum TFLAC_CHANNEL_MODE)t->cur_channel_mode) {
         case TFLAC_CHANNEL_INDEPENDENT: t->frame_header |= (t->channels - 1) << 4; break;
         case TFLAC_CHANNEL_LEFT_SIDE: t->frame_header |= (0x08) << 4; break;
         case TFLAC_CHANNEL_SIDE_RIGHT: t->frame_header |= (0x09) << 4; break;
@@ -4042,6 +9345,31 @@ void tflac_update_frame_header(tflac *t) {
     }
 }
 
+/* picks the largest partition order that evenly divides the block,
+ * leaving at least 2 samples per partition. A short last block may not
+ * divide by the minimum order, in that case it goes below it */
+TFLAC_PURE
+TFLAC_PRIVATE
+tflac_u8 tflac_pick_partition_order(const tflac* t, tflac_u32 blocksize) {
+    tflac_u8 partition_order = t->min_partition_order;
+    while( partition_order > 0 &&
+      ( (blocksize % (1U<<partition_order) != 0) ||
+        (blocksize >> partition_order) < 2) ) {
+        partition_order--;
+    }
+    while( (blocksize % (1U<<(partition_order+1)) == 0) &&
+      (blocksize >> (partition_order+1)) >= 2 &&
+      partition_order < t->max_partition_order) {
+        partition_order++;
+    }
+    return partition_order;
+}
+
+TFLAC_PRIVATE
+void tflac_update_partition_order(tflac *t) {
+    t->partition_order = tflac_pick_partition_order(t, t->cur_blocksize);
+}
+
 TFLAC_PUBLIC
 int tflac_validate(tflac *t, void* ptr, tflac_u32 len) {
     tflac_u32 res_len = 0;
@@ -4057,138 +9385,506 @@ int tflac_validate(tflac *t, void* ptr, tflac_u32 len) {
     if(t->bitdepth == 0) return -1;
     if(t->bitdepth > 32) return -1;
 
-    if(t->channel_mode != TFLAC_CHANNEL_INDEPENDENT) {
-        if(t->channels != 2 || t->bitdepth == 32) {
-            t->channel_mode = TFLAC_CHANNEL_INDEPENDENT;
+    if(t->channel_mode != TFLAC_CHANNEL_INDEPENDENT) {
+        if(t->channels != 2 || t->bitdepth == 32) {
+            t->channel_mode = TFLAC_CHANNEL_INDEPENDENT;
+        }
+    }
+
+    /* the split estimate only knows about fixed predictors, with LPC
+     * it'd never split anything */
+    if(t->enable_lpc_subframe) {
+        t->enable_variable_blocksize = 0;
+    }
+
+    if(t->channel_mode == TFLAC_CHANNEL_AUTO) {
+        t->cur_channel_mode = TFLAC_CHANNEL_INDEPENDENT;
+    } else if(t->channel_mode < TFLAC_CHANNEL_MODE_COUNT) {
+        t->cur_channel_mode = t->channel_mode;
+    } else {
+        return -1;
+    }
+
+    if(t->max_rice_value == 0) {
+        if(t->bitdepth <= 16) {
+            t->max_rice_value = 14;
+        } else {
+            t->max_rice_value = 30;
+        }
+    } else if(t->max_rice_value > 30) {
+        return -1;
+    }
+
+    if(t->max_partition_order > 15) {
+        return -1;
+    }
+
+    if(t->min_partition_order > t->max_partition_order) return -1;
+
+    /* partitions need at least 2 samples, this also makes sure we
+     * have room for every order's partition sums */
+    if( (t->blocksize >> t->min_partition_order) < 2) return -1;
+
+    if(t->max_lpc_order == 0) {
+        t->max_lpc_order = 1;
+    } else if(t->max_lpc_order > TFLAC_MAX_LPC_ORDER) {
+        t->max_lpc_order = TFLAC_MAX_LPC_ORDER;
+    }
+
+    if(t->lpc_precision > 15) return -1;
+
+    if(len < tflac_size_memory(t->blocksize)) return -1;
+
+    p1 = ((tflac_uptr)ptr);
+    p2 = (p1 + 15) & ~(tflac_uptr)UINT32_C(0x0F);
+
+    p2 -= p1; /* we now have an offset rather than an absolute pointer,
+    in case things went sideways with type detecion and tflac_uptr
+    wound up too small */
+
+    d = (tflac_u8*)ptr;
+    d += p2;
+
+    res_len = (15UL + (t->blocksize * 4UL)) & UINT32_C(0xFFFFFFF0);
+    t->residuals[0] = (tflac_s32*)(&d[(0 * res_len)]);
+    t->residuals[1] = (tflac_s32*)(&d[(1 * res_len)]);
+    t->residuals[2] = t->residuals[1];
+    t->residuals[3] = t->residuals[1];
+    t->residuals[4] = t->residuals[1];
+    t->lpc_residuals = t->residuals[1];
+    t->stereo_residuals = (tflac_s32*)(&d[(2 * res_len)]);
+    t->folded_residuals = (tflac_u32*)(&d[(3 * res_len)]);
+    t->partition_sums = (tflac_u64*)(&d[(4 * res_len)]);
+
+    t->cur_blocksize = t->blocksize;
+    tflac_update_partition_order(t);
+
+    tflac_update_frame_header(t);
+
+    switch(t->bitdepth) {
+        case 32: {
+            t->calculate_order[1] = tflac_cfr_order1_wide;
+        }
+        /* fall-through */
+        case 31: {
+            t->calculate_order[2] = tflac_cfr_order2_wide;
+        }
+        /* fall-through */
+        case 30: {
+            t->calculate_order[3] = tflac_cfr_order3_wide;
+        }
+        /* fall-through */
+        case 29: {
+            t->calculate_order[4] = tflac_cfr_order4_wide;
+            t->calculate_fused = NULL;
+        }
+        /* fall-through */
+        default: break;
+    }
+
+    t->max_frame_len = tflac_max_size_frame(t->cur_blocksize, t->channels, t->bitdepth);
+
+    return 0;
+}
+
+TFLAC_PRIVATE
+void tflac_set_cur_blocksize(tflac* t, tflac_u32 blocksize) {
+    if(t->cur_blocksize != blocksize) {
+        t->cur_blocksize = blocksize;
+        tflac_update_partition_order(t);
+
+        tflac_update_frame_header(t);
+        t->max_frame_len = tflac_max_size_frame(t->cur_blocksize, t->channels, t->bitdepth);
+    }
+}
+
+/* the fixed-order error sums and a few flags for each quarter of one
+ * channel, for scoring ways of splitting a block */
+struct tflac_split_quarters {
+    tflac_u64 errors[4][5];
+    tflac_u32 constant[4];
+    tflac_s32 values[4];
+    tflac_u32 wasted[4]; /* wasted bits on top of the whole block's */
+};
+typedef struct tflac_split_quarters tflac_split_quarters;
+
+/* estimated bits for a run of quarters (first, first+count) of one
+ * channel. A run of quarters that all hold the same value is a CONSTANT
+ * subframe, otherwise it's the cheapest fixed order across the whole
+ * run, with quarters that end up in the same rice partition getting
+ * their sums merged */
+TFLAC_PRIVATE
+double tflac_estimate_run_bits(const tflac* t, const tflac_split_quarters* s, tflac_u32 quarter, tflac_u32 first, tflac_u32 count) {
+    tflac_u32 partitions = UINT32_C(1) << tflac_pick_partition_order(t, quarter * count);
+    tflac_u32 group = partitions < count ? count / partitions : 1;
+    tflac_u32 bitdepth = t->subframe_bitdepth - t->wasted_bits;
+    tflac_u32 wasted = bitdepth;
+    tflac_u32 order = 0;
+    tflac_u32 q = 0;
+    tflac_u32 i = 0;
+    tflac_u64 sum;
+    double bits;
+    double best = -1.0;
+
+    for(q=first;q<first+count;q++) {
+        if(!s->constant[q] || s->values[q] != s->values[first]) break;
+    }
+    if(q == first + count) return (double)(8 + t->subframe_bitdepth);
+
+    /* the run can drop any low bits that are zero in all of its quarters,
+     * that costs a bit each in the subframe header */
+    for(q=first;q<first+count;q++) {
+        if(s->wasted[q] < wasted) wasted = s->wasted[q];
+    }
+
+    for(order=0;order<5;order++) {
+        bits = (double)(order * (bitdepth - wasted) + wasted);
+        for(q=first;q<first+count;q+=group) {
+            sum = TFLAC_U64_ZERO;
+            for(i=q;i<q+group;i++) {
+                if(TFLAC_U64_EQ(s->errors[i][order], TFLAC_U64_MAX)) {
+                    sum = TFLAC_U64_MAX;
+                    break;
+                }
+                TFLAC_U64_ADD(sum, s->errors[i][order]);
+            }
+            if(wasted && !TFLAC_U64_EQ(sum, TFLAC_U64_MAX)) {
+#ifdef TFLAC_32BIT_ONLY
+                sum.lo = (sum.lo >> wasted) | (sum.hi << (32 - wasted));
+                sum.hi >>= wasted;
+#else
+                sum >>= wasted;
+#endif
+            }
+            bits += tflac_estimate_residual_bits(sum, quarter * group, t->max_rice_value);
+        }
+        if(best < 0.0 || bits < best) best = bits;
+    }
+
+    return best;
+}
+
+/* adds up fixed-order error sums, keeping TFLAC_U64_MAX (an order
+ * that can't be used) sticky */
+TFLAC_PRIVATE
+TFLAC_INLINE
+void tflac_split_add_errors(tflac_u64* errors, const tflac_u64* add) {
+    tflac_u32 i = 0;
+
+    for(i=0;i<5;i++) {
+        if(TFLAC_U64_EQ(errors[i], TFLAC_U64_MAX)) continue;
+        if(TFLAC_U64_EQ(add[i], TFLAC_U64_MAX)) {
+            errors[i] = TFLAC_U64_MAX;
+            continue;
+        }
+        TFLAC_U64_ADD(errors[i], add[i]);
+    }
+}
+
+/* whether a block can be split into halves and quarters. Quarters need
+ * to be at least 16 samples (the smallest block allowed before the last
+ * one), a multiple of 4 samples keeps them aligned for the SIMD
+ * calculators. The scoring only knows about fixed predictors, with LPC
+ * a long block is usually the better deal so it's left alone */
+TFLAC_PURE
+TFLAC_PRIVATE
+int tflac_split_allowed(const tflac* t, tflac_u32 blocksize) {
+    tflac_u32 quarter = blocksize >> 2;
+
+    if(!t->enable_variable_blocksize || t->enable_lpc_subframe) return 0;
+    if(blocksize % 16 != 0 || quarter < 16) return 0;
+    if( (quarter >> t->min_partition_order) < 2) return 0;
+    if(quarter % (UINT32_C(1) << t->min_partition_order) != 0) return 0;
+    return 1;
+}
+
+/* scores the current channel's residuals (already decorrelated and
+ * rescaled) as quarters, halves and the whole block, adding each to
+ * cost (quarters 0-3, halves 4-5, the whole block 6). Each quarter gets
+ * the fixed-order error sums from tflac_cfr, then every run of quarters
+ * is scored with the same rice estimate the stereo mode picker uses.
+ *
+ * The quarter sums skip their first 4 samples, running tflac_cfr over
+ * the 8 samples around each boundary fills those in, which leaves the
+ * whole block's sums in residual_errors for tflac_choose_fixed_order */
+TFLAC_PRIVATE
+void tflac_split_analyze(tflac* t, double* cost) {
+    tflac_split_quarters s;
+    tflac_u64 errors[5];
+    tflac_u32 blocksize = t->cur_blocksize;
+    tflac_u32 quarter = blocksize >> 2;
+    tflac_u32 bitdepth = t->subframe_bitdepth - t->wasted_bits;
+    tflac_u32 bits = 0;
+    tflac_u32 q = 0;
+    tflac_u32 i = 0;
+    tflac_s32* residuals = t->residuals[0];
+    tflac_u64 flag = t->residual_errors[0];
+
+    for(i=0;i<5;i++) errors[i] = TFLAC_U64_ZERO;
+
+    t->cur_blocksize = quarter;
+    for(q=0;q<4;q++) {
+        t->residuals[0] = &residuals[q * quarter];
+        t->residual_errors[0] = flag;
+        tflac_cfr(t);
+        for(i=0;i<5;i++) s.errors[q][i] = t->residual_errors[i];
+
+        /* the order 1 sum skips the first 4 samples */
+        s.values[q] = t->residuals[0][0];
+        s.constant[q] = t->enable_constant_subframe && TFLAC_U64_EQ_WORD(s.errors[q][1], 0);
+        for(i=1;i<5 && s.constant[q];i++) {
+            s.constant[q] = t->residuals[0][i] == s.values[q];
         }
-    }
 
-    if(t->max_rice_value == 0) {
-        if(t->bitdepth <= 16) {
-            t->max_rice_value = 14;
-        } else {
-            t->max_rice_value = 30;
-        }
-    } else if(t->max_rice_value > 30) {
-        return -1;
-    }
+        bits = 0;
+        for(i=0;i<quarter;i++) bits |= (tflac_u32)t->residuals[0][i];
+        s.wasted[q] = tflac_wasted_bits((tflac_s32)bits, bitdepth);
 
-    if(t->max_partition_order > 15) {
-        return -1;
-    }
+        tflac_split_add_errors(errors, s.errors[q]);
+        if(q == 0) continue;
 
-    if(t->min_partition_order > t->max_partition_order) return -1;
+        t->cur_blocksize = 8;
+        t->residuals[0] = &residuals[q * quarter - 4];
+        t->residual_errors[0] = flag;
+        tflac_cfr(t);
+        tflac_split_add_errors(errors, t->residual_errors);
+        t->cur_blocksize = quarter;
+    }
+    t->residuals[0] = residuals;
+    t->cur_blocksize = blocksize;
 
-    if(len < tflac_size_memory(t->blocksize)) return -1;
+    for(i=0;i<5;i++) t->residual_errors[i] = errors[i];
+    t->residual_errors_ready = 1;
 
-    p1 = ((tflac_uptr)ptr);
-    p2 = (p1 + 15) & ~(tflac_uptr)UINT32_C(0x0F);
+    for(q=0;q<4;q++) cost[q] += tflac_estimate_run_bits(t, &s, quarter, q, 1);
+    cost[4] += tflac_estimate_run_bits(t, &s, quarter, 0, 2);
+    cost[5] += tflac_estimate_run_bits(t, &s, quarter, 2, 2);
+    cost[6] += tflac_estimate_run_bits(t, &s, quarter, 0, 4);
+}
 
-    p2 -= p1; /* we now have an offset rather than an absolute pointer,
-    in case things went sideways with type detecion and tflac_uptr
-    wound up too small */
+/* decides whether to keep a block as-is, as two halves, or with either
+ * half split again into quarters (so 4096 can become 4096, 2x2048,
+ * 2048+2x1024, and so on) from the costs tflac_split_analyze added up
+ * for every channel, plus a rough cost for each extra frame header.
+ * Steady signals keep the long block, a transient usually pulls the
+ * quarter it's in out on its own.
+ *
+ * Returns the number of blocks, the sizes go in blocksizes. */
+TFLAC_PRIVATE
+tflac_u32 tflac_split_block(const tflac* t, const tflac_encode_params* p, double* cost, tflac_u32* blocksizes) {
+    double overhead;
+    tflac_u32 quarter = p->blocksize >> 2;
+    tflac_u32 count = 0;
+    tflac_u32 len = 0;
+    tflac_u32 split[2];
+    tflac_u32 i = 0;
 
-    d = (tflac_u8*)ptr;
-    d += p2;
+    blocksizes[0] = p->blocksize;
 
-    res_len = (15UL + (t->blocksize * 4UL)) & UINT32_C(0xFFFFFFF0);
-    t->residuals[0] = (tflac_s32*)(&d[(0 * res_len)]);
-    t->residuals[1] = (tflac_s32*)(&d[(1 * res_len)]);
-    t->residuals[2] = (tflac_s32*)(&d[(2 * res_len)]);
-    t->residuals[3] = (tflac_s32*)(&d[(3 * res_len)]);
-    t->residuals[4] = (tflac_s32*)(&d[(4 * res_len)]);
+    /* frame header, CRC-16, and a subframe and residual header for
+     * each channel */
+    overhead = (double)(8 * (10 + 2) + (t->channels * 14));
+    for(i=0;i<7;i++) cost[i] += overhead;
 
-    t->partition_order = t->min_partition_order;
-    while( (t->blocksize % (1<<(t->partition_order+1)) == 0) && t->partition_order < t->max_partition_order) {
-        t->partition_order++;
+    for(i=0;i<2;i++) {
+        split[i] = 0;
+        if(cost[i*2] + cost[(i*2)+1] < cost[4+i]) {
+            split[i] = 1;
+            cost[4+i] = cost[i*2] + cost[(i*2)+1];
+        }
     }
-    t->cur_blocksize = t->blocksize;
 
-    tflac_update_frame_header(t);
+    if(cost[6] <= cost[4] + cost[5]) return 1;
 
-    switch(t->bitdepth) {
-        case 32: {
-            t->calculate_order[1] = tflac_cfr_order1_wide;
-        }
-        /* fall-through */
-        case 31: {
-            t->calculate_order[2] = tflac_cfr_order2_wide;
-        }
-        /* fall-through */
-        case 30: {
-            t->calculate_order[3] = tflac_cfr_order3_wide;
-        }
-        /* fall-through */
-        case 29: {
-            t->calculate_order[4] = tflac_cfr_order4_wide;
+    for(i=0;i<2;i++) {
+        if(split[i]) {
+            blocksizes[count++] = quarter;
+            blocksizes[count++] = quarter;
+        } else {
+            blocksizes[count++] = quarter * 2;
         }
-        /* fall-through */
-        default: break;
     }
 
-    t->max_frame_len = tflac_max_size_frame(t->cur_blocksize, t->channels, t->bitdepth);
+    /* only split if every frame's worst case still fits in the buffer */
+    for(i=0;i<count;i++) {
+        len += tflac_max_size_frame(blocksizes[i], t->channels, t->bitdepth);
+    }
+    if(len + 8 > p->buffer_len) {
+        blocksizes[0] = p->blocksize;
+        return 1;
+    }
 
-    return 0;
+    return count;
 }
 
+/* encodes a single frame, when split_cost is set it also scores
+ * splitting the block with tflac_split_analyze */
 TFLAC_PRIVATE
-int tflac_encode(tflac* t, const tflac_encode_params* p) {
+int tflac_encode_frame(tflac* t, const tflac_encode_params* p, double* split_cost) {
     tflac_u8 c = 0;
     int r;
 
-    if(t->cur_blocksize != p->blocksize) {
-        t->cur_blocksize = p->blocksize;
-
-        t->partition_order = t->min_partition_order;
-        while( (t->cur_blocksize % (1<<(t->partition_order+1)) == 0) && t->partition_order < t->max_partition_order) {
-            t->partition_order++;
-        }
+    tflac_set_cur_blocksize(t, p->blocksize);
 
+    if(t->channel_mode == TFLAC_CHANNEL_AUTO) {
+        p->estimate(t, p->samples);
         tflac_update_frame_header(t);
-        t->max_frame_len = tflac_max_size_frame(t->cur_blocksize, t->channels, t->bitdepth);
     }
 
-    if(t->enable_md5) p->calculate_md5(t, p->samples);
-
     tflac_bitwriter_init(&t->bw);
     t->bw.buffer = p->buffer;
     t->bw.len    = p->buffer_len;
+    t->bw.calculate_crc16 = t->calculate_crc16;
     if(t->bw.len > t->max_frame_len) t->bw.len = t->max_frame_len;
 
     if( (r = tflac_encode_frame_header(t)) != 0) return r;
 
     for(c=0;c<t->channels;c++) {
         t->residual_errors[0] = TFLAC_U64_ZERO;
+        t->residual_errors_ready = 0;
         p->decorrelate(t, c, p->samples);
         tflac_rescale_samples(t);
+        if(split_cost != NULL) tflac_split_analyze(t, split_cost);
         if( (r = tflac_encode_subframe(t, c)) != 0) return r;
+        TFLAC_BW_UPDATE_CRC(&t->bw);
     }
     if( (r = tflac_bitwriter_align(&t->bw)) != 0) return r;
     if( (r = tflac_bitwriter_flush(&t->bw)) != 0) return r;
-    if( (r = tflac_bitwriter_add(&t->bw, 16, tflac_crc16(t->bw.buffer,t->bw.pos,0))) != 0) return r;
+    if( (r = tflac_bitwriter_add(&t->bw, 16, tflac_bitwriter_crc16(&t->bw))) != 0) return r;
     if( (r = tflac_bitwriter_flush(&t->bw)) != 0) return r;
 
     *(p->used) = t->bw.pos;
-    if(t->bw.pos < t->min_frame_size || t->min_frame_size == 0) {
-        t->min_frame_size = t->bw.pos;
+
+    return 0;
+}
+
+TFLAC_PRIVATE
+int tflac_encode(tflac* t, const tflac_encode_params* p) {
+    tflac_encode_params s;
+    double cost[7];
+    tflac_u32 blocksizes[4];
+    tflac_u32 count = 1;
+    tflac_u32 offset = 0;
+    tflac_u32 used = 0;
+    tflac_u32 i = 0;
+    tflac_u32 c = 0;
+    tflac_s16* s16[8];
+    tflac_s32* s32[8];
+#ifndef TFLAC_DISABLE_COUNTERS
+    tflac_u64 counts[8][TFLAC_SUBFRAME_TYPE_COUNT];
+#endif
+    int r;
+
+    tflac_set_cur_blocksize(t, p->blocksize);
+
+    if(t->enable_md5) {
+        if(t->md5_push != NULL) t->md5_push(t, p->format, p->blocksize, p->samples);
+        else p->calculate_md5(t, p->samples);
+    }
+
+    if(!tflac_split_allowed(t, p->blocksize)) {
+        if( (r = tflac_encode_frame(t, p, NULL)) != 0) return r;
+        tflac_add_frame(t, t->cur_blocksize, *(p->used));
+        return 0;
+    }
+
+    /* encode the whole block, scoring the ways of splitting it along
+     * the way, then only go back and redo it if splitting wins */
+#ifndef TFLAC_DISABLE_COUNTERS
+    for(c=0;c<t->channels;c++) {
+        for(i=0;i<TFLAC_SUBFRAME_TYPE_COUNT;i++) counts[c][i] = t->subframe_type_counts[c][i];
+    }
+#endif
+    for(i=0;i<7;i++) cost[i] = 0.0;
+    if( (r = tflac_encode_frame(t, p, cost)) != 0) return r;
+
+    count = tflac_split_block(t, p, cost, blocksizes);
+    if(count == 1) {
+        tflac_add_frame(t, t->cur_blocksize, *(p->used));
+        return 0;
+    }
+
+#ifndef TFLAC_DISABLE_COUNTERS
+    for(c=0;c<t->channels;c++) {
+        for(i=0;i<TFLAC_SUBFRAME_TYPE_COUNT;i++) t->subframe_type_counts[c][i] = counts[c][i];
+    }
+#endif
+
+    s = *p;
+    s.used = &used;
+    *(p->used) = 0;
+
+    for(i=0;i<count;i++) {
+        s.blocksize = blocksizes[i];
+
+        switch(p->format) {
+            case TFLAC_SAMPLES_S16P: {
+                for(c=0;c<t->channels;c++) {
+                    s16[c] = &((tflac_s16**)p->samples)[c][offset];
+                }
+                s.samples = s16;
+                break;
+            }
+            case TFLAC_SAMPLES_S16I: {
+                s.samples = &((tflac_s16*)p->samples)[offset * t->channels];
+                break;
+            }
+            case TFLAC_SAMPLES_S32P: {
+                for(c=0;c<t->channels;c++) {
+                    s32[c] = &((tflac_s32**)p->samples)[c][offset];
+                }
+                s.samples = s32;
+                break;
+            }
+            default: {
+                s.samples = &((tflac_s32*)p->samples)[offset * t->channels];
+                break;
+            }
+        }
+
+        if( (r = tflac_encode_frame(t, &s, NULL)) != 0) return r;
+        tflac_add_frame(t, t->cur_blocksize, used);
+
+        s.buffer = &((tflac_u8*)s.buffer)[used];
+        s.buffer_len -= used;
+        *(p->used) += used;
+        offset += blocksizes[i];
+    }
+
+    return 0;
+}
+
+TFLAC_PUBLIC
+void tflac_add_frame(tflac* t, tflac_u32 blocksize, tflac_u32 frame_size) {
+    if(frame_size < t->min_frame_size || t->min_frame_size == 0) {
+        t->min_frame_size = frame_size;
+    }
+
+    if(frame_size > t->max_frame_size) {
+        t->max_frame_size = frame_size;
+    }
+
+    /* the last block is allowed to be short, so it only counts towards
+     * the minimum once another frame comes after it */
+    if(t->last_blocksize != 0 && (t->last_blocksize < t->min_blocksize || t->min_blocksize == 0)) {
+        t->min_blocksize = t->last_blocksize;
     }
 
-    if(t->bw.pos > t->max_frame_size) {
-        t->max_frame_size = t->bw.pos;
+    if(blocksize > t->max_blocksize) {
+        t->max_blocksize = blocksize;
     }
+    t->last_blocksize = blocksize;
 
     t->frameno++;
     t->frameno &= UINT32_C(0x7FFFFFFF); /* cap to 31 bits */
 
-    TFLAC_U64_ADD_WORD(t->samplecount, t->cur_blocksize);
+    TFLAC_U64_ADD_WORD(t->samplecount, blocksize);
 
 #ifdef TFLAC_32BIT_ONLY
     t->samplecount.hi &= UINT32_C(0x0000000F); /* cap to 4 bits of extension */
 #else
     t->samplecount &= UINT64_C(0x0000000FFFFFFFFF); /* cap to 36 bits */
 #endif
-
-    return 0;
 }
 
 TFLAC_PUBLIC
@@ -4200,8 +9896,10 @@ int tflac_encode_s16p(tflac* t, tflac_u32 blocksize, tflac_s16** samples, void*
     p.buffer = buffer;
     p.used = used;
     p.samples = samples;
+    p.format = TFLAC_SAMPLES_S16P;
     p.calculate_md5 = (tflac_md5_calculator)tflac_update_md5_int16_planar;
     p.decorrelate = (tflac_stereo_decorrelator)tflac_stereo_decorrelate_int16_planar;
+    p.estimate = (tflac_stereo_estimator)tflac_stereo_estimate_int16_planar;
 
     return tflac_encode(t, &p);
 }
@@ -4215,7 +9913,9 @@ int tflac_encode_s16i(tflac* t, tflac_u32 blocksize, tflac_s16* samples, void* b
     p.buffer = buffer;
     p.used = used;
     p.samples = samples;
+    p.format = TFLAC_SAMPLES_S16I;
     p.decorrelate = (tflac_stereo_decorrelator)tflac_stereo_decorrelate_int16_interleaved;
+    p.estimate = (tflac_stereo_estimator)tflac_stereo_estimate_int16_interleaved;
 
     switch((7 + t->bitdepth) & 0xF8) {
         case 8:  p.calculate_md5 = (tflac_md5_calculator)tflac_update_md5_s16i_1; break;
@@ -4234,8 +9934,10 @@ int tflac_encode_s32p(tflac* t, tflac_u32 blocksize, tflac_s32** samples, void*
     p.buffer = buffer;
     p.used = used;
     p.samples = samples;
+    p.format = TFLAC_SAMPLES_S32P;
     p.calculate_md5 = (tflac_md5_calculator)tflac_update_md5_int32_planar;
     p.decorrelate = (tflac_stereo_decorrelator)tflac_stereo_decorrelate_int32_planar;
+    p.estimate = (tflac_stereo_estimator)tflac_stereo_estimate_int32_planar;
 
     return tflac_encode(t, &p);
 }
@@ -4249,7 +9951,9 @@ int tflac_encode_s32i(tflac* t, tflac_u32 blocksize, tflac_s32* samples, void* b
     p.buffer = buffer;
     p.used = used;
     p.samples = samples;
+    p.format = TFLAC_SAMPLES_S32I;
     p.decorrelate = (tflac_stereo_decorrelator)tflac_stereo_decorrelate_int32_interleaved;
+    p.estimate = (tflac_stereo_estimator)tflac_stereo_estimate_int32_interleaved;
 
     switch((7 + t->bitdepth) & 0xF8) {
         case 8:  p.calculate_md5 = (tflac_md5_calculator)tflac_update_md5_s32i_1; break;
@@ -4276,12 +9980,103 @@ tflac_u32 tflac_size(void) {
 TFLAC_PUBLIC
 void tflac_finalize(tflac* t) {
     if(t->enable_md5) {
+        if(t->md5_wait != NULL) t->md5_wait(t);
         tflac_md5_finalize(&t->md5_ctx);
         tflac_md5_digest(&t->md5_ctx, t->md5_digest);
     }
     tflac_md5_init(&t->md5_ctx);
 }
 
+TFLAC_PUBLIC
+void tflac_update_md5_s16p(tflac* t, tflac_u32 blocksize, tflac_s16** samples) {
+    tflac_u32 cur_blocksize = t->cur_blocksize;
+
+    if(!t->enable_md5) return;
+    if(t->md5_push != NULL) {
+        t->md5_push(t, TFLAC_SAMPLES_S16P, blocksize, samples);
+        return;
+    }
+
+    t->cur_blocksize = blocksize;
+    tflac_update_md5_int16_planar(t, (const tflac_s16**)samples);
+    t->cur_blocksize = cur_blocksize;
+}
+
+TFLAC_PUBLIC
+void tflac_update_md5_s16i(tflac* t, tflac_u32 blocksize, tflac_s16* samples) {
+    tflac_u32 cur_blocksize = t->cur_blocksize;
+
+    if(!t->enable_md5) return;
+    if(t->md5_push != NULL) {
+        t->md5_push(t, TFLAC_SAMPLES_S16I, blocksize, samples);
+        return;
+    }
+
+    t->cur_blocksize = blocksize;
+    switch((7 + t->bitdepth) & 0xF8) {
+        case 8:  tflac_update_md5_s16i_1(t, samples); break;
+        case 16: tflac_update_md5_s16i_2(t, samples); break;
+        default: break;
+    }
+    t->cur_blocksize = cur_blocksize;
+}
+
+TFLAC_PUBLIC
+void tflac_update_md5_s32p(tflac* t, tflac_u32 blocksize, tflac_s32** samples) {
+    tflac_u32 cur_blocksize = t->cur_blocksize;
+
+    if(!t->enable_md5) return;
+    if(t->md5_push != NULL) {
+        t->md5_push(t, TFLAC_SAMPLES_S32P, blocksize, samples);
+        return;
+    }
+
+    t->cur_blocksize = blocksize;
+    tflac_update_md5_int32_planar(t, (const tflac_s32**)samples);
+    t->cur_blocksize = cur_blocksize;
+}
+
+TFLAC_PUBLIC
+void tflac_update_md5_s32i(tflac* t, tflac_u32 blocksize, tflac_s32* samples) {
+    tflac_u32 cur_blocksize = t->cur_blocksize;
+
+    if(!t->enable_md5) return;
+    if(t->md5_push != NULL) {
+        t->md5_push(t, TFLAC_SAMPLES_S32I, blocksize, samples);
+        return;
+    }
+
+    t->cur_blocksize = blocksize;
+    switch((7 + t->bitdepth) & 0xF8) {
+        case 8:  tflac_update_md5_s32i_1(t, samples); break;
+        case 16: tflac_update_md5_s32i_2(t, samples); break;
+        case 24: tflac_update_md5_s32i_3(t, samples); break;
+        case 32: tflac_update_md5_s32i_4(t, samples); break;
+        default: break;
+    }
+    t->cur_blocksize = cur_blocksize;
+}
+
+TFLAC_PUBLIC
+void tflac_update_md5_multi_s16p(tflac** t, tflac_u32 count, const tflac_u32* blocksizes, tflac_s16*** samples) {
+    tflac_update_md5_multi(t, count, blocksizes, (const void* const*)samples, 1, 0);
+}
+
+TFLAC_PUBLIC
+void tflac_update_md5_multi_s16i(tflac** t, tflac_u32 count, const tflac_u32* blocksizes, tflac_s16** samples) {
+    tflac_update_md5_multi(t, count, blocksizes, (const void* const*)samples, 0, 0);
+}
+
+TFLAC_PUBLIC
+void tflac_update_md5_multi_s32p(tflac** t, tflac_u32 count, const tflac_u32* blocksizes, tflac_s32*** samples) {
+    tflac_update_md5_multi(t, count, blocksizes, (const void* const*)samples, 1, 1);
+}
+
+TFLAC_PUBLIC
+void tflac_update_md5_multi_s32i(tflac** t, tflac_u32 count, const tflac_u32* blocksizes, tflac_s32** samples) {
+    tflac_update_md5_multi(t, count, blocksizes, (const void* const*)samples, 0, 1);
+}
+
 TFLAC_PUBLIC
 int tflac_encode_streaminfo(const tflac* t, tflac_u32 lastflag, void* buffer, tflac_u32 len, tflac_u32* used) {
     int r;
@@ -4296,9 +10091,17 @@ int tflac_encode_streaminfo(const tflac* t, tflac_u32 lastflag, void* buffer, tf
     if( (r = tflac_bitwriter_add(&bw, 7, 0)) != 0) return r;
     if( (r = tflac_bitwriter_add(&bw, 24, 34)) != 0) return r;
 
-    /* min/max block sizes */
-    if( (r = tflac_bitwriter_add(&bw, 16, t->blocksize)) != 0) return r;
-    if( (r = tflac_bitwriter_add(&bw, 16, t->blocksize)) != 0) return r;
+    /* min/max block sizes, a variable blocksize stream reports what
+     * it actually used. The last frame doesn't count towards the
+     * minimum and can be under 16 samples, so until there's another
+     * frame just say blocksize */
+    if(t->enable_variable_blocksize && t->min_blocksize != 0) {
+        if( (r = tflac_bitwriter_add(&bw, 16, t->min_blocksize)) != 0) return r;
+        if( (r = tflac_bitwriter_add(&bw, 16, t->max_blocksize)) != 0) return r;
+    } else {
+        if( (r = tflac_bitwriter_add(&bw, 16, t->blocksize)) != 0) return r;
+        if( (r = tflac_bitwriter_add(&bw, 16, t->blocksize)) != 0) return r;
+    }
 
     /* min/max frame sizes */
     if( (r = tflac_bitwriter_add(&bw, 24, t->min_frame_size)) != 0) return r;
@@ -4385,41 +10188,250 @@ TFLAC_PUBLIC void tflac_set_fixed_subframe(tflac* t, tflac_u32 enable) {
     t->enable_fixed_subframe = (tflac_u8)enable;
 }
 
-TFLAC_PUBLIC void tflac_set_enable_md5(tflac* t, tflac_u32 enable) {
-    t->enable_md5 = (tflac_u8)enable;
+TFLAC_PUBLIC void tflac_set_partition_search(tflac* t, tflac_u32 enable) {
+    t->enable_partition_search = (tflac_u8)enable;
+}
+
+TFLAC_PUBLIC void tflac_set_exact_rice(tflac* t, tflac_u32 enable) {
+    t->enable_exact_rice = (tflac_u8)enable;
+}
+
+TFLAC_PUBLIC void tflac_set_variable_blocksize(tflac* t, tflac_u32 enable) {
+    t->enable_variable_blocksize = (tflac_u8)enable;
+}
+
+TFLAC_PUBLIC void tflac_set_lpc_subframe(tflac* t, tflac_u32 enable) {
+    t->enable_lpc_subframe = (tflac_u8)enable;
+}
+
+TFLAC_PUBLIC void tflac_set_max_lpc_order(tflac* t, tflac_u32 max_lpc_order) {
+    t->max_lpc_order = (tflac_u8)(max_lpc_order > TFLAC_MAX_LPC_ORDER ? TFLAC_MAX_LPC_ORDER : max_lpc_order);
+}
+
+TFLAC_PUBLIC void tflac_set_lpc_precision(tflac* t, tflac_u32 lpc_precision) {
+    t->lpc_precision = (tflac_u8)lpc_precision;
+}
+
+TFLAC_PUBLIC void tflac_set_enable_md5(tflac* t, tflac_u32 enable) {
+    t->enable_md5 = (tflac_u8)enable;
+}
+
+TFLAC_PUBLIC void tflac_set_frameno(tflac* t, tflac_u32 frameno) {
+    t->frameno = frameno & UINT32_C(0x7FFFFFFF);
+}
+
+TFLAC_PUBLIC
+tflac_u32 tflac_enable_sse2(tflac* t, tflac_u32 enable) {
+#ifdef TFLAC_ENABLE_SSE2
+    if(enable) {
+        t->calculate_order[0] = tflac_cfr_order0_sse2;
+        t->calculate_order[1] = tflac_cfr_order1_sse2;
+        t->calculate_order[2] = tflac_cfr_order2_sse2;
+        t->calculate_order[3] = tflac_cfr_order3_sse2;
+        t->calculate_order[4] = tflac_cfr_order4_sse2;
+        t->calculate_fused = tflac_cfr_fused_sse2;
+        t->decorrelate_s16i = tflac_decorrelate_s16i_sse2;
+        t->decorrelate_s16p = tflac_decorrelate_s16p_sse2;
+        t->decorrelate_s32i = tflac_decorrelate_s32i_sse2;
+        t->decorrelate_s32p = tflac_decorrelate_s32p_sse2;
+        t->fold_residuals = tflac_fold_residuals_sse2;
+    } else {
+        t->calculate_order[0] = tflac_cfr_order0_std;
+        t->calculate_order[1] = tflac_cfr_order1_std;
+        t->calculate_order[2] = tflac_cfr_order2_std;
+        t->calculate_order[3] = tflac_cfr_order3_std;
+        t->calculate_order[4] = tflac_cfr_order4_std;
+        t->calculate_fused = tflac_cfr_fused_std;
+        t->decorrelate_s16i = tflac_decorrelate_s16i_std;
+        t->decorrelate_s16p = tflac_decorrelate_s16p_std;
+        t->decorrelate_s32i = tflac_decorrelate_s32i_std;
+        t->decorrelate_s32p = tflac_decorrelate_s32p_std;
+        t->fold_residuals = tflac_fold_residuals_std;
+    }
+    switch(t->bitdepth) {
+        case 32: {
+            t->calculate_order[1] = tflac_cfr_order1_wide_std;
+        }
+        /* fall-through */
+        case 31: {
+            t->calculate_order[2] = tflac_cfr_order2_wide_std;
+        }
+        /* fall-through */
+        case 30: {
+            t->calculate_order[3] = tflac_cfr_order3_wide_std;
+        }
+        /* fall-through */
+        case 29: {
+            t->calculate_order[4] = tflac_cfr_order4_wide_std;
+            t->calculate_fused = NULL;
+        }
+        /* fall-through */
+        default: break;
+    }
+    return 0;
+#else
+    (void)t;
+    (void)enable;
+    return 1;
+#endif
+}
+
+TFLAC_PUBLIC
+tflac_u32 tflac_enable_ssse3(tflac* t, tflac_u32 enable) {
+#ifdef TFLAC_ENABLE_SSSE3
+    if(enable) {
+        t->calculate_order[0] = tflac_cfr_order0_ssse3;
+        t->calculate_order[1] = tflac_cfr_order1_ssse3;
+        t->calculate_order[2] = tflac_cfr_order2_ssse3;
+        t->calculate_order[3] = tflac_cfr_order3_ssse3;
+        t->calculate_order[4] = tflac_cfr_order4_ssse3;
+        t->calculate_fused = tflac_cfr_fused_sse2;
+        t->decorrelate_s16i = tflac_decorrelate_s16i_sse2;
+        t->decorrelate_s16p = tflac_decorrelate_s16p_sse2;
+        t->decorrelate_s32i = tflac_decorrelate_s32i_sse2;
+        t->decorrelate_s32p = tflac_decorrelate_s32p_sse2;
+        t->fold_residuals = tflac_fold_residuals_sse2;
+    } else {
+        t->calculate_order[0] = tflac_cfr_order0_std;
+        t->calculate_order[1] = tflac_cfr_order1_std;
+        t->calculate_order[2] = tflac_cfr_order2_std;
+        t->calculate_order[3] = tflac_cfr_order3_std;
+        t->calculate_order[4] = tflac_cfr_order4_std;
+        t->calculate_fused = tflac_cfr_fused_std;
+        t->decorrelate_s16i = tflac_decorrelate_s16i_std;
+        t->decorrelate_s16p = tflac_decorrelate_s16p_std;
+        t->decorrelate_s32i = tflac_decorrelate_s32i_std;
+        t->decorrelate_s32p = tflac_decorrelate_s32p_std;
+        t->fold_residuals = tflac_fold_residuals_std;
+    }
+    switch(t->bitdepth) {
+        case 32: {
+            t->calculate_order[1] = tflac_cfr_order1_wide_std;
+        }
+        /* fall-through */
+        case 31: {
+            t->calculate_order[2] = tflac_cfr_order2_wide_std;
+        }
+        /* fall-through */
+        case 30: {
+            t->calculate_order[3] = tflac_cfr_order3_wide_std;
+        }
+        /* fall-through */
+        case 29: {
+            t->calculate_order[4] = tflac_cfr_order4_wide_std;
+            t->calculate_fused = NULL;
+        }
+        /* fall-through */
+        default: break;
+    }
+    return 0;
+#else
+    (void)t;
+    (void)enable;
+    return 1;
+#endif
+}
+
+TFLAC_PUBLIC
+tflac_u32 tflac_enable_sse4_1(tflac* t, tflac_u32 enable) {
+#ifdef TFLAC_ENABLE_SSE4_1
+    if(enable) {
+        t->calculate_order[0] = tflac_cfr_order0_sse4_1;
+        t->calculate_order[1] = tflac_cfr_order1_sse4_1;
+        t->calculate_order[2] = tflac_cfr_order2_sse4_1;
+        t->calculate_order[3] = tflac_cfr_order3_sse4_1;
+        t->calculate_order[4] = tflac_cfr_order4_sse4_1;
+        t->calculate_fused = tflac_cfr_fused_sse2;
+        t->decorrelate_s16i = tflac_decorrelate_s16i_sse2;
+        t->decorrelate_s16p = tflac_decorrelate_s16p_sse2;
+        t->decorrelate_s32i = tflac_decorrelate_s32i_sse2;
+        t->decorrelate_s32p = tflac_decorrelate_s32p_sse2;
+        t->fold_residuals = tflac_fold_residuals_sse2;
+    } else {
+        t->calculate_order[0] = tflac_cfr_order0_std;
+        t->calculate_order[1] = tflac_cfr_order1_std;
+        t->calculate_order[2] = tflac_cfr_order2_std;
+        t->calculate_order[3] = tflac_cfr_order3_std;
+        t->calculate_order[4] = tflac_cfr_order4_std;
+        t->calculate_fused = tflac_cfr_fused_std;
+        t->decorrelate_s16i = tflac_decorrelate_s16i_std;
+        t->decorrelate_s16p = tflac_decorrelate_s16p_std;
+        t->decorrelate_s32i = tflac_decorrelate_s32i_std;
+        t->decorrelate_s32p = tflac_decorrelate_s32p_std;
+        t->fold_residuals = tflac_fold_residuals_std;
+    }
+    switch(t->bitdepth) {
+        case 32: {
+            t->calculate_order[1] = enable ? tflac_cfr_order1_wide_sse4_1 : tflac_cfr_order1_wide_std;
+        }
+        /* fall-through */
+        case 31: {
+            t->calculate_order[2] = enable ? tflac_cfr_order2_wide_sse4_1 : tflac_cfr_order2_wide_std;
+        }
+        /* fall-through */
+        case 30: {
+            t->calculate_order[3] = enable ? tflac_cfr_order3_wide_sse4_1 : tflac_cfr_order3_wide_std;
+        }
+        /* fall-through */
+        case 29: {
+            t->calculate_order[4] = enable ? tflac_cfr_order4_wide_sse4_1 : tflac_cfr_order4_wide_std;
+            t->calculate_fused = NULL;
+        }
+        /* fall-through */
+        default: break;
+    }
+    return 0;
+#else
+    (void)t;
+    (void)enable;
+    return 1;
+#endif
 }
 
 TFLAC_PUBLIC
-tflac_u32 tflac_enable_sse2(tflac* t, tflac_u32 enable) {
-#ifdef TFLAC_ENABLE_SSE2
+tflac_u32 tflac_enable_avx2(tflac* t, tflac_u32 enable) {
+#ifdef TFLAC_ENABLE_AVX2
     if(enable) {
-        t->calculate_order[0] = tflac_cfr_order0_sse2;
-        t->calculate_order[1] = tflac_cfr_order1_sse2;
-        t->calculate_order[2] = tflac_cfr_order2_sse2;
-        t->calculate_order[3] = tflac_cfr_order3_sse2;
-        t->calculate_order[4] = tflac_cfr_order4_sse2;
+        t->calculate_order[0] = tflac_cfr_order0_avx2;
+        t->calculate_order[1] = tflac_cfr_order1_avx2;
+        t->calculate_order[2] = tflac_cfr_order2_avx2;
+        t->calculate_order[3] = tflac_cfr_order3_avx2;
+        t->calculate_order[4] = tflac_cfr_order4_avx2;
+        t->calculate_fused = tflac_cfr_fused_avx2;
+        t->decorrelate_s16i = tflac_decorrelate_s16i_avx2;
+        t->decorrelate_s16p = tflac_decorrelate_s16p_avx2;
+        t->decorrelate_s32i = tflac_decorrelate_s32i_avx2;
+        t->decorrelate_s32p = tflac_decorrelate_s32p_avx2;
+        t->fold_residuals = tflac_fold_residuals_avx2;
     } else {
         t->calculate_order[0] = tflac_cfr_order0_std;
         t->calculate_order[1] = tflac_cfr_order1_std;
         t->calculate_order[2] = tflac_cfr_order2_std;
         t->calculate_order[3] = tflac_cfr_order3_std;
         t->calculate_order[4] = tflac_cfr_order4_std;
+        t->calculate_fused = tflac_cfr_fused_std;
+        t->decorrelate_s16i = tflac_decorrelate_s16i_std;
+        t->decorrelate_s16p = tflac_decorrelate_s16p_std;
+        t->decorrelate_s32i = tflac_decorrelate_s32i_std;
+        t->decorrelate_s32p = tflac_decorrelate_s32p_std;
+        t->fold_residuals = tflac_fold_residuals_std;
     }
     switch(t->bitdepth) {
         case 32: {
-            t->calculate_order[1] = tflac_cfr_order1_wide;
+            t->calculate_order[1] = enable ? tflac_cfr_order1_wide_avx2 : tflac_cfr_order1_wide_std;
         }
         /* fall-through */
         case 31: {
-            t->calculate_order[2] = tflac_cfr_order2_wide;
+            t->calculate_order[2] = enable ? tflac_cfr_order2_wide_avx2 : tflac_cfr_order2_wide_std;
         }
         /* fall-through */
         case 30: {
-            t->calculate_order[3] = tflac_cfr_order3_wide;
+            t->calculate_order[3] = enable ? tflac_cfr_order3_wide_avx2 : tflac_cfr_order3_wide_std;
         }
         /* fall-through */
         case 29: {
-            t->calculate_order[4] = tflac_cfr_order4_wide;
+            t->calculate_order[4] = enable ? tflac_cfr_order4_wide_avx2 : tflac_cfr_order4_wide_std;
+            t->calculate_fused = NULL;
         }
         /* fall-through */
         default: break;
@@ -4433,36 +10445,84 @@ tflac_u32 tflac_enable_sse2(tflac* t, tflac_u32 enable) {
 }
 
 TFLAC_PUBLIC
-tflac_u32 tflac_enable_ssse3(tflac* t, tflac_u32 enable) {
-#ifdef TFLAC_ENABLE_SSSE3
+tflac_u32 tflac_enable_avx512(tflac* t, tflac_u32 enable) {
+#ifdef TFLAC_ENABLE_AVX512
+    /* this also picks the wide calculators for the bit depth */
+    tflac_enable_avx2(t, enable);
     if(enable) {
-        t->calculate_order[0] = tflac_cfr_order0_ssse3;
-        t->calculate_order[1] = tflac_cfr_order1_ssse3;
-        t->calculate_order[2] = tflac_cfr_order2_ssse3;
-        t->calculate_order[3] = tflac_cfr_order3_ssse3;
-        t->calculate_order[4] = tflac_cfr_order4_ssse3;
+        t->calculate_order[0] = tflac_cfr_order0_avx512;
+        if(t->bitdepth < 32) t->calculate_order[1] = tflac_cfr_order1_avx512;
+        if(t->bitdepth < 31) t->calculate_order[2] = tflac_cfr_order2_avx512;
+        if(t->bitdepth < 30) t->calculate_order[3] = tflac_cfr_order3_avx512;
+        if(t->bitdepth < 29) {
+            t->calculate_order[4] = tflac_cfr_order4_avx512;
+            t->calculate_fused = tflac_cfr_fused_avx512;
+        }
+    }
+    return 0;
+#else
+    (void)t;
+    (void)enable;
+    return 1;
+#endif
+}
+
+TFLAC_PUBLIC
+tflac_u32 tflac_enable_pclmul(tflac* t, tflac_u32 enable) {
+#ifdef TFLAC_ENABLE_PCLMUL
+    t->calculate_crc16 = enable ? tflac_crc16_pclmul : tflac_crc16_std;
+    return 0;
+#else
+    (void)t;
+    (void)enable;
+    return 1;
+#endif
+}
+
+TFLAC_PUBLIC
+tflac_u32 tflac_enable_neon(tflac* t, tflac_u32 enable) {
+#ifdef TFLAC_ENABLE_NEON
+    if(enable) {
+        t->calculate_order[0] = tflac_cfr_order0_neon;
+        t->calculate_order[1] = tflac_cfr_order1_neon;
+        t->calculate_order[2] = tflac_cfr_order2_neon;
+        t->calculate_order[3] = tflac_cfr_order3_neon;
+        t->calculate_order[4] = tflac_cfr_order4_neon;
+        t->calculate_fused = tflac_cfr_fused_neon;
+        t->decorrelate_s16i = tflac_decorrelate_s16i_neon;
+        t->decorrelate_s16p = tflac_decorrelate_s16p_neon;
+        t->decorrelate_s32i = tflac_decorrelate_s32i_neon;
+        t->decorrelate_s32p = tflac_decorrelate_s32p_neon;
+        t->fold_residuals = tflac_fold_residuals_neon;
     } else {
         t->calculate_order[0] = tflac_cfr_order0_std;
         t->calculate_order[1] = tflac_cfr_order1_std;
         t->calculate_order[2] = tflac_cfr_order2_std;
         t->calculate_order[3] = tflac_cfr_order3_std;
         t->calculate_order[4] = tflac_cfr_order4_std;
+        t->calculate_fused = tflac_cfr_fused_std;
+        t->decorrelate_s16i = tflac_decorrelate_s16i_std;
+        t->decorrelate_s16p = tflac_decorrelate_s16p_std;
+        t->decorrelate_s32i = tflac_decorrelate_s32i_std;
+        t->decorrelate_s32p = tflac_decorrelate_s32p_std;
+        t->fold_residuals = tflac_fold_residuals_std;
     }
     switch(t->bitdepth) {
         case 32: {
-            t->calculate_order[1] = tflac_cfr_order1_wide;
+            t->calculate_order[1] = enable ? tflac_cfr_order1_wide_neon : tflac_cfr_order1_wide_std;
         }
         /* fall-through */
         case 31: {
-            t->calculate_order[2] = tflac_cfr_order2_wide;
+            t->calculate_order[2] = enable ? tflac_cfr_order2_wide_neon : tflac_cfr_order2_wide_std;
         }
         /* fall-through */
         case 30: {
-            t->calculate_order[3] = tflac_cfr_order3_wide;
+            t->calculate_order[3] = enable ? tflac_cfr_order3_wide_neon : tflac_cfr_order3_wide_std;
         }
         /* fall-through */
         case 29: {
-            t->calculate_order[4] = tflac_cfr_order4_wide;
+            t->calculate_order[4] = enable ? tflac_cfr_order4_wide_neon : tflac_cfr_order4_wide_std;
+            t->calculate_fused = NULL;
         }
         /* fall-through */
         default: break;
@@ -4476,36 +10536,48 @@ tflac_u32 tflac_enable_ssse3(tflac* t, tflac_u32 enable) {
 }
 
 TFLAC_PUBLIC
-tflac_u32 tflac_enable_sse4_1(tflac* t, tflac_u32 enable) {
-#ifdef TFLAC_ENABLE_SSE4_1
+tflac_u32 tflac_enable_simd128(tflac* t, tflac_u32 enable) {
+#ifdef TFLAC_ENABLE_SIMD128
     if(enable) {
-        t->calculate_order[0] = tflac_cfr_order0_sse4_1;
-        t->calculate_order[1] = tflac_cfr_order1_sse4_1;
-        t->calculate_order[2] = tflac_cfr_order2_sse4_1;
-        t->calculate_order[3] = tflac_cfr_order3_sse4_1;
-        t->calculate_order[4] = tflac_cfr_order4_sse4_1;
+        t->calculate_order[0] = tflac_cfr_order0_simd128;
+        t->calculate_order[1] = tflac_cfr_order1_simd128;
+        t->calculate_order[2] = tflac_cfr_order2_simd128;
+        t->calculate_order[3] = tflac_cfr_order3_simd128;
+        t->calculate_order[4] = tflac_cfr_order4_simd128;
+        t->calculate_fused = tflac_cfr_fused_simd128;
+        t->decorrelate_s16i = tflac_decorrelate_s16i_simd128;
+        t->decorrelate_s16p = tflac_decorrelate_s16p_simd128;
+        t->decorrelate_s32i = tflac_decorrelate_s32i_simd128;
+        t->decorrelate_s32p = tflac_decorrelate_s32p_simd128;
     } else {
         t->calculate_order[0] = tflac_cfr_order0_std;
         t->calculate_order[1] = tflac_cfr_order1_std;
         t->calculate_order[2] = tflac_cfr_order2_std;
         t->calculate_order[3] = tflac_cfr_order3_std;
         t->calculate_order[4] = tflac_cfr_order4_std;
+        t->calculate_fused = tflac_cfr_fused_std;
+        t->decorrelate_s16i = tflac_decorrelate_s16i_std;
+        t->decorrelate_s16p = tflac_decorrelate_s16p_std;
+        t->decorrelate_s32i = tflac_decorrelate_s32i_std;
+        t->decorrelate_s32p = tflac_decorrelate_s32p_std;
     }
+    t->fold_residuals = tflac_fold_residuals_std;
     switch(t->bitdepth) {
         case 32: {
-            t->calculate_order[1] = tflac_cfr_order1_wide;
+            t->calculate_order[1] = tflac_cfr_order1_wide_std;
         }
         /* fall-through */
         case 31: {
-            t->calculate_order[2] = tflac_cfr_order2_wide;
+            t->calculate_order[2] = tflac_cfr_order2_wide_std;
         }
         /* fall-through */
         case 30: {
-            t->calculate_order[3] = tflac_cfr_order3_wide;
+            t->calculate_order[3] = tflac_cfr_order3_wide_std;
         }
         /* fall-through */
         case 29: {
-            t->calculate_order[4] = tflac_cfr_order4_wide;
+            t->calculate_order[4] = tflac_cfr_order4_wide_std;
+            t->calculate_fused = NULL;
         }
         /* fall-through */
         default: break;
@@ -4545,6 +10617,51 @@ TFLAC_PURE TFLAC_PUBLIC tflac_u32 tflac_get_enable_sse4_1(const tflac* t) {
 #endif
 }
 
+TFLAC_PURE TFLAC_PUBLIC tflac_u32 tflac_get_enable_avx2(const tflac* t) {
+#ifdef TFLAC_ENABLE_AVX2
+    return t->calculate_order[0] == tflac_cfr_order0_avx2;
+#else
+    (void)t;
+    return 0;
+#endif
+}
+
+TFLAC_PURE TFLAC_PUBLIC tflac_u32 tflac_get_enable_avx512(const tflac* t) {
+#ifdef TFLAC_ENABLE_AVX512
+    return t->calculate_order[0] == tflac_cfr_order0_avx512;
+#else
+    (void)t;
+    return 0;
+#endif
+}
+
+TFLAC_PURE TFLAC_PUBLIC tflac_u32 tflac_get_enable_pclmul(const tflac* t) {
+#ifdef TFLAC_ENABLE_PCLMUL
+    return t->calculate_crc16 == tflac_crc16_pclmul;
+#else
+    (void)t;
+    return 0;
+#endif
+}
+
+TFLAC_PURE TFLAC_PUBLIC tflac_u32 tflac_get_enable_neon(const tflac* t) {
+#ifdef TFLAC_ENABLE_NEON
+    return t->calculate_order[0] == tflac_cfr_order0_neon;
+#else
+    (void)t;
+    return 0;
+#endif
+}
+
+TFLAC_PURE TFLAC_PUBLIC tflac_u32 tflac_get_enable_simd128(const tflac* t) {
+#ifdef TFLAC_ENABLE_SIMD128
+    return t->calculate_order[0] == tflac_cfr_order0_simd128;
+#else
+    (void)t;
+    return 0;
+#endif
+}
+
 TFLAC_PURE TFLAC_PUBLIC tflac_u32 tflac_get_blocksize(const tflac* t) {
     return t->blocksize;
 }
@@ -4562,6 +10679,7 @@ TFLAC_PURE TFLAC_PUBLIC tflac_u32 tflac_get_bitdepth(const tflac* t) {
 }
 
 TFLAC_PURE TFLAC_PUBLIC tflac_u32 tflac_get_channel_mode(const tflac* t) {
+    if(t->channel_mode == TFLAC_CHANNEL_AUTO) return TFLAC_CHANNEL_AUTO;
     return t->channel_mode >= ((tflac_u32) TFLAC_CHANNEL_MODE_COUNT) ? 0 : t->channel_mode;
 }
 
@@ -4585,6 +10703,30 @@ TFLAC_PURE TFLAC_PUBLIC tflac_u32 tflac_get_fixed_subframe(const tflac* t) {
     return t->enable_fixed_subframe;
 }
 
+TFLAC_PURE TFLAC_PUBLIC tflac_u32 tflac_get_partition_search(const tflac* t) {
+    return t->enable_partition_search;
+}
+
+TFLAC_PURE TFLAC_PUBLIC tflac_u32 tflac_get_exact_rice(const tflac* t) {
+    return t->enable_exact_rice;
+}
+
+TFLAC_PURE TFLAC_PUBLIC tflac_u32 tflac_get_variable_blocksize(const tflac* t) {
+    return t->enable_variable_blocksize;
+}
+
+TFLAC_PURE TFLAC_PUBLIC tflac_u32 tflac_get_lpc_subframe(const tflac* t) {
+    return t->enable_lpc_subframe;
+}
+
+TFLAC_PURE TFLAC_PUBLIC tflac_u32 tflac_get_max_lpc_order(const tflac* t) {
+    return t->max_lpc_order;
+}
+
+TFLAC_PURE TFLAC_PUBLIC tflac_u32 tflac_get_lpc_precision(const tflac* t) {
+    return t->lpc_precision;
+}
+
 TFLAC_PURE TFLAC_PUBLIC tflac_u32 tflac_get_wasted_bits(const tflac* t) {
     return t->wasted_bits;
 }
@@ -4597,17 +10739,19 @@ TFLAC_PURE TFLAC_PUBLIC tflac_u32 tflac_get_enable_md5(const tflac* t) {
     return t->enable_md5;
 }
 
-/* TODO:
- *
- *   For SUBFRAME_FIXED:
+TFLAC_PURE TFLAC_PUBLIC tflac_u32 tflac_get_frameno(const tflac* t) {
+    return t->frameno;
+}
+
+/* NOTE:
  *
- *       I'm not sure if the best thing to is is pick the largest partition
- *       order since that results in the smallest partition size, or to try
- *       all partition orders until the one that results in the smallest
- *       length is found?
+ *   By default we pick the largest partition order since that results in
+ *   the smallest partition size. Using the largest order is really, really
+ *   fast and still gets decent compression results.
  *
- *       Using the largest order seems to be seems to be really, really fast
- *       and still get decent compression results.
+ *   With tflac_set_partition_search() enabled we sum the partitions at the
+ *   largest order once, then merge pairs of sums to estimate every order
+ *   down to min_partition_order and keep the smallest.
  */
 
 TFLAC_PRIVATE const tflac_u8 tflac_crc8_table[256] = {
@@ -4920,59 +11064,159 @@ TFLAC_PRIVATE const tflac_u16 tflac_crc16_tables[8][256] = {
   },
 };
 
+/* NEON is always there on AArch64, so it starts out as the default
+ * instead of waiting on tflac_detect_cpu. Same for SIMD128, which is
+ * only in the fixed-order calculators and decorrelation */
+#if defined(TFLAC_ENABLE_NEON)
+#define TFLAC_DEFAULT_IMPL(f) f ## _neon
+#define TFLAC_DEFAULT_CFR_IMPL(f) f ## _neon
+#elif defined(TFLAC_ENABLE_SIMD128)
+#define TFLAC_DEFAULT_IMPL(f) f ## _std
+#define TFLAC_DEFAULT_CFR_IMPL(f) f ## _simd128
+#else
+#define TFLAC_DEFAULT_IMPL(f) f ## _std
+#define TFLAC_DEFAULT_CFR_IMPL(f) f ## _std
+#endif
+
 TFLAC_PRIVATE void (*tflac_cfr_order0)(
     tflac_u32 blocksize,
     const tflac_s32* TFLAC_RESTRICT,
     tflac_s32* TFLAC_RESTRICT,
-    tflac_u64* TFLAC_RESTRICT) = tflac_cfr_order0_std;
+    tflac_u64* TFLAC_RESTRICT) = TFLAC_DEFAULT_CFR_IMPL(tflac_cfr_order0);
 
 TFLAC_PRIVATE void (*tflac_cfr_order1)(
     tflac_u32 blocksize,
     const tflac_s32* TFLAC_RESTRICT,
     tflac_s32* TFLAC_RESTRICT,
-    tflac_u64* TFLAC_RESTRICT) = tflac_cfr_order1_std;
+    tflac_u64* TFLAC_RESTRICT) = TFLAC_DEFAULT_CFR_IMPL(tflac_cfr_order1);
 
 TFLAC_PRIVATE void (*tflac_cfr_order2)(
     tflac_u32 blocksize,
     const tflac_s32* TFLAC_RESTRICT,
     tflac_s32* TFLAC_RESTRICT,
-    tflac_u64* TFLAC_RESTRICT) = tflac_cfr_order2_std;
+    tflac_u64* TFLAC_RESTRICT) = TFLAC_DEFAULT_CFR_IMPL(tflac_cfr_order2);
 
 TFLAC_PRIVATE void (*tflac_cfr_order3)(
     tflac_u32 blocksize,
     const tflac_s32* TFLAC_RESTRICT,
     tflac_s32* TFLAC_RESTRICT,
-    tflac_u64* TFLAC_RESTRICT) = tflac_cfr_order3_std;
+    tflac_u64* TFLAC_RESTRICT) = TFLAC_DEFAULT_CFR_IMPL(tflac_cfr_order3);
 
 TFLAC_PRIVATE void (*tflac_cfr_order4)(
     tflac_u32 blocksize,
     const tflac_s32* TFLAC_RESTRICT,
     tflac_s32* TFLAC_RESTRICT,
-    tflac_u64* TFLAC_RESTRICT) = tflac_cfr_order4_std;
+    tflac_u64* TFLAC_RESTRICT) = TFLAC_DEFAULT_CFR_IMPL(tflac_cfr_order4);
+
+TFLAC_PRIVATE void (*tflac_cfr_fused)(
+    tflac_u32 blocksize,
+    const tflac_s32* TFLAC_RESTRICT,
+    tflac_u64* TFLAC_RESTRICT) = TFLAC_DEFAULT_CFR_IMPL(tflac_cfr_fused);
+
+TFLAC_PRIVATE tflac_stereo_decorrelator_int16 tflac_decorrelate_s16i = TFLAC_DEFAULT_CFR_IMPL(tflac_decorrelate_s16i);
+TFLAC_PRIVATE tflac_decorrelator_int16 tflac_decorrelate_s16p = TFLAC_DEFAULT_CFR_IMPL(tflac_decorrelate_s16p);
+TFLAC_PRIVATE tflac_stereo_decorrelator_int32 tflac_decorrelate_s32i = TFLAC_DEFAULT_CFR_IMPL(tflac_decorrelate_s32i);
+TFLAC_PRIVATE tflac_decorrelator_int32 tflac_decorrelate_s32p = TFLAC_DEFAULT_CFR_IMPL(tflac_decorrelate_s32p);
+
+TFLAC_PRIVATE tflac_md5_multi_transform tflac_md5_transform_multi = tflac_md5_transform_multi_std;
+TFLAC_PRIVATE tflac_md5_packer_int16 tflac_md5_pack_s16 = TFLAC_DEFAULT_IMPL(tflac_md5_pack_s16);
+TFLAC_PRIVATE tflac_md5_packer_int32 tflac_md5_pack_s32 = TFLAC_DEFAULT_IMPL(tflac_md5_pack_s32);
+
+TFLAC_PRIVATE tflac_u16 (*tflac_crc16)(const tflac_u8*, tflac_u32, tflac_u16) = tflac_crc16_std;
+
+TFLAC_PRIVATE tflac_residual_folder tflac_fold_residuals = TFLAC_DEFAULT_IMPL(tflac_fold_residuals);
 
 TFLAC_PRIVATE void (*tflac_cfr_order1_wide)(
     tflac_u32 blocksize,
     const tflac_s32* TFLAC_RESTRICT,
     tflac_s32* TFLAC_RESTRICT,
-    tflac_u64* TFLAC_RESTRICT) = tflac_cfr_order1_wide_std;
+    tflac_u64* TFLAC_RESTRICT) = TFLAC_DEFAULT_IMPL(tflac_cfr_order1_wide);
 
 TFLAC_PRIVATE void (*tflac_cfr_order2_wide)(
     tflac_u32 blocksize,
     const tflac_s32* TFLAC_RESTRICT,
     tflac_s32* TFLAC_RESTRICT,
-    tflac_u64* TFLAC_RESTRICT) = tflac_cfr_order2_wide_std;
+    tflac_u64* TFLAC_RESTRICT) = TFLAC_DEFAULT_IMPL(tflac_cfr_order2_wide);
 
 TFLAC_PRIVATE void (*tflac_cfr_order3_wide)(
     tflac_u32 blocksize,
     const tflac_s32* TFLAC_RESTRICT,
     tflac_s32* TFLAC_RESTRICT,
-    tflac_u64* TFLAC_RESTRICT) = tflac_cfr_order3_wide_std;
+    tflac_u64* TFLAC_RESTRICT) = TFLAC_DEFAULT_IMPL(tflac_cfr_order3_wide);
 
 TFLAC_PRIVATE void (*tflac_cfr_order4_wide)(
     tflac_u32 blocksize,
     const tflac_s32* TFLAC_RESTRICT,
     tflac_s32* TFLAC_RESTRICT,
-    tflac_u64* TFLAC_RESTRICT) = tflac_cfr_order4_wide_std;
+    tflac_u64* TFLAC_RESTRICT) = TFLAC_DEFAULT_IMPL(tflac_cfr_order4_wide);
+
+#undef TFLAC_DEFAULT_IMPL
+#undef TFLAC_DEFAULT_CFR_IMPL
+
+#ifdef TFLAC_ENABLE_AVX2
+/* AVX2 needs the CPU flag from leaf 7, plus the OS has to
+ * save the YMM registers (OSXSAVE set, XCR0 bits 1 and 2) */
+TFLAC_PRIVATE int tflac_detect_avx2(const int* info) {
+    int ext[4];
+    tflac_u32 max_leaf = 0;
+    tflac_u32 xcr0 = 0;
+    ext[0] = 0;
+    ext[1] = 0;
+    ext[2] = 0;
+    ext[3] = 0;
+
+    if( (info[2] & (1 << 27)) == 0) return 0; /* OSXSAVE */
+    if( (info[2] & (1 << 28)) == 0) return 0; /* AVX */
+
+#if defined(_MSC_VER)
+    __cpuid(ext,0);
+    max_leaf = (tflac_u32)ext[0];
+    if(max_leaf >= 7) __cpuidex(ext,7,0);
+    xcr0 = (tflac_u32)_xgetbv(0);
+#elif defined(__GNUC__)
+    max_leaf = __get_cpuid_max(0, NULL);
+    if(max_leaf >= 7) __cpuid_count(7, 0, ext[0], ext[1], ext[2], ext[3]);
+    {
+        tflac_u32 hi;
+        __asm__ __volatile__("xgetbv" : "=a"(xcr0), "=d"(hi) : "c"(0));
+        (void)hi;
+    }
+#endif
+
+    if(max_leaf < 7) return 0;
+    if( (xcr0 & 0x06) != 0x06) return 0;
+    return (ext[1] & (1 << 5)) != 0;
+}
+#endif
+
+#ifdef TFLAC_ENABLE_AVX512
+/* AVX-512F is leaf 7 ebx bit 16, and the OS has to save the opmask
+ * and ZMM registers too (XCR0 bits 5-7 on top of 1 and 2). Only call
+ * this once tflac_detect_avx2 passed. */
+TFLAC_PRIVATE int tflac_detect_avx512(void) {
+    int ext[4];
+    tflac_u32 xcr0 = 0;
+    ext[0] = 0;
+    ext[1] = 0;
+    ext[2] = 0;
+    ext[3] = 0;
+
+#if defined(_MSC_VER)
+    __cpuidex(ext,7,0);
+    xcr0 = (tflac_u32)_xgetbv(0);
+#elif defined(__GNUC__)
+    __cpuid_count(7, 0, ext[0], ext[1], ext[2], ext[3]);
+    {
+        tflac_u32 hi;
+        __asm__ __volatile__("xgetbv" : "=a"(xcr0), "=d"(hi) : "c"(0));
+        (void)hi;
+    }
+#endif
+
+    if( (xcr0 & 0xE6) != 0xE6) return 0;
+    return (ext[1] & (1 << 16)) != 0;
+}
+#endif
 
 TFLAC_PUBLIC
 void tflac_detect_cpu(void) {
@@ -4997,6 +11241,15 @@ void tflac_detect_cpu(void) {
         tflac_cfr_order2 = tflac_cfr_order2_sse2;
         tflac_cfr_order3 = tflac_cfr_order3_sse2;
         tflac_cfr_order4 = tflac_cfr_order4_sse2;
+        tflac_cfr_fused = tflac_cfr_fused_sse2;
+        tflac_decorrelate_s16i = tflac_decorrelate_s16i_sse2;
+        tflac_decorrelate_s16p = tflac_decorrelate_s16p_sse2;
+        tflac_decorrelate_s32i = tflac_decorrelate_s32i_sse2;
+        tflac_decorrelate_s32p = tflac_decorrelate_s32p_sse2;
+        tflac_fold_residuals = tflac_fold_residuals_sse2;
+        tflac_md5_transform_multi = tflac_md5_transform_multi_sse2;
+        tflac_md5_pack_s16 = tflac_md5_pack_s16_sse2;
+        tflac_md5_pack_s32 = tflac_md5_pack_s32_sse2;
     }
 #endif
 
@@ -5007,6 +11260,15 @@ void tflac_detect_cpu(void) {
         tflac_cfr_order2 = tflac_cfr_order2_ssse3;
         tflac_cfr_order3 = tflac_cfr_order3_ssse3;
         tflac_cfr_order4 = tflac_cfr_order4_ssse3;
+        tflac_cfr_fused = tflac_cfr_fused_sse2;
+        tflac_decorrelate_s16i = tflac_decorrelate_s16i_sse2;
+        tflac_decorrelate_s16p = tflac_decorrelate_s16p_sse2;
+        tflac_decorrelate_s32i = tflac_decorrelate_s32i_sse2;
+        tflac_decorrelate_s32p = tflac_decorrelate_s32p_sse2;
+        tflac_fold_residuals = tflac_fold_residuals_sse2;
+        tflac_md5_transform_multi = tflac_md5_transform_multi_sse2;
+        tflac_md5_pack_s16 = tflac_md5_pack_s16_sse2;
+        tflac_md5_pack_s32 = tflac_md5_pack_s32_ssse3;
     }
 #endif
 
@@ -5017,8 +11279,64 @@ void tflac_detect_cpu(void) {
         tflac_cfr_order2 = tflac_cfr_order2_sse4_1;
         tflac_cfr_order3 = tflac_cfr_order3_sse4_1;
         tflac_cfr_order4 = tflac_cfr_order4_sse4_1;
+        tflac_cfr_fused = tflac_cfr_fused_sse2;
+        tflac_decorrelate_s16i = tflac_decorrelate_s16i_sse2;
+        tflac_decorrelate_s16p = tflac_decorrelate_s16p_sse2;
+        tflac_decorrelate_s32i = tflac_decorrelate_s32i_sse2;
+        tflac_decorrelate_s32p = tflac_decorrelate_s32p_sse2;
+        tflac_fold_residuals = tflac_fold_residuals_sse2;
+        tflac_cfr_order1_wide = tflac_cfr_order1_wide_sse4_1;
+        tflac_cfr_order2_wide = tflac_cfr_order2_wide_sse4_1;
+        tflac_cfr_order3_wide = tflac_cfr_order3_wide_sse4_1;
+        tflac_cfr_order4_wide = tflac_cfr_order4_wide_sse4_1;
+        tflac_md5_transform_multi = tflac_md5_transform_multi_sse2;
+    }
+#endif
+
+#ifdef TFLAC_ENABLE_AVX2
+    if(tflac_detect_avx2(info)) {
+        tflac_cfr_order0 = tflac_cfr_order0_avx2;
+        tflac_cfr_order1 = tflac_cfr_order1_avx2;
+        tflac_cfr_order2 = tflac_cfr_order2_avx2;
+        tflac_cfr_order3 = tflac_cfr_order3_avx2;
+        tflac_cfr_order4 = tflac_cfr_order4_avx2;
+        tflac_cfr_fused = tflac_cfr_fused_avx2;
+        tflac_decorrelate_s16i = tflac_decorrelate_s16i_avx2;
+        tflac_decorrelate_s16p = tflac_decorrelate_s16p_avx2;
+        tflac_decorrelate_s32i = tflac_decorrelate_s32i_avx2;
+        tflac_decorrelate_s32p = tflac_decorrelate_s32p_avx2;
+        tflac_fold_residuals = tflac_fold_residuals_avx2;
+        tflac_cfr_order1_wide = tflac_cfr_order1_wide_avx2;
+        tflac_cfr_order2_wide = tflac_cfr_order2_wide_avx2;
+        tflac_cfr_order3_wide = tflac_cfr_order3_wide_avx2;
+        tflac_cfr_order4_wide = tflac_cfr_order4_wide_avx2;
+        tflac_md5_transform_multi = tflac_md5_transform_multi_avx2;
+#ifdef TFLAC_ENABLE_AVX512
+        if(tflac_detect_avx512()) {
+            tflac_cfr_order0 = tflac_cfr_order0_avx512;
+            tflac_cfr_order1 = tflac_cfr_order1_avx512;
+            tflac_cfr_order2 = tflac_cfr_order2_avx512;
+            tflac_cfr_order3 = tflac_cfr_order3_avx512;
+            tflac_cfr_order4 = tflac_cfr_order4_avx512;
+            tflac_cfr_fused = tflac_cfr_fused_avx512;
+        }
+#endif
+    }
+#endif
+
+#ifdef TFLAC_ENABLE_PCLMUL
+    if( (info[2] & (1 << 1)) != 0 && (info[2] & (1 << 9)) != 0) {
+        tflac_crc16 = tflac_crc16_pclmul;
     }
 #endif
+
+#ifdef TFLAC_ENABLE_NEON
+    tflac_default_neon(1);
+#endif
+
+#ifdef TFLAC_ENABLE_SIMD128
+    tflac_default_simd128(1);
+#endif
 }
 
 TFLAC_PUBLIC
@@ -5030,12 +11348,38 @@ int tflac_default_sse2(int enable) {
         tflac_cfr_order2 = tflac_cfr_order2_sse2;
         tflac_cfr_order3 = tflac_cfr_order3_sse2;
         tflac_cfr_order4 = tflac_cfr_order4_sse2;
+        tflac_cfr_fused = tflac_cfr_fused_sse2;
+        tflac_decorrelate_s16i = tflac_decorrelate_s16i_sse2;
+        tflac_decorrelate_s16p = tflac_decorrelate_s16p_sse2;
+        tflac_decorrelate_s32i = tflac_decorrelate_s32i_sse2;
+        tflac_decorrelate_s32p = tflac_decorrelate_s32p_sse2;
+        tflac_fold_residuals = tflac_fold_residuals_sse2;
+        tflac_cfr_order1_wide = tflac_cfr_order1_wide_std;
+        tflac_cfr_order2_wide = tflac_cfr_order2_wide_std;
+        tflac_cfr_order3_wide = tflac_cfr_order3_wide_std;
+        tflac_cfr_order4_wide = tflac_cfr_order4_wide_std;
+        tflac_md5_transform_multi = tflac_md5_transform_multi_sse2;
+        tflac_md5_pack_s16 = tflac_md5_pack_s16_sse2;
+        tflac_md5_pack_s32 = tflac_md5_pack_s32_sse2;
     } else {
         tflac_cfr_order0 = tflac_cfr_order0_std;
         tflac_cfr_order1 = tflac_cfr_order1_std;
         tflac_cfr_order2 = tflac_cfr_order2_std;
         tflac_cfr_order3 = tflac_cfr_order3_std;
         tflac_cfr_order4 = tflac_cfr_order4_std;
+        tflac_cfr_fused = tflac_cfr_fused_std;
+        tflac_decorrelate_s16i = tflac_decorrelate_s16i_std;
+        tflac_decorrelate_s16p = tflac_decorrelate_s16p_std;
+        tflac_decorrelate_s32i = tflac_decorrelate_s32i_std;
+        tflac_decorrelate_s32p = tflac_decorrelate_s32p_std;
+        tflac_fold_residuals = tflac_fold_residuals_std;
+        tflac_cfr_order1_wide = tflac_cfr_order1_wide_std;
+        tflac_cfr_order2_wide = tflac_cfr_order2_wide_std;
+        tflac_cfr_order3_wide = tflac_cfr_order3_wide_std;
+        tflac_cfr_order4_wide = tflac_cfr_order4_wide_std;
+        tflac_md5_transform_multi = tflac_md5_transform_multi_std;
+        tflac_md5_pack_s16 = tflac_md5_pack_s16_std;
+        tflac_md5_pack_s32 = tflac_md5_pack_s32_std;
     }
     return 0;
 #else
@@ -5053,12 +11397,38 @@ int tflac_default_ssse3(int enable) {
         tflac_cfr_order2 = tflac_cfr_order2_ssse3;
         tflac_cfr_order3 = tflac_cfr_order3_ssse3;
         tflac_cfr_order4 = tflac_cfr_order4_ssse3;
+        tflac_cfr_fused = tflac_cfr_fused_sse2;
+        tflac_decorrelate_s16i = tflac_decorrelate_s16i_sse2;
+        tflac_decorrelate_s16p = tflac_decorrelate_s16p_sse2;
+        tflac_decorrelate_s32i = tflac_decorrelate_s32i_sse2;
+        tflac_decorrelate_s32p = tflac_decorrelate_s32p_sse2;
+        tflac_fold_residuals = tflac_fold_residuals_sse2;
+        tflac_cfr_order1_wide = tflac_cfr_order1_wide_std;
+        tflac_cfr_order2_wide = tflac_cfr_order2_wide_std;
+        tflac_cfr_order3_wide = tflac_cfr_order3_wide_std;
+        tflac_cfr_order4_wide = tflac_cfr_order4_wide_std;
+        tflac_md5_transform_multi = tflac_md5_transform_multi_sse2;
+        tflac_md5_pack_s16 = tflac_md5_pack_s16_sse2;
+        tflac_md5_pack_s32 = tflac_md5_pack_s32_ssse3;
     } else {
         tflac_cfr_order0 = tflac_cfr_order0_std;
         tflac_cfr_order1 = tflac_cfr_order1_std;
         tflac_cfr_order2 = tflac_cfr_order2_std;
         tflac_cfr_order3 = tflac_cfr_order3_std;
         tflac_cfr_order4 = tflac_cfr_order4_std;
+        tflac_cfr_fused = tflac_cfr_fused_std;
+        tflac_decorrelate_s16i = tflac_decorrelate_s16i_std;
+        tflac_decorrelate_s16p = tflac_decorrelate_s16p_std;
+        tflac_decorrelate_s32i = tflac_decorrelate_s32i_std;
+        tflac_decorrelate_s32p = tflac_decorrelate_s32p_std;
+        tflac_fold_residuals = tflac_fold_residuals_std;
+        tflac_cfr_order1_wide = tflac_cfr_order1_wide_std;
+        tflac_cfr_order2_wide = tflac_cfr_order2_wide_std;
+        tflac_cfr_order3_wide = tflac_cfr_order3_wide_std;
+        tflac_cfr_order4_wide = tflac_cfr_order4_wide_std;
+        tflac_md5_transform_multi = tflac_md5_transform_multi_std;
+        tflac_md5_pack_s16 = tflac_md5_pack_s16_std;
+        tflac_md5_pack_s32 = tflac_md5_pack_s32_std;
     }
     return 0;
 #else
@@ -5076,13 +11446,215 @@ int tflac_default_sse4_1(int enable) {
         tflac_cfr_order2 = tflac_cfr_order2_sse4_1;
         tflac_cfr_order3 = tflac_cfr_order3_sse4_1;
         tflac_cfr_order4 = tflac_cfr_order4_sse4_1;
+        tflac_cfr_fused = tflac_cfr_fused_sse2;
+        tflac_decorrelate_s16i = tflac_decorrelate_s16i_sse2;
+        tflac_decorrelate_s16p = tflac_decorrelate_s16p_sse2;
+        tflac_decorrelate_s32i = tflac_decorrelate_s32i_sse2;
+        tflac_decorrelate_s32p = tflac_decorrelate_s32p_sse2;
+        tflac_fold_residuals = tflac_fold_residuals_sse2;
+        tflac_cfr_order1_wide = tflac_cfr_order1_wide_sse4_1;
+        tflac_cfr_order2_wide = tflac_cfr_order2_wide_sse4_1;
+        tflac_cfr_order3_wide = tflac_cfr_order3_wide_sse4_1;
+        tflac_cfr_order4_wide = tflac_cfr_order4_wide_sse4_1;
+        tflac_md5_transform_multi = tflac_md5_transform_multi_sse2;
+        tflac_md5_pack_s16 = tflac_md5_pack_s16_sse2;
+#ifdef TFLAC_ENABLE_SSSE3
+        tflac_md5_pack_s32 = tflac_md5_pack_s32_ssse3;
+#else
+        tflac_md5_pack_s32 = tflac_md5_pack_s32_sse2;
+#endif
+    } else {
+        tflac_cfr_order0 = tflac_cfr_order0_std;
+        tflac_cfr_order1 = tflac_cfr_order1_std;
+        tflac_cfr_order2 = tflac_cfr_order2_std;
+        tflac_cfr_order3 = tflac_cfr_order3_std;
+        tflac_cfr_order4 = tflac_cfr_order4_std;
+        tflac_cfr_fused = tflac_cfr_fused_std;
+        tflac_decorrelate_s16i = tflac_decorrelate_s16i_std;
+        tflac_decorrelate_s16p = tflac_decorrelate_s16p_std;
+        tflac_decorrelate_s32i = tflac_decorrelate_s32i_std;
+        tflac_decorrelate_s32p = tflac_decorrelate_s32p_std;
+        tflac_fold_residuals = tflac_fold_residuals_std;
+        tflac_cfr_order1_wide = tflac_cfr_order1_wide_std;
+        tflac_cfr_order2_wide = tflac_cfr_order2_wide_std;
+        tflac_cfr_order3_wide = tflac_cfr_order3_wide_std;
+        tflac_cfr_order4_wide = tflac_cfr_order4_wide_std;
+        tflac_md5_transform_multi = tflac_md5_transform_multi_std;
+        tflac_md5_pack_s16 = tflac_md5_pack_s16_std;
+        tflac_md5_pack_s32 = tflac_md5_pack_s32_std;
+    }
+    return 0;
+#else
+    (void)enable;
+    return 1;
+#endif
+}
+
+TFLAC_PUBLIC
+int tflac_default_avx2(int enable) {
+#ifdef TFLAC_ENABLE_AVX2
+    if(enable) {
+        tflac_cfr_order0 = tflac_cfr_order0_avx2;
+        tflac_cfr_order1 = tflac_cfr_order1_avx2;
+        tflac_cfr_order2 = tflac_cfr_order2_avx2;
+        tflac_cfr_order3 = tflac_cfr_order3_avx2;
+        tflac_cfr_order4 = tflac_cfr_order4_avx2;
+        tflac_cfr_fused = tflac_cfr_fused_avx2;
+        tflac_decorrelate_s16i = tflac_decorrelate_s16i_avx2;
+        tflac_decorrelate_s16p = tflac_decorrelate_s16p_avx2;
+        tflac_decorrelate_s32i = tflac_decorrelate_s32i_avx2;
+        tflac_decorrelate_s32p = tflac_decorrelate_s32p_avx2;
+        tflac_fold_residuals = tflac_fold_residuals_avx2;
+        tflac_cfr_order1_wide = tflac_cfr_order1_wide_avx2;
+        tflac_cfr_order2_wide = tflac_cfr_order2_wide_avx2;
+        tflac_cfr_order3_wide = tflac_cfr_order3_wide_avx2;
+        tflac_cfr_order4_wide = tflac_cfr_order4_wide_avx2;
+        tflac_md5_transform_multi = tflac_md5_transform_multi_avx2;
+        /* no AVX2 packers, use the best SSE ones */
+#if defined(TFLAC_ENABLE_SSSE3)
+        tflac_md5_pack_s16 = tflac_md5_pack_s16_sse2;
+        tflac_md5_pack_s32 = tflac_md5_pack_s32_ssse3;
+#elif defined(TFLAC_ENABLE_SSE2) || defined(TFLAC_ENABLE_SSE4_1)
+        tflac_md5_pack_s16 = tflac_md5_pack_s16_sse2;
+        tflac_md5_pack_s32 = tflac_md5_pack_s32_sse2;
+#endif
+    } else {
+        tflac_cfr_order0 = tflac_cfr_order0_std;
+        tflac_cfr_order1 = tflac_cfr_order1_std;
+        tflac_cfr_order2 = tflac_cfr_order2_std;
+        tflac_cfr_order3 = tflac_cfr_order3_std;
+        tflac_cfr_order4 = tflac_cfr_order4_std;
+        tflac_cfr_fused = tflac_cfr_fused_std;
+        tflac_decorrelate_s16i = tflac_decorrelate_s16i_std;
+        tflac_decorrelate_s16p = tflac_decorrelate_s16p_std;
+        tflac_decorrelate_s32i = tflac_decorrelate_s32i_std;
+        tflac_decorrelate_s32p = tflac_decorrelate_s32p_std;
+        tflac_fold_residuals = tflac_fold_residuals_std;
+        tflac_cfr_order1_wide = tflac_cfr_order1_wide_std;
+        tflac_cfr_order2_wide = tflac_cfr_order2_wide_std;
+        tflac_cfr_order3_wide = tflac_cfr_order3_wide_std;
+        tflac_cfr_order4_wide = tflac_cfr_order4_wide_std;
+        tflac_md5_transform_multi = tflac_md5_transform_multi_std;
+        tflac_md5_pack_s16 = tflac_md5_pack_s16_std;
+        tflac_md5_pack_s32 = tflac_md5_pack_s32_std;
+    }
+    return 0;
+#else
+    (void)enable;
+    return 1;
+#endif
+}
+
+TFLAC_PUBLIC
+int tflac_default_avx512(int enable) {
+#ifdef TFLAC_ENABLE_AVX512
+    tflac_default_avx2(enable);
+    if(enable) {
+        tflac_cfr_order0 = tflac_cfr_order0_avx512;
+        tflac_cfr_order1 = tflac_cfr_order1_avx512;
+        tflac_cfr_order2 = tflac_cfr_order2_avx512;
+        tflac_cfr_order3 = tflac_cfr_order3_avx512;
+        tflac_cfr_order4 = tflac_cfr_order4_avx512;
+        tflac_cfr_fused = tflac_cfr_fused_avx512;
+    }
+    return 0;
+#else
+    (void)enable;
+    return 1;
+#endif
+}
+
+TFLAC_PUBLIC
+int tflac_default_pclmul(int enable) {
+#ifdef TFLAC_ENABLE_PCLMUL
+    tflac_crc16 = enable ? tflac_crc16_pclmul : tflac_crc16_std;
+    return 0;
+#else
+    (void)enable;
+    return 1;
+#endif
+}
+
+TFLAC_PUBLIC
+int tflac_default_neon(int enable) {
+#ifdef TFLAC_ENABLE_NEON
+    if(enable) {
+        tflac_cfr_order0 = tflac_cfr_order0_neon;
+        tflac_cfr_order1 = tflac_cfr_order1_neon;
+        tflac_cfr_order2 = tflac_cfr_order2_neon;
+        tflac_cfr_order3 = tflac_cfr_order3_neon;
+        tflac_cfr_order4 = tflac_cfr_order4_neon;
+        tflac_cfr_fused = tflac_cfr_fused_neon;
+        tflac_decorrelate_s16i = tflac_decorrelate_s16i_neon;
+        tflac_decorrelate_s16p = tflac_decorrelate_s16p_neon;
+        tflac_decorrelate_s32i = tflac_decorrelate_s32i_neon;
+        tflac_decorrelate_s32p = tflac_decorrelate_s32p_neon;
+        tflac_fold_residuals = tflac_fold_residuals_neon;
+        tflac_cfr_order1_wide = tflac_cfr_order1_wide_neon;
+        tflac_cfr_order2_wide = tflac_cfr_order2_wide_neon;
+        tflac_cfr_order3_wide = tflac_cfr_order3_wide_neon;
+        tflac_cfr_order4_wide = tflac_cfr_order4_wide_neon;
+        tflac_md5_pack_s16 = tflac_md5_pack_s16_neon;
+        tflac_md5_pack_s32 = tflac_md5_pack_s32_neon;
+    } else {
+        tflac_cfr_order0 = tflac_cfr_order0_std;
+        tflac_cfr_order1 = tflac_cfr_order1_std;
+        tflac_cfr_order2 = tflac_cfr_order2_std;
+        tflac_cfr_order3 = tflac_cfr_order3_std;
+        tflac_cfr_order4 = tflac_cfr_order4_std;
+        tflac_cfr_fused = tflac_cfr_fused_std;
+        tflac_decorrelate_s16i = tflac_decorrelate_s16i_std;
+        tflac_decorrelate_s16p = tflac_decorrelate_s16p_std;
+        tflac_decorrelate_s32i = tflac_decorrelate_s32i_std;
+        tflac_decorrelate_s32p = tflac_decorrelate_s32p_std;
+        tflac_fold_residuals = tflac_fold_residuals_std;
+        tflac_cfr_order1_wide = tflac_cfr_order1_wide_std;
+        tflac_cfr_order2_wide = tflac_cfr_order2_wide_std;
+        tflac_cfr_order3_wide = tflac_cfr_order3_wide_std;
+        tflac_cfr_order4_wide = tflac_cfr_order4_wide_std;
+        tflac_md5_pack_s16 = tflac_md5_pack_s16_std;
+        tflac_md5_pack_s32 = tflac_md5_pack_s32_std;
+    }
+    return 0;
+#else
+    (void)enable;
+    return 1;
+#endif
+}
+
+TFLAC_PUBLIC
+int tflac_default_simd128(int enable) {
+#ifdef TFLAC_ENABLE_SIMD128
+    if(enable) {
+        tflac_cfr_order0 = tflac_cfr_order0_simd128;
+        tflac_cfr_order1 = tflac_cfr_order1_simd128;
+        tflac_cfr_order2 = tflac_cfr_order2_simd128;
+        tflac_cfr_order3 = tflac_cfr_order3_simd128;
+        tflac_cfr_order4 = tflac_cfr_order4_simd128;
+        tflac_cfr_fused = tflac_cfr_fused_simd128;
+        tflac_decorrelate_s16i = tflac_decorrelate_s16i_simd128;
+        tflac_decorrelate_s16p = tflac_decorrelate_s16p_simd128;
+        tflac_decorrelate_s32i = tflac_decorrelate_s32i_simd128;
+        tflac_decorrelate_s32p = tflac_decorrelate_s32p_simd128;
     } else {
         tflac_cfr_order0 = tflac_cfr_order0_std;
         tflac_cfr_order1 = tflac_cfr_order1_std;
         tflac_cfr_order2 = tflac_cfr_order2_std;
         tflac_cfr_order3 = tflac_cfr_order3_std;
         tflac_cfr_order4 = tflac_cfr_order4_std;
+        tflac_cfr_fused = tflac_cfr_fused_std;
+        tflac_decorrelate_s16i = tflac_decorrelate_s16i_std;
+        tflac_decorrelate_s16p = tflac_decorrelate_s16p_std;
+        tflac_decorrelate_s32i = tflac_decorrelate_s32i_std;
+        tflac_decorrelate_s32p = tflac_decorrelate_s32p_std;
     }
+    tflac_fold_residuals = tflac_fold_residuals_std;
+    tflac_cfr_order1_wide = tflac_cfr_order1_wide_std;
+    tflac_cfr_order2_wide = tflac_cfr_order2_wide_std;
+    tflac_cfr_order3_wide = tflac_cfr_order3_wide_std;
+    tflac_cfr_order4_wide = tflac_cfr_order4_wide_std;
+    tflac_md5_pack_s16 = tflac_md5_pack_s16_std;
+    tflac_md5_pack_s32 = tflac_md5_pack_s32_std;
     return 0;
 #else
     (void)enable;
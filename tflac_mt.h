@@ -0,0 +1,842 @@
+/* SPDX-License-Identifier: 0BSD */
+
+#ifndef TFLAC_MT_HEADER_GUARD
+#define TFLAC_MT_HEADER_GUARD
+
+/*
+Copyright (C) 2024 John Regan <john@jrjrtech.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/*
+
+TFLAC_MT
+========
+
+A frame-parallel encoder built on top of tflac. FLAC frames don't depend
+on each other, so a long run of samples can be split into frames and
+handed out to a pool of worker threads, each with its own tflac instance
+and residual memory. The frames are put back in order once they're all
+done, and a single "master" tflac tracks everything that goes into the
+STREAMINFO block (frame number, sample count, min/max frame sizes, MD5).
+
+Unlike tflac.h this uses the C library and POSIX threads, but it still
+doesn't allocate memory.
+
+Every block becomes exactly one frame, so variable blocksize mode isn't
+supported, tflac_mt_validate fails if it's enabled.
+
+In one C file, define TFLAC_MT_IMPLEMENTATION before including this
+header (tflac.h still needs TFLAC_IMPLEMENTATION somewhere):
+
+    #define TFLAC_IMPLEMENTATION
+    #define TFLAC_MT_IMPLEMENTATION
+    #include "tflac_mt.h"
+
+Initialize a tflac_mt with tflac_mt_init, set your encoder parameters on
+the master tflac (the "t" field) and the number of worker threads:
+
+    tflac_mt m;
+
+    tflac_mt_init(&m);
+    m.t.channels = 2;
+    m.t.blocksize = 1152;
+    m.t.bitdepth = 16;
+    m.t.samplerate = 44100;
+    m.threads = 8;
+
+Every worker needs its own residual memory, get the total size with
+tflac_mt_size_memory. tflac_mt_validate validates the settings, copies
+them into every worker, and starts the threads:
+
+    tflac_u32 mem_size = tflac_mt_size_memory(8, 1152);
+    void* block = malloc(mem_size);
+    tflac_mt_validate(&m, block, mem_size);
+
+Each call to a tflac_mt_encode function takes a run of samples (the
+number of samples per channel, all frames but the last get the full
+block size) and writes the encoded frames to a buffer, in order. Every
+frame gets a worst-case slot in the buffer while encoding, use
+tflac_mt_size_buffer to find out how big the buffer needs to be for
+a given run length:
+
+    tflac_u32 buffer_len = tflac_mt_size_buffer(1152 * 64, 1152, 2, 16);
+    void* buffer = malloc(buffer_len);
+    tflac_mt_encode_s16i(&m, 1152 * 64, samples, buffer, buffer_len, &used);
+
+Larger runs keep the threads busy for longer, you'll want at least a few
+frames per thread. The calling thread computes the MD5 checksum while the
+workers encode, unless a tflac_md5_thread was started on the master (see
+below).
+
+When you're done call tflac_mt_finalize, then use the master tflac
+to create your STREAMINFO block. tflac_mt_destroy stops the threads.
+
+MD5 HELPER THREAD
+-----------------
+
+MD5 has to see every sample in order, so it can't be spread across
+threads like frames can. A tflac_md5_thread takes it off the encoding
+thread instead: once started on a tflac, every block of samples that
+would be hashed gets copied into a ring of slots and a dedicated thread
+hashes them in order. This works with a plain tflac as well as a
+tflac_mt's master, and samples don't need to stay around once the
+encode call returns.
+
+The ring lives in memory you provide, each slot holds up to one block
+of samples. If the ring fills up the encoding thread waits for a free
+slot, a few slots is enough to smooth things out:
+
+    tflac_md5_thread h;
+    tflac_u32 md5_size = tflac_md5_thread_size_memory(4, 1152, 2);
+    void* md5_block = malloc(md5_size);
+    tflac_md5_thread_start(&h, &t, 4, md5_block, md5_size);
+
+tflac_finalize waits for the ring to drain before computing the digest.
+tflac_md5_thread_stop waits for it too, then stops the thread and hands
+MD5 back to the encoding thread.
+*/
+
+#include "tflac.h"
+
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct tflac_mt_worker tflac_mt_worker;
+
+struct tflac_mt {
+    tflac t; /* the master encoder, set your parameters here */
+    tflac_u32 threads; /* number of worker threads */
+
+    tflac_mt_worker* workers;
+    tflac_u32 running; /* number of started threads */
+    tflac_u32 slot_len; /* bytes reserved per frame in the output buffer */
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+
+    /* the current run */
+    tflac_u32 generation;
+    tflac_u32 quit;
+    tflac_u32 format;
+    void* samples;
+    tflac_u32 samples_len;
+    tflac_u8* buffer;
+    tflac_u32 frameno;
+    tflac_u32 frames;
+    tflac_u32 next_frame;
+    tflac_u32 done_frames;
+    int error;
+};
+typedef struct tflac_mt tflac_mt;
+
+/* returns how much memory the workers need for their tflac structs and residuals */
+TFLAC_PUBLIC
+TFLAC_CONST
+tflac_u32 tflac_mt_size_memory(tflac_u32 threads, tflac_u32 blocksize);
+
+/* returns the buffer size needed to encode a run of samples, or 0 if
+ * it would overflow */
+TFLAC_PUBLIC
+TFLAC_CONST
+tflac_u32 tflac_mt_size_buffer(tflac_u32 samples, tflac_u32 blocksize, tflac_u32 channels, tflac_u32 bitdepth);
+
+TFLAC_PUBLIC
+void tflac_mt_init(tflac_mt *);
+
+/* validates settings, sets up the workers and starts the threads */
+TFLAC_PUBLIC
+int tflac_mt_validate(tflac_mt *, void* ptr, tflac_u32 len);
+
+TFLAC_PUBLIC
+int tflac_mt_encode_s16p(tflac_mt *, tflac_u32 samples_len, tflac_s16** samples, void* buffer, tflac_u32 len, tflac_u32* used);
+
+TFLAC_PUBLIC
+int tflac_mt_encode_s16i(tflac_mt *, tflac_u32 samples_len, tflac_s16* samples, void* buffer, tflac_u32 len, tflac_u32* used);
+
+TFLAC_PUBLIC
+int tflac_mt_encode_s32p(tflac_mt *, tflac_u32 samples_len, tflac_s32** samples, void* buffer, tflac_u32 len, tflac_u32* used);
+
+TFLAC_PUBLIC
+int tflac_mt_encode_s32i(tflac_mt *, tflac_u32 samples_len, tflac_s32* samples, void* buffer, tflac_u32 len, tflac_u32* used);
+
+/* computes the final MD5 digest on the master tflac, if it was enabled */
+TFLAC_PUBLIC
+void tflac_mt_finalize(tflac_mt *);
+
+/* stops the worker threads */
+TFLAC_PUBLIC
+void tflac_mt_destroy(tflac_mt *);
+
+struct tflac_md5_thread {
+    tflac md5; /* private copy of the encoder, only its MD5 state is used */
+    tflac* t; /* the encoder we're hashing for */
+
+    tflac_u8* slots;
+    tflac_u32 slot_len; /* bytes per slot */
+    tflac_u32 slot_count;
+    tflac_u32 slot_samples; /* samples per channel that fit in a slot */
+
+    /* single producer (the encoding thread) and single consumer (the
+     * MD5 thread), each index is only written by one side */
+    tflac_u32 head; /* slots filled */
+    tflac_u32 tail; /* slots hashed */
+
+    /* set by either side before sleeping, so the other knows to signal */
+    tflac_u32 producer_waiting;
+    tflac_u32 consumer_waiting;
+
+    tflac_u32 resync; /* set after tflac_finalize reset the MD5 */
+    tflac_u32 quit;
+    tflac_u32 running;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t space;
+};
+typedef struct tflac_md5_thread tflac_md5_thread;
+
+/* returns how much memory the ring needs */
+TFLAC_PUBLIC
+TFLAC_CONST
+tflac_u32 tflac_md5_thread_size_memory(tflac_u32 slots, tflac_u32 blocksize, tflac_u32 channels);
+
+/* starts hashing t's samples on a helper thread, t's blocksize, channels
+ * and bitdepth need to be set already */
+TFLAC_PUBLIC
+int tflac_md5_thread_start(tflac_md5_thread *, tflac* t, tflac_u32 slots, void* ptr, tflac_u32 len);
+
+/* waits for the ring to drain, stops the thread and hands MD5 back to t */
+TFLAC_PUBLIC
+void tflac_md5_thread_stop(tflac_md5_thread *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ifndef TFLAC_MT_HEADER_GUARD */
+
+#ifdef TFLAC_MT_IMPLEMENTATION
+
+#include <string.h>
+
+enum TFLAC_MT_FORMAT {
+    TFLAC_MT_FORMAT_S16P = 0,
+    TFLAC_MT_FORMAT_S16I = 1,
+    TFLAC_MT_FORMAT_S32P = 2,
+    TFLAC_MT_FORMAT_S32I = 3
+};
+
+struct tflac_mt_worker {
+    tflac t;
+    tflac_mt* m;
+    pthread_t thread;
+};
+
+/* the MD5 ring's indices are lock-free when the compiler has atomics,
+ * the mutex is only taken to sleep or wake the other side up */
+#ifdef __ATOMIC_SEQ_CST
+#define TFLAC_MT_LOAD(h, p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define TFLAC_MT_STORE(h, p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define TFLAC_MT_LOAD_LOCKED(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define TFLAC_MT_STORE_LOCKED(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#else
+#define TFLAC_MT_LOAD(h, p) tflac_md5_thread_load((h), (p))
+#define TFLAC_MT_STORE(h, p, v) tflac_md5_thread_store((h), (p), (v))
+#define TFLAC_MT_LOAD_LOCKED(p) (*(p))
+#define TFLAC_MT_STORE_LOCKED(p, v) (*(p) = (v))
+#endif
+
+/* every MD5 slot starts with the format and number of samples */
+#define TFLAC_MD5_SLOT_HEADER UINT32_C(8)
+
+/* every frame slot starts with the encoded length */
+#define TFLAC_MT_SLOT_HEADER UINT32_C(4)
+#define TFLAC_MT_WORKER_LEN ((15UL + sizeof(tflac_mt_worker)) & ~15UL)
+
+TFLAC_PRIVATE void* tflac_mt_worker_run(void* userdata);
+TFLAC_PRIVATE int tflac_mt_encode_frame(tflac_mt* m, tflac_mt_worker* w, tflac_u32 frame);
+TFLAC_PRIVATE int tflac_mt_encode(tflac_mt* m, tflac_u32 format, tflac_u32 samples_len, void* samples, void* buffer, tflac_u32 len, tflac_u32* used);
+
+TFLAC_PRIVATE void* tflac_md5_thread_run(void* userdata);
+TFLAC_PRIVATE void tflac_md5_thread_hash(tflac_md5_thread* h, const tflac_u8* slot);
+TFLAC_PRIVATE void tflac_md5_thread_drain(tflac_md5_thread* h, tflac_u32 pending);
+TFLAC_PRIVATE void tflac_md5_thread_push(tflac* t, tflac_u32 format, tflac_u32 blocksize, const void* samples);
+TFLAC_PRIVATE void tflac_md5_thread_wait(tflac* t);
+#ifndef __ATOMIC_SEQ_CST
+TFLAC_PRIVATE tflac_u32 tflac_md5_thread_load(tflac_md5_thread* h, const tflac_u32* p);
+TFLAC_PRIVATE void tflac_md5_thread_store(tflac_md5_thread* h, tflac_u32* p, tflac_u32 v);
+#endif
+
+TFLAC_PUBLIC
+TFLAC_CONST
+tflac_u32 tflac_mt_size_memory(tflac_u32 threads, tflac_u32 blocksize) {
+    return (tflac_u32)(15UL + (threads * (TFLAC_MT_WORKER_LEN + tflac_size_memory(blocksize))));
+}
+
+TFLAC_PUBLIC
+TFLAC_CONST
+tflac_u32 tflac_mt_size_buffer(tflac_u32 samples, tflac_u32 blocksize, tflac_u32 channels, tflac_u32 bitdepth) {
+    tflac_u32 frames;
+    tflac_u32 slot_len;
+
+    if(blocksize == 0) return 0;
+
+    frames = (samples / blocksize) + (samples % blocksize != 0);
+    slot_len = TFLAC_MT_SLOT_HEADER + tflac_size_frame(blocksize, channels, bitdepth);
+
+    if(frames > UINT32_C(0xFFFFFFFF) / slot_len) return 0;
+    return frames * slot_len;
+}
+
+TFLAC_PUBLIC
+void tflac_mt_init(tflac_mt* m) {
+    tflac_init(&m->t);
+    m->threads = 0;
+    m->workers = NULL;
+    m->running = 0;
+    m->slot_len = 0;
+    m->generation = 0;
+    m->quit = 0;
+    m->format = 0;
+    m->samples = NULL;
+    m->samples_len = 0;
+    m->buffer = NULL;
+    m->frameno = 0;
+    m->frames = 0;
+    m->next_frame = 0;
+    m->done_frames = 0;
+    m->error = 0;
+}
+
+TFLAC_PUBLIC
+int tflac_mt_validate(tflac_mt* m, void* ptr, tflac_u32 len) {
+    tflac_u32 i = 0;
+    tflac_u32 mem_len = 0;
+    tflac_u8* d;
+    tflac_mt_worker* w;
+
+    if(m->threads == 0) return -1;
+    if(m->t.blocksize == 0) return -1;
+
+    /* frames are put back together assuming one per block */
+    if(m->t.enable_variable_blocksize) return -1;
+    if(len < tflac_mt_size_memory(m->threads, m->t.blocksize)) return -1;
+
+    d = (tflac_u8*)ptr;
+    d += (16 - (((tflac_uptr)d) & 15)) & 15;
+
+    m->workers = (tflac_mt_worker*)d;
+    d += m->threads * TFLAC_MT_WORKER_LEN;
+
+    mem_len = tflac_size_memory(m->t.blocksize);
+
+    for(i=0;i<m->threads;i++) {
+        w = &m->workers[i];
+        memcpy(&w->t, &m->t, sizeof(tflac));
+        w->t.enable_md5 = 0; /* the master handles MD5 */
+        w->m = m;
+        if(tflac_validate(&w->t, d, mem_len) != 0) {
+            m->workers = NULL;
+            return -1;
+        }
+        d += mem_len;
+    }
+
+    m->slot_len = TFLAC_MT_SLOT_HEADER + tflac_size_frame(m->t.blocksize, m->t.channels, m->t.bitdepth);
+    m->generation = 0;
+    m->quit = 0;
+    m->running = 0;
+
+    if(pthread_mutex_init(&m->lock, NULL) != 0) {
+        m->workers = NULL;
+        return -1;
+    }
+    if(pthread_cond_init(&m->start, NULL) != 0) {
+        pthread_mutex_destroy(&m->lock);
+        m->workers = NULL;
+        return -1;
+    }
+    if(pthread_cond_init(&m->done, NULL) != 0) {
+        pthread_cond_destroy(&m->start);
+        pthread_mutex_destroy(&m->lock);
+        m->workers = NULL;
+        return -1;
+    }
+
+    for(i=0;i<m->threads;i++) {
+        if(pthread_create(&m->workers[i].thread, NULL, tflac_mt_worker_run, &m->workers[i]) != 0) {
+            tflac_mt_destroy(m);
+            return -1;
+        }
+        m->running++;
+    }
+
+    return 0;
+}
+
+TFLAC_PRIVATE
+void* tflac_mt_worker_run(void* userdata) {
+    tflac_mt_worker* w = (tflac_mt_worker*)userdata;
+    tflac_mt* m = w->m;
+    tflac_u32 generation = 0;
+    tflac_u32 frame = 0;
+    int r;
+
+    pthread_mutex_lock(&m->lock);
+    for(;;) {
+        while(m->generation == generation && !m->quit) {
+            pthread_cond_wait(&m->start, &m->lock);
+        }
+        if(m->quit) break;
+        generation = m->generation;
+
+        while(m->next_frame < m->frames) {
+            frame = m->next_frame++;
+            pthread_mutex_unlock(&m->lock);
+
+            r = tflac_mt_encode_frame(m, w, frame);
+
+            pthread_mutex_lock(&m->lock);
+            if(r != 0) m->error = r;
+            if(++m->done_frames == m->frames) {
+                pthread_cond_signal(&m->done);
+            }
+        }
+    }
+    pthread_mutex_unlock(&m->lock);
+
+    return NULL;
+}
+
+TFLAC_PRIVATE
+int tflac_mt_encode_frame(tflac_mt* m, tflac_mt_worker* w, tflac_u32 frame) {
+    tflac_u32 offset = frame * m->t.blocksize;
+    tflac_u32 blocksize = m->samples_len - offset;
+    tflac_u8* slot = &m->buffer[frame * m->slot_len];
+    tflac_u8* dest = &slot[TFLAC_MT_SLOT_HEADER];
+    tflac_u32 dest_len = m->slot_len - TFLAC_MT_SLOT_HEADER;
+    tflac_u32 used = 0;
+    tflac_u32 c = 0;
+    tflac_s16* s16[8];
+    tflac_s32* s32[8];
+    int r = -1;
+
+    if(blocksize > m->t.blocksize) blocksize = m->t.blocksize;
+
+    /* the frame number is part of the frame header */
+    w->t.frameno = (m->frameno + frame) & UINT32_C(0x7FFFFFFF);
+
+    switch(m->format) {
+        case TFLAC_MT_FORMAT_S16P: {
+            for(c=0;c<m->t.channels;c++) {
+                s16[c] = &((tflac_s16**)m->samples)[c][offset];
+            }
+            r = tflac_encode_s16p(&w->t, blocksize, s16, dest, dest_len, &used);
+            break;
+        }
+        case TFLAC_MT_FORMAT_S16I: {
+            r = tflac_encode_s16i(&w->t, blocksize, &((tflac_s16*)m->samples)[offset * m->t.channels], dest, dest_len, &used);
+            break;
+        }
+        case TFLAC_MT_FORMAT_S32P: {
+            for(c=0;c<m->t.channels;c++) {
+                s32[c] = &((tflac_s32**)m->samples)[c][offset];
+            }
+            r = tflac_encode_s32p(&w->t, blocksize, s32, dest, dest_len, &used);
+            break;
+        }
+        case TFLAC_MT_FORMAT_S32I: {
+            r = tflac_encode_s32i(&w->t, blocksize, &((tflac_s32*)m->samples)[offset * m->t.channels], dest, dest_len, &used);
+            break;
+        }
+        default: break;
+    }
+
+    memcpy(slot, &used, sizeof(used));
+    return r;
+}
+
+TFLAC_PRIVATE
+int tflac_mt_encode(tflac_mt* m, tflac_u32 format, tflac_u32 samples_len, void* samples, void* buffer, tflac_u32 len, tflac_u32* used) {
+    tflac_u32 frames = 0;
+    tflac_u32 frame = 0;
+    tflac_u32 pos = 0;
+    tflac_u32 frame_len = 0;
+    tflac_u32 blocksize = 0;
+    tflac_u8* b = (tflac_u8*)buffer;
+    int r;
+
+    *used = 0;
+    if(m->running == 0) return -1;
+    if(samples_len == 0) return 0;
+
+    frames = (samples_len / m->t.blocksize) + (samples_len % m->t.blocksize != 0);
+    if(frames > len / m->slot_len) return -1;
+
+    pthread_mutex_lock(&m->lock);
+    m->format = format;
+    m->samples = samples;
+    m->samples_len = samples_len;
+    m->buffer = b;
+    m->frameno = m->t.frameno;
+    m->frames = frames;
+    m->next_frame = 0;
+    m->done_frames = 0;
+    m->error = 0;
+    m->generation++;
+    pthread_cond_broadcast(&m->start);
+    pthread_mutex_unlock(&m->lock);
+
+    /* MD5 has to see samples in order, do it here while the workers encode
+     * (this only copies them if there's an MD5 thread) */
+    switch(format) {
+        case TFLAC_MT_FORMAT_S16P: tflac_update_md5_s16p(&m->t, samples_len, (tflac_s16**)samples); break;
+        case TFLAC_MT_FORMAT_S16I: tflac_update_md5_s16i(&m->t, samples_len, (tflac_s16*)samples); break;
+        case TFLAC_MT_FORMAT_S32P: tflac_update_md5_s32p(&m->t, samples_len, (tflac_s32**)samples); break;
+        case TFLAC_MT_FORMAT_S32I: tflac_update_md5_s32i(&m->t, samples_len, (tflac_s32*)samples); break;
+        default: break;
+    }
+
+    pthread_mutex_lock(&m->lock);
+    while(m->done_frames != m->frames) {
+        pthread_cond_wait(&m->done, &m->lock);
+    }
+    r = m->error;
+    pthread_mutex_unlock(&m->lock);
+
+    if(r != 0) return r;
+
+    /* pack the frames together, we're always moving data towards the start
+     * of the buffer and never past the next slot's header */
+    for(frame=0;frame<frames;frame++) {
+        memcpy(&frame_len, &b[frame * m->slot_len], sizeof(frame_len));
+        memmove(&b[pos], &b[(frame * m->slot_len) + TFLAC_MT_SLOT_HEADER], frame_len);
+        pos += frame_len;
+
+        blocksize = samples_len - (frame * m->t.blocksize);
+        if(blocksize > m->t.blocksize) blocksize = m->t.blocksize;
+        tflac_add_frame(&m->t, blocksize, frame_len);
+    }
+
+    *used = pos;
+    return 0;
+}
+
+TFLAC_PUBLIC
+int tflac_mt_encode_s16p(tflac_mt* m, tflac_u32 samples_len, tflac_s16** samples, void* buffer, tflac_u32 len, tflac_u32* used) {
+    return tflac_mt_encode(m, TFLAC_MT_FORMAT_S16P, samples_len, samples, buffer, len, used);
+}
+
+TFLAC_PUBLIC
+int tflac_mt_encode_s16i(tflac_mt* m, tflac_u32 samples_len, tflac_s16* samples, void* buffer, tflac_u32 len, tflac_u32* used) {
+    return tflac_mt_encode(m, TFLAC_MT_FORMAT_S16I, samples_len, samples, buffer, len, used);
+}
+
+TFLAC_PUBLIC
+int tflac_mt_encode_s32p(tflac_mt* m, tflac_u32 samples_len, tflac_s32** samples, void* buffer, tflac_u32 len, tflac_u32* used) {
+    return tflac_mt_encode(m, TFLAC_MT_FORMAT_S32P, samples_len, samples, buffer, len, used);
+}
+
+TFLAC_PUBLIC
+int tflac_mt_encode_s32i(tflac_mt* m, tflac_u32 samples_len, tflac_s32* samples, void* buffer, tflac_u32 len, tflac_u32* used) {
+    return tflac_mt_encode(m, TFLAC_MT_FORMAT_S32I, samples_len, samples, buffer, len, used);
+}
+
+TFLAC_PUBLIC
+void tflac_mt_finalize(tflac_mt* m) {
+    tflac_finalize(&m->t);
+}
+
+TFLAC_PUBLIC
+void tflac_mt_destroy(tflac_mt* m) {
+    tflac_u32 i = 0;
+
+    if(m->workers == NULL) return;
+
+    pthread_mutex_lock(&m->lock);
+    m->quit = 1;
+    pthread_cond_broadcast(&m->start);
+    pthread_mutex_unlock(&m->lock);
+
+    for(i=0;i<m->running;i++) {
+        pthread_join(m->workers[i].thread, NULL);
+    }
+    m->running = 0;
+
+    pthread_cond_destroy(&m->done);
+    pthread_cond_destroy(&m->start);
+    pthread_mutex_destroy(&m->lock);
+    m->workers = NULL;
+}
+
+#ifndef __ATOMIC_SEQ_CST
+TFLAC_PRIVATE
+tflac_u32 tflac_md5_thread_load(tflac_md5_thread* h, const tflac_u32* p) {
+    tflac_u32 v;
+
+    pthread_mutex_lock(&h->lock);
+    v = *p;
+    pthread_mutex_unlock(&h->lock);
+    return v;
+}
+
+TFLAC_PRIVATE
+void tflac_md5_thread_store(tflac_md5_thread* h, tflac_u32* p, tflac_u32 v) {
+    pthread_mutex_lock(&h->lock);
+    *p = v;
+    pthread_mutex_unlock(&h->lock);
+}
+#endif
+
+#define TFLAC_MD5_SLOT_LEN(blocksize, channels) \
+    ((TFLAC_MD5_SLOT_HEADER + ((blocksize) * (channels) * 4UL) + 15UL) & ~15UL)
+
+TFLAC_PUBLIC
+TFLAC_CONST
+tflac_u32 tflac_md5_thread_size_memory(tflac_u32 slots, tflac_u32 blocksize, tflac_u32 channels) {
+    return (tflac_u32)(15UL + (slots * TFLAC_MD5_SLOT_LEN(blocksize, channels)));
+}
+
+TFLAC_PUBLIC
+int tflac_md5_thread_start(tflac_md5_thread* h, tflac* t, tflac_u32 slots, void* ptr, tflac_u32 len) {
+    tflac_u8* d;
+
+    if(slots == 0) return -1;
+    if(t->blocksize == 0) return -1;
+    if(t->channels == 0 || t->channels > 8) return -1;
+    if(t->md5_push != NULL) return -1;
+    if(len < tflac_md5_thread_size_memory(slots, t->blocksize, t->channels)) return -1;
+
+    d = (tflac_u8*)ptr;
+    d += (16 - (((tflac_uptr)d) & 15)) & 15;
+
+    memcpy(&h->md5, t, sizeof(tflac));
+    h->md5.enable_md5 = 1;
+    h->md5.md5_push = NULL;
+    h->md5.md5_wait = NULL;
+    h->md5.md5_userdata = NULL;
+
+    h->t = t;
+    h->slots = d;
+    h->slot_len = (tflac_u32)TFLAC_MD5_SLOT_LEN(t->blocksize, t->channels);
+    h->slot_count = slots;
+    h->slot_samples = t->blocksize;
+    h->head = 0;
+    h->tail = 0;
+    h->producer_waiting = 0;
+    h->consumer_waiting = 0;
+    h->resync = 0;
+    h->quit = 0;
+    h->running = 0;
+
+    if(pthread_mutex_init(&h->lock, NULL) != 0) {
+        return -1;
+    }
+    if(pthread_cond_init(&h->ready, NULL) != 0) {
+        pthread_mutex_destroy(&h->lock);
+        return -1;
+    }
+    if(pthread_cond_init(&h->space, NULL) != 0) {
+        pthread_cond_destroy(&h->ready);
+        pthread_mutex_destroy(&h->lock);
+        return -1;
+    }
+    if(pthread_create(&h->thread, NULL, tflac_md5_thread_run, h) != 0) {
+        pthread_cond_destroy(&h->space);
+        pthread_cond_destroy(&h->ready);
+        pthread_mutex_destroy(&h->lock);
+        return -1;
+    }
+    h->running = 1;
+
+    t->md5_userdata = h;
+    t->md5_wait = tflac_md5_thread_wait;
+    t->md5_push = tflac_md5_thread_push;
+
+    return 0;
+}
+
+TFLAC_PRIVATE
+void* tflac_md5_thread_run(void* userdata) {
+    tflac_md5_thread* h = (tflac_md5_thread*)userdata;
+    tflac_u32 tail = 0;
+
+    for(;;) {
+        if(TFLAC_MT_LOAD(h, &h->head) == tail) {
+            pthread_mutex_lock(&h->lock);
+            TFLAC_MT_STORE_LOCKED(&h->consumer_waiting, 1);
+            while(TFLAC_MT_LOAD_LOCKED(&h->head) == tail && !h->quit) {
+                pthread_cond_wait(&h->ready, &h->lock);
+            }
+            TFLAC_MT_STORE_LOCKED(&h->consumer_waiting, 0);
+            if(TFLAC_MT_LOAD_LOCKED(&h->head) == tail) {
+                /* told to quit with nothing left */
+                pthread_mutex_unlock(&h->lock);
+                break;
+            }
+            pthread_mutex_unlock(&h->lock);
+        }
+
+        tflac_md5_thread_hash(h, &h->slots[(tail % h->slot_count) * h->slot_len]);
+
+        TFLAC_MT_STORE(h, &h->tail, ++tail);
+        if(TFLAC_MT_LOAD(h, &h->producer_waiting)) {
+            pthread_mutex_lock(&h->lock);
+            pthread_cond_signal(&h->space);
+            pthread_mutex_unlock(&h->lock);
+        }
+    }
+
+    return NULL;
+}
+
+TFLAC_PRIVATE
+void tflac_md5_thread_hash(tflac_md5_thread* h, const tflac_u8* slot) {
+    tflac_u32 format = 0;
+    tflac_u32 blocksize = 0;
+    tflac_u32 c = 0;
+    tflac_u8* data = (tflac_u8*)&slot[TFLAC_MD5_SLOT_HEADER];
+    tflac_s16* s16[8];
+    tflac_s32* s32[8];
+
+    memcpy(&format, &slot[0], sizeof(format));
+    memcpy(&blocksize, &slot[4], sizeof(blocksize));
+
+    switch(format) {
+        case TFLAC_SAMPLES_S16P: {
+            for(c=0;c<h->md5.channels;c++) {
+                s16[c] = &((tflac_s16*)data)[c * blocksize];
+            }
+            tflac_update_md5_s16p(&h->md5, blocksize, s16);
+            break;
+        }
+        case TFLAC_SAMPLES_S16I: tflac_update_md5_s16i(&h->md5, blocksize, (tflac_s16*)data); break;
+        case TFLAC_SAMPLES_S32P: {
+            for(c=0;c<h->md5.channels;c++) {
+                s32[c] = &((tflac_s32*)data)[c * blocksize];
+            }
+            tflac_update_md5_s32p(&h->md5, blocksize, s32);
+            break;
+        }
+        case TFLAC_SAMPLES_S32I: tflac_update_md5_s32i(&h->md5, blocksize, (tflac_s32*)data); break;
+        default: break;
+    }
+}
+
+/* waits until no more than pending slots are waiting to be hashed,
+ * only called from the encoding thread */
+TFLAC_PRIVATE
+void tflac_md5_thread_drain(tflac_md5_thread* h, tflac_u32 pending) {
+    tflac_u32 head = h->head;
+
+    if(head - TFLAC_MT_LOAD(h, &h->tail) <= pending) return;
+
+    pthread_mutex_lock(&h->lock);
+    TFLAC_MT_STORE_LOCKED(&h->producer_waiting, 1);
+    while(head - TFLAC_MT_LOAD_LOCKED(&h->tail) > pending) {
+        pthread_cond_wait(&h->space, &h->lock);
+    }
+    TFLAC_MT_STORE_LOCKED(&h->producer_waiting, 0);
+    pthread_mutex_unlock(&h->lock);
+}
+
+TFLAC_PRIVATE
+void tflac_md5_thread_push(tflac* t, tflac_u32 format, tflac_u32 blocksize, const void* samples) {
+    tflac_md5_thread* h = (tflac_md5_thread*)t->md5_userdata;
+    tflac_u32 size = format >= TFLAC_SAMPLES_S32P ? 4 : 2;
+    tflac_u32 offset = 0;
+    tflac_u32 n = 0;
+    tflac_u32 c = 0;
+    tflac_u32 head = h->head;
+    tflac_u8* slot;
+    tflac_u8* data;
+
+    if(h->resync) {
+        /* tflac_finalize reset t's MD5, the thread is idle so we can
+         * pick that up without locking */
+        h->md5.md5_ctx = t->md5_ctx;
+        h->resync = 0;
+    }
+
+    while(offset < blocksize) {
+        n = blocksize - offset;
+        if(n > h->slot_samples) n = h->slot_samples;
+
+        tflac_md5_thread_drain(h, h->slot_count - 1);
+
+        slot = &h->slots[(head % h->slot_count) * h->slot_len];
+        data = &slot[TFLAC_MD5_SLOT_HEADER];
+        memcpy(&slot[0], &format, sizeof(format));
+        memcpy(&slot[4], &n, sizeof(n));
+
+        if(format & 1) {
+            memcpy(data, &((const tflac_u8*)samples)[offset * t->channels * size], n * t->channels * size);
+        } else {
+            for(c=0;c<t->channels;c++) {
+                memcpy(&data[c * n * size], &((const tflac_u8* const*)samples)[c][offset * size], n * size);
+            }
+        }
+
+        TFLAC_MT_STORE(h, &h->head, ++head);
+        if(TFLAC_MT_LOAD(h, &h->consumer_waiting)) {
+            pthread_mutex_lock(&h->lock);
+            pthread_cond_signal(&h->ready);
+            pthread_mutex_unlock(&h->lock);
+        }
+
+        offset += n;
+    }
+}
+
+TFLAC_PRIVATE
+void tflac_md5_thread_wait(tflac* t) {
+    tflac_md5_thread* h = (tflac_md5_thread*)t->md5_userdata;
+
+    tflac_md5_thread_drain(h, 0);
+    if(!h->resync) {
+        t->md5_ctx = h->md5.md5_ctx;
+        h->resync = 1;
+    }
+}
+
+TFLAC_PUBLIC
+void tflac_md5_thread_stop(tflac_md5_thread* h) {
+    if(!h->running) return;
+
+    tflac_md5_thread_drain(h, 0);
+    if(!h->resync) h->t->md5_ctx = h->md5.md5_ctx;
+
+    pthread_mutex_lock(&h->lock);
+    h->quit = 1;
+    pthread_cond_signal(&h->ready);
+    pthread_mutex_unlock(&h->lock);
+
+    pthread_join(h->thread, NULL);
+    h->running = 0;
+
+    pthread_cond_destroy(&h->space);
+    pthread_cond_destroy(&h->ready);
+    pthread_mutex_destroy(&h->lock);
+
+    h->t->md5_push = NULL;
+    h->t->md5_wait = NULL;
+    h->t->md5_userdata = NULL;
+}
+
+#endif /* ifdef TFLAC_MT_IMPLEMENTATION */